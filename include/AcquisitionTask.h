@@ -0,0 +1,87 @@
+#pragma once
+
+#include "AdcChannelDemux.h"
+#include "Config.h"
+#include "EventDetector.h"
+#include "Metrics.h"
+#include "PowerMeter.h"
+#include "SpscRing.h"
+#include "TimeSync.h"
+#include "VoltageSampler.h"
+#include "WaveformRecorder.h"
+
+#include <atomic>
+
+// Runs sampling and event detection on a dedicated task pinned to one core, so blocking
+// work in loop() (NTP, HTTP, LittleFS) cannot delay window processing.
+class AcquisitionTask : private HalfCycleListener {
+ public:
+  AcquisitionTask(AdcChannelDemux& adc,
+                  VoltageSampler& sampler,
+                  EventDetector& detector,
+                  WaveformRecorder& waveforms,
+                  TimeSync& timeSync,
+                  Metrics& metrics);
+
+  // Adds the next secondary channel of a scanned layout; its sampler must follow the primary
+  // sampler's windows. Voltage channels bring their own detector, current channels nullptr
+  // and their PowerMeter. Call before begin().
+  void addChannel(ChannelKind kind, VoltageSampler& sampler, EventDetector* detector, PowerMeter* meter = nullptr);
+  bool begin();
+  // Energy counters of the current channels, integrated on the sampling task window by window
+  // so queue overflows do not lose energy. setEnergy() restores saved counters.
+  void setEnergy(const ChannelEnergy& energy);
+  void energy(ChannelEnergy& out) const;
+  void setWifiConnected(bool connected);
+  // The primary channel's window; channels, if given, receives the secondary channels' values
+  // over the same window (count 0 for a single-channel layout).
+  bool popSample(VoltageSample& out, ChannelValues* channels = nullptr);
+  bool popEvent(VoltageEvent& out);
+  uint32_t droppedSamples() const;
+  uint32_t droppedEvents() const;
+  uint32_t sampleQueueHighWatermark() const;
+
+ private:
+  // Feeds a secondary voltage channel's half cycles to its own detector.
+  struct SecondaryChannel : HalfCycleListener {
+    void onHalfCycleRms(float vrms, uint32_t ageMs) override;
+
+    AcquisitionTask* task = nullptr;
+    ChannelKind kind = ChannelKind::Voltage;
+    VoltageSampler* sampler = nullptr;
+    EventDetector* detector = nullptr;
+    PowerMeter* meter = nullptr;
+    uint8_t index = 0;
+    VoltageSample sample;
+  };
+
+  struct Window {
+    VoltageSample sample;
+    ChannelValues channels;
+  };
+
+  static void taskEntry(void* arg);
+  void run();
+  void onHalfCycleRms(float vrms, uint32_t ageMs) override;
+  void captureStartedEvent();
+  void sampleSecondaries(Window& window);
+  void sampleSecondary(SecondaryChannel& channel, Window& window);
+  void drainSecondaries();
+  void queueCompletedEvents(EventDetector& detector, uint8_t channel);
+
+  AdcChannelDemux& adc_;
+  VoltageSampler& sampler_;
+  EventDetector& detector_;
+  WaveformRecorder& waveforms_;
+  TimeSync& timeSync_;
+  Metrics& metrics_;
+  TaskHandle_t task_ = nullptr;
+  std::atomic<bool> wifiConnected_{false};
+  SecondaryChannel secondaries_[Config::kMaxAdcChannels - 1];
+  size_t secondaryCount_ = 0;
+  ChannelEnergy energy_;
+  mutable portMUX_TYPE energyLock_ = portMUX_INITIALIZER_UNLOCKED;
+
+  SpscRing<Window, Config::kSampleQueueDepth> samples_;
+  SpscRing<VoltageEvent, Config::kEventQueueDepth> events_;
+};
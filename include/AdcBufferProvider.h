@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Source of raw 12-bit ADC samples captured at a fixed rate, independent of loop() timing.
+class AdcBufferProvider {
+ public:
+  virtual ~AdcBufferProvider() = default;
+
+  virtual bool begin() = 0;
+  // Copies up to maxCount samples into out, waiting at most timeoutMs for data.
+  virtual size_t read(uint16_t* out, size_t maxCount, uint32_t timeoutMs) = 0;
+  virtual uint32_t sampleRateHz() const = 0;
+  // Number of DMA buffers lost because the consumer did not keep up.
+  virtual uint32_t overrunCount() const = 0;
+
+  // A scanning provider interleaves several inputs in one stream (see AdcChannelDemux): every
+  // sample then keeps its input's tag in the top 4 bits, and sampleRateHz() is per input.
+  virtual size_t inputCount() const {
+    return 1;
+  }
+  // Tag of input index, valid after begin().
+  virtual uint8_t inputTag(size_t) const {
+    return 0;
+  }
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "AdcBufferProvider.h"
+#include "Config.h"
+
+#include <vector>
+
+// Splits the interleaved stream of a scanning AdcBufferProvider into one provider per input,
+// so every channel runs through its own VoltageSampler. fill() reads one DMA buffer and sorts
+// it by tag; the channel streams only hand out what was sorted and never wait. With a single
+// input, channel(0) reads the source directly and the one-channel path copies nothing extra.
+class AdcChannelDemux {
+ public:
+  explicit AdcChannelDemux(AdcBufferProvider& source);
+
+  // Begins the source once; the channels' begin() ends up here.
+  bool begin();
+  size_t channelCount() const;
+  AdcBufferProvider& channel(size_t index);
+  // Sorts one source buffer into the channels; false if nothing arrived within timeoutMs.
+  // Drain every channel before the next fill(): each holds one DMA buffer at most.
+  bool fill(uint32_t timeoutMs);
+  // Samples with an unknown tag, or sorted into a channel that was still full.
+  uint32_t droppedSamples() const;
+
+ private:
+  class Stream : public AdcBufferProvider {
+   public:
+    bool begin() override;
+    size_t read(uint16_t* out, size_t maxCount, uint32_t timeoutMs) override;
+    uint32_t sampleRateHz() const override;
+    uint32_t overrunCount() const override;
+
+    AdcChannelDemux* demux = nullptr;
+    size_t index = 0;
+  };
+
+  static constexpr size_t kStreamCapacity = Config::kAdcDmaBufferLen;
+  static constexpr uint8_t kNoChannel = 0xFF;
+
+  AdcBufferProvider& source_;
+  Stream streams_[Config::kMaxAdcChannels];
+  bool begun_ = false;
+  bool ok_ = false;
+  size_t channels_ = 1;
+  uint8_t channelForTag_[16];
+  uint16_t raw_[Config::kAdcDmaBufferLen];
+  std::vector<uint16_t> staging_; // kStreamCapacity per channel, scanned layouts only
+  size_t length_[Config::kMaxAdcChannels] = {};
+  size_t position_[Config::kMaxAdcChannels] = {};
+  uint32_t dropped_ = 0;
+};
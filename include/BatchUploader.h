@@ -1,40 +1,137 @@
 #pragma once
 
 #include "Config.h"
+#include "GzipWriter.h"
+#include "HttpSession.h"
+#include "Metrics.h"
+#include "SampleHistory.h"
+#include "SampleReducer.h"
 #include "StorageQueue.h"
-
-#include <HTTPClient.h>
-#include <WiFiClient.h>
+#include "WaveformRecorder.h"
 
 class BatchUploader {
  public:
+  // The device configuration document served on GET /config (see DeviceConfig). It is
+  // fetched with If-None-Match every kConfigFetchIntervalMs while connected, and on the upload
+  // backoff schedule after failures; onConfig() is called from update() only when it changed.
+  class ConfigListener {
+   public:
+    virtual ~ConfigListener() = default;
+    virtual void onConfig(const char* document) = 0;
+  };
+
   BatchUploader();
   void begin(const char* baseUrl, const char* deviceId, const char* apiKey);
-  void addSample(const VoltageSample& sample);
-  void addEvent(const VoltageEvent& event);
+  // channels: the secondary channels over the same window, for scanned ADC layouts; batches
+  // then carry them as columns beside the samples.
+  void addSample(const VoltageSample& sample, const ChannelValues* channels = nullptr);
+  // Energy counters of the current channels; each batch carries the latest totals.
+  void setEnergy(const ChannelEnergy& energy);
+  void addEvent(const VoltageEvent& event, const SampleHistory& history);
+  // Queues a raw waveform capture as a binary attachment on the events channel; the server
+  // matches it to its event by device_id and event_start_ts.
+  void addWaveform(const WaveformRecorder::Capture& capture, float voltsPerCount);
+  // Queues a snapshot of the runtime metrics on the events channel.
+  void addTelemetry(const Metrics& metrics);
   void update(bool wifiConnected, uint32_t samplePeriodMs);
+  // Queues the open batch now, e.g. before a restart, so its windows survive in flash.
+  void flush();
+  // Reduction applied to new windows before they are batched; queues the open batch first so
+  // every batch has a single reduction.
+  void setReduction(SampleReduction mode, float swingToleranceV);
+  SampleReduction reduction() const;
+  float swingTolerance() const;
+  // Windows with a voltage outside (low, high) are kept unreduced.
+  void setDisturbanceBand(float low, float high);
+  void setConfigListener(ConfigListener* listener);
+  // ETag of the document last handed to the listener; restored at boot so an unchanged
+  // document is not downloaded again.
+  void setConfigEtag(const char* etag);
+  const char* configEtag() const;
+  // Fetches at the next update() with a connection, ignoring the interval and backoff.
+  void requestConfigFetch();
+  // Reported in telemetry, so the server can see which document the device runs.
+  void setConfigVersion(uint32_t version);
+  // A batch is queued at maxPoints points or after maxWaitMs, and sooner when its rows fill
+  // kBatchRamBytes; maxPoints is capped at kBatchMaxPoints.
+  void setBatchLimits(uint32_t maxPoints, uint32_t maxWaitMs);
+  uint32_t batchMaxPoints() const;
+  uint32_t batchMaxWaitMs() const;
+  void setUploadFormat(UploadFormat format);
+  UploadFormat uploadFormat() const;
+  // Gzip new queue records; they are stored and POSTed compressed (Content-Encoding: gzip).
+  void setCompression(bool enabled);
+  bool compression() const;
+  const HttpSession& session() const;
+  // The upload connection, for other requests to the same server between update() calls.
+  HttpSession& session();
+  // Records accepted by the server since boot, on both channels.
+  uint32_t uploadsSent() const;
+  // Fills the queue and HTTP gauges.
+  void collectGauges(Metrics::Gauges& gauges) const;
 
  private:
-  struct RetryState {
+  enum class SendResult {
+    Sent,
+    DeadLettered,
+    Deferred,
+    Idle,
+  };
+
+  // One upload queue with its own backoff and per-item retry state.
+  struct Channel {
+    Channel(const char* label, uint8_t deadLetterTag, const char* queueName, const char* legacyPath, uint32_t maxBytes);
+
+    const char* label;
+    uint8_t deadLetterTag;
+    StorageQueue queue;
     unsigned long nextAttemptMs = 0;
     size_t backoffIndex = 0;
+    uint8_t headAttempts = 0;
+    uint32_t sent = 0;
+    uint32_t deadLettered = 0;
   };
 
-  bool sendPayload(const String& endpoint, const String& payload, bool wifiConnected, RetryState& retry);
-  String buildSamplesPayload(uint32_t samplePeriodMs);
-  String buildEventPayload(const VoltageEvent& event);
-  void queueSamplesPayload(const String& payload);
-  void queueEventPayload(const String& payload);
+  void fetchConfig();
+  void drainQueues();
+  SendResult sendNext(Channel& channel, size_t& bytesSent);
+  const char* endpointFor(const Channel& channel, uint8_t kind, const char** contentType) const;
+  int postFront(const char* endpoint, const char* contentType, const char* contentEncoding);
+  void scheduleRetry(Channel& channel);
+  void deadLetter(Channel& channel, int httpCode);
+  bool writeSamplesJson(ByteSink& out, uint32_t samplePeriodMs);
+  bool writeEventJson(ByteSink& out, const VoltageEvent& event, const SampleHistory& history);
+  bool writeTelemetryJson(ByteSink& out, const Metrics& metrics);
+  void queueSamplesBatch(uint32_t samplePeriodMs);
+  void reserveBatch(bool channels);
+  ByteSink& beginRecordBody(ByteSink& record);
+  bool finishRecordBody();
 
-  const char* baseUrl_ = nullptr;
   const char* deviceId_ = nullptr;
-  const char* apiKey_ = nullptr;
+  HttpSession session_;
 
-  std::vector<VoltageSample> samples_;
+  UploadFormat format_ = UploadFormat::Json;
+  bool compression_ = false;
+  GzipWriter gzip_;
+  SampleReducer reducer_;
+  SamplePoints points_;
+  size_t batchRows_ = 0;       // rows points_ has room for within kBatchRamBytes
+  size_t batchRowBytes_ = 0;   // the row layout they were reserved for
+  ChannelEnergy energy_;
   unsigned long lastBatchMs_ = 0;
 
-  StorageQueue samplesQueue_;
-  StorageQueue eventsQueue_;
-  RetryState samplesRetry_;
-  RetryState eventsRetry_;
+  Channel samplesChannel_;
+  Channel eventsChannel_;
+  StorageQueue deadLetterQueue_;
+  StorageQueue::FrontStream sendStream_;
+  bool lastWifiConnected_ = false;
+
+  uint32_t batchMaxPoints_ = Config::kBatchMaxPoints;
+  uint32_t batchMaxWaitMs_ = Config::kBatchMaxWaitMs;
+
+  ConfigListener* configListener_ = nullptr;
+  unsigned long nextConfigFetchMs_ = 0;
+  size_t configBackoffIndex_ = 0;
+  char configEtag_[64] = "";
+  uint32_t configVersion_ = 0;
 };
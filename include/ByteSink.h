@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// Destination for encoded payload bytes. Encoders write through this so the same code can
+// target RAM, the storage queue or a socket.
+class ByteSink {
+ public:
+  virtual ~ByteSink() = default;
+  virtual bool write(const uint8_t* data, size_t len) = 0;
+};
+
+class VectorSink : public ByteSink {
+ public:
+  explicit VectorSink(std::vector<uint8_t>& out) : out_(out) {}
+
+  bool write(const uint8_t* data, size_t len) override {
+    out_.insert(out_.end(), data, data + len);
+    return true;
+  }
+
+ private:
+  std::vector<uint8_t>& out_;
+};
+
+// Small write buffer in front of a ByteSink with the little-endian and LEB128 primitives the
+// binary codecs share. Errors are sticky; flush() reports whether everything was written.
+class BufferedWriter {
+ public:
+  explicit BufferedWriter(ByteSink& sink) : sink_(sink) {}
+
+  void put(uint8_t value) {
+    if (len_ == sizeof(buffer_)) {
+      flush();
+    }
+    buffer_[len_++] = value;
+  }
+
+  void putLe(uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+      put(static_cast<uint8_t>(value >> (8 * i)));
+    }
+  }
+
+  void putVarint(uint64_t value) {
+    while (value >= 0x80) {
+      put(static_cast<uint8_t>(value) | 0x80);
+      value >>= 7;
+    }
+    put(static_cast<uint8_t>(value));
+  }
+
+  void putSvarint(int64_t value) {
+    putVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+  }
+
+  void putString(const char* value) {
+    size_t len = value != nullptr ? strlen(value) : 0;
+    if (len > 255) {
+      len = 255;
+    }
+    put(static_cast<uint8_t>(len));
+    for (size_t i = 0; i < len; ++i) {
+      put(static_cast<uint8_t>(value[i]));
+    }
+  }
+
+  bool flush() {
+    if (len_ > 0 && ok_) {
+      ok_ = sink_.write(buffer_, len_);
+    }
+    len_ = 0;
+    return ok_;
+  }
+
+ private:
+  ByteSink& sink_;
+  uint8_t buffer_[64];
+  size_t len_ = 0;
+  bool ok_ = true;
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "Config.h"
+
+// ADC1 inputs scanned by the sampler and what each measures, written as one entry per channel:
+// "V34 V35 V32 I33" is three phases on GPIO34/35/32 and a current clamp on GPIO33. Channel 0
+// is the primary: it must be a voltage, its windows bound every other channel's, it feeds
+// the waveform recorder and its Vrms is the "samples" series of the batches.
+struct ChannelLayout {
+  size_t count = 1;
+  ChannelKind kinds[Config::kMaxAdcChannels] = {ChannelKind::Voltage};
+  gpio_num_t pins[Config::kMaxAdcChannels] = {Config::kDefaultAdcPin};
+
+  // Entries separated by spaces or commas, V or I followed by an ADC1 GPIO (32-39), each
+  // pin once. Leaves the layout unchanged on error.
+  bool parse(const char* text);
+  // The parse() form; buf should hold kMaxAdcChannels * 4 bytes.
+  void format(char* buf, size_t size) const;
+};
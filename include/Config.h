@@ -13,25 +13,93 @@
 #define CCR_FW_VERSION_STR "0.1.0.0000000"
 #endif
 
+#ifndef CCR_FS_BASE_PATH
+#define CCR_FS_BASE_PATH "/littlefs"
+#endif
+
 namespace Config {
 constexpr const char* kFirmwareVersion = CCR_FW_VERSION_STR;
 
 constexpr uint32_t kSampleRateHz = 2500;
 constexpr uint32_t kWindowMs = 200;
-constexpr uint32_t kRingBufferSeconds = 60;
-constexpr uint32_t kRingBufferPoints = (kRingBufferSeconds * 1000) / kWindowMs;
+constexpr uint32_t kWindowSamples = (kSampleRateHz * kWindowMs) / 1000;
+constexpr int kAdcDmaBufferCount = 32;   // 32 x 100ms covers loop stalls up to ~3s
+constexpr int kAdcDmaBufferLen = 250;    // samples per DMA buffer
+constexpr size_t kMaxAdcChannels = 6;    // ADC1 inputs in one scan pattern, kSampleRateHz each
+constexpr uint32_t kMainsNominalHz = 50;
+constexpr uint32_t kCyclesPerWindow = kMainsNominalHz == 60 ? 12 : 10; // ~kWindowMs, IEC 61000-4-30
+constexpr int32_t kZeroCrossHysteresis = 20; // ADC counts around the DC bias
+constexpr bool kCycleSyncDefault = true;
+constexpr uint32_t kHarmonicMaxOrder = 13; // THD over orders 2..13 (650/780 Hz, below Nyquist)
+constexpr bool kHarmonicsDefault = false;
 constexpr uint32_t kEventPreSeconds = 60;
 constexpr uint32_t kEventPostSeconds = 60;
 constexpr uint32_t kEventPrePoints = (kEventPreSeconds * 1000) / kWindowMs;
 constexpr uint32_t kEventPostPoints = (kEventPostSeconds * 1000) / kWindowMs;
+constexpr uint32_t kEventHistoryPoints = 2048; // shared by detection and event capture, ~6.8 min
+constexpr uint32_t kEventMaxPoints = 1536;     // longer events keep their latest points
+constexpr uint32_t kChannelEventHistoryPoints = 896; // secondary voltage channels, 35 KB each, ~3 min
+constexpr size_t kMaxActiveEvents = 3;         // one open event plus events still post-recording
+constexpr size_t kDetectorQueueDepth = 4;      // completed events awaiting pollCompletedEvent()
+// Raw ADC waveform kept around each event start, in nominal mains cycles at full sample rate.
+// RAM: 2 bytes x (pre + slots x (pre + post)) samples, ~7 KB with these values.
+constexpr uint32_t kWaveformPreCycles = 10;
+constexpr uint32_t kWaveformPostCycles = 20;
+constexpr size_t kWaveformSlots = 2; // frozen captures awaiting storage by loop()
+constexpr uint32_t kWaveformPreSamples = kWaveformPreCycles * kSampleRateHz / kMainsNominalHz;
+constexpr uint32_t kWaveformPostSamples = kWaveformPostCycles * kSampleRateHz / kMainsNominalHz;
+// Power metering on current channels. Sensor phase correction is limited to what the meter's
+// look-back covers: kPowerMaxDelaySamples including the scan offset, ~+/-15 degrees at 50 Hz.
+constexpr float kPowerMaxDelaySamples = 3.0f;
+constexpr uint32_t kEnergySaveIntervalMs = 15UL * 60UL * 1000UL; // NVS write at most this often
+constexpr double kEnergySaveMinWh = 1.0;                         // ... and only once a counter moved
+constexpr size_t kEnergySlots = 4;                               // rotating NVS records
+
+constexpr BaseType_t kAcqTaskCore = 1;
+constexpr UBaseType_t kAcqTaskPriority = 5; // above loop() (1), below the WiFi stack
+constexpr uint32_t kAcqTaskStackBytes = 6144;
+constexpr uint32_t kAcqReadTimeoutMs = 100;
+constexpr size_t kSampleQueueDepth = 64; // ~12s of windows between the tasks
+constexpr size_t kEventQueueDepth = 4;
 
 constexpr uint32_t kBatchMaxPoints = (30 * 60 * 1000) / kWindowMs; // 30 minutes
 constexpr uint32_t kBatchMaxWaitMs = 30 * 60 * 1000;
+// RAM for the open samples batch, allocated once: a batch is queued early when its rows
+// (sample, plus tier summary and secondary channels when present) would outgrow it.
+constexpr size_t kBatchRamBytes = 64 * 1024;
+constexpr uint32_t kReduceMaxTierMs = 60 * 1000; // longest aggregation tier
+constexpr float kSwingDoorToleranceV = 0.5f;
+constexpr uint32_t kSwingDoorMaxGapMs = 60 * 1000; // a point at least this often when flat
+
+constexpr const char* kFsBasePath = CCR_FS_BASE_PATH; // LittleFS VFS mount point
+constexpr uint32_t kQueueSegmentBytes = 32 * 1024;
+constexpr uint32_t kSamplesQueueMaxBytes = 768 * 1024;
+constexpr uint32_t kEventsQueueMaxBytes = 256 * 1024;
+constexpr size_t kQueueScratchBytes = 512; // per streaming reader/writer
+constexpr uint32_t kDeadLetterMaxBytes = 128 * 1024;
+
+constexpr uint32_t kDrainTimeBudgetMs = 3000; // per loop() pass
+constexpr size_t kDrainByteBudget = 256 * 1024;
+
+constexpr uint16_t kHttpTimeoutMs = 10000;
+constexpr uint32_t kConfigFetchIntervalMs = 15UL * 60UL * 1000UL; // GET /config while connected
+constexpr uint32_t kHttpIdleTimeoutMs = 4000; // below common server keep-alive timeouts
+
+constexpr uint32_t kTelemetryIntervalMs = 5UL * 60UL * 1000UL;
+
+// Firmware updates: one Range GET of kOtaChunkBytes per loop() pass, so a download never holds
+// loop() longer than one request and one flash sector.
+constexpr size_t kOtaChunkBytes = 4096;
+constexpr uint8_t kOtaMaxImageAttempts = 3;                  // downloads of a version before giving up
+constexpr uint32_t kOtaValidationMs = 30UL * 60UL * 1000UL;  // a new image must upload within this
+constexpr uint8_t kOtaMaxBootAttempts = 3;                   // boots of an unconfirmed image
 
 constexpr uint32_t kNtpResyncMs = 6UL * 60UL * 60UL * 1000UL;
 
 constexpr gpio_num_t kDefaultAdcPin = GPIO_NUM_34;
 
+// Defaults of the runtime ThresholdProfile (detect CLI / server), for a 230 V supply.
+constexpr float kNominalVrms = 230.0f;
 constexpr float kSagStart = 207.0f;
 constexpr float kSagEnd = 210.0f;
 constexpr float kSwellStart = 253.0f;
@@ -44,6 +112,12 @@ constexpr uint16_t kSagEndWindows = 50;    // 10s / 200ms
 constexpr uint16_t kSwellStartWindows = 5;
 constexpr uint16_t kSwellEndWindows = 50;
 constexpr uint16_t kCriticalEndWindows = 50;
+// Consecutive Urms(1/2) values beyond a start threshold that open an event (~10 ms each).
+constexpr uint8_t kFastTriggerHalfCycles = 2;
+// Nominal-mode baseline: first-order tracking of undisturbed windows, clamped around nominal.
+constexpr uint32_t kBaselineTimeConstantMs = 60 * 1000;
+constexpr float kBaselineMaxDeviation = 0.10f;
+constexpr uint16_t kBaselineRefreshWindows = 25; // thresholds recomputed every 5 s
 
 constexpr float kAdcSaturationThreshold = 0.05f; // 5% samples saturated
 
@@ -59,6 +133,7 @@ enum SampleFlags : uint16_t {
   FLAG_OUT_OF_RANGE_SENSOR = 1u << 3,
   FLAG_WIFI_DOWN = 1u << 4,
   FLAG_NO_SIGNAL = 1u << 5,
+  FLAG_NOT_CYCLE_SYNC = 1u << 6, // cycle-synchronized mode, window not bounded by zero crossings
 };
 
 struct VoltageSample {
@@ -69,6 +144,38 @@ struct VoltageSample {
   uint16_t sample_count = 0;
   uint16_t flags = FLAG_NONE;
   float raw_rms = 0.0f;
+  float freq_hz = 0.0f; // measured line frequency; 0 when not cycle-synchronized
+  // Harmonic analysis, only when enabled on the sampler: thd_cpct is kNoHarmonics otherwise.
+  static constexpr uint16_t kNoHarmonics = UINT16_MAX;
+  uint16_t thd_cpct = kNoHarmonics; // THD-F in 0.01 %
+  uint16_t harmonic_cv[3] = {};     // 3rd, 5th and 7th harmonic RMS in 0.01 V
+
+  bool hasHarmonics() const { return thd_cpct != kNoHarmonics; }
+};
+
+enum class ChannelKind : uint8_t {
+  Voltage = 0,
+  Current = 1,
+};
+
+// The secondary channels of a scanned ADC layout over the same window as the VoltageSample they
+// travel with, in layout order from channel 1. rms is in volts or amps; flags as VoltageSample.
+// Current channels also carry the power against their voltage channel (0 on voltage channels);
+// the power factor is activeW / apparentVa.
+struct ChannelValues {
+  uint8_t count = 0;
+  ChannelKind kind[Config::kMaxAdcChannels - 1] = {};
+  float rms[Config::kMaxAdcChannels - 1] = {};
+  uint16_t flags[Config::kMaxAdcChannels - 1] = {};
+  float activeW[Config::kMaxAdcChannels - 1] = {};
+  float reactiveVar[Config::kMaxAdcChannels - 1] = {}; // positive when the current lags
+  float apparentVa[Config::kMaxAdcChannels - 1] = {};
+};
+
+// Active energy counters of the current channels, indexed like ChannelValues.
+struct ChannelEnergy {
+  double importWh[Config::kMaxAdcChannels - 1] = {};
+  double exportWh[Config::kMaxAdcChannels - 1] = {};
 };
 
 enum class EventType {
@@ -83,9 +190,29 @@ struct VoltageEvent {
   uint64_t end_ts = 0;
   float min_vrms = 0.0f;
   float max_vrms = 0.0f;
-  std::vector<VoltageSample> samples;
+  // Samples live in the detector's SampleHistory: [first_seq, first_seq + sample_count).
+  uint32_t first_seq = 0;
+  uint32_t sample_count = 0;
+  // A window trigger is listed twice in the payload, closing the pre-trigger run and opening
+  // the event, as the copying detector always sent it; not set for half-cycle triggers.
+  uint32_t trigger_seq = 0;
+  bool repeats_trigger = false;
+  uint8_t channel = 0; // ADC layout index of the voltage channel that saw it
+};
+
+enum class UploadFormat : uint8_t {
+  Json = 0,
+  Binary = 1,
 };
 
+inline const char* UploadFormatToString(UploadFormat format) {
+  return format == UploadFormat::Binary ? "bin" : "json";
+}
+
+inline const char* ChannelKindToString(ChannelKind kind) {
+  return kind == ChannelKind::Current ? "current" : "voltage";
+}
+
 inline const char* EventTypeToString(EventType type) {
   switch (type) {
     case EventType::Sag:
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "Config.h"
+#include "OtaUpdater.h"
+#include "SampleReducer.h"
+#include "ThresholdProfile.h"
+
+// Everything the server can set remotely, as the text document served on GET /config: one
+// key=value pair per line, '#' starting a comment line, e.g.
+//
+//   version=7
+//   gain0=1.0234
+//   offset0=-0.40
+//   phase3=2.5
+//   thresholds=mode=nominal nominal=120 sag_start_windows=3
+//   batch_points=3000
+//   batch_wait_s=600
+//   window=cycles
+//   harmonics=on
+//   format=bin
+//   gzip=on
+//   reduce=swing
+//   swing_tol=0.5
+//   fw_version=0.3.12.a1b2c3d
+//   fw_path=/firmware/0.3.12.bin
+//   fw_size=912384
+//   fw_sha256=<64 hex digits>
+//
+// gain<n>/offset<n>/phase<n> address channel n of the ADC layout. "thresholds" takes the
+// pairs of ThresholdProfile::parse(). The fw_* keys offer a firmware image to OtaUpdater.
+// Keys left out keep the device's current value.
+struct DeviceConfig {
+  // Longest document accepted; a complete format() output stays well below it.
+  static constexpr size_t kMaxDocumentLength = 2048;
+
+  struct Calibration {
+    float gain = 1.0f;
+    float offset = 0.0f;
+    float phase = 0.0f;
+    bool present = false;
+  };
+
+  uint32_t version = 0;
+  size_t channelCount = 1;
+  Calibration calib[Config::kMaxAdcChannels];
+  ThresholdProfile thresholds;
+  uint32_t batchMaxPoints = Config::kBatchMaxPoints;
+  uint32_t batchMaxWaitMs = Config::kBatchMaxWaitMs;
+  bool cycleSync = Config::kCycleSyncDefault;
+  bool harmonics = Config::kHarmonicsDefault;
+  UploadFormat uploadFormat = UploadFormat::Json;
+  bool compression = false;
+  SampleReduction reduction = SampleReduction::Raw;
+  float swingToleranceV = Config::kSwingDoorToleranceV;
+  FirmwareManifest firmware;
+
+  // Applies the document over this config, all or nothing: on a malformed line, a value out
+  // of range or a channel beyond channelCount the config is unchanged and errorLine (if given)
+  // is the 1-based line at fault. Unknown keys are skipped and counted in unknownKeys, so
+  // documents written for newer firmware still apply.
+  bool parse(const char* document, uint32_t* unknownKeys = nullptr, uint32_t* errorLine = nullptr);
+  // Writes a complete document, every key set, that parse() reads back to this config.
+  void format(char* buf, size_t size) const;
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+#include "Config.h"
+
+// Energy counters in NVS, saved at most every kEnergySaveIntervalMs and only once a counter has
+// moved by kEnergySaveMinWh. Any load above 4 W moves a counter by 1 Wh within the interval, so
+// a loaded channel means one write per interval, ~35,000 a year; on the default 20 KB NVS
+// partition that is a few hundred erases per sector a year. Saves rotate over kEnergySlots keys
+// with a sequence number and a CRC: a write cut short by a reset leaves the previous record to
+// load, and NVS spreads the entries over its pages.
+class EnergyStore {
+ public:
+  // Loads the newest valid record; false (and zeros) if there is none.
+  bool begin(ChannelEnergy& out);
+  // Saves if the interval has passed and the counters moved; true if a record was written.
+  bool update(const ChannelEnergy& energy);
+  bool save(const ChannelEnergy& energy);
+  void clear();
+
+ private:
+  struct Record {
+    uint32_t sequence;
+    uint32_t crc; // over sequence and energy
+    ChannelEnergy energy;
+  };
+
+  static uint32_t checksum(const Record& record);
+  static void slotKey(size_t slot, char* key);
+
+  Preferences prefs_;
+  uint32_t sequence_ = 0;
+  ChannelEnergy saved_;
+  unsigned long lastSaveMs_ = 0;
+};
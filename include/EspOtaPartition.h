@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp_ota_ops.h>
+
+#include "OtaPartition.h"
+
+// OtaPartition on the two app slots of the ESP32 partition table. Validation is tracked in
+// NVS instead of relying on the bootloader's rollback support, which the stock Arduino
+// bootloader is built without: an activated image that boots more than kOtaMaxBootAttempts
+// times unconfirmed, or never boots at all, is rolled back and remembered as rejected.
+class EspOtaPartition : public OtaPartition {
+ public:
+  // Reconciles the boot with what the previous run recorded; may roll back and restart.
+  void begin(const char* runningVersion);
+
+  size_t capacity() const override;
+  bool beginImage(size_t imageSize, const char* version) override;
+  bool write(const uint8_t* data, size_t length) override;
+  bool activate() override;
+  void abort() override;
+
+  bool pendingValidation() const override;
+  void markValid() override;
+  void rollback() override;
+  bool rejected(const char* version) const override;
+
+ private:
+  void reject(const char* version);
+  void clearPending();
+
+  Preferences prefs_;
+  const char* runningVersion_ = "";
+  const esp_partition_t* target_ = nullptr;
+  esp_ota_handle_t handle_ = 0;
+  bool writing_ = false;
+  bool pending_ = false;
+  char imageVersion_[32] = "";
+  char rejected_[32] = "";
+};
@@ -1,35 +1,93 @@
 #pragma once
 
 #include "Config.h"
+#include "SampleHistory.h"
+#include "SpscRing.h"
+#include "ThresholdProfile.h"
 
-#include <deque>
+#include <atomic>
 
+// Events are emitted as ranges over history(); no samples are copied and nothing is
+// allocated once the detector is constructed. Up to kMaxActiveEvents may be recording at
+// once: a new disturbance during an earlier event's post-trigger window starts its own
+// event, whose samples simply overlap the earlier one's. A trigger finding every slot taken
+// completes the oldest event early.
 class EventDetector {
  public:
-  EventDetector();
+  // historyPoints sizes the shared history; events keep at most 3/4 of it, up to
+  // kEventMaxPoints with the default size.
+  explicit EventDetector(size_t historyPoints = Config::kEventHistoryPoints);
   void addSample(const VoltageSample& sample);
+  // Fast path fed with Urms(1/2), the one-cycle RMS refreshed every half cycle, ts_ms at the
+  // crossing that closed the cycle. Opens events kFastTriggerHalfCycles after onset,
+  // timestamped at onset to within a half cycle, instead of waiting for the averaged 200 ms
+  // windows; for an open event it tracks the depth and the recovery time.
+  // Must be called from the same task as addSample().
+  void addHalfCycle(float vrms, uint64_t ts_ms);
+  // Hands a new profile to the detecting task, which applies it before its next window; open
+  // events then end against the new levels. Call from a single other task; false if too many
+  // changes are still pending.
+  bool setProfile(const ThresholdProfile& profile);
+  // The nominal-mode baseline in volts; the nominal voltage until it has been tracked, and
+  // unused in fixed mode.
+  float baseline() const;
   bool pollCompletedEvent(VoltageEvent& eventOut);
+  // The event opened by the last addSample()/addHalfCycle() call, as it was at its start;
+  // reported once.
+  bool pollStartedEvent(VoltageEvent& eventOut);
+  const SampleHistory& history() const;
+  // Events that outgrew their maximum length and lost their oldest points.
+  uint32_t truncatedEvents() const;
+  // Events completed before the end of their post-recording to free a slot for a new trigger.
+  uint32_t shortenedEvents() const;
+  // Completed events lost because nobody polled the completed queue in time.
+  uint32_t droppedEvents() const;
 
  private:
+  struct ActiveEvent {
+    VoltageEvent event;
+    bool postRecording = false;
+    bool truncated = false;
+    uint16_t endCounter = 0;
+    uint16_t postCounter = 0;
+    uint64_t recoveryTs = 0; // first half cycle back inside the end band, 0 while disturbed
+  };
+
   float detectionValue() const;
-  void startEvent(EventType type, const VoltageSample& sample);
-  void appendSampleToEvent(const VoltageSample& sample);
-  void finalizeEvent();
+  bool endConditionMet(ActiveEvent& active, float detectVrms) const;
+  bool insideEndBand(EventType type, float vrms) const;
+  void applyPendingProfile();
+  void trackBaseline(float vrms);
+  // windowTrigger: opened by the newest history entry, which the payload then repeats.
+  void startEvent(EventType type, uint64_t ts_ms, float vrms, bool windowTrigger);
+  void appendSampleToEvent(ActiveEvent& active, const VoltageSample& sample);
+  void finalizeEvent(size_t index);
+
+  SampleHistory history_;
+  uint32_t maxEventPoints_;
 
-  std::vector<VoltageSample> ringBuffer_;
-  size_t ringIndex_ = 0;
-  bool ringFull_ = false;
+  // Read on every window and half cycle; only rebuilt when the profile or baseline moves.
+  DetectionThresholds thresholds_;
+  ThresholdProfile profile_;
+  SpscRing<ThresholdProfile, 4> pendingProfiles_;
+  float baselineV_ = Config::kNominalVrms;
+  uint16_t baselineWindows_ = 0;
+  std::atomic<float> publishedBaseline_{Config::kNominalVrms};
 
   uint16_t sagCounter_ = 0;
   uint16_t swellCounter_ = 0;
 
-  bool eventActive_ = false;
-  bool postRecording_ = false;
-  EventType activeType_ = EventType::Sag;
-  VoltageEvent activeEvent_;
-  uint16_t endCounter_ = 0;
-  uint16_t postCounter_ = 0;
+  EventType fastType_ = EventType::Sag;
+  uint8_t fastCounter_ = 0;
+  uint64_t fastOnsetTs_ = 0;
+  uint64_t lastHalfCycleTs_ = 0;
+
+  // Oldest first; only the newest can still be before its end condition.
+  ActiveEvent active_[Config::kMaxActiveEvents];
+  size_t activeCount_ = 0;
+  bool started_ = false;
 
-  bool completedReady_ = false;
-  VoltageEvent completedEvent_;
+  SpscRing<VoltageEvent, Config::kDetectorQueueDepth> completed_;
+  std::atomic<uint32_t> truncatedEvents_{0};
+  std::atomic<uint32_t> shortenedEvents_{0};
 };
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "ByteSink.h"
+
+// Streaming gzip (RFC 1952) compressor with a fixed working set: a 4 KiB LZ77 window with
+// single-probe hashing and fixed Huffman codes. Deliberately simpler than zlib, but it needs no
+// heap and gets most of the gain on the repetitive JSON/binary batches. Instances are large
+// (~16 KiB); keep one as a long-lived member rather than on a task stack.
+class GzipWriter : public ByteSink {
+ public:
+  // Starts a new gzip member that writes into out.
+  bool begin(ByteSink& out);
+  bool write(const uint8_t* data, size_t len) override;
+  // Flushes pending input and writes the trailer. The writer can then be reused via begin().
+  bool finish();
+  uint32_t inputBytes() const;
+  uint32_t outputBytes() const;
+
+ private:
+  static constexpr size_t kWindowSize = 4096;
+  static constexpr size_t kBufferSize = 2 * kWindowSize;
+  static constexpr size_t kHashBits = 12;
+  static constexpr size_t kHashSize = 1u << kHashBits;
+  static constexpr size_t kMinMatch = 3;
+  static constexpr size_t kMaxMatch = 258;
+
+  void compress(bool flushAll);
+  void slide();
+  uint32_t hashAt(size_t pos) const;
+  void insertHash(size_t pos);
+  void emitMatch(size_t length, size_t distance);
+  void putBits(uint32_t value, uint32_t count);
+  void putHuffman(uint32_t code, uint32_t count);
+  void putSymbol(uint32_t symbol);
+  void putByte(uint8_t value);
+  bool flushOutput();
+
+  ByteSink* out_ = nullptr;
+  bool ok_ = false;
+  uint32_t crc_ = 0;
+  uint32_t inputBytes_ = 0;
+  uint32_t outputBytes_ = 0;
+
+  uint8_t window_[kBufferSize];
+  size_t windowLen_ = 0;
+  size_t pos_ = 0;
+  uint16_t head_[kHashSize];
+
+  uint32_t bitBuffer_ = 0;
+  uint32_t bitCount_ = 0;
+  uint8_t output_[256];
+  size_t outputLen_ = 0;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Config.h"
+#include "WindowKernel.h"
+
+// Goertzel filters at the first Config::kHarmonicMaxOrder multiples of the line frequency,
+// fed with the same raw samples as the window RMS. The coefficient table is rebuilt once
+// per window from the last measured frequency (one cos() plus a Chebyshev recurrence), so
+// on cycle-synchronized windows every harmonic sits on an exact DFT bin. All state is
+// static; a window costs kHarmonicMaxOrder multiply-adds per sample.
+class HarmonicAnalyzer {
+ public:
+  static constexpr size_t kOrders = Config::kHarmonicMaxOrder;
+
+  struct Result {
+    float rms[kOrders] = {}; // RMS in ADC counts of harmonic order i + 1
+    float thdPct = 0.0f;     // relative to the fundamental, orders 2..kOrders
+  };
+
+  void begin(float lineHz, uint32_t sampleRateHz);
+  // raw values are taken relative to dc; count <= WindowKernel::kMaxBlock.
+  void accumulate(const uint16_t* raw, size_t count, int32_t dc);
+  bool finish(Result& out) const;
+
+ private:
+  float coeff_[kOrders] = {};
+  float s1_[kOrders] = {};
+  float s2_[kOrders] = {};
+  float block_[WindowKernel::kMaxBlock];
+  uint32_t count_ = 0;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+#include <HTTPClient.h>
+#include <WiFiClient.h>
+
+// One keep-alive HTTP connection to the CCR server, shared by every endpoint.
+class HttpSession {
+ public:
+  struct Stats {
+    uint32_t connectionsOpened = 0;
+    uint32_t requests = 0;
+    uint32_t requestsOnConnection = 0;
+    uint32_t maxRequestsPerConnection = 0;
+    uint32_t errors = 0;
+    uint32_t busyMs = 0; // time spent inside requests
+  };
+
+  void begin(const char* baseUrl, const char* deviceId, const char* apiKey);
+  // Closes the connection once it has been idle longer than Config::kHttpIdleTimeoutMs.
+  void update();
+  // Returns the HTTP status code or a negative HTTPClient error. contentEncoding (e.g. "gzip")
+  // is sent as Content-Encoding when set.
+  int post(const char* path, const char* contentType, Stream& body, size_t size, const char* contentEncoding = nullptr);
+  // GETs path; on a 2xx answer body holds the response and etag (if given) its ETag header.
+  // ifNoneMatch, when set, is sent as If-None-Match so an unchanged resource costs a 304.
+  int get(const char* path, String& body, const char* ifNoneMatch = nullptr, String* etag = nullptr);
+  // GETs length bytes of path starting at offset with a Range header, straight into buf;
+  // received is how many arrived. A server that honours the range answers 206.
+  int getRange(const char* path, size_t offset, uint8_t* buf, size_t length, size_t& received);
+  // True when the last request went out on a connection opened by an earlier request, i.e. a
+  // failure may just mean the server dropped the idle socket.
+  bool lastRequestReused() const;
+  void close();
+  const Stats& stats() const;
+
+ private:
+  void prepare(const char* path);
+  void finish(int httpCode);
+
+  const char* baseUrl_ = nullptr;
+  const char* deviceId_ = nullptr;
+  const char* apiKey_ = nullptr;
+
+  WiFiClient client_;
+  HTTPClient http_;
+  unsigned long lastUseMs_ = 0;
+  bool lastReused_ = false;
+  Stats stats_;
+};
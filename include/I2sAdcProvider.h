@@ -0,0 +1,35 @@
+#pragma once
+
+#include "AdcBufferProvider.h"
+#include "Config.h"
+
+#include <driver/adc.h>
+#include <driver/i2s.h>
+
+class I2sAdcProvider : public AdcBufferProvider {
+ public:
+  I2sAdcProvider(gpio_num_t pin, uint32_t sampleRateHz);
+
+  // Scans several ADC1 pins in one conversion pattern, each at sampleRateHz; samples keep
+  // their channel tag for AdcChannelDemux. Call before begin().
+  void setPins(const gpio_num_t* pins, size_t count);
+
+  bool begin() override;
+  size_t read(uint16_t* out, size_t maxCount, uint32_t timeoutMs) override;
+  uint32_t sampleRateHz() const override;
+  uint32_t overrunCount() const override;
+  size_t inputCount() const override;
+  uint8_t inputTag(size_t index) const override;
+
+ private:
+  void drainEvents();
+  void setScanPattern();
+
+  gpio_num_t pins_[Config::kMaxAdcChannels];
+  adc1_channel_t channels_[Config::kMaxAdcChannels];
+  size_t pinCount_ = 1;
+  uint32_t sampleRateHz_;
+  i2s_port_t port_ = I2S_NUM_0;
+  QueueHandle_t eventQueue_ = nullptr;
+  uint32_t overruns_ = 0;
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The I2S ADC DMA packs two 16-bit samples per 32-bit word with the later one in the low half,
+// so each pair arrives swapped, and tags every sample with its ADC1 channel in the top 4 bits.
+// Restores capture order and strips the tags of a single-channel stream in place. count should
+// be even (whole DMA words); a trailing odd sample is only untagged.
+inline void i2sAdcUnpackSingle(uint16_t* samples, size_t count) {
+  for (size_t i = 0; i + 1 < count; i += 2) {
+    const uint16_t first = samples[i + 1];
+    samples[i + 1] = samples[i] & 0x0FFF;
+    samples[i] = first & 0x0FFF;
+  }
+  if (count % 2 != 0) {
+    samples[count - 1] &= 0x0FFF;
+  }
+}
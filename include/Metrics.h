@@ -0,0 +1,104 @@
+#pragma once
+
+#include "ByteSink.h"
+
+#include <Arduino.h>
+#include <atomic>
+
+// Cheap runtime instrumentation: CPU cycles per stage, loop() period histogram, heap
+// watermarks and a few gauges that main collects from the other modules. Each stage is
+// recorded by exactly one task; readers may run on any task.
+class Metrics {
+ public:
+  enum class Stage : uint8_t {
+    Sampler,  // window math only, not the wait for DMA data
+    Detector,
+    Wifi,
+    Time,
+    Enqueue,  // encoding + LittleFS writes for samples, events and telemetry
+    Upload,   // queue drain: LittleFS reads + HTTP
+    Count,
+  };
+
+  struct StageStats {
+    uint32_t calls = 0;
+    uint64_t cycles = 0;
+    uint64_t maxCycles = 0;
+  };
+
+  struct QueueDepth {
+    uint32_t records = 0;
+    uint32_t bytes = 0;
+  };
+
+  // Filled by the owner of the measured modules right before printing or publishing.
+  struct Gauges {
+    uint32_t adcOverruns = 0;     // DMA buffers lost, kAdcDmaBufferLen samples each
+    uint32_t acqSampleDrops = 0;  // windows lost between the acquisition task and loop()
+    uint32_t acqSampleHighWatermark = 0;
+    QueueDepth samplesQueue;
+    QueueDepth eventsQueue;
+    QueueDepth deadLetterQueue;
+    uint32_t httpRequests = 0;
+    uint32_t httpErrors = 0;
+    uint32_t httpConnections = 0;
+    uint32_t httpBusyMs = 0;
+  };
+
+  // Records the cycles between construction and destruction against one stage. The 32-bit
+  // cycle counter wraps after ~17 s at 240 MHz, so long scopes (blocking HTTP) fall back to
+  // millis().
+  class Scope {
+   public:
+    Scope(Metrics& metrics, Stage stage) : metrics_(metrics), stage_(stage), startCycles_(cycleCount()), startMs_(millis()) {}
+    ~Scope() { metrics_.record(stage_, elapsedCycles(startCycles_, startMs_)); }
+
+   private:
+    Metrics& metrics_;
+    Stage stage_;
+    uint32_t startCycles_;
+    unsigned long startMs_;
+  };
+
+  static constexpr size_t kLoopBuckets = 8;
+  // Upper bounds (ms) of the loop() period buckets; the last bucket is open-ended.
+  static constexpr uint16_t kLoopBucketMs[kLoopBuckets - 1] = {1, 5, 10, 50, 100, 500, 2000};
+
+  static uint32_t cycleCount();
+  static uint64_t elapsedCycles(uint32_t startCycles, unsigned long startMs);
+
+  void record(Stage stage, uint64_t cycles);
+  void recordWindow(uint32_t samples);
+  // Call once at the top of every loop().
+  void markLoop();
+  // Refreshes the heap watermarks at most once per second.
+  void sampleHeap();
+  void setGauges(const Gauges& gauges);
+
+  StageStats stage(Stage stage) const;
+  void printTo(Print& out) const;
+  // Writes the telemetry fields as a JSON object body without the enclosing braces.
+  bool writeJsonFields(ByteSink& out) const;
+
+ private:
+  struct StageCounters {
+    std::atomic<uint32_t> calls{0};
+    std::atomic<uint64_t> cycles{0};
+    std::atomic<uint64_t> maxCycles{0};
+  };
+
+  StageCounters stages_[static_cast<size_t>(Stage::Count)];
+  std::atomic<uint32_t> windows_{0};
+  std::atomic<uint32_t> windowSamples_{0};
+
+  // loop()-side state.
+  uint32_t lastLoopUs_ = 0;
+  uint32_t loopMaxUs_ = 0;
+  uint32_t loopHistogram_[kLoopBuckets] = {};
+  unsigned long lastHeapSampleMs_ = 0;
+  uint32_t heapFree_ = 0;
+  uint32_t heapMinFree_ = 0;
+  uint32_t heapMaxBlock_ = 0;
+  uint32_t heapMinMaxBlock_ = UINT32_MAX;
+  Gauges gauges_;
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The flash slot a firmware update is written to, and the boot state of the running image.
+// EspOtaPartition is the ESP32 implementation; native/ has a file-backed fake.
+class OtaPartition {
+ public:
+  virtual ~OtaPartition() = default;
+
+  // Largest image the inactive slot holds.
+  virtual size_t capacity() const = 0;
+  // Starts an image of imageSize bytes in the inactive slot, discarding any earlier attempt.
+  virtual bool beginImage(size_t imageSize, const char* version) = 0;
+  // Appends to the image; writes are sequential and erase flash only as they reach it.
+  virtual bool write(const uint8_t* data, size_t length) = 0;
+  // Closes a complete image and makes it the one to boot next, pending validation.
+  virtual bool activate() = 0;
+  virtual void abort() = 0;
+
+  // True while the running image was booted from an update and has not been confirmed.
+  virtual bool pendingValidation() const = 0;
+  // Confirms the running image; it stays the boot image from now on.
+  virtual void markValid() = 0;
+  // Marks the running image bad and boots the previous one; does not return on the device.
+  virtual void rollback() = 0;
+  // True if an image of this version was rolled back before; it is not installed again.
+  virtual bool rejected(const char* version) const = 0;
+};
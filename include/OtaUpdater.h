@@ -0,0 +1,69 @@
+#pragma once
+
+#include "Config.h"
+#include "OtaPartition.h"
+#include "Sha256.h"
+
+class HttpSession;
+
+// A firmware image the server offers, from the fw_* keys of the config document.
+struct FirmwareManifest {
+  char version[32] = "";
+  char path[96] = ""; // GET path of the image on the CCR server
+  uint32_t size = 0;
+  uint8_t sha256[Sha256::kDigestSize] = {};
+
+  bool complete() const;
+};
+
+// Streams an offered image into the inactive partition one kOtaChunkBytes Range request per
+// update() call, hashing it on the way, so loop() keeps draining samples and the acquisition
+// task never notices. The image is activated only if its SHA-256 matches the manifest; the
+// new firmware then has kOtaValidationMs of reaching the server to complete an upload before
+// it rolls itself back.
+class OtaUpdater {
+ public:
+  enum class State : uint8_t {
+    Idle,
+    Downloading,
+    Ready,  // activated, waiting for a reboot
+    Failed, // gave up on the offered version
+  };
+
+  explicit OtaUpdater(OtaPartition& partition);
+  // Starts boot validation if the running image came from an update.
+  void begin();
+  // Downloads manifest unless it is the running version, was rolled back before, or is
+  // already being downloaded; false if it is not taken.
+  bool offer(const FirmwareManifest& manifest, const char* runningVersion);
+  void update(HttpSession& session, bool connected);
+  // uploadsSent: successful uploads since boot. The first one confirms a pending image.
+  // serverResponses: HTTP responses of any status since boot. The validation window only
+  // runs while connected and after the server has answered, so an outage never rejects the
+  // image.
+  void checkHealth(uint32_t uploadsSent, bool connected, uint32_t serverResponses);
+  State state() const;
+  const FirmwareManifest& manifest() const;
+  uint32_t bytesWritten() const;
+  bool validating() const;
+
+ private:
+  void restartImage();
+  void fail(const char* reason);
+  void scheduleRetry();
+
+  OtaPartition& partition_;
+  State state_ = State::Idle;
+  FirmwareManifest manifest_;
+  Sha256 hash_;
+  uint32_t written_ = 0;
+  uint8_t imageAttempts_ = 0;
+  size_t backoffIndex_ = 0;
+  unsigned long nextAttemptMs_ = 0;
+  bool validating_ = false;
+  unsigned long lastHealthMs_ = 0;
+  uint32_t validatedMs_ = 0; // time online with the server answering, since boot
+  uint8_t chunk_[Config::kOtaChunkBytes];
+};
+
+const char* OtaStateToString(OtaUpdater::State state);
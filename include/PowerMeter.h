@@ -0,0 +1,102 @@
+#pragma once
+
+#include "Config.h"
+#include "SpscRing.h"
+#include "VoltageSampler.h"
+
+// The latest samples of a voltage channel around its sampler's DC bias, kept for the
+// PowerMeters that measure current channels against it. Attach it to the voltage sampler with
+// setSampleListener(); sample indices count from that sampler's first sample.
+class VoltageTrace : public SampleListener {
+ public:
+  void onSamples(const uint16_t* raw, size_t count, uint16_t dc) override;
+  // Sample index + frac / 256, linearly interpolated, in ADC counts with 8 fractional bits.
+  int32_t atQ8(uint32_t index, uint32_t frac) const;
+
+ private:
+  // The voltage sampler runs up to one DMA buffer ahead of its current channels, and the
+  // meter looks back a quarter cycle plus its delays from there.
+  static constexpr size_t kLength = 512;
+  static_assert(kLength > Config::kAdcDmaBufferLen + Config::kSampleRateHz / 40 + 16, "trace too short");
+
+  int16_t samples_[kLength] = {};
+  uint32_t written_ = 0;
+};
+
+struct PowerReading {
+  float vrms = 0.0f;
+  float irms = 0.0f;
+  float activeW = 0.0f;
+  float reactiveVar = 0.0f; // positive when the current lags
+  float apparentVa = 0.0f;
+  float powerFactor = 0.0f;
+  double energyWh = 0.0;    // active energy over the window, negative when exported
+};
+
+// Real, reactive and apparent power of a current channel against a voltage channel of the same
+// scan, from the V*I cross products of each window. The current sampler feeds it through
+// setSampleListener(); every current sample is paired with the voltage interpolated at the
+// instant it was converted, shifted by the sensors' phase error, and with the voltage a
+// quarter cycle earlier for Q. Products trail the current samples by kLag samples, so the
+// last few samples of a window count in the next one. The voltage sampler must have been
+// updated at least as far as the current sampler (AcquisitionTask runs voltages first).
+class PowerMeter : public SampleListener {
+ public:
+  PowerMeter(const VoltageTrace& voltage, uint32_t sampleRateHz);
+
+  // Gains of the two channels (volts and amps per ADC count; the RMS offsets do not apply to
+  // power) and the phase the current input leads its voltage by because of the sensors, in
+  // degrees. Call from a single other task: the values are queued and the sampling task applies
+  // them when the running window closes (or to the first window, if set before it), so no
+  // reading mixes two calibrations.
+  void setCalibration(float voltsPerCount, float ampsPerCount, float phaseDeg);
+  // How many sample periods after its voltage the current input is converted within a scan
+  // ((current index - voltage index) / inputs for the I2S scan pattern).
+  void setScanDelay(float samples);
+  void onSamples(const uint16_t* raw, size_t count, uint16_t dc) override;
+  // Closes the window, at the current sampler's window end. lineHz (0 if unknown) sets the
+  // phase terms for the next window. False if no products were accumulated.
+  bool finishWindow(float lineHz, PowerReading& out);
+
+ private:
+  static constexpr uint32_t kLag = 5; // > kPowerMaxDelaySamples + 1 scan of imbalance
+  static constexpr size_t kHistory = 8;
+  static_assert(kLag < kHistory, "history shorter than the lag");
+  static_assert(Config::kPowerMaxDelaySamples + 2.0f <= kLag, "delay beyond the lag");
+
+  // Sampling task side of setCalibration(); true if a new calibration was taken.
+  bool applyPendingCalibration();
+  void updateDelays(float lineHz);
+
+  const VoltageTrace& voltage_;
+  uint32_t sampleRateHz_;
+  float voltsPerCount_ = 1.0f;
+  float ampsPerCount_ = 1.0f;
+  float phaseDeg_ = 0.0f;
+  float scanDelay_ = 0.0f;
+  struct Calibration {
+    float voltsPerCount;
+    float ampsPerCount;
+    float phaseDeg;
+  };
+  SpscRing<Calibration, 4> pendingCalibration_;
+
+  // Voltage positions relative to the current sample, as whole samples plus frac / 256.
+  int32_t delayInt_ = 0;
+  uint32_t delayFrac_ = 0;
+  int32_t quarterInt_ = 0;
+  uint32_t quarterFrac_ = 0;
+
+  int16_t current_[kHistory] = {};
+  uint32_t currentIndex_ = 0;
+
+  // Voltage in Q8 counts, current in counts, both around their sampler's DC bias.
+  uint32_t count_ = 0;
+  int64_t sumV_ = 0;
+  int64_t sumVq_ = 0;
+  int64_t sumI_ = 0;
+  int64_t sumVV_ = 0;
+  int64_t sumII_ = 0;
+  int64_t sumVI_ = 0;
+  int64_t sumVqI_ = 0;
+};
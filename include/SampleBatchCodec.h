@@ -0,0 +1,41 @@
+#pragma once
+
+#include "ByteSink.h"
+#include "Config.h"
+#include "SampleReducer.h"
+
+// Compact binary encoding of a samples batch (reference decoder: scripts/decode_samples_bin.py).
+//
+// All integers are little-endian; "varint" is unsigned LEB128 and "svarint" is a zigzag varint.
+//   header:  "CCRS" | u8 version | u8 sections | u16 sample_period_ms | u32 count | u64 first_ts_ms
+//            | u8 len + device_id | u8 len + fw_version
+//   ts:      (count - 1) x svarint(ts[i] - ts[i-1] - sample_period_ms)
+//   vrms:    count x svarint(mV[i] - mV[i-1]), mV[-1] = 0, NO_SIGNAL points encoded as 0 V
+//   flags:   runs of varint(run_length) varint(flags) covering count points
+// Optional sections follow in bit order when their bit is set in "sections":
+//   bit 0, harmonics: count x (u8 0 = not analysed | u8 1 + svarint deltas of thd_cpct, h3, h5
+//            and h7 in 0.01 V against the previous analysed point, initially all 0)
+//   bit 1, summary: count x svarint(min, max, p99 in mV, each minus the point's vrms mV)
+//   bit 2, channels: u8 n | n x u8 kind (0 voltage, 1 current) | then per channel, as columns
+//            sharing the ts column: count x svarint deltas of mV (mA) like vrms | flag runs
+//   bit 3, power: per current channel of the channels section, in channel order: count x
+//            svarint deltas of P in 0.1 W | same for Q in 0.1 var | same for S in 0.1 VA
+//            | varint imported Wh | varint exported Wh (totals when the batch was cut)
+namespace SampleBatchCodec {
+constexpr uint8_t kVersion = 1;
+constexpr uint8_t kSectionHarmonics = 1u << 0;
+constexpr uint8_t kSectionSummary = 1u << 1;
+constexpr uint8_t kSectionChannels = 1u << 2;
+constexpr uint8_t kSectionPower = 1u << 3;
+constexpr const char* kContentType = "application/vnd.ccr.samples+binary";
+
+bool encode(ByteSink& out,
+            const char* deviceId,
+            const char* fwVersion,
+            uint32_t samplePeriodMs,
+            const VoltageSample* samples,
+            size_t count,
+            const SampleSummary* summaries = nullptr,
+            const ChannelValues* channels = nullptr,
+            const ChannelEnergy* energy = nullptr);
+} // namespace SampleBatchCodec
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Config.h"
+
+#include <atomic>
+#include <vector>
+
+// Fixed ring of recent samples addressed by a running sequence number. Events reference a
+// range of it instead of copying samples. One task appends; any task may read a range it was
+// handed and then call intact() to learn whether the producer overwrote it meanwhile, so the
+// producer never has to wait for readers.
+class SampleHistory {
+ public:
+  struct Span {
+    const VoltageSample* data = nullptr;
+    size_t count = 0;
+  };
+
+  explicit SampleHistory(size_t capacity);
+
+  // Producer side.
+  uint32_t append(const VoltageSample& sample);
+  const VoltageSample& at(uint32_t seq) const;
+  uint32_t nextSeq() const;
+  uint32_t retained() const;
+  size_t capacity() const;
+
+  // Splits [firstSeq, firstSeq + count) into at most two contiguous runs; returns how many.
+  size_t spans(uint32_t firstSeq, uint32_t count, Span out[2]) const;
+  // True if no sample from firstSeq on has been overwritten. Call after reading the data.
+  bool intact(uint32_t firstSeq) const;
+
+ private:
+  std::vector<VoltageSample> slots_;
+  // One past the newest sequence number the producer has started writing.
+  std::atomic<uint32_t> claimed_{0};
+};
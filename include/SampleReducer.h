@@ -0,0 +1,112 @@
+#pragma once
+
+#include "Config.h"
+
+#include <vector>
+
+enum class SampleReduction : uint8_t {
+  Raw = 0,       // every 200 ms window
+  Tier1s = 1,    // one point per tier: mean Vrms + min/max/p99 summary
+  Tier10s = 2,
+  Tier60s = 3,
+  SwingingDoor = 4, // only the points needed to rebuild Vrms within the tolerance by linear interpolation
+};
+
+const char* SampleReductionToString(SampleReduction reduction);
+bool SampleReductionFromString(const char* text, SampleReduction& out);
+
+// Vrms statistics of the windows behind one tier point.
+struct SampleSummary {
+  float min = 0.0f;
+  float max = 0.0f;
+  float p99 = 0.0f;
+};
+
+// Points of the next samples batch as parallel arrays: summaries only from tier modes,
+// channels only for scanned ADC layouts.
+struct SamplePoints {
+  std::vector<VoltageSample> samples;
+  std::vector<SampleSummary> summaries;
+  std::vector<ChannelValues> channels;
+
+  size_t size() const {
+    return samples.size();
+  }
+  bool empty() const {
+    return samples.empty();
+  }
+  void clear() {
+    samples.clear();
+    summaries.clear();
+    channels.clear();
+  }
+};
+
+// Reduces the window stream before it goes into sample batches. Windows outside the sag/swell
+// start thresholds always pass through at full resolution, and event payloads are built from
+// the detector's history, so reduction never costs event fidelity. Tier points carry the
+// timestamp of their first window; points stay in time order across pass-throughs.
+// Secondary channels are reduced as part of the same rows: a row passes through when any
+// voltage channel is disturbed, tiers average every channel, and the swinging door keeps
+// every channel within the tolerance (volts or amps). Power columns are averaged by the tiers
+// and ride along with their rows through the door; the energy counters stay exact either way.
+class SampleReducer {
+ public:
+  void setMode(SampleReduction mode, float swingToleranceV);
+  SampleReduction mode() const;
+  float swingTolerance() const;
+  // Nominal spacing of the emitted points.
+  uint32_t periodMs(uint32_t windowMs) const;
+  // Voltages outside (low, high) count as disturbed and bypass reduction; the detector's sag
+  // and swell start levels.
+  void setDisturbanceBand(float low, float high);
+
+  // Appends 0..2 points; tier modes also append one summary per point. channels, when
+  // given, must be given for every window.
+  void add(const VoltageSample& sample, const ChannelValues* channels, SamplePoints& out);
+  // Emits whatever is still held back (partial tier, swinging-door segment end).
+  void flush(SamplePoints& out);
+
+ private:
+  static constexpr size_t kMaxTierWindows = Config::kReduceMaxTierMs / Config::kWindowMs + 8;
+
+  bool disturbed(const VoltageSample& sample, const ChannelValues* channels) const;
+  bool outsideBand(float vrms) const;
+  bool isTier() const;
+  uint32_t tierMs() const;
+  void addToTier(const VoltageSample& sample, const ChannelValues* channels, SamplePoints& out);
+  void emitTier(SamplePoints& out);
+  void addSwingingDoor(const VoltageSample& sample, const ChannelValues* channels, SamplePoints& out);
+  void openDoor(const VoltageSample& archive, const ChannelValues& channels);
+  void archiveHeld(SamplePoints& out);
+
+  SampleReduction mode_ = SampleReduction::Raw;
+  float tolerance_ = Config::kSwingDoorToleranceV;
+  float bandLow_ = Config::kSagStart;
+  float bandHigh_ = Config::kSwellStart;
+
+  // Tier state.
+  uint64_t tierBucket_ = 0;
+  uint32_t tierWindows_ = 0;
+  VoltageSample tierPoint_;
+  float values_[kMaxTierWindows];
+  size_t valueCount_ = 0;
+  bool tierHasChannels_ = false;
+  ChannelValues tierChannels_;
+  double channelSums_[Config::kMaxAdcChannels - 1];
+  uint32_t channelValues_[Config::kMaxAdcChannels - 1];
+  double powerSums_[Config::kMaxAdcChannels - 1][3]; // P, Q, S
+
+  // Swinging-door state: the last archived point, the newest point not yet archived and, per
+  // channel (primary first), the slopes of the two doors pivoting on archive +/- tolerance
+  // over the points since.
+  bool haveArchive_ = false;
+  bool doorHasChannels_ = false;
+  VoltageSample archive_;
+  ChannelValues archiveChannels_;
+  bool haveHeld_ = false;
+  VoltageSample held_;
+  ChannelValues heldChannels_;
+  float slopeUpper_[Config::kMaxAdcChannels];
+  float slopeLower_[Config::kMaxAdcChannels];
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Append-only record log split into numbered segment files ("00000001.seg", ...) inside one
+// directory. Records are CRC-framed; the read cursor is persisted separately and segments are
+// deleted whole once fully consumed. Uses plain stdio/POSIX calls so the same code runs on the
+// LittleFS VFS mount and on a host filesystem. RAM use does not depend on the backlog size.
+class SegmentLog {
+ public:
+  struct Stats {
+    uint32_t pendingRecords = 0;
+    uint32_t segments = 0;
+    uint32_t storedBytes = 0;
+    uint32_t droppedRecords = 0;
+    uint32_t corruptRecords = 0;
+  };
+
+  // Streams one record's payload out of the log without loading it into RAM.
+  class Reader {
+   public:
+    Reader() = default;
+    ~Reader();
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    size_t read(uint8_t* out, size_t len);
+    bool rewind();
+    uint32_t length() const;
+    uint32_t remaining() const;
+    uint8_t kind() const;
+    void close();
+
+   private:
+    friend class SegmentLog;
+    FILE* file_ = nullptr;
+    long start_ = 0;
+    uint32_t length_ = 0;
+    uint32_t remaining_ = 0;
+    uint8_t kind_ = 0;
+  };
+
+  SegmentLog(const std::string& dir, uint32_t segmentBytes, uint32_t maxBytes);
+  ~SegmentLog();
+  SegmentLog(const SegmentLog&) = delete;
+  SegmentLog& operator=(const SegmentLog&) = delete;
+
+  bool begin();
+  bool append(const uint8_t* data, size_t len, uint8_t kind);
+  // Streaming append: the record becomes visible to readers only after commitAppend().
+  // sizeHint (0 if unknown) lets the log start a fresh segment when the record will not fit.
+  bool beginAppend(uint8_t kind, size_t sizeHint);
+  bool appendChunk(const uint8_t* data, size_t len);
+  bool commitAppend();
+  void abortAppend();
+  bool empty() const;
+  // Opens the record at the read cursor after verifying its CRC. Corrupt records are skipped
+  // and counted.
+  bool openFront(Reader& reader);
+  bool peek(std::vector<uint8_t>& out, uint8_t* kind);
+  bool pop();
+  const Stats& stats() const;
+
+ private:
+  struct RecordHeader {
+    uint16_t magic;
+    uint8_t kind;
+    uint8_t reserved;
+    uint32_t length;
+    uint32_t crc;
+  };
+
+  std::string segmentPath(uint32_t segment) const;
+  bool openWriter(bool truncate);
+  void closeWriter();
+  bool rollSegment();
+  bool locateFront(RecordHeader& header, FILE** fileOut);
+  bool readHeader(FILE* file, RecordHeader& header) const;
+  bool verifyPayload(FILE* file, const RecordHeader& header) const;
+  void failAppend();
+  uint32_t scanSegment(uint32_t segment, uint32_t fromOffset, uint32_t* records, bool verifyCrc) const;
+  void finishReadSegment();
+  void dropOldestSegment();
+  void loadCursor();
+  void persistCursor();
+
+  std::string dir_;
+  uint32_t segmentBytes_;
+  uint32_t maxBytes_;
+  FILE* writer_ = nullptr;
+
+  uint32_t readSegment_ = 1;
+  uint32_t readOffset_ = 0;
+  uint32_t writeSegment_ = 1;
+  uint32_t writeOffset_ = 0;
+  bool appending_ = false;
+  RecordHeader pending_ = {};
+  Stats stats_;
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// FIPS 180-4 SHA-256, incremental so a firmware image can be hashed chunk by chunk as it
+// streams to flash. Portable like Crc32.h; no table beyond the 64 round constants.
+class Sha256 {
+ public:
+  static constexpr size_t kDigestSize = 32;
+
+  Sha256();
+  void reset();
+  void update(const uint8_t* data, size_t length);
+  // Writes the digest; reset() before hashing again.
+  void finish(uint8_t digest[kDigestSize]);
+
+  // 64 hex digits, either case, to a digest; false on any other text.
+  static bool fromHex(const char* hex, uint8_t digest[kDigestSize]);
+  // 65 bytes with the terminator.
+  static void toHex(const uint8_t digest[kDigestSize], char* hex);
+
+ private:
+  void compress(const uint8_t* block);
+
+  uint32_t state_[8];
+  uint8_t block_[64];
+  size_t blockLength_ = 0;
+  uint64_t totalLength_ = 0;
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+
+// Bounded, wait-free single-producer/single-consumer ring. Exactly one thread may push and
+// exactly one (other) thread may pop. When the ring is full, push() drops the new item and
+// counts it as an overflow so the producer never blocks.
+template <typename T, size_t Capacity>
+class SpscRing {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+ public:
+  bool push(const T& item) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    if (!reserve(head)) {
+      return false;
+    }
+    items_[head & kMask] = item;
+    publish(head);
+    return true;
+  }
+
+  bool push(T&& item) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    if (!reserve(head)) {
+      return false;
+    }
+    items_[head & kMask] = std::move(item);
+    publish(head);
+    return true;
+  }
+
+  bool pop(T& out) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    out = std::move(items_[tail & kMask]);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  static constexpr size_t capacity() {
+    return Capacity;
+  }
+
+  uint32_t overflowCount() const {
+    return overflows_.load(std::memory_order_relaxed);
+  }
+
+  uint32_t pushedCount() const {
+    return head_.load(std::memory_order_relaxed);
+  }
+
+  uint32_t highWatermark() const {
+    return highWatermark_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static constexpr uint32_t kMask = static_cast<uint32_t>(Capacity - 1);
+
+  bool reserve(uint32_t head) {
+    if (head - tail_.load(std::memory_order_acquire) >= Capacity) {
+      overflows_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+
+  void publish(uint32_t head) {
+    head_.store(head + 1, std::memory_order_release);
+    uint32_t depth = head + 1 - tail_.load(std::memory_order_relaxed);
+    if (depth > highWatermark_.load(std::memory_order_relaxed)) {
+      highWatermark_.store(depth, std::memory_order_relaxed);
+    }
+  }
+
+  T items_[Capacity];
+  // Producer and consumer indices live on separate cache lines to avoid false sharing.
+  alignas(64) std::atomic<uint32_t> head_{0};
+  alignas(64) std::atomic<uint32_t> tail_{0};
+  std::atomic<uint32_t> overflows_{0};
+  std::atomic<uint32_t> highWatermark_{0};
+};
@@ -1,21 +1,69 @@
 #pragma once
 
+#include "ByteSink.h"
+#include "Config.h"
+#include "SegmentLog.h"
+
 #include <Arduino.h>
-#include <LittleFS.h>
 #include <vector>
 
 class StorageQueue {
  public:
-  explicit StorageQueue(const char* path);
+  // Streams one record into the queue through a fixed scratch buffer.
+  class RecordWriter : public ByteSink {
+   public:
+    RecordWriter(StorageQueue& queue, uint8_t kind, size_t sizeHint);
+    ~RecordWriter() override;
+    bool write(const uint8_t* data, size_t len) override;
+    bool commit();
+
+   private:
+    bool flush();
+
+    SegmentLog& log_;
+    uint8_t buffer_[Config::kQueueScratchBytes];
+    size_t len_ = 0;
+    bool ok_ = false;
+  };
+
+  // Arduino Stream over the front record, so HTTPClient can send it with a fixed buffer.
+  class FrontStream : public Stream {
+   public:
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t readBytes(char* buffer, size_t length) override;
+    size_t write(uint8_t) override;
+    bool rewind();
+    size_t length() const;
+    uint8_t kind() const;
+    void close();
+
+   private:
+    friend class StorageQueue;
+    bool fill();
+
+    SegmentLog::Reader reader_;
+    uint8_t buffer_[Config::kQueueScratchBytes];
+    size_t pos_ = 0;
+    size_t len_ = 0;
+  };
+
+  // name is a directory below the LittleFS mount; legacyPath is an old line-per-payload queue
+  // file that is imported once and then removed.
+  StorageQueue(const char* name, const char* legacyPath, uint32_t maxBytes);
   bool begin();
-  void enqueue(const String& payload);
+  bool enqueue(const String& payload);
+  bool enqueue(const uint8_t* data, size_t len, uint8_t kind = 0);
   bool hasItems() const;
-  String front() const;
+  bool front(std::vector<uint8_t>& out, uint8_t* kind = nullptr);
+  bool openFront(FrontStream& stream);
   void pop();
+  const SegmentLog::Stats& stats() const;
 
  private:
-  void persist();
+  void migrateLegacy();
 
-  const char* path_;
-  std::vector<String> items_;
+  const char* legacyPath_;
+  SegmentLog log_;
 };
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Config.h"
+
+enum class ThresholdMode : uint8_t {
+  Fixed = 0,   // levels in volts
+  Nominal = 1, // levels in percent of the tracked baseline
+};
+
+// What EventDetector compares against on every window and half cycle, precomputed from a
+// ThresholdProfile whenever the profile or the baseline changes.
+struct DetectionThresholds {
+  float sagStart = Config::kSagStart;
+  float sagEnd = Config::kSagEnd;
+  float swellStart = Config::kSwellStart;
+  float swellEnd = Config::kSwellEnd;
+  float criticalLow = Config::kCriticalLow;
+  float criticalHigh = Config::kCriticalHigh;
+  uint16_t sagStartWindows = Config::kSagStartWindows;
+  uint16_t sagEndWindows = Config::kSagEndWindows;
+  uint16_t swellStartWindows = Config::kSwellStartWindows;
+  uint16_t swellEndWindows = Config::kSwellEndWindows;
+  uint16_t criticalEndWindows = Config::kCriticalEndWindows;
+  uint8_t fastTriggerHalfCycles = Config::kFastTriggerHalfCycles;
+};
+
+// Runtime detection settings, written as key=value pairs: "mode=nominal nominal=120" moves a
+// device to a 120 V site with the default percentages. In nominal mode the levels are
+// percentages of a baseline that follows slow changes of the supply (IEC 61000-4-30 sliding
+// reference, kBaselineTimeConstantMs) within kBaselineMaxDeviation of nominal; in fixed mode
+// they are volts. The defaults are the Config.h constants.
+struct ThresholdProfile {
+  // The format() text of a complete profile fits in this many bytes.
+  static constexpr size_t kTextLength = 320;
+
+  ThresholdMode mode = ThresholdMode::Fixed;
+  float nominalV = Config::kNominalVrms;
+  float sagStart = Config::kSagStart;
+  float sagEnd = Config::kSagEnd;
+  float swellStart = Config::kSwellStart;
+  float swellEnd = Config::kSwellEnd;
+  float criticalLow = Config::kCriticalLow;
+  float criticalHigh = Config::kCriticalHigh;
+  uint16_t sagStartWindows = Config::kSagStartWindows;
+  uint16_t sagEndWindows = Config::kSagEndWindows;
+  uint16_t swellStartWindows = Config::kSwellStartWindows;
+  uint16_t swellEndWindows = Config::kSwellEndWindows;
+  uint16_t criticalEndWindows = Config::kCriticalEndWindows;
+  uint8_t fastTriggerHalfCycles = Config::kFastTriggerHalfCycles;
+
+  // Applies the pairs over this profile; keys left out keep their value, except that a mode
+  // change without levels converts the levels at the nominal voltage. Leaves the profile
+  // unchanged if a key is unknown or the result is not ordered critical < sag < swell.
+  bool parse(const char* text);
+  void format(char* buf, size_t size) const;
+  // baselineV only matters in nominal mode.
+  DetectionThresholds thresholds(float baselineV) const;
+  bool valid() const;
+};
+
+const char* ThresholdModeToString(ThresholdMode mode);
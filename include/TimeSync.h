@@ -10,6 +10,8 @@ class TimeSync {
   uint64_t nowMs() const;
 
  private:
+  // nowMs()/isSynced() are also called from the acquisition task.
+  mutable portMUX_TYPE lock_ = portMUX_INITIALIZER_UNLOCKED;
   bool synced_ = false;
   uint64_t bootEpochMs_ = 0;
   unsigned long lastSyncMs_ = 0;
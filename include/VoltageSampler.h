@@ -1,35 +1,163 @@
 #pragma once
 
+#include "AdcBufferProvider.h"
 #include "Config.h"
+#include "HarmonicAnalyzer.h"
+#include "SpscRing.h"
+#include "WindowKernel.h"
+
+#include <atomic>
+
+class WaveformRecorder;
+
+// Receives the RMS of the last full mains cycle at every zero crossing, i.e. once per half
+// cycle (IEC 61000-4-30 Urms(1/2)). Called on the sampling task, cycle-synchronized mode only;
+// cycles with saturated samples are skipped.
+class HalfCycleListener {
+ public:
+  virtual ~HalfCycleListener() = default;
+  // ageMs: capture time between the crossing that closed the cycle and the newest sample read.
+  virtual void onHalfCycleRms(float vrms, uint32_t ageMs) = 0;
+};
+
+// Receives every raw sample as it goes into a window, with the DC bias the window is computed
+// around. Called on the sampling task; see PowerMeter.
+class SampleListener {
+ public:
+  virtual ~SampleListener() = default;
+  virtual void onSamples(const uint16_t* raw, size_t count, uint16_t dc) = 0;
+};
 
 class VoltageSampler {
  public:
-  explicit VoltageSampler(gpio_num_t pin);
+  explicit VoltageSampler(AdcBufferProvider& provider);
 
-  void begin();
+  bool begin();
+  // Gain and offset change together at the start of the next window, so no window mixes old
+  // and new values; safe to call from one other task.
   void setCalibration(float gain, float offset, bool hasCalibration);
-  bool update(VoltageSample& outSample);
+  // Closes windows on Config::kCyclesPerWindow whole mains cycles instead of a fixed sample
+  // count. Takes effect at the next window; safe to call from another task.
+  void setCycleSync(bool enabled);
+  bool cycleSync() const;
+  // Fills the harmonic fields of VoltageSample (THD, 3rd/5th/7th). Takes effect at the next
+  // window; safe to call from another task.
+  void setHarmonics(bool enabled);
+  bool harmonics() const;
+  // Readings below minRms or a raw peak-to-peak below minRawPkPk are NO_SIGNAL; current
+  // channels pass 0 for both, since no load is a valid reading.
+  void setSignalThresholds(float minRms, uint16_t minRawPkPk);
+  // Closes each window where reference closed its own instead of on this channel's zero
+  // crossings, so the channels of a scanned ADC cover the same samples and share the
+  // reference's cycle alignment and frequency. reference must be fed the same stream and be
+  // updated first, this sampler right after each of its windows (AcquisitionTask does).
+  void followWindows(const VoltageSampler* reference);
+  void setHalfCycleListener(HalfCycleListener* listener);
+  void setSampleListener(SampleListener* listener);
+  // Receives every raw DMA buffer as it is read, before any of it is processed.
+  void setWaveformRecorder(WaveformRecorder* recorder);
+  bool update(VoltageSample& outSample, uint32_t waitMs = 0);
   float lastRawRms() const;
   float lastVrms() const;
+  float lastHalfCycleVrms() const;
+  // CPU cycles spent on the last completed window's math, excluding the wait for ADC data.
+  uint32_t lastWindowCycles() const;
 
  private:
-  gpio_num_t adcPin_;
-  float gain_ = 1.0f;
-  float offset_ = 0.0f;
+  // Recent closed windows, read by followers.
+  struct WindowBoundary {
+    uint32_t samples = 0;
+    uint16_t flags = FLAG_NONE; // FLAG_NOT_CYCLE_SYNC or none
+    float freqHz = 0.0f;
+  };
+  static constexpr size_t kBoundaryLog = 4;
+
+  struct HalfCycle {
+    uint32_t count = 0;
+    int32_t sum = 0;
+    uint64_t sumSq = 0;
+    bool saturated = false;
+  };
+
+  void accumulate(const uint16_t* raw, size_t count);
+  size_t accumulateSynced(const uint16_t* raw, size_t count);
+  void addToWindow(const WindowKernel::Stats& block, size_t count);
+  void closeHalfCycle(uint32_t samplesAgo);
+  bool windowComplete() const;
+  size_t windowLimit() const;
+  void finishWindow(VoltageSample& outSample);
+  void finishHarmonics(VoltageSample& outSample);
+  void resetWindow();
+
+  // Fixed-point volts: Q16 output, gain in Q20 (volts per ADC count).
+  static constexpr int kGainFracBits = 20;
+  static constexpr int kVoltFracBits = 16;
+  static constexpr int kRawFracBits = 8;
+
+  int64_t rawToVolts(int64_t rawQ8) const;
+  void applyPendingCalibration();
+
+  AdcBufferProvider& provider_;
+  int32_t gainQ20_ = 1 << kGainFracBits;
+  int32_t offsetQ16_ = 0;
   bool hasCalibration_ = false;
+  struct Calibration {
+    int32_t gainQ20;
+    int32_t offsetQ16;
+    bool present;
+  };
+  SpscRing<Calibration, 8> pendingCalibration_;
+  std::atomic<bool> cycleSyncRequested_{Config::kCycleSyncDefault};
+  std::atomic<bool> harmonicsRequested_{Config::kHarmonicsDefault};
+  HalfCycleListener* halfCycleListener_ = nullptr;
+  SampleListener* sampleListener_ = nullptr;
+  WaveformRecorder* waveformRecorder_ = nullptr;
+  float noSignalRms_ = Config::kNoSignalVrms;
+  uint16_t noSignalRawPkPk_ = Config::kNoSignalRawPkPk;
+  const VoltageSampler* reference_ = nullptr;
+  WindowBoundary boundaries_[kBoundaryLog];
+  uint32_t windowsClosed_ = 0;
 
-  unsigned long windowStartMs_ = 0;
-  unsigned long lastSampleUs_ = 0;
-  uint32_t intervalUs_ = 0;
+  uint32_t samplesPerWindow_ = Config::kWindowSamples;
+  uint32_t maxSyncSamples_ = Config::kWindowSamples;
+  uint16_t buffer_[Config::kAdcDmaBufferLen];
+  size_t bufferPos_ = 0;
+  size_t bufferLen_ = 0;
 
+  // Samples are accumulated relative to dc_, the previous window's mean, so the per-sample
+  // math stays in 32 bits and the variance is computed exactly in integers.
+  uint16_t dc_ = 2048;
   uint32_t count_ = 0;
-  uint64_t sum_ = 0;
+  int32_t sum_ = 0;
   uint64_t sumSq_ = 0;
   uint16_t saturatedCount_ = 0;
   uint16_t minRaw_ = 4095;
   uint16_t maxRaw_ = 0;
+  uint32_t windowCycles_ = 0;
+  uint32_t lastWindowCycles_ = 0;
+
+  // Zero-crossing tracking. Positions are Q8 sample indices; differences survive wrap-around.
+  bool cycleSync_ = false;
+  uint32_t sampleIndex_ = 0;
+  int32_t prevD_ = 0;
+  int8_t armed_ = 0; // -1: was below -hysteresis, waiting to rise; +1: waiting to fall
+  uint8_t risingCrossings_ = 0;
+  bool startSynced_ = false;
+  bool endSynced_ = false;
+  uint32_t firstCrossingQ8_ = 0;
+  uint32_t lastCrossingQ8_ = 0;
+  float lineHz_ = Config::kMainsNominalHz; // last measured, tunes the harmonic filters
+
+  bool harmonics_ = false;
+  HarmonicAnalyzer analyzer_;
+
+  HalfCycle half_;
+  HalfCycle prevHalf_;
+  bool halfValid_ = false;
+  bool prevHalfValid_ = false;
 
   float lastRawRms_ = 0.0f;
   float lastVrms_ = 0.0f;
+  float lastHalfCycleVrms_ = 0.0f;
   bool lastNoSignal_ = false;
 };
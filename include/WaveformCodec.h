@@ -0,0 +1,24 @@
+#pragma once
+
+#include "ByteSink.h"
+#include "WaveformRecorder.h"
+
+// Binary event waveform attachment (reference decoder: scripts/decode_waveform_bin.py).
+//
+// All integers are little-endian; "svarint" is a zigzag LEB128 varint as in SampleBatchCodec.
+//   header:  "CCRW" | u8 version | u8 event type (0 SAG, 1 SWELL, 2 CRITICAL) | u16 sample_rate_hz
+//            | u32 count | u32 trigger_index | u64 event_start_ts_ms | u64 first_sample_ts_ms
+//            | f32 volts_per_count | u8 len + device_id | u8 len + fw_version
+//   samples: u16 raw[0], then (count - 1) x svarint(raw[i] - raw[i-1])
+// Raw values are 12-bit ADC counts around the sensor's DC bias; volts = (raw - mean) x
+// volts_per_count. A 50 Hz sine of ~1200 counts peak costs under 2 bytes per sample.
+namespace WaveformCodec {
+constexpr uint8_t kVersion = 1;
+constexpr const char* kContentType = "application/vnd.ccr.waveform+binary";
+
+bool encode(ByteSink& out,
+            const char* deviceId,
+            const char* fwVersion,
+            const WaveformRecorder::Capture& capture,
+            float voltsPerCount);
+} // namespace WaveformCodec
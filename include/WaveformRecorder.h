@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Config.h"
+#include "SpscRing.h"
+
+#include <atomic>
+
+// Raw ADC samples around event starts. The sampling task appends every DMA buffer to a
+// pre-trigger ring; trigger() copies the ring into a free capture slot, which then keeps
+// filling until kWaveformPostSamples more samples have arrived and is handed to loop().
+// Memory is fixed by Config; the sampling task never blocks or allocates here, and a trigger
+// that finds every slot busy is counted and skipped.
+class WaveformRecorder {
+ public:
+  static constexpr uint32_t kCaptureSamples = Config::kWaveformPreSamples + Config::kWaveformPostSamples;
+
+  struct Capture {
+    EventType type = EventType::Sag;
+    uint64_t event_start_ts = 0;
+    uint64_t first_sample_ts = 0;  // capture time of samples[0], from the trigger's clock
+    uint32_t sample_rate_hz = 0;
+    uint32_t trigger_index = 0;    // newest sample read when the event was detected
+    uint32_t count = 0;
+    uint16_t samples[kCaptureSamples];
+  };
+
+  void setSampleRate(uint32_t sampleRateHz);
+
+  // Sampling task only.
+  void append(const uint16_t* raw, size_t count);
+  // newestSampleTs: capture time of the last sample passed to append().
+  void trigger(EventType type, uint64_t eventStartTs, uint64_t newestSampleTs);
+
+  // loop() only. A popped capture stays valid until release().
+  bool popCapture(const Capture*& out);
+  void release(const Capture* capture);
+
+  // Triggers skipped because every slot was busy.
+  uint32_t droppedCaptures() const;
+
+ private:
+  static constexpr int kNotFilling = -1;
+
+  uint32_t sampleRateHz_ = Config::kSampleRateHz;
+  uint16_t ring_[Config::kWaveformPreSamples];
+  uint32_t ringHead_ = 0;  // next write position
+  uint32_t ringCount_ = 0;
+
+  Capture slots_[Config::kWaveformSlots];
+  std::atomic<bool> busy_[Config::kWaveformSlots] = {};
+  int filling_ = kNotFilling;
+  SpscRing<uint8_t, 4> ready_;
+  std::atomic<uint32_t> dropped_{0};
+};
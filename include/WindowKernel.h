@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Block statistics over raw 12-bit ADC samples, relative to a DC estimate: the per-window
+// reduction behind VoltageSampler. accumulateScalar() is the plain per-sample reference;
+// accumulate() must match it bit for bit (checked by test/test_window_kernel).
+namespace WindowKernel {
+// d * d <= 4095^2, so up to 256 squares fit sumSq; callers fold larger windows block by block.
+constexpr size_t kMaxBlock = 256;
+
+struct Stats {
+  int32_t sum = 0;        // sum of (raw - dc)
+  uint32_t sumSq = 0;     // sum of (raw - dc)^2
+  uint16_t saturated = 0; // raw == 0 or raw >= 4095
+  uint16_t min = UINT16_MAX;
+  uint16_t max = 0;
+};
+
+// Adds count <= kMaxBlock samples (values 0..4095) to stats.
+void accumulate(const uint16_t* raw, size_t count, int32_t dc, Stats& stats);
+void accumulateScalar(const uint16_t* raw, size_t count, int32_t dc, Stats& stats);
+} // namespace WindowKernel
@@ -0,0 +1,537 @@
+// Host benchmark for the firmware hot paths: pio run -e bench && .pio/build/bench/program
+// Numbers are host CPU numbers; compare them between commits, not against the ESP32. The
+// behaviour checks live in test/ (pio test -e native).
+
+#include "AdcChannelDemux.h"
+#include "BatchUploader.h"
+#include "Config.h"
+#include "EventDetector.h"
+#include "GzipWriter.h"
+#include "HostAdcProviders.h"
+#include "NativeHost.h"
+#include "SampleBatchCodec.h"
+#include "SampleReducer.h"
+#include "StorageQueue.h"
+#include "ThresholdProfile.h"
+#include "VoltageSampler.h"
+#include "WindowKernel.h"
+
+#include <dirent.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::vector<VoltageSample> makeTrace(size_t count, uint32_t sagEvery) {
+  std::vector<VoltageSample> trace(count);
+  uint32_t noise = 12345;
+  for (size_t i = 0; i < count; ++i) {
+    noise = noise * 1103515245u + 12345u;
+    float vrms = 230.0f + static_cast<float>((noise >> 16) % 200) / 100.0f - 1.0f;
+    if (sagEvery > 0 && i % sagEvery < 20) {
+      vrms = 200.0f;
+    }
+    trace[i].ts_ms = 1700000000000ULL + i * Config::kWindowMs;
+    trace[i].vrms = vrms;
+    trace[i].vmin = vrms - 1.0f;
+    trace[i].vmax = vrms + 1.0f;
+    trace[i].sample_count = Config::kWindowSamples;
+    trace[i].raw_rms = vrms / 0.3f;
+  }
+  return trace;
+}
+
+uint64_t directoryBytes(const std::string& path) {
+  uint64_t total = 0;
+  DIR* dir = opendir(path.c_str());
+  if (dir == nullptr) {
+    return 0;
+  }
+  while (dirent* entry = readdir(dir)) {
+    struct stat st;
+    if (stat((path + "/" + entry->d_name).c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      total += st.st_size;
+    }
+  }
+  closedir(dir);
+  return total;
+}
+
+double percentile(std::vector<double>& values, double p) {
+  std::sort(values.begin(), values.end());
+  return values[static_cast<size_t>(p * (values.size() - 1))];
+}
+
+void benchSampler() {
+  SineAdcProvider provider;
+  VoltageSampler sampler(provider);
+  sampler.setCalibration(0.3f, 0.0f, true);
+  sampler.begin();
+
+  const uint32_t windows = 20000;
+  VoltageSample sample;
+  auto start = Clock::now();
+  for (uint32_t i = 0; i < windows; ++i) {
+    sampler.update(sample);
+  }
+  double seconds = secondsSince(start);
+  double rate = windows / seconds;
+  printf("sampler      %10.0f windows/s  (%.0fx real time, vrms=%.2f)\n",
+         rate,
+         rate * Config::kWindowMs / 1000.0,
+         sample.vrms);
+
+  // The same single channel behind AdcChannelDemux, as the firmware wires it.
+  SineAdcProvider source;
+  AdcChannelDemux demux(source);
+  VoltageSampler viaDemux(demux.channel(0));
+  viaDemux.setCalibration(0.3f, 0.0f, true);
+  viaDemux.begin();
+  start = Clock::now();
+  for (uint32_t i = 0; i < windows; ++i) {
+    viaDemux.update(sample);
+  }
+  seconds = secondsSince(start);
+  printf("sampler 1ch  %10.0f windows/s  via AdcChannelDemux (%.1f%% of direct)\n",
+         windows / seconds,
+         100.0 * (windows / seconds) / rate);
+}
+
+// De-interleaving cost: one fill() plus draining every channel, per scanned sample.
+void benchDemux() {
+  for (size_t inputs : {3, 6}) {
+    ScannedAdcProvider source(inputs, Config::kSampleRateHz, true, [](size_t c, size_t s) {
+      return static_cast<uint16_t>(2048 + 1000 * sin(2.0 * M_PI * (50.0 * s / Config::kSampleRateHz + c / 3.0)));
+    });
+    AdcChannelDemux demux(source);
+    demux.begin();
+    uint16_t buffer[Config::kAdcDmaBufferLen];
+    const uint32_t fills = 200000;
+    uint64_t samples = 0;
+    auto start = Clock::now();
+    for (uint32_t i = 0; i < fills; ++i) {
+      demux.fill(0);
+      for (size_t c = 0; c < inputs; ++c) {
+        samples += demux.channel(c).read(buffer, Config::kAdcDmaBufferLen, 0);
+      }
+    }
+    const double seconds = secondsSince(start);
+    printf("demux %zu ch   %7.2f ns/sample  (%.0fx real time, %u dropped)\n",
+           inputs,
+           seconds * 1e9 / samples,
+           samples / seconds / (inputs * Config::kSampleRateHz),
+           static_cast<unsigned int>(demux.droppedSamples()));
+  }
+}
+
+// Three phases and a current clamp at 49.93 Hz through the demux, the secondary samplers
+// following the primary's windows as in AcquisitionTask: batch size of the columnar rows
+// against one batch per channel, over one minute of windows.
+void benchChannelBatches() {
+  const size_t inputs = 4;
+  const double frequency = 49.93;
+  const double rms[inputs] = {230.0, 226.0, 234.0, 8.0};
+  const double phase[inputs] = {0.0, -2.0 * M_PI / 3.0, 2.0 * M_PI / 3.0, -M_PI / 6.0};
+  const float gain[inputs] = {0.3f, 0.3f, 0.3f, 0.02f};
+  const size_t scans = Config::kSampleRateHz * 60;
+  ScannedAdcProvider source(inputs, scans, false, [&](size_t c, size_t s) {
+    const double t = static_cast<double>(s) / Config::kSampleRateHz;
+    return static_cast<uint16_t>(lround(2048.0 + rms[c] * sqrt(2.0) / gain[c] * sin(2.0 * M_PI * frequency * t + phase[c])));
+  });
+  AdcChannelDemux demux(source);
+  VoltageSampler primary(demux.channel(0));
+  VoltageSampler follower1(demux.channel(1));
+  VoltageSampler follower2(demux.channel(2));
+  VoltageSampler follower3(demux.channel(3));
+  VoltageSampler* samplers[inputs] = {&primary, &follower1, &follower2, &follower3};
+  for (size_t c = 0; c < inputs; ++c) {
+    samplers[c]->setCalibration(gain[c], 0.0f, true);
+    if (c > 0) {
+      samplers[c]->followWindows(&primary);
+    }
+    samplers[c]->begin();
+  }
+  follower3.setSignalThresholds(0.0f, 0);
+
+  SamplePoints rows;
+  std::vector<VoltageSample> perChannel[inputs];
+  VoltageSample sample;
+  VoltageSample secondary;
+  while (demux.fill(0)) {
+    while (primary.update(sample, 0)) {
+      sample.ts_ms = 1700000000000ULL + rows.size() * Config::kWindowMs;
+      ChannelValues values;
+      for (size_t c = 1; c < inputs; ++c) {
+        samplers[c]->update(secondary, 0);
+        secondary.ts_ms = sample.ts_ms;
+        values.kind[values.count] = c == 3 ? ChannelKind::Current : ChannelKind::Voltage;
+        values.rms[values.count] = secondary.vrms;
+        values.flags[values.count] = secondary.flags;
+        values.count++;
+        perChannel[c].push_back(secondary);
+      }
+      perChannel[0].push_back(sample);
+      rows.samples.push_back(sample);
+      rows.channels.push_back(values);
+    }
+    for (size_t c = 1; c < inputs; ++c) {
+      samplers[c]->update(secondary, 0);
+    }
+  }
+
+  std::vector<uint8_t> columnar;
+  VectorSink columnarSink(columnar);
+  SampleBatchCodec::encode(columnarSink,
+                           "bench",
+                           Config::kFirmwareVersion,
+                           Config::kWindowMs,
+                           rows.samples.data(),
+                           rows.size(),
+                           nullptr,
+                           rows.channels.data());
+  // The same rows with the clamp reported as a plain RMS column, as batches were before the
+  // P/Q/S columns and energy totals of current channels.
+  std::vector<ChannelValues> rmsOnly = rows.channels;
+  for (ChannelValues& values : rmsOnly) {
+    values.kind[2] = ChannelKind::Voltage;
+  }
+  std::vector<uint8_t> columnarRms;
+  VectorSink columnarRmsSink(columnarRms);
+  SampleBatchCodec::encode(columnarRmsSink,
+                           "bench",
+                           Config::kFirmwareVersion,
+                           Config::kWindowMs,
+                           rows.samples.data(),
+                           rows.size(),
+                           nullptr,
+                           rmsOnly.data());
+  size_t separate = 0;
+  for (size_t c = 0; c < inputs; ++c) {
+    std::vector<uint8_t> batch;
+    VectorSink sink(batch);
+    SampleBatchCodec::encode(sink, "bench", Config::kFirmwareVersion, Config::kWindowMs, perChannel[c].data(), perChannel[c].size());
+    separate += batch.size();
+  }
+  printf("channels batch  3V+1I %u windows  columnar %u bytes (%.2f B/row), %u without the current's P/Q/S  "
+         "one batch per channel %u bytes\n",
+         static_cast<unsigned int>(rows.size()),
+         static_cast<unsigned int>(columnar.size()),
+         static_cast<double>(columnar.size()) / std::max<size_t>(rows.size(), 1),
+         static_cast<unsigned int>(columnarRms.size()),
+         static_cast<unsigned int>(separate));
+}
+
+// The sampler's cost per window with the harmonic analysis off and on.
+void benchHarmonics() {
+  double usPerWindow[2] = {};
+  for (int enabled = 0; enabled < 2; ++enabled) {
+    SineAdcProvider provider;
+    VoltageSampler sampler(provider);
+    sampler.setCalibration(0.3f, 0.0f, true);
+    sampler.setHarmonics(enabled != 0);
+    sampler.begin();
+    const uint32_t windows = 20000;
+    VoltageSample sample;
+    auto start = Clock::now();
+    for (uint32_t i = 0; i < windows; ++i) {
+      sampler.update(sample);
+    }
+    usPerWindow[enabled] = secondsSince(start) * 1e6 / windows;
+  }
+  printf("harmonics cost %.2f us/window off, %.2f us/window on (+%.2f us, %u Goertzel filters)\n",
+         usPerWindow[0],
+         usPerWindow[1],
+         usPerWindow[1] - usPerWindow[0],
+         static_cast<unsigned int>(HarmonicAnalyzer::kOrders));
+}
+
+void benchWindowKernel() {
+  std::vector<uint16_t> window(Config::kWindowSamples);
+  for (size_t i = 0; i < window.size(); ++i) {
+    window[i] = static_cast<uint16_t>(2048.0 + 1200.0 * sin(2.0 * M_PI * 50.0 * i / Config::kSampleRateHz));
+  }
+  const uint32_t windows = 200000;
+  struct Variant {
+    const char* label;
+    void (*fn)(const uint16_t*, size_t, int32_t, WindowKernel::Stats&);
+  };
+  const Variant variants[] = {{"scalar", WindowKernel::accumulateScalar}, {"unrolled", WindowKernel::accumulate}};
+  double nsPerSample[2] = {};
+  for (size_t v = 0; v < 2; ++v) {
+    uint64_t checksum = 0;
+    auto start = Clock::now();
+    for (uint32_t w = 0; w < windows; ++w) {
+      WindowKernel::Stats stats;
+      for (size_t pos = 0; pos < window.size(); pos += Config::kAdcDmaBufferLen) {
+        const size_t count = std::min<size_t>(Config::kAdcDmaBufferLen, window.size() - pos);
+        variants[v].fn(window.data() + pos, count, static_cast<int32_t>(2048 + (w & 7)), stats);
+      }
+      checksum += stats.sumSq + stats.min + stats.max;
+    }
+    nsPerSample[v] = secondsSince(start) * 1e9 / (static_cast<double>(windows) * window.size());
+    printf("kernel %-9s %6.3f ns/sample  (checksum %llu)\n",
+           variants[v].label,
+           nsPerSample[v],
+           static_cast<unsigned long long>(checksum));
+  }
+  printf("kernel speedup %.2fx\n", nsPerSample[0] / nsPerSample[1]);
+}
+
+// The default fixed profile, then the same trace in nominal mode, where the baseline tracking
+// and threshold refreshes must not cost throughput.
+void benchDetector() {
+  const std::vector<VoltageSample> trace = makeTrace(1000000, 900);
+  ThresholdProfile nominal;
+  nominal.parse("mode=nominal");
+  const ThresholdProfile* profiles[] = {nullptr, &nominal};
+  for (const ThresholdProfile* profile : profiles) {
+    static EventDetector fixedDetector;
+    static EventDetector nominalDetector;
+    EventDetector& detector = profile == nullptr ? fixedDetector : nominalDetector;
+    if (profile != nullptr) {
+      detector.setProfile(*profile);
+    }
+    uint32_t events = 0;
+    VoltageEvent event;
+    auto start = Clock::now();
+    for (const auto& sample : trace) {
+      detector.addSample(sample);
+      while (detector.pollCompletedEvent(event)) {
+        events++;
+      }
+    }
+    double seconds = secondsSince(start);
+    printf("detector %-3s %10.0f samples/s  %8.0f events/s  (%u events)\n",
+           profile == nullptr ? "" : "nom",
+           trace.size() / seconds,
+           events / seconds,
+           static_cast<unsigned int>(events));
+  }
+}
+
+void benchCodecs() {
+  const std::vector<VoltageSample> batch = makeTrace(Config::kBatchMaxPoints, 0);
+  const int rounds = 20;
+
+  std::vector<uint8_t> binary;
+  auto start = Clock::now();
+  for (int i = 0; i < rounds; ++i) {
+    binary.clear();
+    VectorSink sink(binary);
+    SampleBatchCodec::encode(sink, "bench", Config::kFirmwareVersion, Config::kWindowMs, batch.data(), batch.size());
+  }
+  double seconds = secondsSince(start);
+  printf("binary codec %10.2f ms/batch  %6.1f MB/s out  (%u bytes, %u points)\n",
+         seconds * 1000.0 / rounds,
+         binary.size() * rounds / seconds / 1e6,
+         static_cast<unsigned int>(binary.size()),
+         static_cast<unsigned int>(batch.size()));
+
+  static GzipWriter gzip;
+  std::vector<uint8_t> compressed;
+  start = Clock::now();
+  for (int i = 0; i < rounds; ++i) {
+    compressed.clear();
+    VectorSink sink(compressed);
+    gzip.begin(sink);
+    gzip.write(binary.data(), binary.size());
+    gzip.finish();
+  }
+  seconds = secondsSince(start);
+  printf("gzip         %10.2f ms/batch  %6.1f MB/s in   (binary %u -> %u bytes)\n",
+         seconds * 1000.0 / rounds,
+         binary.size() * rounds / seconds / 1e6,
+         static_cast<unsigned int>(binary.size()),
+         static_cast<unsigned int>(compressed.size()));
+}
+
+// 24 h of realistic Vrms (slow drift, load steps, 0.1 V noise, a sag every 2 h) through every
+// reduction mode: points and encoded bytes against raw, and for the swinging door the worst
+// linear-interpolation error over the undisturbed windows.
+void benchReduction() {
+  const size_t count = 24 * 3600 * 1000 / Config::kWindowMs;
+  std::vector<VoltageSample> trace = makeTrace(count, 0);
+  uint32_t noise = 2463534242u;
+  for (size_t i = 0; i < count; ++i) {
+    const double t = static_cast<double>(i) * Config::kWindowMs / 1000.0;
+    noise = noise * 1664525u + 1013904223u;
+    double vrms = 230.0 + 3.0 * sin(2.0 * M_PI * t / (6 * 3600.0)) + 1.5 * sin(2.0 * M_PI * t / 1020.0) +
+                  ((static_cast<int>(t) / 900) % 3 == 0 ? -1.2 : 0.0) + 0.1 * ((noise >> 8) / 16777216.0 - 0.5) * 3.46;
+    if (i % 36000 >= 18000 && i % 36000 < 18015) {
+      vrms = 195.0; // 3 s sag every 2 h
+    }
+    trace[i].vrms = static_cast<float>(vrms);
+  }
+
+  const SampleReduction modes[] = {SampleReduction::Raw,
+                                   SampleReduction::Tier1s,
+                                   SampleReduction::Tier10s,
+                                   SampleReduction::Tier60s,
+                                   SampleReduction::SwingingDoor};
+  size_t rawBytes = 0;
+  for (SampleReduction mode : modes) {
+    SampleReducer reducer;
+    reducer.setMode(mode, Config::kSwingDoorToleranceV);
+    SamplePoints reduced;
+    auto start = Clock::now();
+    for (const VoltageSample& sample : trace) {
+      reducer.add(sample, nullptr, reduced);
+    }
+    reducer.flush(reduced);
+    const double seconds = secondsSince(start);
+    const std::vector<VoltageSample>& points = reduced.samples;
+
+    std::vector<uint8_t> binary;
+    VectorSink sink(binary);
+    SampleBatchCodec::encode(sink,
+                             "bench",
+                             Config::kFirmwareVersion,
+                             reducer.periodMs(Config::kWindowMs),
+                             points.data(),
+                             points.size(),
+                             reduced.summaries.empty() ? nullptr : reduced.summaries.data());
+    if (mode == SampleReduction::Raw) {
+      rawBytes = binary.size();
+    }
+
+    double maxError = 0.0;
+    if (mode == SampleReduction::SwingingDoor) {
+      size_t segment = 0;
+      for (const VoltageSample& sample : trace) {
+        while (segment + 1 < points.size() && points[segment + 1].ts_ms <= sample.ts_ms) {
+          segment++;
+        }
+        if (segment + 1 >= points.size() || sample.vrms < Config::kSagStart) {
+          continue;
+        }
+        const VoltageSample& a = points[segment];
+        const VoltageSample& b = points[segment + 1];
+        const double f = static_cast<double>(sample.ts_ms - a.ts_ms) / static_cast<double>(b.ts_ms - a.ts_ms);
+        maxError = std::max(maxError, fabs(a.vrms + f * (b.vrms - a.vrms) - sample.vrms));
+      }
+    }
+    printf("reduce %-6s %7u points  %8u bytes bin  %5.1fx smaller  %6.1f ns/window%s",
+           SampleReductionToString(mode),
+           static_cast<unsigned int>(points.size()),
+           static_cast<unsigned int>(binary.size()),
+           static_cast<double>(rawBytes) / std::max<size_t>(binary.size(), 1),
+           seconds * 1e9 / count,
+           mode == SampleReduction::SwingingDoor ? "" : "\n");
+    if (mode == SampleReduction::SwingingDoor) {
+      printf("  max interp err %.3f V (tol %.2f V)\n", maxError, Config::kSwingDoorToleranceV);
+    }
+  }
+}
+
+// Full batch path: JSON/binary encoding, optional gzip and the streaming queue write, per
+// kBatchMaxPoints windows (queued in several records, as kBatchRamBytes allows).
+void benchBatches() {
+  const std::vector<VoltageSample> batch = makeTrace(Config::kBatchMaxPoints, 0);
+  const int rounds = 5;
+  struct Mode {
+    const char* label;
+    UploadFormat format;
+    bool gzip;
+  };
+  const Mode modes[] = {
+      {"json", UploadFormat::Json, false},
+      {"json+gzip", UploadFormat::Json, true},
+      {"bin", UploadFormat::Binary, false},
+      {"bin+gzip", UploadFormat::Binary, true},
+  };
+
+  for (const Mode& mode : modes) {
+    NativeHost::resetFilesystem();
+    static BatchUploader uploader;
+    uploader.begin("http://bench", "bench", "");
+    uploader.setUploadFormat(mode.format);
+    uploader.setCompression(mode.gzip);
+
+    double seconds = 0.0;
+    for (int i = 0; i < rounds; ++i) {
+      auto start = Clock::now();
+      for (const auto& sample : batch) {
+        uploader.addSample(sample);
+      }
+      uploader.flush();
+      seconds += secondsSince(start);
+    }
+    uint64_t bytes = directoryBytes(std::string(Config::kFsBasePath) + "/queue_samples");
+
+    NativeHost::http() = {};
+    auto start = Clock::now();
+    while (true) {
+      uint32_t before = NativeHost::http().requests;
+      uploader.update(true, Config::kWindowMs);
+      if (NativeHost::http().requests == before) {
+        break;
+      }
+    }
+    double drainSeconds = secondsSince(start);
+    printf("batch %-10s %6.2f ms/batch  %6.1f MB/s  %7u bytes/batch  drain %6.2f ms/record\n",
+           mode.label,
+           seconds * 1000.0 / rounds,
+           bytes / seconds / 1e6,
+           static_cast<unsigned int>(bytes / rounds),
+           drainSeconds * 1000.0 / std::max<uint32_t>(1, NativeHost::http().requests));
+  }
+}
+
+void benchStorageQueue() {
+  NativeHost::resetFilesystem();
+  StorageQueue queue("/bench_queue", nullptr, 512 * 1024);
+  queue.begin();
+
+  const int records = 2000;
+  std::vector<uint8_t> payload(512, 'x');
+  std::vector<double> enqueueUs;
+  std::vector<double> popUs;
+  std::vector<uint8_t> out;
+  for (int i = 0; i < records; ++i) {
+    auto start = Clock::now();
+    queue.enqueue(payload.data(), payload.size());
+    enqueueUs.push_back(secondsSince(start) * 1e6);
+  }
+  while (queue.hasItems()) {
+    auto start = Clock::now();
+    queue.front(out);
+    queue.pop();
+    popUs.push_back(secondsSince(start) * 1e6);
+  }
+  printf("queue enqueue p50 %7.1f us  p99 %7.1f us  (%u x %u bytes)\n",
+         percentile(enqueueUs, 0.5),
+         percentile(enqueueUs, 0.99),
+         static_cast<unsigned int>(records),
+         static_cast<unsigned int>(payload.size()));
+  printf("queue pop     p50 %7.1f us  p99 %7.1f us  (front + pop)\n", percentile(popUs, 0.5), percentile(popUs, 0.99));
+}
+} // namespace
+
+int main() {
+  NativeHost::setSerialQuiet(true);
+  if (!NativeHost::resetFilesystem()) {
+    fprintf(stderr, "cannot create %s\n", Config::kFsBasePath);
+    return 1;
+  }
+  benchWindowKernel();
+  benchSampler();
+  benchHarmonics();
+  benchDemux();
+  benchChannelBatches();
+  benchDetector();
+  benchCodecs();
+  benchBatches();
+  benchReduction();
+  benchStorageQueue();
+  return 0;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+// Host-side stand-in for the parts of the Arduino-ESP32 core the portable sources use.
+// Only built by [env:native]; see native/include/NativeHost.h for the test hooks.
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void* TaskHandle_t;
+#define pdPASS 1
+
+enum gpio_num_t {
+  GPIO_NUM_32 = 32,
+  GPIO_NUM_33 = 33,
+  GPIO_NUM_34 = 34,
+  GPIO_NUM_35 = 35,
+  GPIO_NUM_36 = 36,
+  GPIO_NUM_39 = 39,
+};
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+int analogRead(uint8_t pin);
+uint32_t getCpuFrequencyMhz();
+
+// Cycle counter derived from the host clock at getCpuFrequencyMhz(); heap figures are zero.
+class EspClass {
+ public:
+  uint32_t getCycleCount();
+  uint32_t getFreeHeap() { return 0; }
+  uint32_t getMinFreeHeap() { return 0; }
+  uint32_t getMaxAllocHeap() { return 0; }
+};
+
+extern EspClass ESP;
+
+class String {
+ public:
+  String() = default;
+  String(const char* value) : value_(value != nullptr ? value : "") {}
+  String(const std::string& value) : value_(value) {}
+  String(char value) : value_(1, value) {}
+  String(int value) : value_(std::to_string(value)) {}
+  String(unsigned int value) : value_(std::to_string(value)) {}
+  String(long value) : value_(std::to_string(value)) {}
+  String(unsigned long value) : value_(std::to_string(value)) {}
+  String(float value, unsigned int decimals = 2);
+  String(double value, unsigned int decimals = 2);
+
+  const char* c_str() const { return value_.c_str(); }
+  unsigned int length() const { return static_cast<unsigned int>(value_.size()); }
+  char operator[](unsigned int index) const { return index < value_.size() ? value_[index] : 0; }
+
+  String& operator+=(const String& other) {
+    value_ += other.value_;
+    return *this;
+  }
+  String& operator+=(const char* other) {
+    value_ += other;
+    return *this;
+  }
+  String& operator+=(char other) {
+    value_ += other;
+    return *this;
+  }
+  bool reserve(unsigned int size) {
+    value_.reserve(size);
+    return true;
+  }
+
+  bool operator==(const String& other) const { return value_ == other.value_; }
+  bool operator!=(const String& other) const { return value_ != other.value_; }
+  bool equalsIgnoreCase(const String& other) const;
+  bool startsWith(const String& prefix) const;
+  bool endsWith(const String& suffix) const;
+  int indexOf(char c, unsigned int from = 0) const;
+  String substring(unsigned int from) const;
+  String substring(unsigned int from, unsigned int to) const;
+  void trim();
+  long toInt() const { return strtol(value_.c_str(), nullptr, 10); }
+  float toFloat() const { return strtof(value_.c_str(), nullptr); }
+
+ private:
+  std::string value_;
+};
+
+inline String operator+(const String& a, const String& b) {
+  String result = a;
+  result += b;
+  return result;
+}
+
+inline String operator+(const String& a, const char* b) {
+  String result = a;
+  result += b;
+  return result;
+}
+
+class Print {
+ public:
+  virtual ~Print() = default;
+  virtual size_t write(uint8_t value) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size);
+
+  size_t print(const char* text);
+  size_t print(const String& text) { return print(text.c_str()); }
+  size_t println(const char* text = "");
+  size_t println(const String& text) { return println(text.c_str()); }
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual size_t readBytes(char* buffer, size_t length);
+  size_t readBytes(uint8_t* buffer, size_t length) { return readBytes(reinterpret_cast<char*>(buffer), length); }
+  String readStringUntil(char terminator);
+};
+
+// Serial prints to stdout unless NativeHost::setSerialQuiet(true); it never has input.
+class HostSerial : public Stream {
+ public:
+  void begin(unsigned long) {}
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  size_t write(uint8_t value) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+};
+
+extern HostSerial Serial;
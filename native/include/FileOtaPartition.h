@@ -0,0 +1,48 @@
+#pragma once
+
+#include "OtaPartition.h"
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+// OtaPartition over a host file, standing in for the inactive app slot. boot() plays the
+// bootloader and EspOtaPartition::begin() so validation and rollback run without a device.
+class FileOtaPartition : public OtaPartition {
+ public:
+  FileOtaPartition(const char* path, size_t capacity, const char* runningVersion);
+  ~FileOtaPartition() override;
+
+  size_t capacity() const override;
+  bool beginImage(size_t imageSize, const char* version) override;
+  bool write(const uint8_t* data, size_t length) override;
+  bool activate() override;
+  void abort() override;
+
+  bool pendingValidation() const override;
+  void markValid() override;
+  void rollback() override;
+  bool rejected(const char* version) const override;
+
+  // Restarts; an activated image becomes the running one, pending validation.
+  void boot();
+  const std::string& runningVersion() const;
+  const std::string& path() const;
+  // Largest single write(), i.e. the most of the image ever held in RAM at once.
+  size_t largestWrite() const;
+
+ private:
+  std::string path_;
+  size_t capacity_;
+  FILE* file_ = nullptr;
+  size_t imageSize_ = 0;
+  size_t written_ = 0;
+  size_t largestWrite_ = 0;
+  std::string imageVersion_;
+  std::string runningVersion_;
+  std::string previousVersion_;
+  bool activated_ = false;
+  bool pending_ = false;
+  std::vector<std::string> rejected_;
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+
+// HTTPClient stand-in: drains the request body and answers from NativeHost::http().
+class HTTPClient {
+ public:
+  void setReuse(bool reuse) { reuse_ = reuse; }
+  void setTimeout(uint16_t timeoutMs) { timeoutMs_ = timeoutMs; }
+  bool begin(WiFiClient& client, const String& url);
+  void addHeader(const String& name, const String& value);
+  int sendRequest(const char* method, Stream* stream, size_t size);
+  int sendRequest(const char* method, const uint8_t* payload, size_t size);
+  int GET();
+  String getString();
+  void collectHeaders(const char* headerKeys[], size_t count);
+  String header(const char* name);
+  // Body of a ranged GET; -1 and nullptr otherwise.
+  int getSize();
+  Stream* getStreamPtr();
+  void end();
+
+ private:
+  // Reads back the slice of NativeHost::http().responseBody a Range request asked for.
+  class RangeStream : public Stream {
+   public:
+    void reset(std::string body);
+    bool empty() const { return body_.empty(); }
+    size_t size() const { return body_.size(); }
+    int available() override { return static_cast<int>(body_.size() - pos_); }
+    int read() override { return pos_ < body_.size() ? static_cast<uint8_t>(body_[pos_++]) : -1; }
+    int peek() override { return pos_ < body_.size() ? static_cast<uint8_t>(body_[pos_]) : -1; }
+    size_t write(uint8_t) override { return 0; }
+    using Print::write;
+
+   private:
+    std::string body_;
+    size_t pos_ = 0;
+  };
+
+  int respond(const std::string& body);
+
+  WiFiClient* client_ = nullptr;
+  std::string url_;
+  std::vector<std::pair<std::string, std::string>> headers_;
+  RangeStream range_;
+  bool reuse_ = false;
+  uint16_t timeoutMs_ = 0;
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "AdcBufferProvider.h"
+#include "Config.h"
+#include "I2sAdcSamples.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// Fake ADC sources for the host builds (bench and test suites). Nothing here exists in the
+// firmware build.
+
+// 50 Hz sine around mid-scale, served from a one-period table as fast as it is read.
+class SineAdcProvider : public AdcBufferProvider {
+ public:
+  bool begin() override {
+    const uint32_t period = Config::kSampleRateHz / 50;
+    table_.resize(period);
+    for (uint32_t i = 0; i < period; ++i) {
+      table_[i] = static_cast<uint16_t>(2048.0 + 1200.0 * sin(2.0 * M_PI * i / period));
+    }
+    return true;
+  }
+
+  size_t read(uint16_t* out, size_t maxCount, uint32_t) override {
+    for (size_t i = 0; i < maxCount; ++i) {
+      out[i] = table_[pos_];
+      pos_ = (pos_ + 1) % table_.size();
+    }
+    return maxCount;
+  }
+
+  uint32_t sampleRateHz() const override {
+    return Config::kSampleRateHz;
+  }
+
+  uint32_t overrunCount() const override {
+    return 0;
+  }
+
+ private:
+  std::vector<uint16_t> table_;
+  size_t pos_ = 0;
+};
+
+// Replays a prepared sample buffer once, in DMA-sized reads.
+class TraceAdcProvider : public AdcBufferProvider {
+ public:
+  explicit TraceAdcProvider(const std::vector<uint16_t>& samples) : samples_(samples) {}
+
+  bool begin() override {
+    return true;
+  }
+
+  size_t read(uint16_t* out, size_t maxCount, uint32_t) override {
+    size_t count = std::min(maxCount, samples_.size() - pos_);
+    std::copy_n(samples_.begin() + pos_, count, out);
+    pos_ += count;
+    return count;
+  }
+
+  uint32_t sampleRateHz() const override {
+    return Config::kSampleRateHz;
+  }
+
+  uint32_t overrunCount() const override {
+    return 0;
+  }
+
+ private:
+  const std::vector<uint16_t>& samples_;
+  size_t pos_ = 0;
+};
+
+// Inputs as the I2S ADC DMA delivers them: ADC1 channel tag in the top 4 bits and the two
+// samples of every 32-bit word swapped. Serves the prepared buffer once, or in a loop; a single
+// input is unpacked in read() as I2sAdcProvider does.
+class ScannedAdcProvider : public AdcBufferProvider {
+ public:
+  static constexpr uint8_t kTags[Config::kMaxAdcChannels] = {6, 7, 4, 5, 0, 3}; // GPIO34 35 32 33 36 39
+
+  // value(input, index) gives the 12-bit sample of each input at each scan.
+  template <typename Value>
+  ScannedAdcProvider(size_t inputs, size_t scans, bool loop, Value value) : inputs_(inputs), loop_(loop) {
+    samples_.resize(inputs * scans);
+    for (size_t s = 0; s < scans; ++s) {
+      for (size_t c = 0; c < inputs; ++c) {
+        samples_[s * inputs + c] = static_cast<uint16_t>((kTags[c] << 12) | (value(c, s) & 0x0FFF));
+      }
+    }
+    for (size_t i = 0; i + 1 < samples_.size(); i += 2) {
+      std::swap(samples_[i], samples_[i + 1]);
+    }
+  }
+
+  bool begin() override {
+    return true;
+  }
+
+  size_t read(uint16_t* out, size_t maxCount, uint32_t) override {
+    if (loop_ && pos_ == samples_.size()) {
+      pos_ = 0;
+    }
+    if (inputs_ == 1 && maxCount > 1) {
+      maxCount &= ~static_cast<size_t>(1);
+    }
+    size_t count = std::min(maxCount, samples_.size() - pos_);
+    std::copy_n(samples_.begin() + pos_, count, out);
+    pos_ += count;
+    if (inputs_ == 1) {
+      i2sAdcUnpackSingle(out, count);
+    }
+    return count;
+  }
+
+  uint32_t sampleRateHz() const override {
+    return Config::kSampleRateHz;
+  }
+
+  uint32_t overrunCount() const override {
+    return 0;
+  }
+
+  size_t inputCount() const override {
+    return inputs_;
+  }
+
+  uint8_t inputTag(size_t index) const override {
+    return kTags[index];
+  }
+
+ private:
+  std::vector<uint16_t> samples_;
+  size_t inputs_;
+  bool loop_;
+  size_t pos_ = 0;
+};
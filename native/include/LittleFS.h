@@ -0,0 +1,40 @@
+#pragma once
+
+#include <Arduino.h>
+
+// LittleFS stand-in backed by the host directory Config::kFsBasePath.
+class File : public Stream {
+ public:
+  File() = default;
+  explicit File(FILE* file) : file_(file) {}
+  File(File&& other) noexcept : file_(other.file_) { other.file_ = nullptr; }
+  File& operator=(File&& other) noexcept;
+  ~File() override;
+
+  explicit operator bool() const { return file_ != nullptr; }
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t value) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+  size_t size() const;
+  void close();
+
+ private:
+  FILE* file_ = nullptr;
+};
+
+namespace fs {
+class LittleFSFS {
+ public:
+  bool begin(bool formatOnFail = false);
+  bool exists(const char* path);
+  File open(const char* path, const char* mode = "r");
+  bool remove(const char* path);
+  bool rename(const char* from, const char* to);
+  bool mkdir(const char* path);
+};
+} // namespace fs
+
+extern fs::LittleFSFS LittleFS;
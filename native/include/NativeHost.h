@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Knobs for the host shims. Nothing here exists in the firmware build.
+namespace NativeHost {
+// Switches millis()/micros() from the steady clock to a manually advanced virtual clock.
+void useVirtualClock(uint64_t startMs);
+void advanceClockMs(uint32_t ms);
+bool virtualClock();
+
+// Drops Serial output; benchmarks keep the firmware logs out of their report.
+void setSerialQuiet(bool quiet);
+
+// analogRead() returns this value for every pin.
+void setAnalogValue(int value);
+
+// Removes and recreates the directory that backs Config::kFsBasePath.
+bool resetFilesystem();
+
+// The HTTPClient stub answers every request with statusCode (or a negative transport
+// error) and records what it was sent.
+struct HttpStub {
+  int statusCode = 200;
+  uint32_t requests = 0;
+  uint64_t bodyBytes = 0;
+  std::string lastUrl;
+  std::string lastContentType;
+  std::string lastContentEncoding;
+  std::string lastBody;
+  bool keepBodies = false;
+  // Body of every successful response; GET reads it back through getString().
+  std::string responseBody;
+  // Sent as ETag with responseBody. A GET whose If-None-Match equals it gets 304 instead of
+  // statusCode, like a server whose document has not changed.
+  std::string responseEtag;
+  std::string lastIfNoneMatch;
+  // A GET with a Range header gets 206 and that slice of responseBody instead of statusCode
+  // 200, or 416 when the range starts past its end.
+  std::string lastRange;
+  // Called after every request, with the last* fields describing it.
+  void (*onRequest)(const HttpStub& stub) = nullptr;
+};
+HttpStub& http();
+} // namespace NativeHost
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Connection state only; the HTTPClient stub never opens a socket.
+class WiFiClient {
+ public:
+  bool connected() const { return connected_; }
+  void stop() { connected_ = false; }
+
+ private:
+  friend class HTTPClient;
+  bool connected_ = false;
+};
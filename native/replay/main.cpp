@@ -0,0 +1,487 @@
+// Replays recorded or synthetic grid data through VoltageSampler -> EventDetector ->
+// BatchUploader on a virtual clock, much faster than real time.
+//
+//   pio run -e replay && .pio/build/replay/program [options] <input>
+//
+// Input (one of):
+//   --adc FILE          raw ADC capture: little-endian uint16 samples at kSampleRateHz
+//   --vrms FILE         CSV with one window per line: "vrms" or "ts_ms,vrms[,flags]"
+//   --synthetic HOURS   50 Hz sine at 230 V with a sag (85%, 3 s) every 10 minutes and a
+//                       3-cycle dip (70%, 60 ms) five minutes after each sag
+// Options:
+//   --gain G --offset O calibration applied by the sampler (default 1 / 0)
+//   --format json|bin   upload format (default json)
+//   --gzip              compress queue records
+//   --reduce MODE       sample reduction: raw|1s|10s|60s|swing (default raw)
+//   --swing-tol V       swinging-door tolerance in volts
+//   --thresholds PAIRS  detection profile as for "detect set", e.g. "mode=nominal nominal=120"
+//   --harmonics         enable the sampler's harmonic analysis (raw inputs only)
+//   --offline           never drain the queues (WiFi down)
+//   --payloads          print every uploaded body (JSON only; others as sizes)
+//   --waveforms DIR     also write each uploaded waveform attachment to DIR/waveform_N.bin
+//   --quiet             hide the firmware's own Serial logs
+
+#include "AdcBufferProvider.h"
+#include "BatchUploader.h"
+#include "Config.h"
+#include "EventDetector.h"
+#include "NativeHost.h"
+#include "ThresholdProfile.h"
+#include "VoltageSampler.h"
+#include "WaveformRecorder.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr uint64_t kReplayEpochMs = 1700000000000ULL;
+
+struct Options {
+  std::string adcPath;
+  std::string vrmsPath;
+  double syntheticHours = 0.0;
+  float gain = 1.0f;
+  float offset = 0.0f;
+  UploadFormat format = UploadFormat::Json;
+  bool gzip = false;
+  SampleReduction reduction = SampleReduction::Raw;
+  float swingTolerance = Config::kSwingDoorToleranceV;
+  ThresholdProfile thresholds;
+  bool harmonics = false;
+  bool offline = false;
+  bool payloads = false;
+  std::string waveformDir;
+  bool quiet = false;
+};
+
+struct StageTimer {
+  const char* label;
+  double seconds = 0.0;
+  uint64_t calls = 0;
+};
+
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(StageTimer& timer) : timer_(timer), start_(Clock::now()) {}
+  ~ScopedTimer() {
+    timer_.seconds += std::chrono::duration<double>(Clock::now() - start_).count();
+    timer_.calls++;
+  }
+
+ private:
+  StageTimer& timer_;
+  Clock::time_point start_;
+};
+
+class FileAdcProvider : public AdcBufferProvider {
+ public:
+  explicit FileAdcProvider(const std::string& path) : path_(path) {}
+  ~FileAdcProvider() override {
+    if (file_ != nullptr) {
+      fclose(file_);
+    }
+  }
+
+  bool begin() override {
+    file_ = fopen(path_.c_str(), "rb");
+    return file_ != nullptr;
+  }
+
+  size_t read(uint16_t* out, size_t maxCount, uint32_t) override {
+    uint8_t bytes[2 * Config::kAdcDmaBufferLen];
+    maxCount = std::min<size_t>(maxCount, Config::kAdcDmaBufferLen);
+    size_t n = file_ != nullptr ? fread(bytes, 2, maxCount, file_) : 0;
+    for (size_t i = 0; i < n; ++i) {
+      out[i] = static_cast<uint16_t>((bytes[2 * i] | (bytes[2 * i + 1] << 8)) & 0x0FFF);
+    }
+    return n;
+  }
+
+  uint32_t sampleRateHz() const override {
+    return Config::kSampleRateHz;
+  }
+
+  uint32_t overrunCount() const override {
+    return 0;
+  }
+
+ private:
+  std::string path_;
+  FILE* file_ = nullptr;
+};
+
+class SyntheticAdcProvider : public AdcBufferProvider {
+ public:
+  SyntheticAdcProvider(double hours, float gain) : total_(static_cast<uint64_t>(hours * 3600.0 * Config::kSampleRateHz)) {
+    // Raw RMS that the sampler turns into 230 V with the configured gain.
+    amplitude_ = 230.0 * sqrt(2.0) / gain;
+    const uint32_t period = Config::kSampleRateHz / 50;
+    for (uint32_t i = 0; i < period; ++i) {
+      sine_.push_back(sin(2.0 * M_PI * i / period));
+    }
+  }
+
+  bool begin() override {
+    return amplitude_ < 2047.0;
+  }
+
+  size_t read(uint16_t* out, size_t maxCount, uint32_t) override {
+    size_t n = 0;
+    while (n < maxCount && produced_ < total_) {
+      const uint64_t cycleSamples = Config::kSampleRateHz * 600ULL;
+      const uint64_t phase = produced_ % cycleSamples;
+      const bool sag = phase < Config::kSampleRateHz * 3ULL && produced_ > cycleSamples / 2;
+      const bool dip = phase >= cycleSamples / 2 && phase < cycleSamples / 2 + Config::kSampleRateHz * 60ULL / 1000;
+      const double scale = sag ? 0.85 : (dip ? 0.7 : 1.0);
+      out[n++] = static_cast<uint16_t>(2048.0 + amplitude_ * scale * sine_[produced_ % sine_.size()]);
+      produced_++;
+    }
+    return n;
+  }
+
+  uint32_t sampleRateHz() const override {
+    return Config::kSampleRateHz;
+  }
+
+  uint32_t overrunCount() const override {
+    return 0;
+  }
+
+ private:
+  uint64_t total_;
+  uint64_t produced_ = 0;
+  double amplitude_;
+  std::vector<double> sine_;
+};
+
+// Advances the virtual clock by the capture time of every sample read, so millis() matches the
+// newest sample like on the device.
+class CaptureClockProvider : public AdcBufferProvider {
+ public:
+  explicit CaptureClockProvider(AdcBufferProvider& source) : source_(source) {}
+
+  bool begin() override {
+    return source_.begin();
+  }
+
+  size_t read(uint16_t* out, size_t maxCount, uint32_t timeoutMs) override {
+    size_t n = source_.read(out, maxCount, timeoutMs);
+    captured_ += n;
+    const uint64_t capturedMs = captured_ * 1000 / source_.sampleRateHz();
+    NativeHost::advanceClockMs(static_cast<uint32_t>(capturedMs - advancedMs_));
+    advancedMs_ = capturedMs;
+    return n;
+  }
+
+  uint32_t sampleRateHz() const override {
+    return source_.sampleRateHz();
+  }
+
+  uint32_t overrunCount() const override {
+    return source_.overrunCount();
+  }
+
+ private:
+  AdcBufferProvider& source_;
+  uint64_t captured_ = 0;
+  uint64_t advancedMs_ = 0;
+};
+
+// Same as AcquisitionTask::captureStartedEvent(); the capture clock stands at the newest sample.
+void captureStartedEvent(EventDetector& detector, WaveformRecorder& waveforms) {
+  VoltageEvent started;
+  if (detector.pollStartedEvent(started)) {
+    waveforms.trigger(started.type, started.start_ts, kReplayEpochMs + millis());
+  }
+}
+
+// Same wiring as AcquisitionTask: half-cycle RMS goes to the detector's fast path.
+class HalfCycleFeed : public HalfCycleListener {
+ public:
+  HalfCycleFeed(EventDetector& detector, WaveformRecorder& waveforms) : detector_(detector), waveforms_(waveforms) {}
+
+  void onHalfCycleRms(float vrms, uint32_t ageMs) override {
+    detector_.addHalfCycle(vrms, kReplayEpochMs + millis() - ageMs);
+    captureStartedEvent(detector_, waveforms_);
+  }
+
+ private:
+  EventDetector& detector_;
+  WaveformRecorder& waveforms_;
+};
+
+// Reads "vrms" or "ts_ms,vrms[,flags]" lines; blank lines and lines starting with '#' are skipped.
+class VrmsCsvReader {
+ public:
+  explicit VrmsCsvReader(const std::string& path) : file_(fopen(path.c_str(), "r")) {}
+  ~VrmsCsvReader() {
+    if (file_ != nullptr) {
+      fclose(file_);
+    }
+  }
+
+  bool ok() const {
+    return file_ != nullptr;
+  }
+
+  bool next(VoltageSample& sample, uint64_t defaultTs) {
+    char line[128];
+    while (file_ != nullptr && fgets(line, sizeof(line), file_) != nullptr) {
+      if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') {
+        continue;
+      }
+      double a = 0.0;
+      double b = 0.0;
+      unsigned int flags = 0;
+      int fields = sscanf(line, "%lf,%lf,%u", &a, &b, &flags);
+      if (fields <= 0) {
+        continue;
+      }
+      sample = {};
+      sample.ts_ms = fields >= 2 ? static_cast<uint64_t>(a) : defaultTs;
+      sample.vrms = static_cast<float>(fields >= 2 ? b : a);
+      sample.vmin = sample.vrms;
+      sample.vmax = sample.vrms;
+      sample.sample_count = Config::kWindowSamples;
+      sample.flags = static_cast<uint16_t>(flags);
+      if (sample.vrms < Config::kNoSignalVrms) {
+        sample.flags |= FLAG_NO_SIGNAL;
+        sample.vrms = 0.0f;
+      }
+      return true;
+    }
+    return false;
+  }
+
+ private:
+  FILE* file_;
+};
+
+Options gOptions;
+uint32_t gPayloads = 0;
+uint64_t gPayloadBytes = 0;
+uint32_t gWaveforms = 0;
+
+void printPayload(const NativeHost::HttpStub& stub) {
+  gPayloads++;
+  gPayloadBytes += stub.lastBody.size();
+  printf("[PAYLOAD] %s %s%s%s %u bytes\n",
+         stub.lastUrl.c_str(),
+         stub.lastContentType.c_str(),
+         stub.lastContentEncoding.empty() ? "" : " +",
+         stub.lastContentEncoding.c_str(),
+         static_cast<unsigned int>(stub.lastBody.size()));
+  if (gOptions.payloads && stub.lastContentEncoding.empty() && stub.lastContentType == "application/json") {
+    printf("%s\n", stub.lastBody.c_str());
+  }
+  if (!gOptions.waveformDir.empty() && stub.lastUrl.find("/waveform") != std::string::npos) {
+    const std::string path = gOptions.waveformDir + "/waveform_" + std::to_string(gWaveforms++) + ".bin";
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file != nullptr) {
+      fwrite(stub.lastBody.data(), 1, stub.lastBody.size(), file);
+      fclose(file);
+    }
+  }
+}
+
+bool parseArgs(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--adc" && hasValue) {
+      options.adcPath = argv[++i];
+    } else if (arg == "--vrms" && hasValue) {
+      options.vrmsPath = argv[++i];
+    } else if (arg == "--synthetic" && hasValue) {
+      options.syntheticHours = atof(argv[++i]);
+    } else if (arg == "--gain" && hasValue) {
+      options.gain = static_cast<float>(atof(argv[++i]));
+    } else if (arg == "--offset" && hasValue) {
+      options.offset = static_cast<float>(atof(argv[++i]));
+    } else if (arg == "--format" && hasValue) {
+      options.format = std::string(argv[++i]) == "bin" ? UploadFormat::Binary : UploadFormat::Json;
+    } else if (arg == "--gzip") {
+      options.gzip = true;
+    } else if (arg == "--reduce" && hasValue) {
+      if (!SampleReductionFromString(argv[++i], options.reduction)) {
+        return false;
+      }
+    } else if (arg == "--swing-tol" && hasValue) {
+      options.swingTolerance = static_cast<float>(atof(argv[++i]));
+    } else if (arg == "--thresholds" && hasValue) {
+      if (!options.thresholds.parse(argv[++i])) {
+        return false;
+      }
+    } else if (arg == "--harmonics") {
+      options.harmonics = true;
+    } else if (arg == "--offline") {
+      options.offline = true;
+    } else if (arg == "--payloads") {
+      options.payloads = true;
+    } else if (arg == "--waveforms" && hasValue) {
+      options.waveformDir = argv[++i];
+    } else if (arg == "--quiet") {
+      options.quiet = true;
+    } else {
+      return false;
+    }
+  }
+  int inputs = !options.adcPath.empty() + !options.vrmsPath.empty() + (options.syntheticHours > 0.0);
+  return inputs == 1;
+}
+
+void printTimer(const StageTimer& timer, uint64_t windows) {
+  printf("  %-10s %9.3f s  %8.2f us/window  (%llu calls)\n",
+         timer.label,
+         timer.seconds,
+         windows > 0 ? timer.seconds * 1e6 / windows : 0.0,
+         static_cast<unsigned long long>(timer.calls));
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  if (!parseArgs(argc, argv, gOptions)) {
+    fprintf(stderr,
+            "usage: %s (--adc FILE | --vrms FILE | --synthetic HOURS) [--gain G] [--offset O]\n"
+            "          [--format json|bin] [--gzip] [--reduce MODE] [--swing-tol V] [--thresholds PAIRS]\n"
+            "          [--harmonics] [--offline] [--payloads] [--waveforms DIR] [--quiet]\n",
+            argv[0]);
+    return 2;
+  }
+
+  NativeHost::useVirtualClock(0);
+  NativeHost::setSerialQuiet(gOptions.quiet);
+  if (!NativeHost::resetFilesystem()) {
+    fprintf(stderr, "cannot create %s\n", Config::kFsBasePath);
+    return 1;
+  }
+  NativeHost::http().keepBodies = true;
+  NativeHost::http().onRequest = printPayload;
+
+  static EventDetector detector;
+  static WaveformRecorder waveforms;
+  static BatchUploader uploader;
+  uploader.begin("http://replay", "replay", "");
+  uploader.setUploadFormat(gOptions.format);
+  uploader.setCompression(gOptions.gzip);
+  uploader.setReduction(gOptions.reduction, gOptions.swingTolerance);
+  detector.setProfile(gOptions.thresholds);
+  const DetectionThresholds nominal = gOptions.thresholds.thresholds(gOptions.thresholds.nominalV);
+  uploader.setDisturbanceBand(nominal.sagStart, nominal.swellStart);
+
+  FileAdcProvider fileProvider(gOptions.adcPath);
+  SyntheticAdcProvider syntheticProvider(gOptions.syntheticHours, gOptions.gain);
+  CaptureClockProvider provider(gOptions.syntheticHours > 0.0 ? static_cast<AdcBufferProvider&>(syntheticProvider)
+                                                               : fileProvider);
+  VoltageSampler sampler(provider);
+  HalfCycleFeed halfCycleFeed(detector, waveforms);
+  sampler.setCalibration(gOptions.gain, gOptions.offset, true);
+  sampler.setHalfCycleListener(&halfCycleFeed);
+  sampler.setWaveformRecorder(&waveforms);
+  sampler.setHarmonics(gOptions.harmonics);
+  VrmsCsvReader csv(gOptions.vrmsPath);
+  const bool rawInput = gOptions.vrmsPath.empty();
+  if (rawInput ? !sampler.begin() : !csv.ok()) {
+    fprintf(stderr, "cannot open input\n");
+    return 1;
+  }
+
+  StageTimer samplerTimer{"sampler"};
+  StageTimer detectorTimer{"detector"};
+  StageTimer queueTimer{"enqueue"};
+  StageTimer uploadTimer{"upload"};
+  uint64_t windows = 0;
+  uint32_t events = 0;
+  const auto wallStart = Clock::now();
+
+  for (;;) {
+    VoltageSample sample;
+    const uint64_t virtualTs = kReplayEpochMs + millis() + Config::kWindowMs;
+    {
+      ScopedTimer timer(samplerTimer);
+      bool ok = rawInput ? sampler.update(sample) : csv.next(sample, virtualTs);
+      if (!ok) {
+        break;
+      }
+    }
+    if (rawInput) {
+      sample.ts_ms = kReplayEpochMs + millis();
+    } else {
+      NativeHost::advanceClockMs(Config::kWindowMs);
+    }
+    if (gOptions.offline) {
+      sample.flags |= FLAG_WIFI_DOWN;
+    }
+    windows++;
+
+    // Same routing as AcquisitionTask::run() and loop().
+    const bool saturated = (sample.flags & FLAG_ADC_SATURATED) != 0;
+    VoltageEvent event;
+    bool haveEvent = false;
+    if (!saturated) {
+      ScopedTimer timer(detectorTimer);
+      detector.addSample(sample);
+      if (rawInput) {
+        captureStartedEvent(detector, waveforms);
+      }
+      haveEvent = detector.pollCompletedEvent(event);
+    }
+    while (haveEvent) {
+      events++;
+      printf("[EVENT] %s start=%llu end=%llu min=%.2f max=%.2f samples=%u\n",
+             EventTypeToString(event.type),
+             static_cast<unsigned long long>(event.start_ts),
+             static_cast<unsigned long long>(event.end_ts),
+             event.min_vrms,
+             event.max_vrms,
+             static_cast<unsigned int>(event.sample_count));
+      ScopedTimer timer(queueTimer);
+      uploader.addEvent(event, detector.history());
+      haveEvent = detector.pollCompletedEvent(event);
+    }
+    const WaveformRecorder::Capture* capture = nullptr;
+    while (waveforms.popCapture(capture)) {
+      printf("[WAVE] %s start=%llu first=%llu samples=%u\n",
+             EventTypeToString(capture->type),
+             static_cast<unsigned long long>(capture->event_start_ts),
+             static_cast<unsigned long long>(capture->first_sample_ts),
+             static_cast<unsigned int>(capture->count));
+      {
+        ScopedTimer timer(queueTimer);
+        uploader.addWaveform(*capture, gOptions.gain);
+      }
+      waveforms.release(capture);
+    }
+    if (!saturated) {
+      ScopedTimer timer(queueTimer);
+      uploader.addSample(sample);
+    }
+    ScopedTimer timer(uploadTimer);
+    uploader.update(!gOptions.offline, Config::kWindowMs);
+  }
+
+  const double wallSeconds = std::chrono::duration<double>(Clock::now() - wallStart).count();
+  const double gridSeconds = millis() / 1000.0;
+  printf("\n[REPLAY] %llu windows (%.2f h of grid data) in %.3f s, %.0fx real time\n",
+         static_cast<unsigned long long>(windows),
+         gridSeconds / 3600.0,
+         wallSeconds,
+         wallSeconds > 0.0 ? gridSeconds / wallSeconds : 0.0);
+  printf("[REPLAY] events=%u shortened=%u dropped=%u truncated=%u waveform drops=%u payloads=%u (%llu bytes)\n",
+         static_cast<unsigned int>(events),
+         static_cast<unsigned int>(detector.shortenedEvents()),
+         static_cast<unsigned int>(detector.droppedEvents()),
+         static_cast<unsigned int>(detector.truncatedEvents()),
+         static_cast<unsigned int>(waveforms.droppedCaptures()),
+         static_cast<unsigned int>(gPayloads),
+         static_cast<unsigned long long>(gPayloadBytes));
+  printf("[REPLAY] stage timing:\n");
+  printTimer(samplerTimer, windows);
+  printTimer(detectorTimer, windows);
+  printTimer(queueTimer, windows);
+  printTimer(uploadTimer, windows);
+  return 0;
+}
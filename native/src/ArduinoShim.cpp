@@ -0,0 +1,190 @@
+#include <Arduino.h>
+
+#include "NativeHost.h"
+
+#include <stdarg.h>
+
+#include <chrono>
+#include <thread>
+
+HostSerial Serial;
+EspClass ESP;
+
+namespace {
+bool gVirtualClock = false;
+uint64_t gVirtualMs = 0;
+uint64_t gVirtualUs = 0;
+bool gSerialQuiet = false;
+int gAnalogValue = 0;
+
+uint64_t steadyMicros() {
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+} // namespace
+
+unsigned long millis() {
+  if (gVirtualClock) {
+    return static_cast<unsigned long>(gVirtualMs);
+  }
+  return static_cast<unsigned long>(steadyMicros() / 1000);
+}
+
+unsigned long micros() {
+  if (gVirtualClock) {
+    return static_cast<unsigned long>(gVirtualUs);
+  }
+  return static_cast<unsigned long>(steadyMicros());
+}
+
+void delay(uint32_t ms) {
+  if (gVirtualClock) {
+    NativeHost::advanceClockMs(ms);
+    return;
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+int analogRead(uint8_t) {
+  return gAnalogValue;
+}
+
+uint32_t getCpuFrequencyMhz() {
+  return 240;
+}
+
+uint32_t EspClass::getCycleCount() {
+  return static_cast<uint32_t>(steadyMicros() * getCpuFrequencyMhz());
+}
+
+namespace NativeHost {
+void useVirtualClock(uint64_t startMs) {
+  gVirtualClock = true;
+  gVirtualMs = startMs;
+  gVirtualUs = startMs * 1000;
+}
+
+void advanceClockMs(uint32_t ms) {
+  gVirtualMs += ms;
+  gVirtualUs += static_cast<uint64_t>(ms) * 1000;
+}
+
+bool virtualClock() {
+  return gVirtualClock;
+}
+
+void setSerialQuiet(bool quiet) {
+  gSerialQuiet = quiet;
+}
+
+void setAnalogValue(int value) {
+  gAnalogValue = value;
+}
+} // namespace NativeHost
+
+String::String(float value, unsigned int decimals) : String(static_cast<double>(value), decimals) {}
+
+String::String(double value, unsigned int decimals) {
+  char buf[48];
+  snprintf(buf, sizeof(buf), "%.*f", static_cast<int>(decimals), value);
+  value_ = buf;
+}
+
+bool String::equalsIgnoreCase(const String& other) const {
+  return value_.size() == other.value_.size() && strcasecmp(value_.c_str(), other.value_.c_str()) == 0;
+}
+
+bool String::startsWith(const String& prefix) const {
+  return value_.compare(0, prefix.value_.size(), prefix.value_) == 0;
+}
+
+bool String::endsWith(const String& suffix) const {
+  return value_.size() >= suffix.value_.size() &&
+         value_.compare(value_.size() - suffix.value_.size(), suffix.value_.size(), suffix.value_) == 0;
+}
+
+int String::indexOf(char c, unsigned int from) const {
+  size_t pos = value_.find(c, from);
+  return pos == std::string::npos ? -1 : static_cast<int>(pos);
+}
+
+String String::substring(unsigned int from) const {
+  return from < value_.size() ? String(value_.substr(from)) : String();
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+  if (from > to) {
+    std::swap(from, to);
+  }
+  return from < value_.size() ? String(value_.substr(from, to - from)) : String();
+}
+
+void String::trim() {
+  const char* spaces = " \t\r\n";
+  size_t first = value_.find_first_not_of(spaces);
+  if (first == std::string::npos) {
+    value_.clear();
+    return;
+  }
+  value_ = value_.substr(first, value_.find_last_not_of(spaces) - first + 1);
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+  size_t written = 0;
+  while (written < size && write(buffer[written]) == 1) {
+    written++;
+  }
+  return written;
+}
+
+size_t Print::print(const char* text) {
+  return write(reinterpret_cast<const uint8_t*>(text), strlen(text));
+}
+
+size_t Print::println(const char* text) {
+  return print(text) + print("\n");
+}
+
+size_t Print::printf(const char* format, ...) {
+  char buf[256];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  if (len < 0) {
+    return 0;
+  }
+  return write(reinterpret_cast<const uint8_t*>(buf), std::min<size_t>(len, sizeof(buf) - 1));
+}
+
+size_t Stream::readBytes(char* buffer, size_t length) {
+  size_t count = 0;
+  while (count < length) {
+    int c = read();
+    if (c < 0) {
+      break;
+    }
+    buffer[count++] = static_cast<char>(c);
+  }
+  return count;
+}
+
+String Stream::readStringUntil(char terminator) {
+  String result;
+  int c;
+  while ((c = read()) >= 0 && c != terminator) {
+    result += static_cast<char>(c);
+  }
+  return result;
+}
+
+size_t HostSerial::write(uint8_t value) {
+  return write(&value, 1);
+}
+
+size_t HostSerial::write(const uint8_t* buffer, size_t size) {
+  if (!gSerialQuiet) {
+    fwrite(buffer, 1, size, stdout);
+  }
+  return size;
+}
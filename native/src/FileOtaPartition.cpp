@@ -0,0 +1,92 @@
+#include "FileOtaPartition.h"
+
+#include <algorithm>
+
+FileOtaPartition::FileOtaPartition(const char* path, size_t capacity, const char* runningVersion)
+    : path_(path), capacity_(capacity), runningVersion_(runningVersion) {}
+
+FileOtaPartition::~FileOtaPartition() {
+  abort();
+}
+
+size_t FileOtaPartition::capacity() const {
+  return capacity_;
+}
+
+bool FileOtaPartition::beginImage(size_t imageSize, const char* version) {
+  abort();
+  if (imageSize > capacity_) {
+    return false;
+  }
+  file_ = fopen(path_.c_str(), "wb");
+  imageSize_ = imageSize;
+  written_ = 0;
+  imageVersion_ = version;
+  return file_ != nullptr;
+}
+
+bool FileOtaPartition::write(const uint8_t* data, size_t length) {
+  if (file_ == nullptr || written_ + length > imageSize_ || fwrite(data, 1, length, file_) != length) {
+    return false;
+  }
+  written_ += length;
+  largestWrite_ = std::max(largestWrite_, length);
+  return true;
+}
+
+bool FileOtaPartition::activate() {
+  if (file_ == nullptr || written_ != imageSize_) {
+    return false;
+  }
+  fclose(file_);
+  file_ = nullptr;
+  activated_ = true;
+  return true;
+}
+
+void FileOtaPartition::abort() {
+  if (file_ != nullptr) {
+    fclose(file_);
+    file_ = nullptr;
+    remove(path_.c_str());
+  }
+}
+
+bool FileOtaPartition::pendingValidation() const {
+  return pending_;
+}
+
+void FileOtaPartition::markValid() {
+  pending_ = false;
+}
+
+void FileOtaPartition::rollback() {
+  rejected_.push_back(runningVersion_);
+  pending_ = false;
+  runningVersion_ = previousVersion_;
+}
+
+bool FileOtaPartition::rejected(const char* version) const {
+  return std::find(rejected_.begin(), rejected_.end(), version) != rejected_.end();
+}
+
+void FileOtaPartition::boot() {
+  if (activated_) {
+    previousVersion_ = runningVersion_;
+    runningVersion_ = imageVersion_;
+    pending_ = true;
+    activated_ = false;
+  }
+}
+
+const std::string& FileOtaPartition::runningVersion() const {
+  return runningVersion_;
+}
+
+const std::string& FileOtaPartition::path() const {
+  return path_;
+}
+
+size_t FileOtaPartition::largestWrite() const {
+  return largestWrite_;
+}
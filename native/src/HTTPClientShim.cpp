@@ -0,0 +1,121 @@
+#include <HTTPClient.h>
+
+#include "NativeHost.h"
+
+#include <strings.h>
+
+namespace NativeHost {
+HttpStub& http() {
+  static HttpStub stub;
+  return stub;
+}
+} // namespace NativeHost
+
+bool HTTPClient::begin(WiFiClient& client, const String& url) {
+  client_ = &client;
+  url_ = url.c_str();
+  headers_.clear();
+  return true;
+}
+
+void HTTPClient::addHeader(const String& name, const String& value) {
+  headers_.emplace_back(name.c_str(), value.c_str());
+}
+
+int HTTPClient::sendRequest(const char*, Stream* stream, size_t size) {
+  std::string body;
+  body.reserve(size);
+  char chunk[512];
+  while (body.size() < size) {
+    size_t n = stream->readBytes(chunk, std::min(sizeof(chunk), size - body.size()));
+    if (n == 0) {
+      return HTTPC_ERROR_SEND_PAYLOAD_FAILED;
+    }
+    body.append(chunk, n);
+  }
+  return respond(body);
+}
+
+int HTTPClient::sendRequest(const char*, const uint8_t* payload, size_t size) {
+  return respond(std::string(reinterpret_cast<const char*>(payload), size));
+}
+
+int HTTPClient::GET() {
+  range_.reset(std::string());
+  const int httpCode = respond(std::string());
+  const NativeHost::HttpStub& stub = NativeHost::http();
+  if (httpCode == 200 && !stub.responseEtag.empty() && stub.lastIfNoneMatch == stub.responseEtag) {
+    return 304;
+  }
+  unsigned long first = 0;
+  unsigned long last = 0;
+  if (httpCode == 200 && sscanf(stub.lastRange.c_str(), "bytes=%lu-%lu", &first, &last) == 2) {
+    if (first >= stub.responseBody.size() || last < first) {
+      return 416;
+    }
+    range_.reset(stub.responseBody.substr(first, last - first + 1));
+    return 206;
+  }
+  return httpCode;
+}
+
+String HTTPClient::getString() {
+  return String(NativeHost::http().responseBody);
+}
+
+void HTTPClient::collectHeaders(const char*[], size_t) {}
+
+String HTTPClient::header(const char* name) {
+  return strcasecmp(name, "ETag") == 0 ? String(NativeHost::http().responseEtag) : String();
+}
+
+int HTTPClient::getSize() {
+  return range_.empty() ? -1 : static_cast<int>(range_.size());
+}
+
+Stream* HTTPClient::getStreamPtr() {
+  return range_.empty() ? nullptr : &range_;
+}
+
+void HTTPClient::end() {
+  if (!reuse_ && client_ != nullptr) {
+    client_->stop();
+  }
+}
+
+int HTTPClient::respond(const std::string& body) {
+  NativeHost::HttpStub& stub = NativeHost::http();
+  stub.requests++;
+  stub.bodyBytes += body.size();
+  stub.lastUrl = url_;
+  stub.lastContentType.clear();
+  stub.lastContentEncoding.clear();
+  stub.lastIfNoneMatch.clear();
+  stub.lastRange.clear();
+  for (const auto& header : headers_) {
+    if (header.first == "Content-Type") {
+      stub.lastContentType = header.second;
+    } else if (header.first == "Content-Encoding") {
+      stub.lastContentEncoding = header.second;
+    } else if (header.first == "If-None-Match") {
+      stub.lastIfNoneMatch = header.second;
+    } else if (header.first == "Range") {
+      stub.lastRange = header.second;
+    }
+  }
+  if (stub.keepBodies) {
+    stub.lastBody = body;
+  }
+  if (client_ != nullptr) {
+    client_->connected_ = stub.statusCode > 0;
+  }
+  if (stub.onRequest != nullptr) {
+    stub.onRequest(stub);
+  }
+  return stub.statusCode;
+}
+
+void HTTPClient::RangeStream::reset(std::string body) {
+  body_ = std::move(body);
+  pos_ = 0;
+}
@@ -0,0 +1,116 @@
+#include <LittleFS.h>
+
+#include "Config.h"
+#include "NativeHost.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+fs::LittleFSFS LittleFS;
+
+namespace {
+std::string hostPath(const char* path) {
+  return std::string(Config::kFsBasePath) + path;
+}
+} // namespace
+
+File& File::operator=(File&& other) noexcept {
+  if (this != &other) {
+    close();
+    file_ = other.file_;
+    other.file_ = nullptr;
+  }
+  return *this;
+}
+
+File::~File() {
+  close();
+}
+
+int File::available() {
+  if (file_ == nullptr) {
+    return 0;
+  }
+  long pos = ftell(file_);
+  return static_cast<int>(static_cast<long>(size()) - pos);
+}
+
+int File::read() {
+  return file_ != nullptr ? fgetc(file_) : -1;
+}
+
+int File::peek() {
+  if (file_ == nullptr) {
+    return -1;
+  }
+  int c = fgetc(file_);
+  if (c >= 0) {
+    ungetc(c, file_);
+  }
+  return c;
+}
+
+size_t File::write(uint8_t value) {
+  return write(&value, 1);
+}
+
+size_t File::write(const uint8_t* buffer, size_t size) {
+  return file_ != nullptr ? fwrite(buffer, 1, size, file_) : 0;
+}
+
+size_t File::size() const {
+  struct stat st;
+  if (file_ == nullptr || fstat(fileno(file_), &st) != 0) {
+    return 0;
+  }
+  return static_cast<size_t>(st.st_size);
+}
+
+void File::close() {
+  if (file_ != nullptr) {
+    fclose(file_);
+    file_ = nullptr;
+  }
+}
+
+namespace fs {
+bool LittleFSFS::begin(bool) {
+  ::mkdir(Config::kFsBasePath, 0755);
+  struct stat st;
+  return stat(Config::kFsBasePath, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool LittleFSFS::exists(const char* path) {
+  struct stat st;
+  return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+File LittleFSFS::open(const char* path, const char* mode) {
+  std::string fullMode = std::string(mode) + "b";
+  return File(fopen(hostPath(path).c_str(), fullMode.c_str()));
+}
+
+bool LittleFSFS::remove(const char* path) {
+  return ::remove(hostPath(path).c_str()) == 0;
+}
+
+bool LittleFSFS::rename(const char* from, const char* to) {
+  return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+bool LittleFSFS::mkdir(const char* path) {
+  return ::mkdir(hostPath(path).c_str(), 0755) == 0;
+}
+} // namespace fs
+
+namespace NativeHost {
+bool resetFilesystem() {
+  std::string command = std::string("rm -rf '") + Config::kFsBasePath + "'";
+  if (system(command.c_str()) != 0) {
+    return false;
+  }
+  return LittleFS.begin(true);
+}
+} // namespace NativeHost
@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+"""Reference decoder for the binary samples batch format (see include/SampleBatchCodec.h).
+
+Usage: decode_samples_bin.py <payload.bin> [--stats]
+
+Prints the batch as the equivalent JSON payload accepted by /ingest/voltage/samples.
+With --stats, prints the binary size against the size of that JSON instead.
+"""
+
+import json
+import struct
+import sys
+
+MAGIC = b"CCRS"
+SUPPORTED_VERSION = 1
+SECTION_HARMONICS = 0x01
+SECTION_SUMMARY = 0x02
+SECTION_CHANNELS = 0x04
+SECTION_POWER = 0x08
+CHANNEL_KINDS = {0: "voltage", 1: "current"}
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def take(self, n):
+        if self.pos + n > len(self.data):
+            raise ValueError("truncated payload")
+        chunk = self.data[self.pos:self.pos + n]
+        self.pos += n
+        return chunk
+
+    def u8(self):
+        return self.take(1)[0]
+
+    def le(self, fmt):
+        return struct.unpack("<" + fmt, self.take(struct.calcsize(fmt)))[0]
+
+    def varint(self):
+        result = 0
+        shift = 0
+        while True:
+            byte = self.u8()
+            result |= (byte & 0x7F) << shift
+            if byte < 0x80:
+                return result
+            shift += 7
+
+    def svarint(self):
+        value = self.varint()
+        return (value >> 1) ^ -(value & 1)
+
+    def string(self):
+        return self.take(self.u8()).decode("utf-8")
+
+
+def read_deltas(r, count):
+    values = []
+    previous = 0
+    for _ in range(count):
+        previous += r.svarint()
+        values.append(previous)
+    return values
+
+
+def read_flag_runs(r, count):
+    flags = []
+    while len(flags) < count:
+        run = r.varint()
+        value = r.varint()
+        flags.extend([value] * run)
+    if len(flags) != count:
+        raise ValueError("flag runs do not match point count")
+    return flags
+
+
+def decode(data):
+    r = Reader(data)
+    if r.take(4) != MAGIC:
+        raise ValueError("bad magic")
+    version = r.u8()
+    if version != SUPPORTED_VERSION:
+        raise ValueError(f"unsupported version {version}")
+    sections = r.u8()
+    if sections & ~(SECTION_HARMONICS | SECTION_SUMMARY | SECTION_CHANNELS | SECTION_POWER):
+        raise ValueError(f"unknown sections 0x{sections:02x}")
+    period = r.le("H")
+    count = r.le("I")
+    first_ts = r.le("Q")
+    device_id = r.string()
+    fw_version = r.string()
+
+    ts = [first_ts] if count else []
+    for _ in range(count - 1):
+        ts.append(ts[-1] + period + r.svarint())
+
+    vrms_mv = read_deltas(r, count)
+    flags = read_flag_runs(r, count)
+
+    harmonics = None
+    if sections & SECTION_HARMONICS:
+        harmonics = []
+        previous = [0, 0, 0, 0]
+        for _ in range(count):
+            if r.u8() == 0:
+                harmonics.append(None)
+                continue
+            previous = [p + r.svarint() for p in previous]
+            harmonics.append([round(v / 100.0, 2) for v in previous])
+
+    summary = None
+    if sections & SECTION_SUMMARY:
+        summary = []
+        for mv in vrms_mv:
+            summary.append([round((mv + r.svarint()) / 1000.0, 3) for _ in range(3)])
+
+    channels = None
+    if sections & SECTION_CHANNELS:
+        kinds = [r.u8() for _ in range(r.u8())]
+        channels = []
+        for index, kind in enumerate(kinds, start=1):
+            values = read_deltas(r, count)
+            channels.append({
+                "channel": index,
+                "kind": CHANNEL_KINDS.get(kind, str(kind)),
+                "rms": [round(v / 1000.0, 3) for v in values],
+                "flags": read_flag_runs(r, count),
+            })
+    if sections & SECTION_POWER:
+        if channels is None:
+            raise ValueError("power section without channels")
+        for channel in channels:
+            if channel["kind"] != "current":
+                continue
+            for key in ("p", "q", "s"):
+                channel[key] = [round(v / 10.0, 1) for v in read_deltas(r, count)]
+            channel["energy_wh"] = [float(r.varint()), float(r.varint())]
+    if r.pos != len(data):
+        raise ValueError("trailing bytes after payload")
+
+    batch = {
+        "device_id": device_id,
+        "fw_version": fw_version,
+        "sample_period_ms": period,
+        "samples": [[t, round(mv / 1000.0, 3), f] for t, mv, f in zip(ts, vrms_mv, flags)],
+    }
+    if harmonics is not None:
+        batch["harmonics"] = harmonics
+    if summary is not None:
+        batch["summary"] = summary
+    if channels is not None:
+        batch["channels"] = channels
+    return batch
+
+
+def main(argv):
+    if len(argv) < 2:
+        print(__doc__.strip(), file=sys.stderr)
+        return 2
+    with open(argv[1], "rb") as f:
+        data = f.read()
+    batch = decode(data)
+    text = json.dumps(batch, separators=(",", ":"))
+    if "--stats" in argv[2:]:
+        points = len(batch["samples"])
+        print(f"points={points} binary={len(data)}B json={len(text)}B "
+              f"ratio={len(text) / max(len(data), 1):.1f}x "
+              f"bytes/point={len(data) / max(points, 1):.2f}")
+    else:
+        print(text)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""Reference decoder for the binary event waveform format (see include/WaveformCodec.h).
+
+Usage: decode_waveform_bin.py <payload.bin> [--stats]
+
+Prints the capture as JSON: header fields, the raw ADC counts and the instantaneous voltage
+(counts around their mean, times volts_per_count). With --stats, prints a one-line summary
+with the encoded size per sample and the RMS of the pre-trigger and post-trigger parts.
+"""
+
+import json
+import math
+import struct
+import sys
+
+MAGIC = b"CCRW"
+SUPPORTED_VERSION = 1
+EVENT_TYPES = {0: "SAG", 1: "SWELL", 2: "CRITICAL"}
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def take(self, n):
+        if self.pos + n > len(self.data):
+            raise ValueError("truncated payload")
+        chunk = self.data[self.pos:self.pos + n]
+        self.pos += n
+        return chunk
+
+    def u8(self):
+        return self.take(1)[0]
+
+    def le(self, fmt):
+        return struct.unpack("<" + fmt, self.take(struct.calcsize(fmt)))[0]
+
+    def varint(self):
+        result = 0
+        shift = 0
+        while True:
+            byte = self.u8()
+            result |= (byte & 0x7F) << shift
+            if byte < 0x80:
+                return result
+            shift += 7
+
+    def svarint(self):
+        value = self.varint()
+        return (value >> 1) ^ -(value & 1)
+
+    def string(self):
+        return self.take(self.u8()).decode("utf-8")
+
+
+def decode(data):
+    r = Reader(data)
+    if r.take(4) != MAGIC:
+        raise ValueError("bad magic")
+    version = r.u8()
+    if version != SUPPORTED_VERSION:
+        raise ValueError(f"unsupported version {version}")
+    event_type = r.u8()
+    rate = r.le("H")
+    count = r.le("I")
+    trigger_index = r.le("I")
+    event_start_ts = r.le("Q")
+    first_sample_ts = r.le("Q")
+    volts_per_count = r.le("f")
+    device_id = r.string()
+    fw_version = r.string()
+
+    raw = [r.le("H")] if count else []
+    for _ in range(count - 1):
+        raw.append(raw[-1] + r.svarint())
+    if r.pos != len(data):
+        raise ValueError("trailing bytes after payload")
+
+    mean = sum(raw) / len(raw) if raw else 0.0
+    return {
+        "device_id": device_id,
+        "fw_version": fw_version,
+        "type": EVENT_TYPES.get(event_type, "UNKNOWN"),
+        "event_start_ts": event_start_ts,
+        "first_sample_ts": first_sample_ts,
+        "sample_rate_hz": rate,
+        "trigger_index": trigger_index,
+        "volts_per_count": volts_per_count,
+        "raw": raw,
+        "volts": [round((v - mean) * volts_per_count, 3) for v in raw],
+    }
+
+
+def rms(values):
+    return math.sqrt(sum(v * v for v in values) / len(values)) if values else 0.0
+
+
+def main(argv):
+    if len(argv) < 2:
+        print(__doc__.strip(), file=sys.stderr)
+        return 2
+    with open(argv[1], "rb") as f:
+        data = f.read()
+    capture = decode(data)
+    if "--stats" in argv[2:]:
+        volts = capture["volts"]
+        split = capture["trigger_index"] + 1
+        print(f"{capture['type']} start={capture['event_start_ts']} first={capture['first_sample_ts']} "
+              f"samples={len(volts)} trigger={capture['trigger_index']} binary={len(data)}B "
+              f"bytes/sample={len(data) / max(len(volts), 1):.2f} "
+              f"rms_pre={rms(volts[:split]):.2f} rms_post={rms(volts[split:]):.2f}")
+    else:
+        print(json.dumps(capture, separators=(",", ":")))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,221 @@
+#include "AcquisitionTask.h"
+
+AcquisitionTask::AcquisitionTask(AdcChannelDemux& adc,
+                                 VoltageSampler& sampler,
+                                 EventDetector& detector,
+                                 WaveformRecorder& waveforms,
+                                 TimeSync& timeSync,
+                                 Metrics& metrics)
+    : adc_(adc),
+      sampler_(sampler),
+      detector_(detector),
+      waveforms_(waveforms),
+      timeSync_(timeSync),
+      metrics_(metrics) {}
+
+void AcquisitionTask::addChannel(ChannelKind kind, VoltageSampler& sampler, EventDetector* detector, PowerMeter* meter) {
+  if (secondaryCount_ == Config::kMaxAdcChannels - 1) {
+    return;
+  }
+  SecondaryChannel& channel = secondaries_[secondaryCount_++];
+  channel.task = this;
+  channel.kind = kind;
+  channel.sampler = &sampler;
+  channel.detector = detector;
+  channel.meter = meter;
+  channel.index = static_cast<uint8_t>(secondaryCount_);
+}
+
+bool AcquisitionTask::begin() {
+  sampler_.setHalfCycleListener(this);
+  sampler_.setWaveformRecorder(&waveforms_);
+  for (size_t i = 0; i < secondaryCount_; ++i) {
+    if (secondaries_[i].detector != nullptr) {
+      secondaries_[i].sampler->setHalfCycleListener(&secondaries_[i]);
+    }
+  }
+  BaseType_t ok = xTaskCreatePinnedToCore(&AcquisitionTask::taskEntry,
+                                          "acq",
+                                          Config::kAcqTaskStackBytes,
+                                          this,
+                                          Config::kAcqTaskPriority,
+                                          &task_,
+                                          Config::kAcqTaskCore);
+  return ok == pdPASS;
+}
+
+void AcquisitionTask::setEnergy(const ChannelEnergy& energy) {
+  portENTER_CRITICAL(&energyLock_);
+  energy_ = energy;
+  portEXIT_CRITICAL(&energyLock_);
+}
+
+void AcquisitionTask::energy(ChannelEnergy& out) const {
+  portENTER_CRITICAL(&energyLock_);
+  out = energy_;
+  portEXIT_CRITICAL(&energyLock_);
+}
+
+void AcquisitionTask::setWifiConnected(bool connected) {
+  wifiConnected_.store(connected, std::memory_order_relaxed);
+}
+
+bool AcquisitionTask::popSample(VoltageSample& out, ChannelValues* channels) {
+  Window window;
+  if (!samples_.pop(window)) {
+    return false;
+  }
+  out = window.sample;
+  if (channels != nullptr) {
+    *channels = window.channels;
+  }
+  return true;
+}
+
+bool AcquisitionTask::popEvent(VoltageEvent& out) {
+  return events_.pop(out);
+}
+
+uint32_t AcquisitionTask::droppedSamples() const {
+  return samples_.overflowCount();
+}
+
+uint32_t AcquisitionTask::droppedEvents() const {
+  return events_.overflowCount();
+}
+
+uint32_t AcquisitionTask::sampleQueueHighWatermark() const {
+  return samples_.highWatermark();
+}
+
+void AcquisitionTask::taskEntry(void* arg) {
+  static_cast<AcquisitionTask*>(arg)->run();
+}
+
+// Called from inside sampler_.update(), on this task.
+void AcquisitionTask::onHalfCycleRms(float vrms, uint32_t ageMs) {
+  detector_.addHalfCycle(vrms, timeSync_.nowMs() - ageMs);
+  captureStartedEvent();
+}
+
+void AcquisitionTask::SecondaryChannel::onHalfCycleRms(float vrms, uint32_t ageMs) {
+  detector->addHalfCycle(vrms, task->timeSync_.nowMs() - ageMs);
+}
+
+// The sampler hands every DMA buffer to the recorder as soon as it is read, so the newest
+// recorded sample is the one captured just before now.
+void AcquisitionTask::captureStartedEvent() {
+  VoltageEvent started;
+  if (detector_.pollStartedEvent(started)) {
+    waveforms_.trigger(started.type, started.start_ts, timeSync_.nowMs());
+  }
+}
+
+// Voltage channels go before current channels, so every PowerMeter finds its voltage samples
+// already traced; the values stay in layout order.
+void AcquisitionTask::sampleSecondaries(Window& window) {
+  window.channels = ChannelValues();
+  window.channels.count = static_cast<uint8_t>(secondaryCount_);
+  for (ChannelKind kind : {ChannelKind::Voltage, ChannelKind::Current}) {
+    for (size_t i = 0; i < secondaryCount_; ++i) {
+      if (secondaries_[i].kind == kind) {
+        sampleSecondary(secondaries_[i], window);
+      }
+    }
+  }
+}
+
+// Closes the secondary channel's window matching the primary one just closed and runs its
+// detector or power meter on it.
+void AcquisitionTask::sampleSecondary(SecondaryChannel& channel, Window& window) {
+  ChannelValues& values = window.channels;
+  const size_t slot = channel.index - 1;
+  values.kind[slot] = channel.kind;
+  VoltageSample& sample = channel.sample;
+  if (!channel.sampler->update(sample, 0)) {
+    // Cannot happen while the sampler follows the primary on the same buffers.
+    values.rms[slot] = 0.0f;
+    values.flags[slot] = FLAG_NO_SIGNAL;
+    return;
+  }
+  metrics_.record(Metrics::Stage::Sampler, channel.sampler->lastWindowCycles());
+  sample.ts_ms = window.sample.ts_ms;
+  sample.flags |= window.sample.flags & (FLAG_NTP_NOT_SYNC | FLAG_WIFI_DOWN);
+  values.rms[slot] = sample.vrms;
+  values.flags[slot] = sample.flags;
+  PowerReading power;
+  if (channel.meter != nullptr && channel.meter->finishWindow(window.sample.freq_hz, power)) {
+    values.activeW[slot] = power.activeW;
+    values.reactiveVar[slot] = power.reactiveVar;
+    values.apparentVa[slot] = power.apparentVa;
+    portENTER_CRITICAL(&energyLock_);
+    if (power.energyWh >= 0.0) {
+      energy_.importWh[slot] += power.energyWh;
+    } else {
+      energy_.exportWh[slot] -= power.energyWh;
+    }
+    portEXIT_CRITICAL(&energyLock_);
+  }
+  if (channel.detector != nullptr && (sample.flags & FLAG_ADC_SATURATED) == 0) {
+    Metrics::Scope scope(metrics_, Metrics::Stage::Detector);
+    channel.detector->addSample(sample);
+    queueCompletedEvents(*channel.detector, channel.index);
+  }
+}
+
+void AcquisitionTask::queueCompletedEvents(EventDetector& detector, uint8_t channel) {
+  VoltageEvent event;
+  while (detector.pollCompletedEvent(event)) {
+    event.channel = channel;
+    events_.push(event);
+  }
+}
+
+void AcquisitionTask::run() {
+  // A scanned layout reads the ADC here, one DMA buffer at a time, and the samplers only take
+  // what fill() sorted for them; a single channel reads straight from the sampler.
+  const bool scanned = secondaryCount_ > 0;
+  const uint32_t waitMs = scanned ? 0 : Config::kAcqReadTimeoutMs;
+  Window window;
+  for (;;) {
+    if (scanned && !adc_.fill(Config::kAcqReadTimeoutMs)) {
+      continue;
+    }
+    while (sampler_.update(window.sample, waitMs)) {
+      VoltageSample& sample = window.sample;
+      metrics_.record(Metrics::Stage::Sampler, sampler_.lastWindowCycles());
+      metrics_.recordWindow(sample.sample_count);
+      sample.ts_ms = timeSync_.nowMs();
+      if (!timeSync_.isSynced()) {
+        sample.flags |= FLAG_NTP_NOT_SYNC;
+      }
+      if (!wifiConnected_.load(std::memory_order_relaxed)) {
+        sample.flags |= FLAG_WIFI_DOWN;
+      }
+
+      sampleSecondaries(window);
+
+      if ((sample.flags & FLAG_ADC_SATURATED) == 0) {
+        Metrics::Scope scope(metrics_, Metrics::Stage::Detector);
+        detector_.addSample(sample);
+        captureStartedEvent();
+        queueCompletedEvents(detector_, 0);
+      }
+      samples_.push(window);
+    }
+    drainSecondaries();
+  }
+}
+
+// The primary ran out of data mid-window; the others take the rest of the buffer into their
+// open windows too, so every channel is drained before the next fill(). Voltages first, as in
+// sampleSecondaries().
+void AcquisitionTask::drainSecondaries() {
+  for (ChannelKind kind : {ChannelKind::Voltage, ChannelKind::Current}) {
+    for (size_t i = 0; i < secondaryCount_; ++i) {
+      if (secondaries_[i].kind == kind) {
+        secondaries_[i].sampler->update(secondaries_[i].sample, 0);
+      }
+    }
+  }
+}
@@ -0,0 +1,104 @@
+#include "AdcChannelDemux.h"
+
+#include <algorithm>
+#include <string.h>
+
+AdcChannelDemux::AdcChannelDemux(AdcBufferProvider& source) : source_(source) {
+  for (size_t i = 0; i < Config::kMaxAdcChannels; ++i) {
+    streams_[i].demux = this;
+    streams_[i].index = i;
+  }
+  memset(channelForTag_, kNoChannel, sizeof(channelForTag_));
+}
+
+bool AdcChannelDemux::begin() {
+  if (begun_) {
+    return ok_;
+  }
+  begun_ = true;
+  ok_ = source_.begin();
+  channels_ = std::min(std::max<size_t>(source_.inputCount(), 1), Config::kMaxAdcChannels);
+  if (channels_ > 1) {
+    for (size_t i = 0; i < channels_; ++i) {
+      channelForTag_[source_.inputTag(i) & 0x0F] = static_cast<uint8_t>(i);
+    }
+    staging_.assign(channels_ * kStreamCapacity, 0);
+  }
+  return ok_;
+}
+
+size_t AdcChannelDemux::channelCount() const {
+  return begun_ ? channels_ : std::min(std::max<size_t>(source_.inputCount(), 1), Config::kMaxAdcChannels);
+}
+
+AdcBufferProvider& AdcChannelDemux::channel(size_t index) {
+  return streams_[std::min(index, Config::kMaxAdcChannels - 1)];
+}
+
+bool AdcChannelDemux::fill(uint32_t timeoutMs) {
+  if (channels_ <= 1) {
+    return false;
+  }
+  const size_t count = source_.read(raw_, Config::kAdcDmaBufferLen, timeoutMs);
+  if (count == 0) {
+    return false;
+  }
+
+  // Whatever a channel left unread moves to the front of its buffer.
+  uint16_t* next[Config::kMaxAdcChannels];
+  uint16_t* end[Config::kMaxAdcChannels];
+  for (size_t c = 0; c < channels_; ++c) {
+    uint16_t* data = staging_.data() + c * kStreamCapacity;
+    const size_t left = length_[c] - position_[c];
+    memmove(data, data + position_[c], left * sizeof(uint16_t));
+    position_[c] = 0;
+    next[c] = data + left;
+    end[c] = data + kStreamCapacity;
+  }
+
+  // Sorted by tag rather than by position: the I2S DMA swaps the two halves of each 32-bit
+  // word, so the inputs do not arrive in scan order.
+  for (size_t i = 0; i < count; ++i) {
+    const uint16_t value = raw_[i];
+    const uint8_t c = channelForTag_[value >> 12];
+    if (c == kNoChannel || next[c] == end[c]) {
+      dropped_++;
+      continue;
+    }
+    *next[c]++ = value & 0x0FFF;
+  }
+  for (size_t c = 0; c < channels_; ++c) {
+    length_[c] = static_cast<size_t>(next[c] - (staging_.data() + c * kStreamCapacity));
+  }
+  return true;
+}
+
+uint32_t AdcChannelDemux::droppedSamples() const {
+  return dropped_;
+}
+
+bool AdcChannelDemux::Stream::begin() {
+  return demux->begin();
+}
+
+size_t AdcChannelDemux::Stream::read(uint16_t* out, size_t maxCount, uint32_t timeoutMs) {
+  if (demux->channels_ <= 1) {
+    return index == 0 ? demux->source_.read(out, maxCount, timeoutMs) : 0;
+  }
+  if (index >= demux->channels_) {
+    return 0;
+  }
+  size_t& position = demux->position_[index];
+  const size_t count = std::min(maxCount, demux->length_[index] - position);
+  memcpy(out, demux->staging_.data() + index * kStreamCapacity + position, count * sizeof(uint16_t));
+  position += count;
+  return count;
+}
+
+uint32_t AdcChannelDemux::Stream::sampleRateHz() const {
+  return demux->source_.sampleRateHz();
+}
+
+uint32_t AdcChannelDemux::Stream::overrunCount() const {
+  return demux->source_.overrunCount();
+}
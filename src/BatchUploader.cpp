@@ -1,167 +1,677 @@
 #include "BatchUploader.h"
 
+#include "SampleBatchCodec.h"
+#include "WaveformCodec.h"
+
+#include <algorithm>
+
 namespace {
 constexpr unsigned long kBackoffScheduleMs[] = {60000, 120000, 300000, 600000};
+constexpr const char* kJsonContentType = "application/json";
+
+// StorageQueue record kinds.
+constexpr uint8_t kRecordJson = 0;
+constexpr uint8_t kRecordBinary = 1;
+constexpr uint8_t kRecordTelemetry = 2;  // JSON, events channel
+constexpr uint8_t kRecordWaveform = 3;   // WaveformCodec, events channel
+// Flag on any record kind: the payload is a gzip member.
+constexpr uint8_t kRecordGzip = 0x40;
+// Dead-letter records keep the original kind, tagged with the channel they came from.
+constexpr uint8_t kDeadLetterSamples = 0x00;
+constexpr uint8_t kDeadLetterEvents = 0x80;
+// SampleReducer::add() appends at most two points, flush() one more.
+constexpr size_t kMaxRowsPerAdd = 2;
+
+bool isSuccess(int httpCode) {
+  return httpCode >= 200 && httpCode < 300;
+}
+
+// Client errors the server will keep returning for this payload; retrying cannot help.
+bool isPermanentFailure(int httpCode) {
+  return httpCode >= 400 && httpCode < 500 && httpCode != 408 && httpCode != 429;
+}
+
+// Formats JSON text straight into a sink; numbers match the old String() conversions.
+class JsonWriter {
+ public:
+  explicit JsonWriter(ByteSink& out) : out_(out) {}
+
+  void raw(const char* text) {
+    ok_ = ok_ && out_.write(reinterpret_cast<const uint8_t*>(text), strlen(text));
+  }
+
+  void u64(uint64_t value) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%llu", static_cast<unsigned long long>(value));
+    raw(buf);
+  }
+
+  void f3(float value) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%.3f", value);
+    raw(buf);
+  }
+
+  void f1(double value) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%.1f", value);
+    raw(buf);
+  }
+
+  void samples(const VoltageSample* samples, size_t count) {
+    raw("[");
+    sampleRun(samples, count, true);
+    raw("]");
+  }
+
+  // [min, max, p99] Vrms per tier point.
+  void summaries(const SampleSummary* summaries, size_t count) {
+    raw("[");
+    for (size_t i = 0; i < count && ok_; ++i) {
+      raw(i == 0 ? "[" : ",[");
+      f3(summaries[i].min);
+      raw(",");
+      f3(summaries[i].max);
+      raw(",");
+      f3(summaries[i].p99);
+      raw("]");
+    }
+    raw("]");
+  }
+
+  // [thd_pct, h3, h5, h7] per sample, null where the window was not analysed.
+  void harmonics(const VoltageSample* samples, size_t count) {
+    raw("[");
+    for (size_t i = 0; i < count && ok_; ++i) {
+      const VoltageSample& sample = samples[i];
+      if (i > 0) {
+        raw(",");
+      }
+      if (!sample.hasHarmonics()) {
+        raw("null");
+        continue;
+      }
+      char buf[64];
+      snprintf(buf,
+               sizeof(buf),
+               "[%.2f,%.2f,%.2f,%.2f]",
+               sample.thd_cpct / 100.0,
+               sample.harmonic_cv[0] / 100.0,
+               sample.harmonic_cv[1] / 100.0,
+               sample.harmonic_cv[2] / 100.0);
+      raw(buf);
+    }
+    raw("]");
+  }
+
+  // One object per secondary channel, its values and flags as columns parallel to "samples".
+  // Current channels add P, Q and S columns and the energy totals.
+  void channels(const ChannelValues* rows, size_t count, const ChannelEnergy& energy) {
+    raw("[");
+    for (size_t c = 0; c < rows[0].count && ok_; ++c) {
+      raw(c == 0 ? "{\"channel\":" : ",{\"channel\":");
+      u64(c + 1);
+      raw(",\"kind\":\"");
+      raw(ChannelKindToString(rows[0].kind[c]));
+      raw("\",\"rms\":[");
+      for (size_t i = 0; i < count && ok_; ++i) {
+        if (i > 0) {
+          raw(",");
+        }
+        f3((rows[i].flags[c] & FLAG_NO_SIGNAL) ? 0.0f : rows[i].rms[c]);
+      }
+      raw("],\"flags\":[");
+      for (size_t i = 0; i < count && ok_; ++i) {
+        if (i > 0) {
+          raw(",");
+        }
+        u64(rows[i].flags[c]);
+      }
+      if (rows[0].kind[c] == ChannelKind::Current) {
+        powerColumn(",\"p\":[", rows, count, &ChannelValues::activeW, c);
+        powerColumn("],\"q\":[", rows, count, &ChannelValues::reactiveVar, c);
+        powerColumn("],\"s\":[", rows, count, &ChannelValues::apparentVa, c);
+        raw("],\"energy_wh\":[");
+        f1(energy.importWh[c]);
+        raw(",");
+        f1(energy.exportWh[c]);
+      }
+      raw("]}");
+    }
+    raw("]");
+  }
+
+  void samples(const SampleHistory::Span* spans, size_t spanCount) {
+    raw("[");
+    for (size_t i = 0; i < spanCount; ++i) {
+      sampleRun(spans[i].data, spans[i].count, i == 0);
+    }
+    raw("]");
+  }
+
+  bool ok() const {
+    return ok_;
+  }
+
+ private:
+  using PowerColumn = float (ChannelValues::*)[Config::kMaxAdcChannels - 1];
+
+  void powerColumn(const char* key, const ChannelValues* rows, size_t count, PowerColumn column, size_t c) {
+    raw(key);
+    for (size_t i = 0; i < count && ok_; ++i) {
+      if (i > 0) {
+        raw(",");
+      }
+      f1((rows[i].*column)[c]);
+    }
+  }
+
+  void sampleRun(const VoltageSample* samples, size_t count, bool first) {
+    for (size_t i = 0; i < count && ok_; ++i) {
+      const auto& sample = samples[i];
+      float vrms = (sample.flags & FLAG_NO_SIGNAL) ? 0.0f : sample.vrms;
+      raw(first && i == 0 ? "[" : ",[");
+      u64(sample.ts_ms);
+      raw(",");
+      f3(vrms);
+      raw(",");
+      u64(sample.flags);
+      raw("]");
+    }
+  }
+
+  ByteSink& out_;
+  bool ok_ = true;
+};
 }
 
+BatchUploader::Channel::Channel(const char* label,
+                                uint8_t deadLetterTag,
+                                const char* queueName,
+                                const char* legacyPath,
+                                uint32_t maxBytes)
+    : label(label), deadLetterTag(deadLetterTag), queue(queueName, legacyPath, maxBytes) {}
+
 BatchUploader::BatchUploader()
-    : samplesQueue_("/samples_queue.txt"), eventsQueue_("/events_queue.txt") {}
+    : samplesChannel_("samples", kDeadLetterSamples, "/queue_samples", "/samples_queue.txt", Config::kSamplesQueueMaxBytes),
+      eventsChannel_("events", kDeadLetterEvents, "/queue_events", "/events_queue.txt", Config::kEventsQueueMaxBytes),
+      deadLetterQueue_("/queue_dead", nullptr, Config::kDeadLetterMaxBytes) {}
 
 void BatchUploader::begin(const char* baseUrl, const char* deviceId, const char* apiKey) {
-  baseUrl_ = baseUrl;
   deviceId_ = deviceId;
-  apiKey_ = apiKey;
-  samplesQueue_.begin();
-  eventsQueue_.begin();
+  session_.begin(baseUrl, deviceId, apiKey);
+  samplesChannel_.queue.begin();
+  eventsChannel_.queue.begin();
+  deadLetterQueue_.begin();
   lastBatchMs_ = millis();
 }
 
-void BatchUploader::addSample(const VoltageSample& sample) {
-  samples_.push_back(sample);
+void BatchUploader::addSample(const VoltageSample& sample, const ChannelValues* channels) {
+  if (points_.empty()) {
+    reserveBatch(channels != nullptr);
+  } else if (points_.size() + kMaxRowsPerAdd >= batchRows_) {
+    // Full: queue it before the reducer would grow the vectors past their reservation.
+    queueSamplesBatch(Config::kWindowMs);
+    lastBatchMs_ = millis();
+  }
+  reducer_.add(sample, channels, points_);
 }
 
-void BatchUploader::addEvent(const VoltageEvent& event) {
-  String payload = buildEventPayload(event);
-  queueEventPayload(payload);
+void BatchUploader::addEvent(const VoltageEvent& event, const SampleHistory& history) {
+  StorageQueue::RecordWriter writer(eventsChannel_.queue,
+                                    kRecordJson | (compression_ ? kRecordGzip : 0),
+                                    (event.sample_count + 1) * 24 + 256);
+  if (!writeEventJson(beginRecordBody(writer), event, history) || !finishRecordBody()) {
+    Serial.println("[QUEUE] Failed to store event payload");
+    return;
+  }
+  // The acquisition task never waits for us; drop the record if it lapped the event meanwhile.
+  if (!history.intact(event.first_seq)) {
+    Serial.println("[QUEUE] Event samples overwritten before they were stored");
+    return;
+  }
+  if (!writer.commit()) {
+    Serial.println("[QUEUE] Failed to store event payload");
+  }
+}
+
+void BatchUploader::addWaveform(const WaveformRecorder::Capture& capture, float voltsPerCount) {
+  StorageQueue::RecordWriter writer(eventsChannel_.queue,
+                                    kRecordWaveform | (compression_ ? kRecordGzip : 0),
+                                    capture.count * 2 + 64);
+  if (!WaveformCodec::encode(beginRecordBody(writer), deviceId_, Config::kFirmwareVersion, capture, voltsPerCount) ||
+      !finishRecordBody() || !writer.commit()) {
+    Serial.println("[QUEUE] Failed to store waveform payload");
+  }
+}
+
+void BatchUploader::addTelemetry(const Metrics& metrics) {
+  StorageQueue::RecordWriter writer(eventsChannel_.queue, kRecordTelemetry | (compression_ ? kRecordGzip : 0), 512);
+  if (!writeTelemetryJson(beginRecordBody(writer), metrics) || !finishRecordBody() || !writer.commit()) {
+    Serial.println("[QUEUE] Failed to store telemetry payload");
+  }
+}
+
+void BatchUploader::setEnergy(const ChannelEnergy& energy) {
+  energy_ = energy;
 }
 
 void BatchUploader::update(bool wifiConnected, uint32_t samplePeriodMs) {
   unsigned long now = millis();
 
-  if (!samples_.empty()) {
-    bool batchReady = samples_.size() >= Config::kBatchMaxPoints || (now - lastBatchMs_ >= Config::kBatchMaxWaitMs);
+  if (!points_.empty()) {
+    bool batchReady = points_.size() >= batchMaxPoints_ || (now - lastBatchMs_ >= batchMaxWaitMs_);
     if (batchReady) {
-      String payload = buildSamplesPayload(samplePeriodMs);
-      queueSamplesPayload(payload);
-      samples_.clear();
+      queueSamplesBatch(samplePeriodMs);
       lastBatchMs_ = now;
     }
   }
 
-  if (samplesQueue_.hasItems()) {
-    String payload = samplesQueue_.front();
-    if (sendPayload("/ingest/voltage/samples", payload, wifiConnected, samplesRetry_)) {
-      samplesQueue_.pop();
+  if (wifiConnected && !lastWifiConnected_) {
+    // Backoff accumulated while offline says nothing about the server; start draining now.
+    for (Channel* channel : {&eventsChannel_, &samplesChannel_}) {
+      channel->nextAttemptMs = now;
+      channel->backoffIndex = 0;
+    }
+    nextConfigFetchMs_ = now;
+  }
+  lastWifiConnected_ = wifiConnected;
+  if (wifiConnected) {
+    if (configListener_ != nullptr && now >= nextConfigFetchMs_) {
+      fetchConfig();
     }
+    drainQueues();
   }
+  session_.update();
+}
 
-  if (eventsQueue_.hasItems()) {
-    String payload = eventsQueue_.front();
-    if (sendPayload("/ingest/voltage/events", payload, wifiConnected, eventsRetry_)) {
-      eventsQueue_.pop();
+void BatchUploader::flush() {
+  reducer_.flush(points_);
+  if (!points_.empty()) {
+    queueSamplesBatch(Config::kWindowMs);
+    lastBatchMs_ = millis();
+  }
+}
+
+void BatchUploader::setReduction(SampleReduction mode, float swingToleranceV) {
+  flush();
+  reducer_.setMode(mode, swingToleranceV);
+}
+
+SampleReduction BatchUploader::reduction() const {
+  return reducer_.mode();
+}
+
+float BatchUploader::swingTolerance() const {
+  return reducer_.swingTolerance();
+}
+
+void BatchUploader::setDisturbanceBand(float low, float high) {
+  reducer_.setDisturbanceBand(low, high);
+}
+
+void BatchUploader::setConfigListener(ConfigListener* listener) {
+  configListener_ = listener;
+}
+
+void BatchUploader::setConfigEtag(const char* etag) {
+  snprintf(configEtag_, sizeof(configEtag_), "%s", etag != nullptr ? etag : "");
+}
+
+const char* BatchUploader::configEtag() const {
+  return configEtag_;
+}
+
+void BatchUploader::requestConfigFetch() {
+  nextConfigFetchMs_ = millis();
+  configBackoffIndex_ = 0;
+}
+
+void BatchUploader::setConfigVersion(uint32_t version) {
+  configVersion_ = version;
+}
+
+void BatchUploader::setBatchLimits(uint32_t maxPoints, uint32_t maxWaitMs) {
+  batchMaxPoints_ = std::min(std::max<uint32_t>(maxPoints, 1), Config::kBatchMaxPoints);
+  batchMaxWaitMs_ = maxWaitMs;
+}
+
+uint32_t BatchUploader::batchMaxPoints() const {
+  return batchMaxPoints_;
+}
+
+uint32_t BatchUploader::batchMaxWaitMs() const {
+  return batchMaxWaitMs_;
+}
+
+void BatchUploader::setUploadFormat(UploadFormat format) {
+  format_ = format;
+}
+
+UploadFormat BatchUploader::uploadFormat() const {
+  return format_;
+}
+
+void BatchUploader::setCompression(bool enabled) {
+  compression_ = enabled;
+}
+
+bool BatchUploader::compression() const {
+  return compression_;
+}
+
+const HttpSession& BatchUploader::session() const {
+  return session_;
+}
+
+HttpSession& BatchUploader::session() {
+  return session_;
+}
+
+uint32_t BatchUploader::uploadsSent() const {
+  return samplesChannel_.sent + eventsChannel_.sent;
+}
+
+void BatchUploader::collectGauges(Metrics::Gauges& gauges) const {
+  const SegmentLog::Stats& samples = samplesChannel_.queue.stats();
+  const SegmentLog::Stats& events = eventsChannel_.queue.stats();
+  const SegmentLog::Stats& dead = deadLetterQueue_.stats();
+  gauges.samplesQueue = {samples.pendingRecords, samples.storedBytes};
+  gauges.eventsQueue = {events.pendingRecords, events.storedBytes};
+  gauges.deadLetterQueue = {dead.pendingRecords, dead.storedBytes};
+  const HttpSession::Stats& http = session_.stats();
+  gauges.httpRequests = http.requests;
+  gauges.httpErrors = http.errors;
+  gauges.httpConnections = http.connectionsOpened;
+  gauges.httpBusyMs = http.busyMs;
+}
+
+// 304 (unchanged) and 404 (no document for this device) keep the current settings until the
+// next interval; transport and server errors retry on the upload backoff schedule.
+void BatchUploader::fetchConfig() {
+  String body;
+  String etag;
+  const int httpCode = session_.get("/config", body, configEtag_, &etag);
+  if (isSuccess(httpCode) || httpCode == 304 || httpCode == 404) {
+    nextConfigFetchMs_ = millis() + Config::kConfigFetchIntervalMs;
+    configBackoffIndex_ = 0;
+  } else {
+    nextConfigFetchMs_ = millis() + kBackoffScheduleMs[configBackoffIndex_];
+    if (configBackoffIndex_ + 1 < (sizeof(kBackoffScheduleMs) / sizeof(kBackoffScheduleMs[0]))) {
+      configBackoffIndex_++;
     }
+    Serial.printf("[CONFIG] Fetch failed (%d). Retry in %lu ms\n", httpCode, nextConfigFetchMs_ - millis());
+    return;
+  }
+  if (isSuccess(httpCode)) {
+    // Remembered even if the listener rejects the document: the same bad document is not
+    // fetched again, a corrected one comes with a new ETag.
+    setConfigEtag(etag.c_str());
+    configListener_->onConfig(body.c_str());
   }
 }
 
-bool BatchUploader::sendPayload(const String& endpoint, const String& payload, bool wifiConnected, RetryState& retry) {
-  unsigned long now = millis();
-  if (!wifiConnected) {
-    retry.nextAttemptMs = now + kBackoffScheduleMs[0];
-    return false;
-  }
-  if (now < retry.nextAttemptMs) {
-    return false;
-  }
-
-  WiFiClient client;
-  HTTPClient http;
-  String url = String(baseUrl_) + endpoint;
-  http.begin(client, url);
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("X-DEVICE-ID", deviceId_);
-  if (apiKey_ != nullptr && strlen(apiKey_) > 0) {
-    http.addHeader("X-API-KEY", apiKey_);
-  }
-
-  int httpCode = http.POST(payload);
-  http.end();
-
-  if (httpCode >= 200 && httpCode < 300) {
-    retry.backoffIndex = 0;
-    retry.nextAttemptMs = now;
-    Serial.printf("[UPLOAD] Success %s (%d)\n", endpoint.c_str(), httpCode);
-    return true;
-  }
-
-  size_t index = retry.backoffIndex;
-  if (index + 1 < (sizeof(kBackoffScheduleMs) / sizeof(kBackoffScheduleMs[0]))) {
-    retry.backoffIndex++;
-  }
-  retry.nextAttemptMs = now + kBackoffScheduleMs[retry.backoffIndex];
-  Serial.printf("[UPLOAD] Failed %s (%d). Retry in %lu ms\n", endpoint.c_str(), httpCode, retry.nextAttemptMs - now);
-  return false;
-}
-
-String BatchUploader::buildSamplesPayload(uint32_t samplePeriodMs) {
-  String payload;
-  payload.reserve(samples_.size() * 24 + 128);
-  payload += "{\"device_id\":\"";
-  payload += deviceId_;
-  payload += "\",\"fw_version\":\"";
-  payload += Config::kFirmwareVersion;
-  payload += "\",\"sample_period_ms\":";
-  payload += String(samplePeriodMs);
-  payload += ",\"samples\":[";
-
-  for (size_t i = 0; i < samples_.size(); ++i) {
-    const auto& sample = samples_[i];
-    float vrms = (sample.flags & FLAG_NO_SIGNAL) ? 0.0f : sample.vrms;
-    payload += "[";
-    payload += String(static_cast<uint64_t>(sample.ts_ms));
-    payload += ",";
-    payload += String(vrms, 3);
-    payload += ",";
-    payload += String(sample.flags);
-    payload += "]";
-    if (i + 1 < samples_.size()) {
-      payload += ",";
+void BatchUploader::drainQueues() {
+  const unsigned long start = millis();
+  size_t bytesSent = 0;
+  // Events first: they are small and time-sensitive, sample batches are bulk.
+  for (Channel* channel : {&eventsChannel_, &samplesChannel_}) {
+    for (;;) {
+      if (millis() - start >= Config::kDrainTimeBudgetMs || bytesSent >= Config::kDrainByteBudget) {
+        return;
+      }
+      SendResult result = sendNext(*channel, bytesSent);
+      if (result != SendResult::Sent && result != SendResult::DeadLettered) {
+        break;
+      }
     }
   }
-  payload += "]}";
-  return payload;
-}
-
-String BatchUploader::buildEventPayload(const VoltageEvent& event) {
-  String payload;
-  payload.reserve(event.samples.size() * 24 + 256);
-  payload += "{\"device_id\":\"";
-  payload += deviceId_;
-  payload += "\",\"fw_version\":\"";
-  payload += Config::kFirmwareVersion;
-  payload += "\",\"type\":\"";
-  payload += EventTypeToString(event.type);
-  payload += "\",\"start_ts\":";
-  payload += String(static_cast<uint64_t>(event.start_ts));
-  payload += ",\"end_ts\":";
-  payload += String(static_cast<uint64_t>(event.end_ts));
-  payload += ",\"min_vrms\":";
-  payload += String(event.min_vrms, 3);
-  payload += ",\"max_vrms\":";
-  payload += String(event.max_vrms, 3);
-  payload += ",\"samples\":[";
-
-  for (size_t i = 0; i < event.samples.size(); ++i) {
-    const auto& sample = event.samples[i];
-    float vrms = (sample.flags & FLAG_NO_SIGNAL) ? 0.0f : sample.vrms;
-    payload += "[";
-    payload += String(static_cast<uint64_t>(sample.ts_ms));
-    payload += ",";
-    payload += String(vrms, 3);
-    payload += ",";
-    payload += String(sample.flags);
-    payload += "]";
-    if (i + 1 < event.samples.size()) {
-      payload += ",";
+}
+
+BatchUploader::SendResult BatchUploader::sendNext(Channel& channel, size_t& bytesSent) {
+  if (!channel.queue.hasItems()) {
+    return SendResult::Idle;
+  }
+  if (millis() < channel.nextAttemptMs) {
+    return SendResult::Deferred;
+  }
+  if (!channel.queue.openFront(sendStream_)) {
+    return SendResult::Idle;
+  }
+
+  const char* contentType = kJsonContentType;
+  const char* endpoint = endpointFor(channel, sendStream_.kind(), &contentType);
+  const char* contentEncoding = (sendStream_.kind() & kRecordGzip) ? "gzip" : nullptr;
+  const size_t size = sendStream_.length();
+  int httpCode = postFront(endpoint, contentType, contentEncoding);
+
+  if (isSuccess(httpCode)) {
+    sendStream_.close();
+    channel.queue.pop();
+    channel.headAttempts = 0;
+    channel.backoffIndex = 0;
+    channel.nextAttemptMs = 0;
+    channel.sent++;
+    bytesSent += size;
+    Serial.printf("[UPLOAD] Success %s (%d)\n", endpoint, httpCode);
+    return SendResult::Sent;
+  }
+
+  if (channel.headAttempts < UINT8_MAX) {
+    channel.headAttempts++;
+  }
+  // Only a client error rejects the payload itself. Transport and server errors (a 5xx streak
+  // is an outage, not a bad record) keep the item at the head while the channel backs off.
+  if (isPermanentFailure(httpCode)) {
+    deadLetter(channel, httpCode);
+    sendStream_.close();
+    channel.queue.pop();
+    channel.headAttempts = 0;
+    return SendResult::DeadLettered;
+  }
+
+  sendStream_.close();
+  scheduleRetry(channel);
+  Serial.printf("[UPLOAD] Failed %s (%d). Retry in %lu ms\n", endpoint, httpCode, channel.nextAttemptMs - millis());
+  return SendResult::Deferred;
+}
+
+const char* BatchUploader::endpointFor(const Channel& channel, uint8_t kind, const char** contentType) const {
+  kind &= ~kRecordGzip;
+  if (&channel == &samplesChannel_ && kind == kRecordBinary) {
+    *contentType = SampleBatchCodec::kContentType;
+    return "/ingest/voltage/samples/bin";
+  }
+  if (&channel == &eventsChannel_ && kind == kRecordWaveform) {
+    *contentType = WaveformCodec::kContentType;
+    return "/ingest/voltage/events/waveform";
+  }
+  *contentType = kJsonContentType;
+  if (&channel == &eventsChannel_ && kind == kRecordTelemetry) {
+    return "/ingest/device/telemetry";
+  }
+  return &channel == &samplesChannel_ ? "/ingest/voltage/samples" : "/ingest/voltage/events";
+}
+
+int BatchUploader::postFront(const char* endpoint, const char* contentType, const char* contentEncoding) {
+  // Content-Length comes from the stored record, so the body is streamed from flash.
+  int httpCode = session_.post(endpoint, contentType, sendStream_, sendStream_.length(), contentEncoding);
+  if (httpCode < 0 && session_.lastRequestReused() && sendStream_.rewind()) {
+    // The server may have closed the idle keep-alive socket; retry once on a fresh connection.
+    httpCode = session_.post(endpoint, contentType, sendStream_, sendStream_.length(), contentEncoding);
+  }
+  return httpCode;
+}
+
+void BatchUploader::scheduleRetry(Channel& channel) {
+  channel.nextAttemptMs = millis() + kBackoffScheduleMs[channel.backoffIndex];
+  if (channel.backoffIndex + 1 < (sizeof(kBackoffScheduleMs) / sizeof(kBackoffScheduleMs[0]))) {
+    channel.backoffIndex++;
+  }
+}
+
+void BatchUploader::deadLetter(Channel& channel, int httpCode) {
+  channel.deadLettered++;
+  Serial.printf("[UPLOAD] Dead-lettered %s payload (%d, attempts=%u)\n",
+                channel.label,
+                httpCode,
+                static_cast<unsigned int>(channel.headAttempts));
+  if (!sendStream_.rewind()) {
+    return;
+  }
+  StorageQueue::RecordWriter writer(deadLetterQueue_, channel.deadLetterTag | sendStream_.kind(), sendStream_.length());
+  char chunk[128];
+  size_t n = 0;
+  while ((n = sendStream_.readBytes(chunk, sizeof(chunk))) > 0) {
+    if (!writer.write(reinterpret_cast<const uint8_t*>(chunk), n)) {
+      return;
     }
   }
-  payload += "]}";
-  return payload;
+  writer.commit();
+}
+
+bool BatchUploader::writeSamplesJson(ByteSink& out, uint32_t samplePeriodMs) {
+  JsonWriter json(out);
+  json.raw("{\"device_id\":\"");
+  json.raw(deviceId_);
+  json.raw("\",\"fw_version\":\"");
+  json.raw(Config::kFirmwareVersion);
+  json.raw("\",\"sample_period_ms\":");
+  json.u64(samplePeriodMs);
+  json.raw(",\"samples\":");
+  json.samples(points_.samples.data(), points_.size());
+  if (!points_.summaries.empty()) {
+    json.raw(",\"summary\":");
+    json.summaries(points_.summaries.data(), points_.summaries.size());
+  }
+  if (std::any_of(points_.samples.begin(), points_.samples.end(), [](const VoltageSample& sample) {
+        return sample.hasHarmonics();
+      })) {
+    json.raw(",\"harmonics\":");
+    json.harmonics(points_.samples.data(), points_.size());
+  }
+  if (!points_.channels.empty() && points_.channels.front().count > 0) {
+    json.raw(",\"channels\":");
+    json.channels(points_.channels.data(), points_.channels.size(), energy_);
+  }
+  json.raw("}");
+  return json.ok();
+}
+
+bool BatchUploader::writeEventJson(ByteSink& out, const VoltageEvent& event, const SampleHistory& history) {
+  JsonWriter json(out);
+  json.raw("{\"device_id\":\"");
+  json.raw(deviceId_);
+  json.raw("\",\"fw_version\":\"");
+  json.raw(Config::kFirmwareVersion);
+  json.raw("\",\"type\":\"");
+  json.raw(EventTypeToString(event.type));
+  json.raw("\",\"channel\":");
+  json.u64(event.channel);
+  json.raw(",\"start_ts\":");
+  json.u64(event.start_ts);
+  json.raw(",\"end_ts\":");
+  json.u64(event.end_ts);
+  json.raw(",\"min_vrms\":");
+  json.f3(event.min_vrms);
+  json.raw(",\"max_vrms\":");
+  json.f3(event.max_vrms);
+  json.raw(",\"samples\":");
+  SampleHistory::Span spans[4];
+  size_t spanCount = 0;
+  if (event.repeats_trigger && event.trigger_seq - event.first_seq < event.sample_count) {
+    // The trigger window ends the pre-trigger run and starts the event run.
+    const uint32_t preCount = event.trigger_seq - event.first_seq + 1;
+    spanCount = history.spans(event.first_seq, preCount, spans);
+    spanCount += history.spans(event.trigger_seq, event.sample_count - preCount + 1, spans + spanCount);
+  } else {
+    spanCount = history.spans(event.first_seq, event.sample_count, spans);
+  }
+  json.samples(spans, spanCount);
+  json.raw("}");
+  return json.ok();
+}
+
+bool BatchUploader::writeTelemetryJson(ByteSink& out, const Metrics& metrics) {
+  JsonWriter json(out);
+  json.raw("{\"device_id\":\"");
+  json.raw(deviceId_);
+  json.raw("\",\"fw_version\":\"");
+  json.raw(Config::kFirmwareVersion);
+  json.raw("\",\"uptime_ms\":");
+  json.u64(millis());
+  json.raw(",\"config_version\":");
+  json.u64(configVersion_);
+  json.raw(",");
+  const bool fields = json.ok() && metrics.writeJsonFields(out);
+  json.raw("}");
+  return fields && json.ok();
+}
+
+// Queues points_ as one batch record and clears it.
+void BatchUploader::queueSamplesBatch(uint32_t samplePeriodMs) {
+  samplePeriodMs = reducer_.periodMs(samplePeriodMs);
+  const uint8_t gzipFlag = compression_ ? kRecordGzip : 0;
+  bool stored = false;
+  if (format_ == UploadFormat::Binary) {
+    StorageQueue::RecordWriter writer(samplesChannel_.queue, kRecordBinary | gzipFlag, points_.size() * 3 + 64);
+    ByteSink& body = beginRecordBody(writer);
+    stored = SampleBatchCodec::encode(body,
+                                      deviceId_,
+                                      Config::kFirmwareVersion,
+                                      samplePeriodMs,
+                                      points_.samples.data(),
+                                      points_.size(),
+                                      points_.summaries.empty() ? nullptr : points_.summaries.data(),
+                                      points_.channels.empty() ? nullptr : points_.channels.data(),
+                                      &energy_) &&
+             finishRecordBody() && writer.commit();
+  } else {
+    StorageQueue::RecordWriter writer(samplesChannel_.queue, kRecordJson | gzipFlag, points_.size() * 24 + 128);
+    stored = writeSamplesJson(beginRecordBody(writer), samplePeriodMs) && finishRecordBody() && writer.commit();
+  }
+  if (!stored) {
+    Serial.println("[QUEUE] Failed to store samples payload");
+  } else if (compression_) {
+    Serial.printf("[QUEUE] Samples batch gzip %u -> %u bytes\n",
+                  static_cast<unsigned int>(gzip_.inputBytes()),
+                  static_cast<unsigned int>(gzip_.outputBytes()));
+  }
+  points_.clear();
 }
 
-void BatchUploader::queueSamplesPayload(const String& payload) {
-  samplesQueue_.enqueue(payload);
+// Sizes the batch vectors once for the row layout of the windows now arriving, so the open
+// batch takes kBatchRamBytes however many points the batch limit allows. The layout only
+// changes with the reduction mode (which queues the batch first) or the channel layout.
+void BatchUploader::reserveBatch(bool channels) {
+  const bool summaries = reducer_.periodMs(Config::kWindowMs) != Config::kWindowMs;
+  const size_t rowBytes = sizeof(VoltageSample) + (summaries ? sizeof(SampleSummary) : 0) +
+                          (channels ? sizeof(ChannelValues) : 0);
+  if (rowBytes == batchRowBytes_) {
+    return;
+  }
+  batchRowBytes_ = rowBytes;
+  batchRows_ = std::max<size_t>(Config::kBatchRamBytes / rowBytes, 2 * kMaxRowsPerAdd);
+  points_ = SamplePoints();
+  points_.samples.reserve(batchRows_);
+  if (summaries) {
+    points_.summaries.reserve(batchRows_);
+  }
+  if (channels) {
+    points_.channels.reserve(batchRows_);
+  }
+}
+
+// Returns the sink an encoder should write a record body to: the record itself, or the
+// compressor in front of it.
+ByteSink& BatchUploader::beginRecordBody(ByteSink& record) {
+  if (!compression_) {
+    return record;
+  }
+  gzip_.begin(record);
+  return gzip_;
 }
 
-void BatchUploader::queueEventPayload(const String& payload) {
-  eventsQueue_.enqueue(payload);
+bool BatchUploader::finishRecordBody() {
+  return !compression_ || gzip_.finish();
 }
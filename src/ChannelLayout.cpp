@@ -0,0 +1,65 @@
+#include "ChannelLayout.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace {
+bool isAdc1Pin(long pin) {
+  return pin >= 32 && pin <= 39;
+}
+} // namespace
+
+bool ChannelLayout::parse(const char* text) {
+  ChannelLayout parsed;
+  parsed.count = 0;
+  const char* p = text;
+  for (;;) {
+    while (*p == ' ' || *p == ',') {
+      ++p;
+    }
+    if (*p == '\0') {
+      break;
+    }
+    const char kind = static_cast<char>(toupper(static_cast<unsigned char>(*p)));
+    if ((kind != 'V' && kind != 'I') || parsed.count == Config::kMaxAdcChannels) {
+      return false;
+    }
+    char* end = nullptr;
+    const long pin = strtol(p + 1, &end, 10);
+    if (end == p + 1 || !isAdc1Pin(pin) || (*end != '\0' && *end != ' ' && *end != ',')) {
+      return false;
+    }
+    for (size_t i = 0; i < parsed.count; ++i) {
+      if (parsed.pins[i] == static_cast<gpio_num_t>(pin)) {
+        return false;
+      }
+    }
+    parsed.kinds[parsed.count] = kind == 'I' ? ChannelKind::Current : ChannelKind::Voltage;
+    parsed.pins[parsed.count] = static_cast<gpio_num_t>(pin);
+    parsed.count++;
+    p = end;
+  }
+  if (parsed.count == 0 || parsed.kinds[0] != ChannelKind::Voltage) {
+    return false;
+  }
+  *this = parsed;
+  return true;
+}
+
+void ChannelLayout::format(char* buf, size_t size) const {
+  size_t used = 0;
+  buf[0] = '\0';
+  for (size_t i = 0; i < count && used < size; ++i) {
+    const int written = snprintf(buf + used,
+                                 size - used,
+                                 "%s%c%d",
+                                 i == 0 ? "" : " ",
+                                 kinds[i] == ChannelKind::Current ? 'I' : 'V',
+                                 static_cast<int>(pins[i]));
+    if (written < 0) {
+      return;
+    }
+    used += static_cast<size_t>(written);
+  }
+}
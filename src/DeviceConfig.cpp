@@ -0,0 +1,220 @@
+#include "DeviceConfig.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+namespace {
+constexpr uint32_t kMaxBatchWaitS = 24 * 60 * 60;
+
+bool parseFloat(const char* text, float minValue, float maxValue, float& out) {
+  char* end = nullptr;
+  const float value = strtof(text, &end);
+  if (end == text || *end != '\0' || !isfinite(value) || value < minValue || value > maxValue) {
+    return false;
+  }
+  out = value;
+  return true;
+}
+
+bool parseUint(const char* text, uint32_t minValue, uint32_t maxValue, uint32_t& out) {
+  char* end = nullptr;
+  const unsigned long value = strtoul(text, &end, 10);
+  if (end == text || *end != '\0' || *text == '-' || value < minValue || value > maxValue) {
+    return false;
+  }
+  out = static_cast<uint32_t>(value);
+  return true;
+}
+
+bool parseChoice(const char* text, const char* off, const char* on, bool& out) {
+  if (strcasecmp(text, off) == 0) {
+    out = false;
+  } else if (strcasecmp(text, on) == 0) {
+    out = true;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool parseText(const char* text, char* out, size_t size) {
+  const size_t length = strlen(text);
+  if (length >= size) {
+    return false;
+  }
+  memcpy(out, text, length + 1);
+  return true;
+}
+
+// "gain3" -> channel 3; plain "gain" is not accepted, the channel is always explicit.
+bool channelKey(const char* key, const char* prefix, size_t& channel) {
+  const size_t length = strlen(prefix);
+  if (strncmp(key, prefix, length) != 0 || key[length] < '0' || key[length] > '9' || key[length + 1] != '\0') {
+    return false;
+  }
+  channel = static_cast<size_t>(key[length] - '0');
+  return true;
+}
+
+enum class KeyResult {
+  Applied,
+  Invalid,
+  Unknown,
+};
+
+KeyResult setValue(DeviceConfig& config, const char* key, const char* value) {
+  size_t channel = 0;
+  for (const char* prefix : {"gain", "offset", "phase"}) {
+    if (!channelKey(key, prefix, channel)) {
+      continue;
+    }
+    if (channel >= config.channelCount) {
+      return KeyResult::Invalid;
+    }
+    DeviceConfig::Calibration& calib = config.calib[channel];
+    bool ok = false;
+    if (prefix[0] == 'g') {
+      ok = parseFloat(value, 1e-6f, 1e6f, calib.gain);
+    } else if (prefix[0] == 'o') {
+      ok = parseFloat(value, -1000.0f, 1000.0f, calib.offset);
+    } else {
+      ok = parseFloat(value, -90.0f, 90.0f, calib.phase);
+    }
+    calib.present = true;
+    return ok ? KeyResult::Applied : KeyResult::Invalid;
+  }
+
+  bool ok = false;
+  uint32_t number = 0;
+  if (strcmp(key, "version") == 0) {
+    ok = parseUint(value, 0, UINT32_MAX, config.version);
+  } else if (strcmp(key, "thresholds") == 0) {
+    ok = config.thresholds.parse(value);
+  } else if (strcmp(key, "batch_points") == 0) {
+    ok = parseUint(value, 1, Config::kBatchMaxPoints, config.batchMaxPoints);
+  } else if (strcmp(key, "batch_wait_s") == 0) {
+    ok = parseUint(value, 1, kMaxBatchWaitS, number);
+    config.batchMaxWaitMs = number * 1000;
+  } else if (strcmp(key, "window") == 0) {
+    ok = parseChoice(value, "fixed", "cycles", config.cycleSync);
+  } else if (strcmp(key, "harmonics") == 0) {
+    ok = parseChoice(value, "off", "on", config.harmonics);
+  } else if (strcmp(key, "format") == 0) {
+    bool binary = false;
+    ok = parseChoice(value, "json", "bin", binary);
+    config.uploadFormat = binary ? UploadFormat::Binary : UploadFormat::Json;
+  } else if (strcmp(key, "gzip") == 0) {
+    ok = parseChoice(value, "off", "on", config.compression);
+  } else if (strcmp(key, "reduce") == 0) {
+    ok = SampleReductionFromString(value, config.reduction);
+  } else if (strcmp(key, "swing_tol") == 0) {
+    ok = parseFloat(value, 0.01f, 50.0f, config.swingToleranceV);
+  } else if (strcmp(key, "fw_version") == 0) {
+    ok = parseText(value, config.firmware.version, sizeof(config.firmware.version));
+  } else if (strcmp(key, "fw_path") == 0) {
+    ok = value[0] == '/' && parseText(value, config.firmware.path, sizeof(config.firmware.path));
+  } else if (strcmp(key, "fw_size") == 0) {
+    ok = parseUint(value, 1, UINT32_MAX, config.firmware.size);
+  } else if (strcmp(key, "fw_sha256") == 0) {
+    ok = Sha256::fromHex(value, config.firmware.sha256);
+  } else {
+    return KeyResult::Unknown;
+  }
+  return ok ? KeyResult::Applied : KeyResult::Invalid;
+}
+} // namespace
+
+bool DeviceConfig::parse(const char* document, uint32_t* unknownKeys, uint32_t* errorLine) {
+  DeviceConfig parsed = *this;
+  uint32_t unknown = 0;
+  uint32_t lineNumber = 0;
+  const char* p = document;
+  while (*p != '\0') {
+    lineNumber++;
+    const char* end = p + strcspn(p, "\r\n");
+    const char* next = *end == '\0' ? end : end + 1;
+    while (p < end && (*p == ' ' || *p == '\t')) {
+      ++p;
+    }
+    const char* last = end;
+    while (last > p && (last[-1] == ' ' || last[-1] == '\t')) {
+      --last;
+    }
+    if (p == last || *p == '#') {
+      p = next;
+      continue;
+    }
+
+    char line[ThresholdProfile::kTextLength + 32];
+    const size_t length = static_cast<size_t>(last - p);
+    char* equals = nullptr;
+    if (length < sizeof(line)) {
+      memcpy(line, p, length);
+      line[length] = '\0';
+      equals = strchr(line, '=');
+    }
+    if (equals == nullptr || equals == line || equals[1] == '\0') {
+      if (errorLine != nullptr) {
+        *errorLine = lineNumber;
+      }
+      return false;
+    }
+    *equals = '\0';
+    const KeyResult result = setValue(parsed, line, equals + 1);
+    if (result == KeyResult::Invalid) {
+      if (errorLine != nullptr) {
+        *errorLine = lineNumber;
+      }
+      return false;
+    }
+    unknown += result == KeyResult::Unknown ? 1 : 0;
+    p = next;
+  }
+
+  if (unknownKeys != nullptr) {
+    *unknownKeys = unknown;
+  }
+  *this = parsed;
+  return true;
+}
+
+void DeviceConfig::format(char* buf, size_t size) const {
+  size_t used = 0;
+  auto append = [&](const char* fmt, auto... args) {
+    if (used < size) {
+      const int n = snprintf(buf + used, size - used, fmt, args...);
+      used += n > 0 ? static_cast<size_t>(n) : 0;
+    }
+  };
+
+  append("version=%lu\n", static_cast<unsigned long>(version));
+  for (size_t i = 0; i < channelCount; ++i) {
+    if (calib[i].present) {
+      const unsigned int channel = static_cast<unsigned int>(i);
+      append("gain%u=%.6g\n", channel, calib[i].gain);
+      append("offset%u=%.6g\n", channel, calib[i].offset);
+      append("phase%u=%.6g\n", channel, calib[i].phase);
+    }
+  }
+  char profile[ThresholdProfile::kTextLength];
+  thresholds.format(profile, sizeof(profile));
+  append("thresholds=%s\n", profile);
+  append("batch_points=%lu\nbatch_wait_s=%lu\n",
+         static_cast<unsigned long>(batchMaxPoints),
+         static_cast<unsigned long>(batchMaxWaitMs / 1000));
+  append("window=%s\nharmonics=%s\n", cycleSync ? "cycles" : "fixed", harmonics ? "on" : "off");
+  append("format=%s\ngzip=%s\n", UploadFormatToString(uploadFormat), compression ? "on" : "off");
+  append("reduce=%s\nswing_tol=%.2f\n", SampleReductionToString(reduction), swingToleranceV);
+  if (firmware.complete()) {
+    char hash[Sha256::kDigestSize * 2 + 1];
+    Sha256::toHex(firmware.sha256, hash);
+    append("fw_version=%s\nfw_path=%s\nfw_size=%lu\nfw_sha256=%s\n",
+           firmware.version,
+           firmware.path,
+           static_cast<unsigned long>(firmware.size),
+           hash);
+  }
+}
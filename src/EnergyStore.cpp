@@ -0,0 +1,81 @@
+#include "EnergyStore.h"
+
+#include "Crc32.h"
+
+#include <math.h>
+#include <stdio.h>
+
+bool EnergyStore::begin(ChannelEnergy& out) {
+  prefs_.begin("energy", false);
+  lastSaveMs_ = millis();
+  out = ChannelEnergy();
+  bool found = false;
+  for (size_t slot = 0; slot < Config::kEnergySlots; ++slot) {
+    char key[4];
+    slotKey(slot, key);
+    Record record;
+    if (prefs_.getBytes(key, &record, sizeof(record)) != sizeof(record) || record.crc != checksum(record)) {
+      continue;
+    }
+    if (!found || static_cast<int32_t>(record.sequence - sequence_) > 0) {
+      sequence_ = record.sequence;
+      out = record.energy;
+      found = true;
+    }
+  }
+  saved_ = out;
+  return found;
+}
+
+bool EnergyStore::update(const ChannelEnergy& energy) {
+  if (millis() - lastSaveMs_ < Config::kEnergySaveIntervalMs) {
+    return false;
+  }
+  bool moved = false;
+  for (size_t i = 0; i < Config::kMaxAdcChannels - 1; ++i) {
+    moved = moved || fabs(energy.importWh[i] - saved_.importWh[i]) >= Config::kEnergySaveMinWh ||
+            fabs(energy.exportWh[i] - saved_.exportWh[i]) >= Config::kEnergySaveMinWh;
+  }
+  if (!moved) {
+    lastSaveMs_ = millis();
+    return false;
+  }
+  return save(energy);
+}
+
+bool EnergyStore::save(const ChannelEnergy& energy) {
+  Record record;
+  record.sequence = sequence_ + 1;
+  record.energy = energy;
+  record.crc = checksum(record);
+  char key[4];
+  slotKey(record.sequence % Config::kEnergySlots, key);
+  lastSaveMs_ = millis();
+  if (prefs_.putBytes(key, &record, sizeof(record)) != sizeof(record)) {
+    Serial.printf("[ENERGY] NVS write failed (%s)\n", key);
+    return false;
+  }
+  sequence_ = record.sequence;
+  saved_ = energy;
+  return true;
+}
+
+void EnergyStore::clear() {
+  for (size_t slot = 0; slot < Config::kEnergySlots; ++slot) {
+    char key[4];
+    slotKey(slot, key);
+    prefs_.remove(key);
+  }
+  sequence_ = 0;
+  saved_ = ChannelEnergy();
+  lastSaveMs_ = millis();
+}
+
+uint32_t EnergyStore::checksum(const Record& record) {
+  const uint32_t crc = crc32Update(0, reinterpret_cast<const uint8_t*>(&record.sequence), sizeof(record.sequence));
+  return crc32Update(crc, reinterpret_cast<const uint8_t*>(&record.energy), sizeof(record.energy));
+}
+
+void EnergyStore::slotKey(size_t slot, char* key) {
+  snprintf(key, 4, "e%u", static_cast<unsigned int>(slot));
+}
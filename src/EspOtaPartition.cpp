@@ -0,0 +1,128 @@
+#include "EspOtaPartition.h"
+
+#include "Config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void EspOtaPartition::begin(const char* runningVersion) {
+  runningVersion_ = runningVersion;
+  prefs_.begin("ota", false);
+  snprintf(rejected_, sizeof(rejected_), "%s", prefs_.getString("rejected", "").c_str());
+  const String pending = prefs_.getString("pending", "");
+  if (pending.length() == 0) {
+    return;
+  }
+  if (strcmp(pending.c_str(), runningVersion) != 0) {
+    // The bootloader refused the new image and started the previous one.
+    Serial.printf("[OTA] %s did not boot, still running %s\n", pending.c_str(), runningVersion);
+    reject(pending.c_str());
+    return;
+  }
+  const uint32_t boots = prefs_.getUInt("boots", 0) + 1;
+  prefs_.putUInt("boots", boots);
+  pending_ = true;
+  if (boots > Config::kOtaMaxBootAttempts) {
+    Serial.printf("[OTA] %s restarted %lu times unconfirmed\n", runningVersion, static_cast<unsigned long>(boots - 1));
+    rollback();
+  }
+}
+
+size_t EspOtaPartition::capacity() const {
+  const esp_partition_t* next = esp_ota_get_next_update_partition(nullptr);
+  return next != nullptr ? next->size : 0;
+}
+
+bool EspOtaPartition::beginImage(size_t imageSize, const char* version) {
+  abort();
+  target_ = esp_ota_get_next_update_partition(nullptr);
+  if (target_ == nullptr || imageSize > target_->size) {
+    Serial.println("[OTA] No update partition that holds the image");
+    return false;
+  }
+  // Sequential writes erase each sector as the image reaches it, not the whole slot up front.
+  const esp_err_t err = esp_ota_begin(target_, OTA_WITH_SEQUENTIAL_WRITES, &handle_);
+  if (err != ESP_OK) {
+    Serial.printf("[OTA] esp_ota_begin failed (%s)\n", esp_err_to_name(err));
+    return false;
+  }
+  writing_ = true;
+  snprintf(imageVersion_, sizeof(imageVersion_), "%s", version);
+  return true;
+}
+
+bool EspOtaPartition::write(const uint8_t* data, size_t length) {
+  if (!writing_) {
+    return false;
+  }
+  const esp_err_t err = esp_ota_write(handle_, data, length);
+  if (err != ESP_OK) {
+    Serial.printf("[OTA] esp_ota_write failed (%s)\n", esp_err_to_name(err));
+    return false;
+  }
+  return true;
+}
+
+bool EspOtaPartition::activate() {
+  if (!writing_) {
+    return false;
+  }
+  writing_ = false;
+  // esp_ota_end() also checks the app image header and its own checksum.
+  esp_err_t err = esp_ota_end(handle_);
+  if (err == ESP_OK) {
+    err = esp_ota_set_boot_partition(target_);
+  }
+  if (err != ESP_OK) {
+    Serial.printf("[OTA] Activating the image failed (%s)\n", esp_err_to_name(err));
+    return false;
+  }
+  prefs_.putString("pending", imageVersion_);
+  prefs_.putUInt("boots", 0);
+  return true;
+}
+
+void EspOtaPartition::abort() {
+  if (writing_) {
+    esp_ota_abort(handle_);
+    writing_ = false;
+  }
+}
+
+bool EspOtaPartition::pendingValidation() const {
+  return pending_;
+}
+
+void EspOtaPartition::markValid() {
+  esp_ota_mark_app_valid_cancel_rollback();
+  clearPending();
+}
+
+void EspOtaPartition::rollback() {
+  reject(runningVersion_);
+  // With two app slots the next update partition is the one the previous image runs from.
+  const esp_partition_t* previous = esp_ota_get_next_update_partition(nullptr);
+  if (previous == nullptr || esp_ota_set_boot_partition(previous) != ESP_OK) {
+    Serial.println("[OTA] No previous image to roll back to");
+    return;
+  }
+  Serial.println("[OTA] Rolling back to the previous image");
+  Serial.flush();
+  ESP.restart();
+}
+
+bool EspOtaPartition::rejected(const char* version) const {
+  return rejected_[0] != '\0' && strcmp(rejected_, version) == 0;
+}
+
+void EspOtaPartition::reject(const char* version) {
+  snprintf(rejected_, sizeof(rejected_), "%s", version);
+  prefs_.putString("rejected", rejected_);
+  clearPending();
+}
+
+void EspOtaPartition::clearPending() {
+  pending_ = false;
+  prefs_.remove("pending");
+  prefs_.remove("boots");
+}
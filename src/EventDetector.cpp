@@ -2,117 +2,188 @@
 
 #include <algorithm>
 
-EventDetector::EventDetector() {
-  ringBuffer_.resize(Config::kRingBufferPoints);
-}
+EventDetector::EventDetector(size_t historyPoints)
+    : history_(historyPoints),
+      maxEventPoints_(static_cast<uint32_t>(historyPoints * Config::kEventMaxPoints / Config::kEventHistoryPoints)) {}
 
 void EventDetector::addSample(const VoltageSample& sample) {
-  ringBuffer_[ringIndex_] = sample;
-  ringIndex_ = (ringIndex_ + 1) % ringBuffer_.size();
-  if (ringIndex_ == 0) {
-    ringFull_ = true;
-  }
+  applyPendingProfile();
+  history_.append(sample);
 
   if (sample.flags & FLAG_NO_SIGNAL) {
-    eventActive_ = false;
-    postRecording_ = false;
+    // Nothing after the loss belongs to an event: complete every slot with the points it
+    // has. An event still open ends at the loss, or at its recovery if it was back in band.
+    while (activeCount_ > 0) {
+      ActiveEvent& active = active_[0];
+      if (!active.postRecording) {
+        active.event.end_ts = active.recoveryTs != 0 ? active.recoveryTs : sample.ts_ms;
+      }
+      finalizeEvent(0);
+    }
+    started_ = false;
     sagCounter_ = 0;
     swellCounter_ = 0;
-    endCounter_ = 0;
-    postCounter_ = 0;
+    fastCounter_ = 0;
     return;
   }
 
   float detectVrms = detectionValue();
+  if (profile_.mode == ThresholdMode::Nominal && activeCount_ == 0) {
+    trackBaseline(sample.vrms);
+  }
 
-  if (eventActive_) {
-    appendSampleToEvent(sample);
+  // Start detection is suspended while an event is still before its end condition.
+  bool eventOpen = false;
+  for (size_t i = 0; i < activeCount_;) {
+    ActiveEvent& active = active_[i];
+    appendSampleToEvent(active, sample);
 
-    bool endCondition = false;
-    if (activeType_ == EventType::Sag) {
-      if (detectVrms > Config::kSagEnd) {
-        endCounter_++;
-      } else {
-        endCounter_ = 0;
+    if (!active.postRecording) {
+      eventOpen = true;
+      if (endConditionMet(active, detectVrms)) {
+        active.event.end_ts = active.recoveryTs != 0 ? active.recoveryTs : sample.ts_ms;
+        active.postRecording = true;
+        active.postCounter = 0;
       }
-      endCondition = endCounter_ >= Config::kSagEndWindows;
-    } else if (activeType_ == EventType::Swell) {
-      if (detectVrms < Config::kSwellEnd) {
-        endCounter_++;
-      } else {
-        endCounter_ = 0;
-      }
-      endCondition = endCounter_ >= Config::kSwellEndWindows;
-    } else {
-      if (detectVrms > Config::kCriticalLow && detectVrms < Config::kCriticalHigh) {
-        endCounter_++;
-      } else {
-        endCounter_ = 0;
-      }
-      endCondition = endCounter_ >= Config::kCriticalEndWindows;
     }
 
-    if (endCondition && !postRecording_) {
-      activeEvent_.end_ts = sample.ts_ms;
-      postRecording_ = true;
-      postCounter_ = 0;
-    }
-
-    if (postRecording_) {
-      postCounter_++;
-      if (postCounter_ >= Config::kEventPostPoints) {
-        finalizeEvent();
+    if (active.postRecording) {
+      active.postCounter++;
+      if (active.postCounter >= Config::kEventPostPoints) {
+        finalizeEvent(i);
+        continue;
       }
     }
+    ++i;
+  }
+  if (eventOpen) {
     return;
   }
 
-  if (detectVrms < Config::kCriticalLow || detectVrms > Config::kCriticalHigh) {
-    startEvent(EventType::Critical, sample);
+  if (detectVrms < thresholds_.criticalLow || detectVrms > thresholds_.criticalHigh) {
+    startEvent(EventType::Critical, sample.ts_ms, sample.vrms, true);
     return;
   }
 
-  if (detectVrms < Config::kSagStart) {
+  if (detectVrms < thresholds_.sagStart) {
     sagCounter_++;
   } else {
     sagCounter_ = 0;
   }
 
-  if (detectVrms > Config::kSwellStart) {
+  if (detectVrms > thresholds_.swellStart) {
     swellCounter_++;
   } else {
     swellCounter_ = 0;
   }
 
-  if (sagCounter_ >= Config::kSagStartWindows) {
-    startEvent(EventType::Sag, sample);
+  if (sagCounter_ >= thresholds_.sagStartWindows) {
+    startEvent(EventType::Sag, sample.ts_ms, sample.vrms, true);
+    sagCounter_ = 0;
+  } else if (swellCounter_ >= thresholds_.swellStartWindows) {
+    startEvent(EventType::Swell, sample.ts_ms, sample.vrms, true);
+    swellCounter_ = 0;
+  }
+}
+
+void EventDetector::addHalfCycle(float vrms, uint64_t ts_ms) {
+  // A value covers the cycle up to ts_ms; one that first leaves or re-enters a band does so
+  // mostly through its newer half, so the change is stamped at the crossing before, half a
+  // measured period earlier. Nominal when a half cycle was skipped.
+  constexpr uint64_t kNominalHalfMs = 500 / Config::kMainsNominalHz;
+  uint64_t halfMs = ts_ms - lastHalfCycleTs_;
+  if (lastHalfCycleTs_ == 0 || ts_ms <= lastHalfCycleTs_ || halfMs > 2 * kNominalHalfMs) {
+    halfMs = kNominalHalfMs;
+  }
+  lastHalfCycleTs_ = ts_ms;
+  const uint64_t halfStartTs = ts_ms - halfMs;
+
+  if (activeCount_ > 0 && !active_[activeCount_ - 1].postRecording) {
+    ActiveEvent& open = active_[activeCount_ - 1];
+    open.event.min_vrms = std::min(open.event.min_vrms, vrms);
+    open.event.max_vrms = std::max(open.event.max_vrms, vrms);
+    if (!insideEndBand(open.event.type, vrms)) {
+      open.recoveryTs = 0;
+    } else if (open.recoveryTs == 0) {
+      open.recoveryTs = halfStartTs;
+    }
+    fastCounter_ = 0;
+    return;
+  }
+
+  EventType type;
+  if (vrms < thresholds_.criticalLow || vrms > thresholds_.criticalHigh) {
+    type = EventType::Critical;
+  } else if (vrms < thresholds_.sagStart) {
+    type = EventType::Sag;
+  } else if (vrms > thresholds_.swellStart) {
+    type = EventType::Swell;
+  } else {
+    fastCounter_ = 0;
+    return;
+  }
+
+  if (fastCounter_ == 0 || type != fastType_) {
+    fastType_ = type;
+    fastOnsetTs_ = halfStartTs;
+    fastCounter_ = 0;
+  }
+  if (++fastCounter_ >= thresholds_.fastTriggerHalfCycles) {
+    startEvent(type, fastOnsetTs_, vrms, false);
+    fastCounter_ = 0;
     sagCounter_ = 0;
-  } else if (swellCounter_ >= Config::kSwellStartWindows) {
-    startEvent(EventType::Swell, sample);
     swellCounter_ = 0;
   }
 }
 
+bool EventDetector::setProfile(const ThresholdProfile& profile) {
+  return pendingProfiles_.push(profile);
+}
+
+float EventDetector::baseline() const {
+  return publishedBaseline_.load(std::memory_order_relaxed);
+}
+
 bool EventDetector::pollCompletedEvent(VoltageEvent& eventOut) {
-  if (!completedReady_) {
+  return completed_.pop(eventOut);
+}
+
+bool EventDetector::pollStartedEvent(VoltageEvent& eventOut) {
+  if (!started_) {
     return false;
   }
-  eventOut = completedEvent_;
-  completedReady_ = false;
+  started_ = false;
+  eventOut = active_[activeCount_ - 1].event;
   return true;
 }
 
+const SampleHistory& EventDetector::history() const {
+  return history_;
+}
+
+uint32_t EventDetector::truncatedEvents() const {
+  return truncatedEvents_.load(std::memory_order_relaxed);
+}
+
+uint32_t EventDetector::shortenedEvents() const {
+  return shortenedEvents_.load(std::memory_order_relaxed);
+}
+
+uint32_t EventDetector::droppedEvents() const {
+  return completed_.overflowCount();
+}
+
 float EventDetector::detectionValue() const {
   float sum = 0.0f;
   int count = 0;
-  size_t available = ringFull_ ? ringBuffer_.size() : ringIndex_;
-  size_t limit = std::min<size_t>(3, available);
-  for (size_t i = 0; i < limit; ++i) {
-    size_t index = (ringIndex_ + ringBuffer_.size() - 1 - i) % ringBuffer_.size();
-    if (ringBuffer_[index].flags & FLAG_NO_SIGNAL) {
+  const uint32_t newest = history_.nextSeq() - 1;
+  uint32_t limit = std::min<uint32_t>(3, history_.retained());
+  for (uint32_t i = 0; i < limit; ++i) {
+    const VoltageSample& sample = history_.at(newest - i);
+    if (sample.flags & FLAG_NO_SIGNAL) {
       continue;
     }
-    sum += ringBuffer_[index].vrms;
+    sum += sample.vrms;
     count++;
   }
   if (count == 0) {
@@ -121,41 +192,120 @@ float EventDetector::detectionValue() const {
   return sum / static_cast<float>(count);
 }
 
-void EventDetector::startEvent(EventType type, const VoltageSample& sample) {
-  eventActive_ = true;
-  postRecording_ = false;
-  activeType_ = type;
-  endCounter_ = 0;
-  postCounter_ = 0;
+bool EventDetector::endConditionMet(ActiveEvent& active, float detectVrms) const {
+  if (active.event.type == EventType::Sag) {
+    if (detectVrms > thresholds_.sagEnd) {
+      active.endCounter++;
+    } else {
+      active.endCounter = 0;
+    }
+    return active.endCounter >= thresholds_.sagEndWindows;
+  }
+  if (active.event.type == EventType::Swell) {
+    if (detectVrms < thresholds_.swellEnd) {
+      active.endCounter++;
+    } else {
+      active.endCounter = 0;
+    }
+    return active.endCounter >= thresholds_.swellEndWindows;
+  }
+  if (detectVrms > thresholds_.criticalLow && detectVrms < thresholds_.criticalHigh) {
+    active.endCounter++;
+  } else {
+    active.endCounter = 0;
+  }
+  return active.endCounter >= thresholds_.criticalEndWindows;
+}
 
-  activeEvent_ = {};
-  activeEvent_.type = type;
-  activeEvent_.start_ts = sample.ts_ms;
-  activeEvent_.min_vrms = sample.vrms;
-  activeEvent_.max_vrms = sample.vrms;
-  activeEvent_.samples.clear();
+bool EventDetector::insideEndBand(EventType type, float vrms) const {
+  switch (type) {
+    case EventType::Sag:
+      return vrms > thresholds_.sagEnd;
+    case EventType::Swell:
+      return vrms < thresholds_.swellEnd;
+    default:
+      return vrms > thresholds_.criticalLow && vrms < thresholds_.criticalHigh;
+  }
+}
+
+void EventDetector::startEvent(EventType type, uint64_t ts_ms, float vrms, bool windowTrigger) {
+  if (activeCount_ == Config::kMaxActiveEvents) {
+    // No free slot. Starts wait for the open event to end, so every slot is post-recording:
+    // complete the oldest now, with a shorter post-trigger window, rather than lose the new
+    // disturbance or its type.
+    finalizeEvent(0);
+    shortenedEvents_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  ActiveEvent& active = active_[activeCount_++];
+  active = {};
 
-  size_t count = ringFull_ ? ringBuffer_.size() : ringIndex_;
-  size_t available = std::min(count, static_cast<size_t>(Config::kEventPrePoints));
-  activeEvent_.samples.reserve(available + Config::kEventPostPoints + 10);
+  // The pre-trigger window ends with the newest history entry: the trigger sample itself, or
+  // for the fast path the last window completed before the one still being measured.
+  const uint32_t count = std::min<uint32_t>(history_.retained(), Config::kEventPrePoints);
+  active.event.type = type;
+  active.event.start_ts = ts_ms;
+  active.event.min_vrms = vrms;
+  active.event.max_vrms = vrms;
+  active.event.first_seq = history_.nextSeq() - count;
+  active.event.sample_count = count;
+  active.event.trigger_seq = history_.nextSeq() - 1;
+  active.event.repeats_trigger = windowTrigger;
+  started_ = true;
+}
+
+void EventDetector::appendSampleToEvent(ActiveEvent& active, const VoltageSample& sample) {
+  VoltageEvent& event = active.event;
+  event.sample_count++;
+  if (event.sample_count > maxEventPoints_) {
+    event.first_seq++;
+    event.sample_count--;
+    if (!active.truncated) {
+      active.truncated = true;
+      truncatedEvents_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  event.min_vrms = std::min(event.min_vrms, sample.vrms);
+  event.max_vrms = std::max(event.max_vrms, sample.vrms);
+}
 
-  size_t startIndex = (ringIndex_ + ringBuffer_.size() - available) % ringBuffer_.size();
-  for (size_t i = 0; i < available; ++i) {
-    size_t idx = (startIndex + i) % ringBuffer_.size();
-    activeEvent_.samples.push_back(ringBuffer_[idx]);
+void EventDetector::finalizeEvent(size_t index) {
+  completed_.push(active_[index].event);
+  for (size_t i = index + 1; i < activeCount_; ++i) {
+    active_[i - 1] = active_[i];
   }
-  appendSampleToEvent(sample);
+  activeCount_--;
 }
 
-void EventDetector::appendSampleToEvent(const VoltageSample& sample) {
-  activeEvent_.samples.push_back(sample);
-  activeEvent_.min_vrms = std::min(activeEvent_.min_vrms, sample.vrms);
-  activeEvent_.max_vrms = std::max(activeEvent_.max_vrms, sample.vrms);
+void EventDetector::applyPendingProfile() {
+  if (pendingProfiles_.empty()) {
+    return;
+  }
+  ThresholdProfile profile;
+  while (pendingProfiles_.pop(profile)) {
+  }
+  if (profile.nominalV != profile_.nominalV || profile.mode != profile_.mode) {
+    baselineV_ = profile.nominalV;
+    publishedBaseline_.store(baselineV_, std::memory_order_relaxed);
+  }
+  baselineWindows_ = 0;
+  profile_ = profile;
+  thresholds_ = profile_.thresholds(baselineV_);
 }
 
-void EventDetector::finalizeEvent() {
-  completedEvent_ = activeEvent_;
-  completedReady_ = true;
-  eventActive_ = false;
-  postRecording_ = false;
+// Sliding reference: a first-order filter over windows with no event open and the value
+// inside the start levels, so the disturbances it is the reference for do not drag it along.
+void EventDetector::trackBaseline(float vrms) {
+  if (vrms <= thresholds_.sagStart || vrms >= thresholds_.swellStart) {
+    return;
+  }
+  constexpr float kAlpha = static_cast<float>(Config::kWindowMs) / Config::kBaselineTimeConstantMs;
+  const float limit = profile_.nominalV * Config::kBaselineMaxDeviation;
+  baselineV_ += kAlpha * (vrms - baselineV_);
+  baselineV_ = std::min(std::max(baselineV_, profile_.nominalV - limit), profile_.nominalV + limit);
+  if (++baselineWindows_ >= Config::kBaselineRefreshWindows) {
+    baselineWindows_ = 0;
+    thresholds_ = profile_.thresholds(baselineV_);
+    publishedBaseline_.store(baselineV_, std::memory_order_relaxed);
+  }
 }
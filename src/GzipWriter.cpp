@@ -0,0 +1,220 @@
+#include "GzipWriter.h"
+
+#include "Crc32.h"
+
+#include <string.h>
+
+namespace {
+const uint16_t kLengthBase[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                  31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t kLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t kDistanceBase[30] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,    65,    97,    129,
+                                    193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const uint8_t kDistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+constexpr uint32_t kEndOfBlock = 256;
+
+uint32_t reverseBits(uint32_t code, uint32_t count) {
+  uint32_t result = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    result = (result << 1) | (code & 1);
+    code >>= 1;
+  }
+  return result;
+}
+} // namespace
+
+bool GzipWriter::begin(ByteSink& out) {
+  out_ = &out;
+  ok_ = true;
+  crc_ = 0;
+  inputBytes_ = 0;
+  outputBytes_ = 0;
+  windowLen_ = 0;
+  pos_ = 0;
+  memset(head_, 0, sizeof(head_));
+  bitBuffer_ = 0;
+  bitCount_ = 0;
+  outputLen_ = 0;
+
+  // ID1 ID2 CM=deflate FLG=0 MTIME=0 XFL=0 OS=unknown
+  static const uint8_t kHeader[10] = {0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff};
+  for (uint8_t value : kHeader) {
+    putByte(value);
+  }
+  // Everything goes into one fixed-Huffman block; finish() appends an empty final block.
+  putBits(0, 1);
+  putBits(1, 2);
+  return ok_;
+}
+
+bool GzipWriter::write(const uint8_t* data, size_t len) {
+  if (!ok_) {
+    return false;
+  }
+  crc_ = crc32Update(crc_, data, len);
+  inputBytes_ += static_cast<uint32_t>(len);
+  while (len > 0 && ok_) {
+    if (windowLen_ == kBufferSize) {
+      slide();
+    }
+    size_t n = kBufferSize - windowLen_;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(window_ + windowLen_, data, n);
+    windowLen_ += n;
+    data += n;
+    len -= n;
+    compress(false);
+  }
+  return ok_;
+}
+
+bool GzipWriter::finish() {
+  if (!ok_) {
+    return false;
+  }
+  compress(true);
+  putSymbol(kEndOfBlock);
+  putBits(1, 1);
+  putBits(1, 2);
+  putSymbol(kEndOfBlock);
+  if (bitCount_ > 0) {
+    putBits(0, 8 - bitCount_);
+  }
+  for (int i = 0; i < 4; ++i) {
+    putByte(static_cast<uint8_t>(crc_ >> (8 * i)));
+  }
+  for (int i = 0; i < 4; ++i) {
+    putByte(static_cast<uint8_t>(inputBytes_ >> (8 * i)));
+  }
+  flushOutput();
+  out_ = nullptr;
+  return ok_;
+}
+
+uint32_t GzipWriter::inputBytes() const {
+  return inputBytes_;
+}
+
+uint32_t GzipWriter::outputBytes() const {
+  return outputBytes_;
+}
+
+// Keeps kMaxMatch bytes of lookahead unless flushAll is set at the end of the input.
+void GzipWriter::compress(bool flushAll) {
+  while (pos_ < windowLen_ && (flushAll || windowLen_ - pos_ >= kMaxMatch)) {
+    const size_t available = windowLen_ - pos_;
+    size_t bestLength = 0;
+    size_t bestDistance = 0;
+    if (available >= kMinMatch) {
+      const uint32_t hash = hashAt(pos_);
+      const size_t candidate = head_[hash];
+      head_[hash] = static_cast<uint16_t>(pos_ + 1);
+      if (candidate != 0) {
+        const size_t start = candidate - 1;
+        const size_t maxLength = available < kMaxMatch ? available : kMaxMatch;
+        size_t length = 0;
+        while (length < maxLength && window_[start + length] == window_[pos_ + length]) {
+          length++;
+        }
+        if (length >= kMinMatch) {
+          bestLength = length;
+          bestDistance = pos_ - start;
+        }
+      }
+    }
+
+    if (bestLength == 0) {
+      putSymbol(window_[pos_]);
+      pos_++;
+      continue;
+    }
+    emitMatch(bestLength, bestDistance);
+    for (size_t i = 1; i < bestLength; ++i) {
+      if (pos_ + i + kMinMatch <= windowLen_) {
+        insertHash(pos_ + i);
+      }
+    }
+    pos_ += bestLength;
+  }
+}
+
+void GzipWriter::slide() {
+  memmove(window_, window_ + kWindowSize, windowLen_ - kWindowSize);
+  windowLen_ -= kWindowSize;
+  pos_ -= kWindowSize;
+  for (size_t i = 0; i < kHashSize; ++i) {
+    head_[i] = head_[i] > kWindowSize ? static_cast<uint16_t>(head_[i] - kWindowSize) : 0;
+  }
+}
+
+uint32_t GzipWriter::hashAt(size_t pos) const {
+  uint32_t value = window_[pos] | (window_[pos + 1] << 8) | (window_[pos + 2] << 16);
+  return (value * 2654435761u) >> (32 - kHashBits);
+}
+
+void GzipWriter::insertHash(size_t pos) {
+  head_[hashAt(pos)] = static_cast<uint16_t>(pos + 1);
+}
+
+void GzipWriter::emitMatch(size_t length, size_t distance) {
+  size_t lengthCode = 0;
+  while (lengthCode + 1 < 29 && kLengthBase[lengthCode + 1] <= length) {
+    lengthCode++;
+  }
+  putSymbol(257 + lengthCode);
+  putBits(length - kLengthBase[lengthCode], kLengthExtra[lengthCode]);
+
+  size_t distanceCode = 0;
+  while (distanceCode + 1 < 30 && kDistanceBase[distanceCode + 1] <= distance) {
+    distanceCode++;
+  }
+  putHuffman(distanceCode, 5);
+  putBits(distance - kDistanceBase[distanceCode], kDistanceExtra[distanceCode]);
+}
+
+void GzipWriter::putBits(uint32_t value, uint32_t count) {
+  bitBuffer_ |= value << bitCount_;
+  bitCount_ += count;
+  while (bitCount_ >= 8) {
+    putByte(static_cast<uint8_t>(bitBuffer_));
+    bitBuffer_ >>= 8;
+    bitCount_ -= 8;
+  }
+}
+
+// Huffman codes are defined MSB-first while deflate packs bits LSB-first.
+void GzipWriter::putHuffman(uint32_t code, uint32_t count) {
+  putBits(reverseBits(code, count), count);
+}
+
+// Fixed literal/length code from RFC 1951 section 3.2.6.
+void GzipWriter::putSymbol(uint32_t symbol) {
+  if (symbol < 144) {
+    putHuffman(0x30 + symbol, 8);
+  } else if (symbol < 256) {
+    putHuffman(0x190 + (symbol - 144), 9);
+  } else if (symbol < 280) {
+    putHuffman(symbol - 256, 7);
+  } else {
+    putHuffman(0xC0 + (symbol - 280), 8);
+  }
+}
+
+void GzipWriter::putByte(uint8_t value) {
+  output_[outputLen_++] = value;
+  if (outputLen_ == sizeof(output_)) {
+    flushOutput();
+  }
+}
+
+bool GzipWriter::flushOutput() {
+  if (outputLen_ > 0 && ok_) {
+    ok_ = out_->write(output_, outputLen_);
+    outputBytes_ += static_cast<uint32_t>(outputLen_);
+  }
+  outputLen_ = 0;
+  return ok_;
+}
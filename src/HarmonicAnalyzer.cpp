@@ -0,0 +1,61 @@
+#include "HarmonicAnalyzer.h"
+
+#include <algorithm>
+#include <math.h>
+
+static_assert(Config::kHarmonicMaxOrder >= 7, "the 3rd, 5th and 7th harmonics are reported");
+
+void HarmonicAnalyzer::begin(float lineHz, uint32_t sampleRateHz) {
+  // coeff = 2 cos(h w); cos(h w) = 2 cos(w) cos((h - 1) w) - cos((h - 2) w).
+  const float c1 = 2.0f * cosf(2.0f * static_cast<float>(M_PI) * lineHz / static_cast<float>(sampleRateHz));
+  float previous = 2.0f;
+  float current = c1;
+  for (size_t h = 0; h < kOrders; ++h) {
+    coeff_[h] = current;
+    const float next = c1 * current - previous;
+    previous = current;
+    current = next;
+  }
+  std::fill(s1_, s1_ + kOrders, 0.0f);
+  std::fill(s2_, s2_ + kOrders, 0.0f);
+  count_ = 0;
+}
+
+void HarmonicAnalyzer::accumulate(const uint16_t* raw, size_t count, int32_t dc) {
+  count = std::min<size_t>(count, WindowKernel::kMaxBlock);
+  for (size_t i = 0; i < count; ++i) {
+    block_[i] = static_cast<float>(static_cast<int32_t>(raw[i]) - dc);
+  }
+  // One filter at a time keeps its state in registers across the block.
+  for (size_t h = 0; h < kOrders; ++h) {
+    const float c = coeff_[h];
+    float s1 = s1_[h];
+    float s2 = s2_[h];
+    for (size_t i = 0; i < count; ++i) {
+      const float s0 = block_[i] + c * s1 - s2;
+      s2 = s1;
+      s1 = s0;
+    }
+    s1_[h] = s1;
+    s2_[h] = s2;
+  }
+  count_ += count;
+}
+
+bool HarmonicAnalyzer::finish(Result& out) const {
+  if (count_ == 0) {
+    return false;
+  }
+  // |X|^2 = s1^2 + s2^2 - coeff s1 s2; a sine of amplitude A gives |X| = A N / 2.
+  const float scale = sqrtf(2.0f) / static_cast<float>(count_);
+  float distortion = 0.0f;
+  for (size_t h = 0; h < kOrders; ++h) {
+    const float power = s1_[h] * s1_[h] + s2_[h] * s2_[h] - coeff_[h] * s1_[h] * s2_[h];
+    out.rms[h] = sqrtf(std::max(power, 0.0f)) * scale;
+    if (h > 0) {
+      distortion += out.rms[h] * out.rms[h];
+    }
+  }
+  out.thdPct = out.rms[0] > 0.0f ? 100.0f * sqrtf(distortion) / out.rms[0] : 0.0f;
+  return true;
+}
@@ -0,0 +1,129 @@
+#include "HttpSession.h"
+
+#include "Config.h"
+
+void HttpSession::begin(const char* baseUrl, const char* deviceId, const char* apiKey) {
+  baseUrl_ = baseUrl;
+  deviceId_ = deviceId;
+  apiKey_ = apiKey;
+  http_.setReuse(true);
+  http_.setTimeout(Config::kHttpTimeoutMs);
+}
+
+void HttpSession::update() {
+  if (client_.connected() && millis() - lastUseMs_ > Config::kHttpIdleTimeoutMs) {
+    close();
+  }
+}
+
+int HttpSession::post(const char* path, const char* contentType, Stream& body, size_t size, const char* contentEncoding) {
+  prepare(path);
+  http_.addHeader("Content-Type", contentType);
+  if (contentEncoding != nullptr) {
+    http_.addHeader("Content-Encoding", contentEncoding);
+  }
+  const unsigned long start = millis();
+  int httpCode = http_.sendRequest("POST", &body, size);
+  stats_.busyMs += millis() - start;
+  finish(httpCode);
+  return httpCode;
+}
+
+int HttpSession::get(const char* path, String& body, const char* ifNoneMatch, String* etag) {
+  prepare(path);
+  if (ifNoneMatch != nullptr && ifNoneMatch[0] != '\0') {
+    http_.addHeader("If-None-Match", ifNoneMatch);
+  }
+  const char* collected[] = {"ETag"};
+  http_.collectHeaders(collected, 1);
+  const unsigned long start = millis();
+  int httpCode = http_.GET();
+  if (httpCode >= 200 && httpCode < 300) {
+    body = http_.getString();
+    if (etag != nullptr) {
+      *etag = http_.header("ETag");
+    }
+  }
+  stats_.busyMs += millis() - start;
+  finish(httpCode);
+  return httpCode;
+}
+
+int HttpSession::getRange(const char* path, size_t offset, uint8_t* buf, size_t length, size_t& received) {
+  received = 0;
+  prepare(path);
+  char range[40];
+  snprintf(range,
+           sizeof(range),
+           "bytes=%lu-%lu",
+           static_cast<unsigned long>(offset),
+           static_cast<unsigned long>(offset + length - 1));
+  http_.addHeader("Range", range);
+  const unsigned long start = millis();
+  int httpCode = http_.GET();
+  size_t expected = 0;
+  if (httpCode == 206) {
+    // Content-Length bounds the read so the keep-alive socket is left at the next response.
+    const int size = http_.getSize();
+    expected = size >= 0 && static_cast<size_t>(size) < length ? static_cast<size_t>(size) : length;
+    Stream* stream = http_.getStreamPtr();
+    while (stream != nullptr && received < expected) {
+      const size_t n = stream->readBytes(buf + received, expected - received);
+      if (n == 0) {
+        break;
+      }
+      received += n;
+    }
+  }
+  stats_.busyMs += millis() - start;
+  finish(httpCode);
+  if (received < expected) {
+    close(); // the rest of a short body would be read as the next response
+  }
+  return httpCode;
+}
+
+bool HttpSession::lastRequestReused() const {
+  return lastReused_;
+}
+
+void HttpSession::close() {
+  http_.end();
+  client_.stop();
+}
+
+const HttpSession::Stats& HttpSession::stats() const {
+  return stats_;
+}
+
+void HttpSession::prepare(const char* path) {
+  lastReused_ = client_.connected();
+  if (!lastReused_) {
+    if (stats_.connectionsOpened > 0) {
+      Serial.printf("[HTTP] New connection (previous served %u requests)\n",
+                    static_cast<unsigned int>(stats_.requestsOnConnection));
+    }
+    stats_.connectionsOpened++;
+    stats_.requestsOnConnection = 0;
+  }
+  http_.begin(client_, String(baseUrl_) + path);
+  http_.addHeader("X-DEVICE-ID", deviceId_);
+  if (apiKey_ != nullptr && strlen(apiKey_) > 0) {
+    http_.addHeader("X-API-KEY", apiKey_);
+  }
+}
+
+void HttpSession::finish(int httpCode) {
+  stats_.requests++;
+  stats_.requestsOnConnection++;
+  if (stats_.requestsOnConnection > stats_.maxRequestsPerConnection) {
+    stats_.maxRequestsPerConnection = stats_.requestsOnConnection;
+  }
+  // end() keeps the socket open when the server allowed keep-alive.
+  http_.end();
+  if (httpCode < 0) {
+    stats_.errors++;
+    client_.stop();
+  }
+  lastUseMs_ = millis();
+}
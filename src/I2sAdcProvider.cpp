@@ -0,0 +1,126 @@
+#include "I2sAdcProvider.h"
+
+#include "I2sAdcSamples.h"
+
+#include <algorithm>
+#include <soc/syscon_struct.h>
+
+namespace {
+constexpr int kEventQueueLength = 4;
+// SAR ADC1 pattern table entry: channel, 12-bit width, 11 dB attenuation.
+constexpr uint32_t kPatternWidth12Bit = 3;
+constexpr uint32_t kPatternAtten11dB = 3;
+}
+
+I2sAdcProvider::I2sAdcProvider(gpio_num_t pin, uint32_t sampleRateHz) : sampleRateHz_(sampleRateHz) {
+  pins_[0] = pin;
+}
+
+void I2sAdcProvider::setPins(const gpio_num_t* pins, size_t count) {
+  pinCount_ = std::min(std::max<size_t>(count, 1), Config::kMaxAdcChannels);
+  std::copy(pins, pins + pinCount_, pins_);
+}
+
+bool I2sAdcProvider::begin() {
+  for (size_t i = 0; i < pinCount_; ++i) {
+    int8_t channel = digitalPinToAnalogChannel(pins_[i]);
+    if (channel < 0 || channel >= ADC1_CHANNEL_MAX) {
+      Serial.printf("[ADC] GPIO%d is not an ADC1 pin\n", static_cast<int>(pins_[i]));
+      return false;
+    }
+    channels_[i] = static_cast<adc1_channel_t>(channel);
+  }
+
+  i2s_config_t config = {};
+  config.mode = static_cast<i2s_mode_t>(I2S_MODE_MASTER | I2S_MODE_RX | I2S_MODE_ADC_BUILT_IN);
+  // The I2S clock paces the conversions, one input after the other.
+  config.sample_rate = sampleRateHz_ * pinCount_;
+  config.bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT;
+  config.channel_format = I2S_CHANNEL_FMT_ONLY_LEFT;
+  config.communication_format = I2S_COMM_FORMAT_STAND_I2S;
+  config.intr_alloc_flags = ESP_INTR_FLAG_LEVEL1;
+  config.dma_buf_count = Config::kAdcDmaBufferCount;
+  config.dma_buf_len = Config::kAdcDmaBufferLen;
+  config.use_apll = false;
+
+  esp_err_t err = i2s_driver_install(port_, &config, kEventQueueLength, &eventQueue_);
+  if (err != ESP_OK) {
+    Serial.printf("[ADC] i2s_driver_install failed (%d)\n", err);
+    return false;
+  }
+  adc1_config_width(ADC_WIDTH_BIT_12);
+  for (size_t i = 0; i < pinCount_; ++i) {
+    adc1_config_channel_atten(channels_[i], ADC_ATTEN_DB_11);
+  }
+  i2s_set_adc_mode(ADC_UNIT_1, channels_[0]);
+  err = i2s_adc_enable(port_);
+  if (err != ESP_OK) {
+    Serial.printf("[ADC] i2s_adc_enable failed (%d)\n", err);
+    return false;
+  }
+  if (pinCount_ > 1) {
+    setScanPattern();
+  }
+  return true;
+}
+
+// The legacy I2S driver only programs a one-entry pattern (and rewrites it in i2s_adc_enable()),
+// so the scan over every input is written straight into the SAR controller afterwards. Entries
+// are 8 bits, four per register, the first in the most significant byte.
+void I2sAdcProvider::setScanPattern() {
+  uint32_t table[(Config::kMaxAdcChannels + 3) / 4] = {};
+  for (size_t i = 0; i < pinCount_; ++i) {
+    const uint32_t entry = (static_cast<uint32_t>(channels_[i]) << 4) | (kPatternWidth12Bit << 2) | kPatternAtten11dB;
+    table[i / 4] |= entry << (24 - 8 * (i % 4));
+  }
+  for (size_t i = 0; i < sizeof(table) / sizeof(table[0]); ++i) {
+    SYSCON.saradc_sar1_patt_tab[i] = table[i];
+  }
+  SYSCON.saradc_ctrl.sar1_patt_len = pinCount_ - 1;
+}
+
+size_t I2sAdcProvider::read(uint16_t* out, size_t maxCount, uint32_t timeoutMs) {
+  drainEvents();
+  if (pinCount_ == 1 && maxCount > 1) {
+    maxCount &= ~static_cast<size_t>(1); // whole DMA words, so no pair is split across reads
+  }
+  size_t bytesRead = 0;
+  esp_err_t err = i2s_read(port_, out, maxCount * sizeof(uint16_t), &bytesRead, pdMS_TO_TICKS(timeoutMs));
+  if (err != ESP_OK) {
+    return 0;
+  }
+  size_t count = bytesRead / sizeof(uint16_t);
+  if (pinCount_ > 1) {
+    return count;
+  }
+  i2sAdcUnpackSingle(out, count);
+  return count;
+}
+
+uint32_t I2sAdcProvider::sampleRateHz() const {
+  return sampleRateHz_;
+}
+
+uint32_t I2sAdcProvider::overrunCount() const {
+  return overruns_;
+}
+
+size_t I2sAdcProvider::inputCount() const {
+  return pinCount_;
+}
+
+uint8_t I2sAdcProvider::inputTag(size_t index) const {
+  return static_cast<uint8_t>(channels_[index < pinCount_ ? index : 0]);
+}
+
+void I2sAdcProvider::drainEvents() {
+  if (eventQueue_ == nullptr) {
+    return;
+  }
+  i2s_event_t event;
+  while (xQueueReceive(eventQueue_, &event, 0) == pdTRUE) {
+    if (event.type == I2S_EVENT_RX_Q_OVF) {
+      overruns_++;
+    }
+  }
+}
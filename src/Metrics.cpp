@@ -0,0 +1,201 @@
+#include "Metrics.h"
+
+#include "Config.h"
+
+#include <stdarg.h>
+
+#include <algorithm>
+
+namespace {
+const char* const kStageNames[] = {"sampler", "detector", "wifi", "time", "enqueue", "upload"};
+static_assert(sizeof(kStageNames) / sizeof(kStageNames[0]) == static_cast<size_t>(Metrics::Stage::Count),
+              "stage names out of sync");
+
+uint32_t cyclesToUs(uint64_t cycles) {
+  return static_cast<uint32_t>(cycles / getCpuFrequencyMhz());
+}
+
+class FieldWriter {
+ public:
+  explicit FieldWriter(ByteSink& out) : out_(out) {}
+
+  void printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    char buf[96];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len > 0) {
+      ok_ = ok_ && out_.write(reinterpret_cast<const uint8_t*>(buf), std::min<size_t>(len, sizeof(buf) - 1));
+    }
+  }
+
+  bool ok() const {
+    return ok_;
+  }
+
+ private:
+  ByteSink& out_;
+  bool ok_ = true;
+};
+} // namespace
+
+constexpr uint16_t Metrics::kLoopBucketMs[];
+
+uint32_t Metrics::cycleCount() {
+  return ESP.getCycleCount();
+}
+
+uint64_t Metrics::elapsedCycles(uint32_t startCycles, unsigned long startMs) {
+  const unsigned long elapsedMs = millis() - startMs;
+  if (elapsedMs >= 10000) {
+    return static_cast<uint64_t>(elapsedMs) * 1000u * getCpuFrequencyMhz();
+  }
+  return cycleCount() - startCycles;
+}
+
+void Metrics::record(Stage stage, uint64_t cycles) {
+  StageCounters& counters = stages_[static_cast<size_t>(stage)];
+  counters.calls.fetch_add(1, std::memory_order_relaxed);
+  counters.cycles.fetch_add(cycles, std::memory_order_relaxed);
+  // Single writer per stage, so a plain compare is enough.
+  if (cycles > counters.maxCycles.load(std::memory_order_relaxed)) {
+    counters.maxCycles.store(cycles, std::memory_order_relaxed);
+  }
+}
+
+void Metrics::recordWindow(uint32_t samples) {
+  windows_.fetch_add(1, std::memory_order_relaxed);
+  windowSamples_.fetch_add(samples, std::memory_order_relaxed);
+}
+
+void Metrics::markLoop() {
+  const uint32_t now = micros();
+  if (lastLoopUs_ != 0) {
+    const uint32_t period = now - lastLoopUs_;
+    loopMaxUs_ = std::max(loopMaxUs_, period);
+    size_t bucket = 0;
+    while (bucket < kLoopBuckets - 1 && period >= kLoopBucketMs[bucket] * 1000u) {
+      bucket++;
+    }
+    loopHistogram_[bucket]++;
+  }
+  lastLoopUs_ = now;
+}
+
+void Metrics::sampleHeap() {
+  const unsigned long now = millis();
+  if (lastHeapSampleMs_ != 0 && now - lastHeapSampleMs_ < 1000) {
+    return;
+  }
+  lastHeapSampleMs_ = now;
+  heapFree_ = ESP.getFreeHeap();
+  heapMinFree_ = ESP.getMinFreeHeap();
+  heapMaxBlock_ = ESP.getMaxAllocHeap();
+  heapMinMaxBlock_ = std::min(heapMinMaxBlock_, heapMaxBlock_);
+}
+
+void Metrics::setGauges(const Gauges& gauges) {
+  gauges_ = gauges;
+}
+
+Metrics::StageStats Metrics::stage(Stage stage) const {
+  const StageCounters& counters = stages_[static_cast<size_t>(stage)];
+  StageStats stats;
+  stats.calls = counters.calls.load(std::memory_order_relaxed);
+  stats.cycles = counters.cycles.load(std::memory_order_relaxed);
+  stats.maxCycles = counters.maxCycles.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void Metrics::printTo(Print& out) const {
+  const uint32_t lost = gauges_.adcOverruns * Config::kAdcDmaBufferLen;
+  const uint32_t captured = windowSamples_.load(std::memory_order_relaxed);
+  out.printf("[STATS] windows=%u samples captured=%u expected=%u (adc overruns=%u)\n",
+             static_cast<unsigned int>(windows_.load(std::memory_order_relaxed)),
+             static_cast<unsigned int>(captured),
+             static_cast<unsigned int>(captured + lost),
+             static_cast<unsigned int>(gauges_.adcOverruns));
+  for (size_t i = 0; i < static_cast<size_t>(Stage::Count); ++i) {
+    const StageStats stats = stage(static_cast<Stage>(i));
+    out.printf("[STATS] %-8s calls=%u avg=%uus max=%uus total=%ums\n",
+               kStageNames[i],
+               static_cast<unsigned int>(stats.calls),
+               static_cast<unsigned int>(stats.calls > 0 ? cyclesToUs(stats.cycles / stats.calls) : 0),
+               static_cast<unsigned int>(cyclesToUs(stats.maxCycles)),
+               static_cast<unsigned int>(cyclesToUs(stats.cycles) / 1000));
+  }
+  out.printf("[STATS] loop max=%uus hist(<1,<5,<10,<50,<100,<500,<2000,>=2000 ms)=%u,%u,%u,%u,%u,%u,%u,%u\n",
+             static_cast<unsigned int>(loopMaxUs_),
+             static_cast<unsigned int>(loopHistogram_[0]),
+             static_cast<unsigned int>(loopHistogram_[1]),
+             static_cast<unsigned int>(loopHistogram_[2]),
+             static_cast<unsigned int>(loopHistogram_[3]),
+             static_cast<unsigned int>(loopHistogram_[4]),
+             static_cast<unsigned int>(loopHistogram_[5]),
+             static_cast<unsigned int>(loopHistogram_[6]),
+             static_cast<unsigned int>(loopHistogram_[7]));
+  out.printf("[STATS] heap free=%u min_free=%u max_block=%u min_max_block=%u\n",
+             static_cast<unsigned int>(heapFree_),
+             static_cast<unsigned int>(heapMinFree_),
+             static_cast<unsigned int>(heapMaxBlock_),
+             static_cast<unsigned int>(heapMinMaxBlock_ == UINT32_MAX ? 0 : heapMinMaxBlock_));
+  out.printf("[STATS] queues samples=%u/%uB events=%u/%uB dead=%u/%uB acq drops=%u hw=%u\n",
+             static_cast<unsigned int>(gauges_.samplesQueue.records),
+             static_cast<unsigned int>(gauges_.samplesQueue.bytes),
+             static_cast<unsigned int>(gauges_.eventsQueue.records),
+             static_cast<unsigned int>(gauges_.eventsQueue.bytes),
+             static_cast<unsigned int>(gauges_.deadLetterQueue.records),
+             static_cast<unsigned int>(gauges_.deadLetterQueue.bytes),
+             static_cast<unsigned int>(gauges_.acqSampleDrops),
+             static_cast<unsigned int>(gauges_.acqSampleHighWatermark));
+  out.printf("[STATS] http connections=%u requests=%u errors=%u busy=%ums\n",
+             static_cast<unsigned int>(gauges_.httpConnections),
+             static_cast<unsigned int>(gauges_.httpRequests),
+             static_cast<unsigned int>(gauges_.httpErrors),
+             static_cast<unsigned int>(gauges_.httpBusyMs));
+}
+
+bool Metrics::writeJsonFields(ByteSink& out) const {
+  FieldWriter json(out);
+  json.printf("\"win\":[%u,%u,%u]",
+              static_cast<unsigned int>(windows_.load(std::memory_order_relaxed)),
+              static_cast<unsigned int>(windowSamples_.load(std::memory_order_relaxed)),
+              static_cast<unsigned int>(gauges_.adcOverruns * Config::kAdcDmaBufferLen));
+  // Per stage: [calls, total_us, max_us].
+  json.printf(",\"stages\":{");
+  for (size_t i = 0; i < static_cast<size_t>(Stage::Count); ++i) {
+    const StageStats stats = stage(static_cast<Stage>(i));
+    json.printf("%s\"%s\":[%u,%llu,%u]",
+                i == 0 ? "" : ",",
+                kStageNames[i],
+                static_cast<unsigned int>(stats.calls),
+                static_cast<unsigned long long>(stats.cycles / getCpuFrequencyMhz()),
+                static_cast<unsigned int>(cyclesToUs(stats.maxCycles)));
+  }
+  json.printf("},\"loop_max_us\":%u,\"loop_hist\":[", static_cast<unsigned int>(loopMaxUs_));
+  for (size_t i = 0; i < kLoopBuckets; ++i) {
+    json.printf("%s%u", i == 0 ? "" : ",", static_cast<unsigned int>(loopHistogram_[i]));
+  }
+  json.printf("],\"heap\":[%u,%u,%u,%u]",
+              static_cast<unsigned int>(heapFree_),
+              static_cast<unsigned int>(heapMinFree_),
+              static_cast<unsigned int>(heapMaxBlock_),
+              static_cast<unsigned int>(heapMinMaxBlock_ == UINT32_MAX ? 0 : heapMinMaxBlock_));
+  json.printf(",\"queues\":[%u,%u,%u,%u,%u,%u]",
+              static_cast<unsigned int>(gauges_.samplesQueue.records),
+              static_cast<unsigned int>(gauges_.samplesQueue.bytes),
+              static_cast<unsigned int>(gauges_.eventsQueue.records),
+              static_cast<unsigned int>(gauges_.eventsQueue.bytes),
+              static_cast<unsigned int>(gauges_.deadLetterQueue.records),
+              static_cast<unsigned int>(gauges_.deadLetterQueue.bytes));
+  json.printf(",\"acq\":[%u,%u]",
+              static_cast<unsigned int>(gauges_.acqSampleDrops),
+              static_cast<unsigned int>(gauges_.acqSampleHighWatermark));
+  json.printf(",\"http\":[%u,%u,%u,%u]",
+              static_cast<unsigned int>(gauges_.httpConnections),
+              static_cast<unsigned int>(gauges_.httpRequests),
+              static_cast<unsigned int>(gauges_.httpErrors),
+              static_cast<unsigned int>(gauges_.httpBusyMs));
+  return json.ok();
+}
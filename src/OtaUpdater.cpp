@@ -0,0 +1,195 @@
+#include "OtaUpdater.h"
+
+#include "HttpSession.h"
+
+#include <string.h>
+
+namespace {
+// A chunk that fails is retried from the same offset; the image is only restarted on a bad hash.
+constexpr unsigned long kRetryScheduleMs[] = {5000, 30000, 120000, 600000};
+constexpr int kHttpPartialContent = 206;
+} // namespace
+
+bool FirmwareManifest::complete() const {
+  bool hashSet = false;
+  for (uint8_t byte : sha256) {
+    hashSet = hashSet || byte != 0;
+  }
+  return version[0] != '\0' && path[0] != '\0' && size > 0 && hashSet;
+}
+
+const char* OtaStateToString(OtaUpdater::State state) {
+  switch (state) {
+    case OtaUpdater::State::Idle:
+      return "idle";
+    case OtaUpdater::State::Downloading:
+      return "downloading";
+    case OtaUpdater::State::Ready:
+      return "ready";
+    case OtaUpdater::State::Failed:
+      return "failed";
+  }
+  return "unknown";
+}
+
+OtaUpdater::OtaUpdater(OtaPartition& partition) : partition_(partition) {}
+
+void OtaUpdater::begin() {
+  validating_ = partition_.pendingValidation();
+  lastHealthMs_ = millis();
+  validatedMs_ = 0;
+  if (validating_) {
+    Serial.printf("[OTA] Image not confirmed yet; rolls back unless an upload succeeds within %lu min online\n",
+                  static_cast<unsigned long>(Config::kOtaValidationMs / 60000UL));
+  }
+}
+
+bool OtaUpdater::offer(const FirmwareManifest& manifest, const char* runningVersion) {
+  if (!manifest.complete() || strcmp(manifest.version, runningVersion) == 0) {
+    return false;
+  }
+  // Until the running image is confirmed the other slot still holds the one to roll back to,
+  // and once an image is activated only a reboot may follow.
+  if (validating_ || state_ == State::Ready) {
+    return false;
+  }
+  const bool sameImage = strcmp(manifest.version, manifest_.version) == 0 &&
+                         memcmp(manifest.sha256, manifest_.sha256, sizeof(manifest.sha256)) == 0;
+  if (sameImage && (state_ == State::Downloading || state_ == State::Failed)) {
+    return false;
+  }
+  if (partition_.rejected(manifest.version)) {
+    Serial.printf("[OTA] %s was rolled back before, not installing it again\n", manifest.version);
+    return false;
+  }
+  if (manifest.size > partition_.capacity()) {
+    Serial.printf("[OTA] %s is %lu bytes, the update partition holds %lu\n",
+                  manifest.version,
+                  static_cast<unsigned long>(manifest.size),
+                  static_cast<unsigned long>(partition_.capacity()));
+    return false;
+  }
+  if (state_ == State::Downloading) {
+    partition_.abort();
+  }
+  manifest_ = manifest;
+  imageAttempts_ = 0;
+  restartImage();
+  return state_ == State::Downloading;
+}
+
+void OtaUpdater::update(HttpSession& session, bool connected) {
+  if (state_ != State::Downloading || !connected || static_cast<long>(millis() - nextAttemptMs_) < 0) {
+    return;
+  }
+
+  const size_t remaining = manifest_.size - written_;
+  const size_t length = remaining < sizeof(chunk_) ? remaining : sizeof(chunk_);
+  size_t received = 0;
+  const int httpCode = session.getRange(manifest_.path, written_, chunk_, length, received);
+  // A 200 means the server ignored the Range header; the body is not the chunk asked for.
+  if (httpCode != kHttpPartialContent || received == 0) {
+    Serial.printf("[OTA] Chunk at %lu failed (HTTP %d)\n", static_cast<unsigned long>(written_), httpCode);
+    scheduleRetry();
+    return;
+  }
+  if (!partition_.write(chunk_, received)) {
+    partition_.abort();
+    fail("flash write failed");
+    return;
+  }
+  hash_.update(chunk_, received);
+  written_ += static_cast<uint32_t>(received);
+  backoffIndex_ = 0;
+  if (written_ < manifest_.size) {
+    return;
+  }
+
+  uint8_t digest[Sha256::kDigestSize];
+  hash_.finish(digest);
+  if (memcmp(digest, manifest_.sha256, sizeof(digest)) != 0) {
+    partition_.abort();
+    char hex[Sha256::kDigestSize * 2 + 1];
+    Sha256::toHex(digest, hex);
+    Serial.printf("[OTA] %s does not match its SHA-256 (got %s)\n", manifest_.version, hex);
+    if (imageAttempts_ >= Config::kOtaMaxImageAttempts) {
+      fail("hash mismatch on every attempt");
+    } else {
+      restartImage();
+    }
+    return;
+  }
+  if (!partition_.activate()) {
+    fail("image rejected by the partition");
+    return;
+  }
+  state_ = State::Ready;
+  Serial.printf("[OTA] %s verified and set as boot image\n", manifest_.version);
+}
+
+void OtaUpdater::checkHealth(uint32_t uploadsSent, bool connected, uint32_t serverResponses) {
+  if (!validating_) {
+    return;
+  }
+  const unsigned long now = millis();
+  // rollback() rejects the version for good, so only time in which the image could have
+  // uploaded counts: without WiFi or an answering server it says nothing about the image.
+  if (connected && serverResponses > 0) {
+    validatedMs_ += static_cast<uint32_t>(now - lastHealthMs_);
+  }
+  lastHealthMs_ = now;
+  if (uploadsSent > 0) {
+    partition_.markValid();
+    validating_ = false;
+    Serial.println("[OTA] Upload succeeded, image confirmed");
+  } else if (validatedMs_ > Config::kOtaValidationMs) {
+    validating_ = false;
+    Serial.println("[OTA] No upload since the update, rolling back");
+    partition_.rollback();
+  }
+}
+
+OtaUpdater::State OtaUpdater::state() const {
+  return state_;
+}
+
+const FirmwareManifest& OtaUpdater::manifest() const {
+  return manifest_;
+}
+
+uint32_t OtaUpdater::bytesWritten() const {
+  return written_;
+}
+
+bool OtaUpdater::validating() const {
+  return validating_;
+}
+
+void OtaUpdater::restartImage() {
+  imageAttempts_++;
+  written_ = 0;
+  hash_.reset();
+  backoffIndex_ = 0;
+  nextAttemptMs_ = millis();
+  if (!partition_.beginImage(manifest_.size, manifest_.version)) {
+    fail("cannot open the update partition");
+    return;
+  }
+  state_ = State::Downloading;
+  Serial.printf("[OTA] Downloading %s, %lu bytes (attempt %u)\n",
+                manifest_.version,
+                static_cast<unsigned long>(manifest_.size),
+                static_cast<unsigned int>(imageAttempts_));
+}
+
+void OtaUpdater::fail(const char* reason) {
+  state_ = State::Failed;
+  Serial.printf("[OTA] Giving up on %s: %s\n", manifest_.version, reason);
+}
+
+void OtaUpdater::scheduleRetry() {
+  nextAttemptMs_ = millis() + kRetryScheduleMs[backoffIndex_];
+  if (backoffIndex_ + 1 < (sizeof(kRetryScheduleMs) / sizeof(kRetryScheduleMs[0]))) {
+    backoffIndex_++;
+  }
+}
@@ -0,0 +1,123 @@
+#include "PowerMeter.h"
+
+#include <algorithm>
+#include <math.h>
+
+namespace {
+// Variance-style mean of products around the two means: n^2 * cov = n * sum(ab) - sum(a) * sum(b).
+double centered(uint32_t n, int64_t sumA, int64_t sumB, int64_t sumAB) {
+  const double count = n;
+  return (count * static_cast<double>(sumAB) - static_cast<double>(sumA) * static_cast<double>(sumB)) / (count * count);
+}
+
+void splitQ8(float samples, int32_t& whole, uint32_t& frac) {
+  const int32_t q8 = static_cast<int32_t>(lroundf(samples * 256.0f));
+  whole = q8 >> 8; // floor, also for negative delays
+  frac = static_cast<uint32_t>(q8 & 0xFF);
+}
+} // namespace
+
+void VoltageTrace::onSamples(const uint16_t* raw, size_t count, uint16_t dc) {
+  for (size_t i = 0; i < count; ++i) {
+    samples_[written_++ % kLength] = static_cast<int16_t>(static_cast<int32_t>(raw[i]) - dc);
+  }
+}
+
+int32_t VoltageTrace::atQ8(uint32_t index, uint32_t frac) const {
+  const int32_t a = samples_[index % kLength];
+  const int32_t b = samples_[(index + 1) % kLength];
+  return a * 256 + static_cast<int32_t>(frac) * (b - a);
+}
+
+PowerMeter::PowerMeter(const VoltageTrace& voltage, uint32_t sampleRateHz)
+    : voltage_(voltage), sampleRateHz_(sampleRateHz) {
+  updateDelays(0.0f);
+}
+
+void PowerMeter::setCalibration(float voltsPerCount, float ampsPerCount, float phaseDeg) {
+  if (!pendingCalibration_.push({voltsPerCount, ampsPerCount, phaseDeg})) {
+    Serial.println("[POWER] Calibration dropped, too many pending changes");
+  }
+}
+
+void PowerMeter::setScanDelay(float samples) {
+  scanDelay_ = samples;
+  updateDelays(0.0f);
+}
+
+void PowerMeter::onSamples(const uint16_t* raw, size_t count, uint16_t dc) {
+  if (currentIndex_ == 0 && applyPendingCalibration()) {
+    updateDelays(0.0f); // set before the first window: it applies to that one
+  }
+  for (size_t s = 0; s < count; ++s) {
+    const uint32_t k = currentIndex_++;
+    current_[k % kHistory] = static_cast<int16_t>(static_cast<int32_t>(raw[s]) - dc);
+    if (k < kLag) {
+      continue;
+    }
+    // Current sample m against the voltage at its own instant and a quarter cycle before; both
+    // stay behind the newest voltage sample by the lag.
+    const uint32_t m = k - kLag;
+    const int32_t i = current_[m % kHistory];
+    const int32_t v = voltage_.atQ8(m + static_cast<uint32_t>(delayInt_), delayFrac_);
+    const int32_t vq = voltage_.atQ8(m + static_cast<uint32_t>(quarterInt_), quarterFrac_);
+    count_++;
+    sumV_ += v;
+    sumVq_ += vq;
+    sumI_ += i;
+    sumVV_ += static_cast<int64_t>(v) * v;
+    sumII_ += i * i;
+    sumVI_ += static_cast<int64_t>(v) * i;
+    sumVqI_ += static_cast<int64_t>(vq) * i;
+  }
+}
+
+bool PowerMeter::finishWindow(float lineHz, PowerReading& out) {
+  const uint32_t n = count_;
+  if (n > 0) {
+    const double volts = voltsPerCount_ / 256.0;
+    const double amps = ampsPerCount_;
+    out.vrms = static_cast<float>(sqrt(std::max(centered(n, sumV_, sumV_, sumVV_), 0.0)) * volts);
+    out.irms = static_cast<float>(sqrt(std::max(centered(n, sumI_, sumI_, sumII_), 0.0)) * amps);
+    const double active = centered(n, sumV_, sumI_, sumVI_) * volts * amps;
+    out.activeW = static_cast<float>(active);
+    out.reactiveVar = static_cast<float>(centered(n, sumVq_, sumI_, sumVqI_) * volts * amps);
+    out.apparentVa = out.vrms * out.irms;
+    out.powerFactor = out.apparentVa > 0.0f ? std::min(std::max(out.activeW / out.apparentVa, -1.0f), 1.0f) : 0.0f;
+    out.energyWh = active * n / sampleRateHz_ / 3600.0;
+  }
+
+  count_ = 0;
+  sumV_ = 0;
+  sumVq_ = 0;
+  sumI_ = 0;
+  sumVV_ = 0;
+  sumII_ = 0;
+  sumVI_ = 0;
+  sumVqI_ = 0;
+  applyPendingCalibration();
+  updateDelays(lineHz);
+  return n > 0;
+}
+
+bool PowerMeter::applyPendingCalibration() {
+  Calibration calibration;
+  bool applied = false;
+  while (pendingCalibration_.pop(calibration)) {
+    voltsPerCount_ = calibration.voltsPerCount;
+    ampsPerCount_ = calibration.ampsPerCount;
+    phaseDeg_ = calibration.phaseDeg;
+    applied = true;
+  }
+  return applied;
+}
+
+// The voltage is read delay samples after the current sample's own index: the scan offset
+// plus the sensors' phase lead converted at the line frequency, clamped to the look-back.
+void PowerMeter::updateDelays(float lineHz) {
+  const float samplesPerCycle = sampleRateHz_ / (lineHz > 0.0f ? lineHz : static_cast<float>(Config::kMainsNominalHz));
+  const float delay = std::min(std::max(scanDelay_ + phaseDeg_ / 360.0f * samplesPerCycle, -Config::kPowerMaxDelaySamples),
+                               Config::kPowerMaxDelaySamples);
+  splitQ8(delay, delayInt_, delayFrac_);
+  splitQ8(delay - samplesPerCycle / 4.0f, quarterInt_, quarterFrac_);
+}
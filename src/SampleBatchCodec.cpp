@@ -0,0 +1,147 @@
+#include "SampleBatchCodec.h"
+
+#include <algorithm>
+#include <math.h>
+
+namespace {
+int32_t quantizeMillivolts(const VoltageSample& sample) {
+  if (sample.flags & FLAG_NO_SIGNAL) {
+    return 0;
+  }
+  return static_cast<int32_t>(lroundf(sample.vrms * 1000.0f));
+}
+
+int32_t quantizeMilli(const ChannelValues& channels, size_t index) {
+  if (channels.flags[index] & FLAG_NO_SIGNAL) {
+    return 0;
+  }
+  return static_cast<int32_t>(lroundf(channels.rms[index] * 1000.0f));
+}
+
+template <typename ValueAt>
+void putDeltas(BufferedWriter& writer, size_t count, ValueAt valueAt) {
+  int64_t previous = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const int64_t value = valueAt(i);
+    writer.putSvarint(value - previous);
+    previous = value;
+  }
+}
+
+int64_t deci(float value) {
+  return static_cast<int64_t>(llroundf(value * 10.0f));
+}
+
+template <typename FlagsAt>
+void putFlagRuns(BufferedWriter& writer, size_t count, FlagsAt flagsAt) {
+  size_t runStart = 0;
+  for (size_t i = 1; i <= count; ++i) {
+    if (i == count || flagsAt(i) != flagsAt(runStart)) {
+      writer.putVarint(i - runStart);
+      writer.putVarint(flagsAt(runStart));
+      runStart = i;
+    }
+  }
+}
+} // namespace
+
+namespace SampleBatchCodec {
+bool encode(ByteSink& out,
+            const char* deviceId,
+            const char* fwVersion,
+            uint32_t samplePeriodMs,
+            const VoltageSample* samples,
+            size_t count,
+            const SampleSummary* summaries,
+            const ChannelValues* channels,
+            const ChannelEnergy* energy) {
+  const bool harmonics = std::any_of(samples, samples + count, [](const VoltageSample& sample) {
+    return sample.hasHarmonics();
+  });
+
+  BufferedWriter writer(out);
+  writer.put('C');
+  writer.put('C');
+  writer.put('R');
+  writer.put('S');
+  writer.put(kVersion);
+  const size_t channelCount = channels != nullptr && count > 0 ? channels[0].count : 0;
+  const bool power = channelCount > 0 && std::any_of(channels[0].kind, channels[0].kind + channelCount, [](ChannelKind kind) {
+                       return kind == ChannelKind::Current;
+                     });
+  writer.put((harmonics ? kSectionHarmonics : 0) | (summaries != nullptr ? kSectionSummary : 0) |
+             (channelCount > 0 ? kSectionChannels : 0) | (power ? kSectionPower : 0));
+  writer.putLe(samplePeriodMs, 2);
+  writer.putLe(count, 4);
+  writer.putLe(count > 0 ? samples[0].ts_ms : 0, 8);
+  writer.putString(deviceId);
+  writer.putString(fwVersion);
+
+  for (size_t i = 1; i < count; ++i) {
+    int64_t delta = static_cast<int64_t>(samples[i].ts_ms - samples[i - 1].ts_ms);
+    writer.putSvarint(delta - static_cast<int64_t>(samplePeriodMs));
+  }
+
+  int32_t previousMv = 0;
+  for (size_t i = 0; i < count; ++i) {
+    int32_t mv = quantizeMillivolts(samples[i]);
+    writer.putSvarint(static_cast<int64_t>(mv) - previousMv);
+    previousMv = mv;
+  }
+
+  putFlagRuns(writer, count, [samples](size_t i) { return samples[i].flags; });
+
+  if (harmonics) {
+    int32_t previous[4] = {};
+    for (size_t i = 0; i < count; ++i) {
+      if (!samples[i].hasHarmonics()) {
+        writer.put(0);
+        continue;
+      }
+      const int32_t values[4] = {samples[i].thd_cpct,
+                                 samples[i].harmonic_cv[0],
+                                 samples[i].harmonic_cv[1],
+                                 samples[i].harmonic_cv[2]};
+      writer.put(1);
+      for (size_t k = 0; k < 4; ++k) {
+        writer.putSvarint(values[k] - previous[k]);
+        previous[k] = values[k];
+      }
+    }
+  }
+
+  if (summaries != nullptr) {
+    for (size_t i = 0; i < count; ++i) {
+      const int32_t mv = quantizeMillivolts(samples[i]);
+      writer.putSvarint(static_cast<int32_t>(lroundf(summaries[i].min * 1000.0f)) - mv);
+      writer.putSvarint(static_cast<int32_t>(lroundf(summaries[i].max * 1000.0f)) - mv);
+      writer.putSvarint(static_cast<int32_t>(lroundf(summaries[i].p99 * 1000.0f)) - mv);
+    }
+  }
+
+  if (channelCount > 0) {
+    writer.put(static_cast<uint8_t>(channelCount));
+    for (size_t c = 0; c < channelCount; ++c) {
+      writer.put(static_cast<uint8_t>(channels[0].kind[c]));
+    }
+    for (size_t c = 0; c < channelCount; ++c) {
+      putDeltas(writer, count, [channels, c](size_t i) { return quantizeMilli(channels[i], c); });
+      putFlagRuns(writer, count, [channels, c](size_t i) { return channels[i].flags[c]; });
+    }
+  }
+
+  if (power) {
+    for (size_t c = 0; c < channelCount; ++c) {
+      if (channels[0].kind[c] != ChannelKind::Current) {
+        continue;
+      }
+      putDeltas(writer, count, [channels, c](size_t i) { return deci(channels[i].activeW[c]); });
+      putDeltas(writer, count, [channels, c](size_t i) { return deci(channels[i].reactiveVar[c]); });
+      putDeltas(writer, count, [channels, c](size_t i) { return deci(channels[i].apparentVa[c]); });
+      writer.putVarint(energy != nullptr ? static_cast<uint64_t>(llround(energy->importWh[c])) : 0);
+      writer.putVarint(energy != nullptr ? static_cast<uint64_t>(llround(energy->exportWh[c])) : 0);
+    }
+  }
+  return writer.flush();
+}
+} // namespace SampleBatchCodec
@@ -0,0 +1,55 @@
+#include "SampleHistory.h"
+
+#include <algorithm>
+
+SampleHistory::SampleHistory(size_t capacity) {
+  slots_.resize(capacity);
+}
+
+uint32_t SampleHistory::append(const VoltageSample& sample) {
+  const uint32_t seq = claimed_.load(std::memory_order_relaxed);
+  // Seqlock-style: announce the slot before overwriting it, so a reader that saw the new data
+  // also sees the claim in intact().
+  claimed_.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slots_[seq % slots_.size()] = sample;
+  return seq;
+}
+
+const VoltageSample& SampleHistory::at(uint32_t seq) const {
+  return slots_[seq % slots_.size()];
+}
+
+uint32_t SampleHistory::nextSeq() const {
+  return claimed_.load(std::memory_order_relaxed);
+}
+
+uint32_t SampleHistory::retained() const {
+  const uint32_t next = nextSeq();
+  return next < slots_.size() ? next : static_cast<uint32_t>(slots_.size());
+}
+
+size_t SampleHistory::capacity() const {
+  return slots_.size();
+}
+
+size_t SampleHistory::spans(uint32_t firstSeq, uint32_t count, Span out[2]) const {
+  if (count == 0) {
+    return 0;
+  }
+  const size_t start = firstSeq % slots_.size();
+  const size_t firstRun = std::min<size_t>(count, slots_.size() - start);
+  out[0].data = &slots_[start];
+  out[0].count = firstRun;
+  if (firstRun == count) {
+    return 1;
+  }
+  out[1].data = &slots_[0];
+  out[1].count = count - firstRun;
+  return 2;
+}
+
+bool SampleHistory::intact(uint32_t firstSeq) const {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return claimed_.load(std::memory_order_relaxed) - firstSeq <= slots_.size();
+}
@@ -0,0 +1,286 @@
+#include "SampleReducer.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <strings.h>
+
+namespace {
+const char* const kReductionNames[] = {"raw", "1s", "10s", "60s", "swing"};
+
+float uploadedVrms(const VoltageSample& sample) {
+  return (sample.flags & FLAG_NO_SIGNAL) ? 0.0f : sample.vrms;
+}
+
+// Row values in door order: the primary Vrms, then each secondary channel, 0 if NO_SIGNAL.
+size_t rowValues(const VoltageSample& sample, const ChannelValues& channels, float* out) {
+  out[0] = uploadedVrms(sample);
+  for (size_t i = 0; i < channels.count; ++i) {
+    out[i + 1] = (channels.flags[i] & FLAG_NO_SIGNAL) ? 0.0f : channels.rms[i];
+  }
+  return channels.count + 1;
+}
+
+bool sameFlags(const ChannelValues& a, const ChannelValues& b) {
+  return a.count == b.count && std::equal(a.flags, a.flags + a.count, b.flags);
+}
+
+void emit(SamplePoints& out, const VoltageSample& sample, const ChannelValues* channels) {
+  out.samples.push_back(sample);
+  if (channels != nullptr) {
+    out.channels.push_back(*channels);
+  }
+}
+} // namespace
+
+const char* SampleReductionToString(SampleReduction reduction) {
+  const size_t index = static_cast<size_t>(reduction);
+  return index < sizeof(kReductionNames) / sizeof(kReductionNames[0]) ? kReductionNames[index] : "raw";
+}
+
+bool SampleReductionFromString(const char* text, SampleReduction& out) {
+  for (size_t i = 0; i < sizeof(kReductionNames) / sizeof(kReductionNames[0]); ++i) {
+    if (strcasecmp(text, kReductionNames[i]) == 0) {
+      out = static_cast<SampleReduction>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+void SampleReducer::setMode(SampleReduction mode, float swingToleranceV) {
+  mode_ = mode;
+  tolerance_ = swingToleranceV > 0.0f ? swingToleranceV : Config::kSwingDoorToleranceV;
+  tierWindows_ = 0;
+  valueCount_ = 0;
+  haveArchive_ = false;
+  haveHeld_ = false;
+}
+
+SampleReduction SampleReducer::mode() const {
+  return mode_;
+}
+
+float SampleReducer::swingTolerance() const {
+  return tolerance_;
+}
+
+void SampleReducer::setDisturbanceBand(float low, float high) {
+  bandLow_ = low;
+  bandHigh_ = high;
+}
+
+uint32_t SampleReducer::periodMs(uint32_t windowMs) const {
+  return isTier() ? tierMs() : windowMs;
+}
+
+void SampleReducer::add(const VoltageSample& sample, const ChannelValues* channels, SamplePoints& out) {
+  if (isTier()) {
+    addToTier(sample, channels, out);
+  } else if (mode_ == SampleReduction::SwingingDoor) {
+    addSwingingDoor(sample, channels, out);
+  } else {
+    emit(out, sample, channels);
+  }
+}
+
+void SampleReducer::flush(SamplePoints& out) {
+  if (isTier() && tierWindows_ > 0) {
+    emitTier(out);
+  }
+  if (mode_ == SampleReduction::SwingingDoor && haveHeld_) {
+    archiveHeld(out);
+  }
+}
+
+// Disturbed windows bypass reduction so batches keep every point of a sag or swell.
+bool SampleReducer::disturbed(const VoltageSample& sample, const ChannelValues* channels) const {
+  if ((sample.flags & FLAG_NO_SIGNAL) == 0 && outsideBand(sample.vrms)) {
+    return true;
+  }
+  for (size_t i = 0; channels != nullptr && i < channels->count; ++i) {
+    if (channels->kind[i] == ChannelKind::Voltage && (channels->flags[i] & FLAG_NO_SIGNAL) == 0 &&
+        outsideBand(channels->rms[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SampleReducer::outsideBand(float vrms) const {
+  return vrms < bandLow_ || vrms > bandHigh_;
+}
+
+bool SampleReducer::isTier() const {
+  return mode_ == SampleReduction::Tier1s || mode_ == SampleReduction::Tier10s || mode_ == SampleReduction::Tier60s;
+}
+
+uint32_t SampleReducer::tierMs() const {
+  switch (mode_) {
+    case SampleReduction::Tier1s:
+      return 1000;
+    case SampleReduction::Tier10s:
+      return 10 * 1000;
+    default:
+      return Config::kReduceMaxTierMs;
+  }
+}
+
+void SampleReducer::addToTier(const VoltageSample& sample, const ChannelValues* channels, SamplePoints& out) {
+  if (disturbed(sample, channels)) {
+    if (tierWindows_ > 0) {
+      emitTier(out);
+    }
+    emit(out, sample, channels);
+    out.summaries.push_back({sample.vrms, sample.vrms, sample.vrms});
+    return;
+  }
+
+  // Tiers are aligned to the clock, so points from different devices line up.
+  const uint64_t bucket = sample.ts_ms / tierMs();
+  if (tierWindows_ > 0 && bucket != tierBucket_) {
+    emitTier(out);
+  }
+  if (tierWindows_ == 0) {
+    tierBucket_ = bucket;
+    tierPoint_ = sample;
+    tierPoint_.flags = sample.flags & ~FLAG_NO_SIGNAL;
+    tierPoint_.thd_cpct = VoltageSample::kNoHarmonics;
+    tierHasChannels_ = channels != nullptr;
+    tierChannels_ = channels != nullptr ? *channels : ChannelValues();
+    for (size_t i = 0; i < tierChannels_.count; ++i) {
+      tierChannels_.flags[i] = 0;
+      channelSums_[i] = 0.0;
+      channelValues_[i] = 0;
+      std::fill(powerSums_[i], powerSums_[i] + 3, 0.0);
+    }
+  }
+  tierWindows_++;
+  tierPoint_.flags |= sample.flags & ~FLAG_NO_SIGNAL;
+  // Keep the most distorted window's harmonics: the tier is there to find the worst case.
+  if (sample.hasHarmonics() && (!tierPoint_.hasHarmonics() || sample.thd_cpct > tierPoint_.thd_cpct)) {
+    tierPoint_.thd_cpct = sample.thd_cpct;
+    std::copy(sample.harmonic_cv, sample.harmonic_cv + 3, tierPoint_.harmonic_cv);
+  }
+  if ((sample.flags & FLAG_NO_SIGNAL) == 0 && valueCount_ < kMaxTierWindows) {
+    values_[valueCount_++] = sample.vrms;
+  }
+  for (size_t i = 0; channels != nullptr && i < std::min(channels->count, tierChannels_.count); ++i) {
+    tierChannels_.flags[i] |= channels->flags[i] & ~FLAG_NO_SIGNAL;
+    if ((channels->flags[i] & FLAG_NO_SIGNAL) == 0) {
+      channelSums_[i] += channels->rms[i];
+      channelValues_[i]++;
+    }
+    powerSums_[i][0] += channels->activeW[i];
+    powerSums_[i][1] += channels->reactiveVar[i];
+    powerSums_[i][2] += channels->apparentVa[i];
+  }
+}
+
+void SampleReducer::emitTier(SamplePoints& out) {
+  VoltageSample point = tierPoint_;
+  SampleSummary summary;
+  point.sample_count = static_cast<uint16_t>(std::min<uint32_t>(tierWindows_, UINT16_MAX));
+  if (valueCount_ == 0) {
+    point.flags |= FLAG_NO_SIGNAL;
+    point.vrms = 0.0f;
+  } else {
+    double sum = 0.0;
+    for (size_t i = 0; i < valueCount_; ++i) {
+      sum += values_[i];
+    }
+    point.vrms = static_cast<float>(sum / valueCount_);
+    summary.min = *std::min_element(values_, values_ + valueCount_);
+    summary.max = *std::max_element(values_, values_ + valueCount_);
+    // Nearest-rank percentile; for short tiers it is the maximum.
+    const size_t rank = (valueCount_ * 99 + 99) / 100 - 1;
+    std::nth_element(values_, values_ + rank, values_ + valueCount_);
+    summary.p99 = values_[rank];
+  }
+  for (size_t i = 0; i < tierChannels_.count; ++i) {
+    if (channelValues_[i] == 0) {
+      tierChannels_.flags[i] |= FLAG_NO_SIGNAL;
+      tierChannels_.rms[i] = 0.0f;
+    } else {
+      tierChannels_.rms[i] = static_cast<float>(channelSums_[i] / channelValues_[i]);
+    }
+    // Mean power over the tier, so P times the tier length is its energy.
+    tierChannels_.activeW[i] = static_cast<float>(powerSums_[i][0] / tierWindows_);
+    tierChannels_.reactiveVar[i] = static_cast<float>(powerSums_[i][1] / tierWindows_);
+    tierChannels_.apparentVa[i] = static_cast<float>(powerSums_[i][2] / tierWindows_);
+  }
+  emit(out, point, tierHasChannels_ ? &tierChannels_ : nullptr);
+  out.summaries.push_back(summary);
+  tierWindows_ = 0;
+  valueCount_ = 0;
+}
+
+// Swinging-door trending: the newest point may end the current segment as long as the line
+// from the last archived point to it stays within the tolerance of every point in between,
+// i.e. its slope lies between the two doors pivoting on archive +/- tolerance. Otherwise the
+// previous point is archived and pivots the next segment, so linear interpolation between
+// archived points is never further than the tolerance from a window. Flag changes, disturbed
+// windows and kSwingDoorMaxGapMs of silence archive both the segment end and the new point.
+// With secondary channels every channel has its own doors and must fit for the row to fit.
+void SampleReducer::addSwingingDoor(const VoltageSample& sample, const ChannelValues* channels, SamplePoints& out) {
+  const ChannelValues none;
+  const ChannelValues& row = channels != nullptr ? *channels : none;
+  if (!haveArchive_) {
+    emit(out, sample, channels);
+    openDoor(sample, row);
+    doorHasChannels_ = channels != nullptr;
+    return;
+  }
+
+  const bool force = disturbed(sample, channels) || disturbed(archive_, doorHasChannels_ ? &archiveChannels_ : nullptr) ||
+                     sample.flags != archive_.flags || !sameFlags(row, archiveChannels_) ||
+                     sample.ts_ms <= archive_.ts_ms || sample.ts_ms - archive_.ts_ms >= Config::kSwingDoorMaxGapMs;
+  if (!force) {
+    const float dt = static_cast<float>(sample.ts_ms - archive_.ts_ms);
+    float values[Config::kMaxAdcChannels];
+    float pivots[Config::kMaxAdcChannels];
+    const size_t count = rowValues(sample, row, values);
+    rowValues(archive_, archiveChannels_, pivots);
+    bool fits = true;
+    for (size_t i = 0; i < count && fits; ++i) {
+      const float slope = (values[i] - pivots[i]) / dt;
+      fits = slope >= slopeUpper_[i] && slope <= slopeLower_[i];
+    }
+    if (fits) {
+      for (size_t i = 0; i < count; ++i) {
+        slopeUpper_[i] = std::max(slopeUpper_[i], (values[i] - (pivots[i] + tolerance_)) / dt);
+        slopeLower_[i] = std::min(slopeLower_[i], (values[i] - (pivots[i] - tolerance_)) / dt);
+      }
+      held_ = sample;
+      heldChannels_ = row;
+      haveHeld_ = true;
+      return;
+    }
+    // Out of the doors: the previous point ends the segment and pivots the next one.
+    if (haveHeld_) {
+      archiveHeld(out);
+      addSwingingDoor(sample, channels, out);
+      return;
+    }
+  }
+
+  if (haveHeld_) {
+    emit(out, held_, doorHasChannels_ ? &heldChannels_ : nullptr);
+  }
+  emit(out, sample, channels);
+  openDoor(sample, row);
+}
+
+void SampleReducer::openDoor(const VoltageSample& archive, const ChannelValues& channels) {
+  haveArchive_ = true;
+  archive_ = archive;
+  archiveChannels_ = channels;
+  haveHeld_ = false;
+  std::fill(slopeUpper_, slopeUpper_ + Config::kMaxAdcChannels, -INFINITY);
+  std::fill(slopeLower_, slopeLower_ + Config::kMaxAdcChannels, INFINITY);
+}
+
+void SampleReducer::archiveHeld(SamplePoints& out) {
+  emit(out, held_, doorHasChannels_ ? &heldChannels_ : nullptr);
+  openDoor(held_, heldChannels_);
+}
@@ -0,0 +1,492 @@
+#include "SegmentLog.h"
+
+#include "Crc32.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+constexpr uint16_t kRecordMagic = 0x4352; // "RC"
+constexpr uint32_t kCursorMagic = 0x43525352;
+constexpr size_t kCrcChunk = 256;
+
+struct CursorFile {
+  uint32_t magic;
+  uint32_t segment;
+  uint32_t offset;
+  uint32_t crc;
+};
+
+uint32_t fileSize(FILE* file) {
+  if (fseek(file, 0, SEEK_END) != 0) {
+    return 0;
+  }
+  long size = ftell(file);
+  return size < 0 ? 0 : static_cast<uint32_t>(size);
+}
+
+uint32_t pathSize(const std::string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return 0;
+  }
+  return static_cast<uint32_t>(st.st_size);
+}
+
+bool parseSegmentName(const char* name, uint32_t& segment) {
+  unsigned int id = 0;
+  char ext[4] = {};
+  if (strlen(name) != 12 || sscanf(name, "%8u.%3s", &id, ext) != 2 || strcmp(ext, "seg") != 0 || id == 0) {
+    return false;
+  }
+  segment = id;
+  return true;
+}
+} // namespace
+
+static_assert(sizeof(CursorFile) == 16, "cursor layout");
+
+SegmentLog::Reader::~Reader() {
+  close();
+}
+
+size_t SegmentLog::Reader::read(uint8_t* out, size_t len) {
+  if (file_ == nullptr) {
+    return 0;
+  }
+  if (len > remaining_) {
+    len = remaining_;
+  }
+  size_t n = fread(out, 1, len, file_);
+  remaining_ -= static_cast<uint32_t>(n);
+  return n;
+}
+
+bool SegmentLog::Reader::rewind() {
+  if (file_ == nullptr || fseek(file_, start_, SEEK_SET) != 0) {
+    return false;
+  }
+  remaining_ = length_;
+  return true;
+}
+
+uint32_t SegmentLog::Reader::length() const {
+  return length_;
+}
+
+uint32_t SegmentLog::Reader::remaining() const {
+  return remaining_;
+}
+
+uint8_t SegmentLog::Reader::kind() const {
+  return kind_;
+}
+
+void SegmentLog::Reader::close() {
+  if (file_ != nullptr) {
+    fclose(file_);
+    file_ = nullptr;
+  }
+  length_ = 0;
+  remaining_ = 0;
+}
+
+SegmentLog::SegmentLog(const std::string& dir, uint32_t segmentBytes, uint32_t maxBytes)
+    : dir_(dir), segmentBytes_(segmentBytes), maxBytes_(maxBytes) {
+  static_assert(sizeof(RecordHeader) == 12, "record header layout");
+}
+
+SegmentLog::~SegmentLog() {
+  closeWriter();
+}
+
+bool SegmentLog::begin() {
+  closeWriter();
+  stats_ = {};
+  if (mkdir(dir_.c_str(), 0775) != 0 && errno != EEXIST) {
+    return false;
+  }
+  DIR* dir = opendir(dir_.c_str());
+  if (dir == nullptr) {
+    return false;
+  }
+  uint32_t minSegment = 0;
+  uint32_t maxSegment = 0;
+  while (struct dirent* entry = readdir(dir)) {
+    uint32_t segment = 0;
+    if (!parseSegmentName(entry->d_name, segment)) {
+      continue;
+    }
+    if (minSegment == 0 || segment < minSegment) {
+      minSegment = segment;
+    }
+    if (segment > maxSegment) {
+      maxSegment = segment;
+    }
+    stats_.segments++;
+    stats_.storedBytes += pathSize(segmentPath(segment));
+  }
+  closedir(dir);
+  remove((dir_ + "/cursor.tmp").c_str());
+
+  if (maxSegment == 0) {
+    readSegment_ = 1;
+    loadCursor();
+    readSegment_ = std::max<uint32_t>(readSegment_, 1);
+    readOffset_ = 0;
+    writeSegment_ = readSegment_;
+    writeOffset_ = 0;
+    return true;
+  }
+
+  // Appends resume after the last intact record; a torn tail seals the segment instead.
+  uint32_t records = 0;
+  uint32_t validEnd = scanSegment(maxSegment, 0, &records, true);
+  if (validEnd == pathSize(segmentPath(maxSegment))) {
+    writeSegment_ = maxSegment;
+    writeOffset_ = validEnd;
+  } else {
+    writeSegment_ = maxSegment + 1;
+    writeOffset_ = 0;
+  }
+
+  readSegment_ = minSegment;
+  readOffset_ = 0;
+  loadCursor();
+  if (readSegment_ < minSegment || readSegment_ > writeSegment_) {
+    readSegment_ = minSegment;
+    readOffset_ = 0;
+  }
+
+  for (uint32_t segment = readSegment_; segment <= writeSegment_; ++segment) {
+    uint32_t count = 0;
+    scanSegment(segment, segment == readSegment_ ? readOffset_ : 0, &count, false);
+    stats_.pendingRecords += count;
+  }
+  return true;
+}
+
+bool SegmentLog::append(const uint8_t* data, size_t len, uint8_t kind) {
+  return beginAppend(kind, len) && appendChunk(data, len) && commitAppend();
+}
+
+bool SegmentLog::beginAppend(uint8_t kind, size_t sizeHint) {
+  abortAppend();
+  const uint32_t recordBytes = static_cast<uint32_t>(sizeof(RecordHeader) + sizeHint);
+  if (writeOffset_ > 0 && writeOffset_ + recordBytes > segmentBytes_) {
+    rollSegment();
+  }
+  while (stats_.storedBytes + recordBytes > maxBytes_ && readSegment_ < writeSegment_) {
+    dropOldestSegment();
+  }
+  if (writer_ == nullptr && !openWriter(writeOffset_ == 0)) {
+    return false;
+  }
+
+  // The placeholder header has no magic, so a record torn before commit is never read back.
+  pending_ = {};
+  pending_.kind = kind;
+  if (fseek(writer_, writeOffset_, SEEK_SET) != 0 || fwrite(&pending_, sizeof(pending_), 1, writer_) != 1) {
+    failAppend();
+    return false;
+  }
+  appending_ = true;
+  return true;
+}
+
+bool SegmentLog::appendChunk(const uint8_t* data, size_t len) {
+  if (!appending_) {
+    return false;
+  }
+  if (len > 0 && fwrite(data, 1, len, writer_) != len) {
+    failAppend();
+    return false;
+  }
+  pending_.crc = crc32Update(pending_.crc, data, len);
+  pending_.length += static_cast<uint32_t>(len);
+  while (stats_.storedBytes + sizeof(RecordHeader) + pending_.length > maxBytes_ && readSegment_ < writeSegment_) {
+    dropOldestSegment();
+  }
+  return true;
+}
+
+bool SegmentLog::commitAppend() {
+  if (!appending_) {
+    return false;
+  }
+  appending_ = false;
+  RecordHeader header = pending_;
+  header.magic = kRecordMagic;
+  header.crc = crc32Update(header.crc, reinterpret_cast<const uint8_t*>(&header), offsetof(RecordHeader, crc));
+
+  const uint32_t recordBytes = sizeof(RecordHeader) + header.length;
+  bool ok = fflush(writer_) == 0 && fseek(writer_, writeOffset_, SEEK_SET) == 0 &&
+            fwrite(&header, sizeof(header), 1, writer_) == 1 && fflush(writer_) == 0 &&
+            fsync(fileno(writer_)) == 0 && fseek(writer_, writeOffset_ + recordBytes, SEEK_SET) == 0;
+  if (!ok) {
+    failAppend();
+    return false;
+  }
+  writeOffset_ += recordBytes;
+  stats_.storedBytes += recordBytes;
+  stats_.pendingRecords++;
+  return true;
+}
+
+void SegmentLog::abortAppend() {
+  if (!appending_) {
+    return;
+  }
+  // Nothing after writeOffset_ is ever read; the next record simply overwrites it.
+  appending_ = false;
+  fflush(writer_);
+}
+
+void SegmentLog::failAppend() {
+  // Leave the partial record behind; readers stop at it and move to the next segment.
+  appending_ = false;
+  closeWriter();
+  uint32_t size = pathSize(segmentPath(writeSegment_));
+  if (size > writeOffset_) {
+    stats_.storedBytes += size - writeOffset_;
+  }
+  rollSegment();
+}
+
+bool SegmentLog::empty() const {
+  return stats_.pendingRecords == 0;
+}
+
+bool SegmentLog::openFront(Reader& reader) {
+  reader.close();
+  RecordHeader header;
+  FILE* file = nullptr;
+  while (locateFront(header, &file)) {
+    const long payloadOffset = ftell(file);
+    if (verifyPayload(file, header) && fseek(file, payloadOffset, SEEK_SET) == 0) {
+      reader.file_ = file;
+      reader.start_ = payloadOffset;
+      reader.length_ = header.length;
+      reader.remaining_ = header.length;
+      reader.kind_ = header.kind;
+      return true;
+    }
+    fclose(file);
+    stats_.corruptRecords++;
+    pop();
+  }
+  stats_.pendingRecords = 0;
+  return false;
+}
+
+bool SegmentLog::peek(std::vector<uint8_t>& out, uint8_t* kind) {
+  Reader reader;
+  if (!openFront(reader)) {
+    out.clear();
+    return false;
+  }
+  out.resize(reader.length());
+  if (reader.read(out.data(), out.size()) != out.size()) {
+    out.clear();
+    return false;
+  }
+  if (kind != nullptr) {
+    *kind = reader.kind();
+  }
+  return true;
+}
+
+bool SegmentLog::pop() {
+  RecordHeader header;
+  if (!locateFront(header, nullptr)) {
+    stats_.pendingRecords = 0;
+    return false;
+  }
+  readOffset_ += sizeof(RecordHeader) + header.length;
+  if (stats_.pendingRecords > 0) {
+    stats_.pendingRecords--;
+  }
+  if (readSegment_ < writeSegment_ && readOffset_ >= pathSize(segmentPath(readSegment_))) {
+    finishReadSegment();
+  } else {
+    persistCursor();
+  }
+  return true;
+}
+
+const SegmentLog::Stats& SegmentLog::stats() const {
+  return stats_;
+}
+
+std::string SegmentLog::segmentPath(uint32_t segment) const {
+  char name[16];
+  snprintf(name, sizeof(name), "/%08u.seg", static_cast<unsigned int>(segment));
+  return dir_ + name;
+}
+
+bool SegmentLog::openWriter(bool truncate) {
+  const std::string path = segmentPath(writeSegment_);
+  if (truncate) {
+    bool existed = access(path.c_str(), F_OK) == 0;
+    writer_ = fopen(path.c_str(), "wb");
+    if (writer_ != nullptr && !existed) {
+      stats_.segments++;
+    }
+    return writer_ != nullptr;
+  }
+  writer_ = fopen(path.c_str(), "r+b");
+  if (writer_ == nullptr) {
+    return false;
+  }
+  if (fseek(writer_, writeOffset_, SEEK_SET) != 0) {
+    closeWriter();
+    return false;
+  }
+  return true;
+}
+
+void SegmentLog::closeWriter() {
+  if (writer_ != nullptr) {
+    fclose(writer_);
+    writer_ = nullptr;
+  }
+}
+
+bool SegmentLog::rollSegment() {
+  closeWriter();
+  writeSegment_++;
+  writeOffset_ = 0;
+  return true;
+}
+
+bool SegmentLog::locateFront(RecordHeader& header, FILE** fileOut) {
+  for (;;) {
+    if (readSegment_ > writeSegment_ || (readSegment_ == writeSegment_ && readOffset_ >= writeOffset_)) {
+      return false;
+    }
+    FILE* file = fopen(segmentPath(readSegment_).c_str(), "rb");
+    if (file != nullptr) {
+      uint32_t size = fileSize(file);
+      if (fseek(file, readOffset_, SEEK_SET) == 0 && readHeader(file, header) &&
+          readOffset_ + sizeof(RecordHeader) + header.length <= size) {
+        if (fileOut != nullptr) {
+          *fileOut = file;
+        } else {
+          fclose(file);
+        }
+        return true;
+      }
+      fclose(file);
+    }
+    if (readSegment_ == writeSegment_) {
+      return false;
+    }
+    finishReadSegment();
+  }
+}
+
+bool SegmentLog::readHeader(FILE* file, RecordHeader& header) const {
+  if (fread(&header, sizeof(header), 1, file) != 1) {
+    return false;
+  }
+  return header.magic == kRecordMagic;
+}
+
+// The CRC covers the payload followed by the header fields before it, so streaming appends can
+// compute it before the final length is known.
+bool SegmentLog::verifyPayload(FILE* file, const RecordHeader& header) const {
+  uint8_t chunk[kCrcChunk];
+  uint32_t crc = 0;
+  uint32_t remaining = header.length;
+  while (remaining > 0) {
+    size_t n = remaining < kCrcChunk ? remaining : kCrcChunk;
+    if (fread(chunk, 1, n, file) != n) {
+      return false;
+    }
+    crc = crc32Update(crc, chunk, n);
+    remaining -= n;
+  }
+  crc = crc32Update(crc, reinterpret_cast<const uint8_t*>(&header), offsetof(RecordHeader, crc));
+  return crc == header.crc;
+}
+
+uint32_t SegmentLog::scanSegment(uint32_t segment, uint32_t fromOffset, uint32_t* records, bool verifyCrc) const {
+  FILE* file = fopen(segmentPath(segment).c_str(), "rb");
+  if (file == nullptr) {
+    return fromOffset;
+  }
+  const uint32_t size = fileSize(file);
+  uint32_t offset = fromOffset;
+  RecordHeader header;
+  while (fseek(file, offset, SEEK_SET) == 0 && readHeader(file, header) &&
+         offset + sizeof(RecordHeader) + header.length <= size) {
+    if (verifyCrc && !verifyPayload(file, header)) {
+      break;
+    }
+    offset += sizeof(RecordHeader) + header.length;
+    (*records)++;
+  }
+  fclose(file);
+  return offset;
+}
+
+void SegmentLog::finishReadSegment() {
+  const std::string path = segmentPath(readSegment_);
+  uint32_t size = pathSize(path);
+  if (remove(path.c_str()) == 0) {
+    stats_.storedBytes = stats_.storedBytes > size ? stats_.storedBytes - size : 0;
+    if (stats_.segments > 0) {
+      stats_.segments--;
+    }
+  }
+  readSegment_++;
+  readOffset_ = 0;
+  persistCursor();
+}
+
+void SegmentLog::dropOldestSegment() {
+  uint32_t count = 0;
+  scanSegment(readSegment_, readOffset_, &count, false);
+  stats_.droppedRecords += count;
+  stats_.pendingRecords = stats_.pendingRecords > count ? stats_.pendingRecords - count : 0;
+  finishReadSegment();
+}
+
+void SegmentLog::loadCursor() {
+  FILE* file = fopen((dir_ + "/cursor").c_str(), "rb");
+  if (file == nullptr) {
+    return;
+  }
+  CursorFile cursor;
+  bool ok = fread(&cursor, sizeof(cursor), 1, file) == 1;
+  fclose(file);
+  if (!ok || cursor.magic != kCursorMagic ||
+      cursor.crc != crc32Update(0, reinterpret_cast<const uint8_t*>(&cursor), offsetof(CursorFile, crc))) {
+    return;
+  }
+  readSegment_ = cursor.segment;
+  readOffset_ = cursor.offset;
+}
+
+void SegmentLog::persistCursor() {
+  CursorFile cursor = {};
+  cursor.magic = kCursorMagic;
+  cursor.segment = readSegment_;
+  cursor.offset = readOffset_;
+  cursor.crc = crc32Update(0, reinterpret_cast<const uint8_t*>(&cursor), offsetof(CursorFile, crc));
+
+  const std::string tmpPath = dir_ + "/cursor.tmp";
+  FILE* file = fopen(tmpPath.c_str(), "wb");
+  if (file == nullptr) {
+    return;
+  }
+  bool ok = fwrite(&cursor, sizeof(cursor), 1, file) == 1 && fflush(file) == 0 && fsync(fileno(file)) == 0;
+  fclose(file);
+  if (ok) {
+    rename(tmpPath.c_str(), (dir_ + "/cursor").c_str());
+  }
+}
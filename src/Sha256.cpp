@@ -0,0 +1,149 @@
+#include "Sha256.h"
+
+#include <string.h>
+
+namespace {
+const uint32_t kRoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+inline uint32_t rotr(uint32_t value, int bits) {
+  return (value >> bits) | (value << (32 - bits));
+}
+
+int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+} // namespace
+
+Sha256::Sha256() {
+  reset();
+}
+
+void Sha256::reset() {
+  static const uint32_t kInitialState[8] = {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+  };
+  memcpy(state_, kInitialState, sizeof(state_));
+  blockLength_ = 0;
+  totalLength_ = 0;
+}
+
+void Sha256::update(const uint8_t* data, size_t length) {
+  totalLength_ += length;
+  if (blockLength_ > 0) {
+    const size_t take = length < sizeof(block_) - blockLength_ ? length : sizeof(block_) - blockLength_;
+    memcpy(block_ + blockLength_, data, take);
+    blockLength_ += take;
+    data += take;
+    length -= take;
+    if (blockLength_ < sizeof(block_)) {
+      return;
+    }
+    compress(block_);
+    blockLength_ = 0;
+  }
+  // Whole blocks straight from the caller's buffer.
+  for (; length >= sizeof(block_); data += sizeof(block_), length -= sizeof(block_)) {
+    compress(data);
+  }
+  memcpy(block_, data, length);
+  blockLength_ = length;
+}
+
+void Sha256::finish(uint8_t digest[kDigestSize]) {
+  const uint64_t bits = totalLength_ * 8;
+  block_[blockLength_++] = 0x80;
+  if (blockLength_ > sizeof(block_) - 8) {
+    memset(block_ + blockLength_, 0, sizeof(block_) - blockLength_);
+    compress(block_);
+    blockLength_ = 0;
+  }
+  memset(block_ + blockLength_, 0, sizeof(block_) - 8 - blockLength_);
+  for (int i = 0; i < 8; ++i) {
+    block_[56 + i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+  }
+  compress(block_);
+  for (int i = 0; i < 8; ++i) {
+    digest[4 * i] = static_cast<uint8_t>(state_[i] >> 24);
+    digest[4 * i + 1] = static_cast<uint8_t>(state_[i] >> 16);
+    digest[4 * i + 2] = static_cast<uint8_t>(state_[i] >> 8);
+    digest[4 * i + 3] = static_cast<uint8_t>(state_[i]);
+  }
+}
+
+bool Sha256::fromHex(const char* hex, uint8_t digest[kDigestSize]) {
+  if (strlen(hex) != 2 * kDigestSize) {
+    return false;
+  }
+  for (size_t i = 0; i < kDigestSize; ++i) {
+    const int high = hexValue(hex[2 * i]);
+    const int low = hexValue(hex[2 * i + 1]);
+    if (high < 0 || low < 0) {
+      return false;
+    }
+    digest[i] = static_cast<uint8_t>(high << 4 | low);
+  }
+  return true;
+}
+
+void Sha256::toHex(const uint8_t digest[kDigestSize], char* hex) {
+  static const char kDigits[] = "0123456789abcdef";
+  for (size_t i = 0; i < kDigestSize; ++i) {
+    hex[2 * i] = kDigits[digest[i] >> 4];
+    hex[2 * i + 1] = kDigits[digest[i] & 0x0F];
+  }
+  hex[2 * kDigestSize] = '\0';
+}
+
+void Sha256::compress(const uint8_t* block) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; ++i) {
+    w[i] = static_cast<uint32_t>(block[4 * i]) << 24 | static_cast<uint32_t>(block[4 * i + 1]) << 16 |
+           static_cast<uint32_t>(block[4 * i + 2]) << 8 | block[4 * i + 3];
+  }
+  for (int i = 16; i < 64; ++i) {
+    const uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    const uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+  uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+  for (int i = 0; i < 64; ++i) {
+    const uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + kRoundConstants[i] + w[i];
+    const uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+  state_[4] += e;
+  state_[5] += f;
+  state_[6] += g;
+  state_[7] += h;
+}
@@ -1,57 +1,166 @@
 #include "StorageQueue.h"
 
-StorageQueue::StorageQueue(const char* path) : path_(path) {}
+#include <LittleFS.h>
+#include <algorithm>
 
-bool StorageQueue::begin() {
-  if (!LittleFS.exists(path_)) {
-    return true;
+StorageQueue::RecordWriter::RecordWriter(StorageQueue& queue, uint8_t kind, size_t sizeHint)
+    : log_(queue.log_), ok_(queue.log_.beginAppend(kind, sizeHint)) {}
+
+StorageQueue::RecordWriter::~RecordWriter() {
+  if (ok_) {
+    log_.abortAppend();
   }
-  File file = LittleFS.open(path_, "r");
-  if (!file) {
-    return false;
+}
+
+bool StorageQueue::RecordWriter::write(const uint8_t* data, size_t len) {
+  while (ok_ && len > 0) {
+    if (len_ == sizeof(buffer_) && !flush()) {
+      break;
+    }
+    size_t n = std::min(len, sizeof(buffer_) - len_);
+    memcpy(buffer_ + len_, data, n);
+    len_ += n;
+    data += n;
+    len -= n;
   }
-  while (file.available()) {
-    String line = file.readStringUntil('\n');
-    line.trim();
-    if (line.length() > 0) {
-      items_.push_back(line);
+  return ok_;
+}
+
+bool StorageQueue::RecordWriter::commit() {
+  bool committed = flush() && log_.commitAppend();
+  ok_ = false;
+  return committed;
+}
+
+bool StorageQueue::RecordWriter::flush() {
+  if (ok_ && len_ > 0) {
+    ok_ = log_.appendChunk(buffer_, len_);
+  }
+  len_ = 0;
+  return ok_;
+}
+
+int StorageQueue::FrontStream::available() {
+  return static_cast<int>((len_ - pos_) + reader_.remaining());
+}
+
+int StorageQueue::FrontStream::read() {
+  if (pos_ == len_ && !fill()) {
+    return -1;
+  }
+  return buffer_[pos_++];
+}
+
+int StorageQueue::FrontStream::peek() {
+  if (pos_ == len_ && !fill()) {
+    return -1;
+  }
+  return buffer_[pos_];
+}
+
+size_t StorageQueue::FrontStream::readBytes(char* buffer, size_t length) {
+  size_t copied = 0;
+  while (copied < length) {
+    if (pos_ == len_ && !fill()) {
+      break;
     }
+    size_t n = std::min(length - copied, len_ - pos_);
+    memcpy(buffer + copied, buffer_ + pos_, n);
+    pos_ += n;
+    copied += n;
   }
-  file.close();
+  return copied;
+}
+
+size_t StorageQueue::FrontStream::write(uint8_t) {
+  return 0;
+}
+
+bool StorageQueue::FrontStream::rewind() {
+  pos_ = 0;
+  len_ = 0;
+  return reader_.rewind();
+}
+
+size_t StorageQueue::FrontStream::length() const {
+  return reader_.length();
+}
+
+uint8_t StorageQueue::FrontStream::kind() const {
+  return reader_.kind();
+}
+
+void StorageQueue::FrontStream::close() {
+  reader_.close();
+  pos_ = 0;
+  len_ = 0;
+}
+
+bool StorageQueue::FrontStream::fill() {
+  pos_ = 0;
+  len_ = reader_.read(buffer_, sizeof(buffer_));
+  return len_ > 0;
+}
+
+StorageQueue::StorageQueue(const char* name, const char* legacyPath, uint32_t maxBytes)
+    : legacyPath_(legacyPath),
+      log_(std::string(Config::kFsBasePath) + name, Config::kQueueSegmentBytes, maxBytes) {}
+
+bool StorageQueue::begin() {
+  if (!log_.begin()) {
+    Serial.println("[QUEUE] Failed to open segment log.");
+    return false;
+  }
+  migrateLegacy();
   return true;
 }
 
-void StorageQueue::enqueue(const String& payload) {
-  items_.push_back(payload);
-  persist();
+bool StorageQueue::enqueue(const String& payload) {
+  return enqueue(reinterpret_cast<const uint8_t*>(payload.c_str()), payload.length());
+}
+
+bool StorageQueue::enqueue(const uint8_t* data, size_t len, uint8_t kind) {
+  return log_.append(data, len, kind);
 }
 
 bool StorageQueue::hasItems() const {
-  return !items_.empty();
+  return !log_.empty();
 }
 
-String StorageQueue::front() const {
-  if (items_.empty()) {
-    return String();
-  }
-  return items_.front();
+bool StorageQueue::front(std::vector<uint8_t>& out, uint8_t* kind) {
+  return log_.peek(out, kind);
+}
+
+bool StorageQueue::openFront(FrontStream& stream) {
+  stream.close();
+  return log_.openFront(stream.reader_);
 }
 
 void StorageQueue::pop() {
-  if (items_.empty()) {
-    return;
-  }
-  items_.erase(items_.begin());
-  persist();
+  log_.pop();
+}
+
+const SegmentLog::Stats& StorageQueue::stats() const {
+  return log_.stats();
 }
 
-void StorageQueue::persist() {
-  File file = LittleFS.open(path_, "w");
+void StorageQueue::migrateLegacy() {
+  if (legacyPath_ == nullptr || !LittleFS.exists(legacyPath_)) {
+    return;
+  }
+  File file = LittleFS.open(legacyPath_, "r");
   if (!file) {
     return;
   }
-  for (const auto& item : items_) {
-    file.println(item);
+  size_t imported = 0;
+  while (file.available()) {
+    String line = file.readStringUntil('\n');
+    line.trim();
+    if (line.length() > 0 && enqueue(line)) {
+      imported++;
+    }
   }
   file.close();
+  LittleFS.remove(legacyPath_);
+  Serial.printf("[QUEUE] Imported %u payloads from %s\n", static_cast<unsigned int>(imported), legacyPath_);
 }
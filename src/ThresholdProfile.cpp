@@ -0,0 +1,190 @@
+#include "ThresholdProfile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+namespace {
+struct LevelKey {
+  const char* name;
+  float ThresholdProfile::*field;
+};
+
+struct CountKey {
+  const char* name;
+  uint16_t ThresholdProfile::*field;
+};
+
+const LevelKey kLevelKeys[] = {
+    {"sag_start", &ThresholdProfile::sagStart},
+    {"sag_end", &ThresholdProfile::sagEnd},
+    {"swell_start", &ThresholdProfile::swellStart},
+    {"swell_end", &ThresholdProfile::swellEnd},
+    {"critical_low", &ThresholdProfile::criticalLow},
+    {"critical_high", &ThresholdProfile::criticalHigh},
+};
+
+const CountKey kCountKeys[] = {
+    {"sag_start_windows", &ThresholdProfile::sagStartWindows},
+    {"sag_end_windows", &ThresholdProfile::sagEndWindows},
+    {"swell_start_windows", &ThresholdProfile::swellStartWindows},
+    {"swell_end_windows", &ThresholdProfile::swellEndWindows},
+    {"critical_end_windows", &ThresholdProfile::criticalEndWindows},
+};
+
+bool parseFloat(const char* text, float& out) {
+  char* end = nullptr;
+  const float value = strtof(text, &end);
+  if (end == text || *end != '\0') {
+    return false;
+  }
+  out = value;
+  return true;
+}
+
+bool parseCount(const char* text, uint32_t max, uint32_t& out) {
+  char* end = nullptr;
+  const unsigned long value = strtoul(text, &end, 10);
+  if (end == text || *end != '\0' || value == 0 || value > max) {
+    return false;
+  }
+  out = static_cast<uint32_t>(value);
+  return true;
+}
+
+bool setValue(ThresholdProfile& profile, const char* key, const char* value, bool& levelSet) {
+  if (strcmp(key, "mode") == 0) {
+    if (strcasecmp(value, "fixed") == 0) {
+      profile.mode = ThresholdMode::Fixed;
+    } else if (strcasecmp(value, "nominal") == 0) {
+      profile.mode = ThresholdMode::Nominal;
+    } else {
+      return false;
+    }
+    return true;
+  }
+  if (strcmp(key, "nominal") == 0) {
+    return parseFloat(value, profile.nominalV) && profile.nominalV >= 50.0f && profile.nominalV <= 500.0f;
+  }
+  if (strcmp(key, "fast_half_cycles") == 0) {
+    uint32_t count = 0;
+    if (!parseCount(value, UINT8_MAX, count)) {
+      return false;
+    }
+    profile.fastTriggerHalfCycles = static_cast<uint8_t>(count);
+    return true;
+  }
+  for (const LevelKey& level : kLevelKeys) {
+    if (strcmp(key, level.name) == 0) {
+      levelSet = true;
+      return parseFloat(value, profile.*level.field);
+    }
+  }
+  for (const CountKey& count : kCountKeys) {
+    if (strcmp(key, count.name) == 0) {
+      uint32_t parsed = 0;
+      if (!parseCount(value, UINT16_MAX, parsed)) {
+        return false;
+      }
+      profile.*count.field = static_cast<uint16_t>(parsed);
+      return true;
+    }
+  }
+  return false;
+}
+} // namespace
+
+const char* ThresholdModeToString(ThresholdMode mode) {
+  return mode == ThresholdMode::Nominal ? "nominal" : "fixed";
+}
+
+bool ThresholdProfile::parse(const char* text) {
+  ThresholdProfile parsed = *this;
+  bool levelSet = false;
+  const char* p = text;
+  for (;;) {
+    while (*p == ' ' || *p == ',') {
+      ++p;
+    }
+    if (*p == '\0') {
+      break;
+    }
+    const char* end = p + strcspn(p, " ,");
+    const char* equals = static_cast<const char*>(memchr(p, '=', end - p));
+    char key[24];
+    char value[16];
+    const size_t keyLength = equals != nullptr ? static_cast<size_t>(equals - p) : 0;
+    const size_t valueLength = equals != nullptr ? static_cast<size_t>(end - equals - 1) : 0;
+    if (keyLength == 0 || keyLength >= sizeof(key) || valueLength == 0 || valueLength >= sizeof(value)) {
+      return false;
+    }
+    memcpy(key, p, keyLength);
+    key[keyLength] = '\0';
+    memcpy(value, equals + 1, valueLength);
+    value[valueLength] = '\0';
+    if (!setValue(parsed, key, value, levelSet)) {
+      return false;
+    }
+    p = end;
+  }
+
+  // Volts were set for the old nominal voltage; percentages turn into volts at the new one.
+  if (parsed.mode != mode && !levelSet) {
+    const float scale = parsed.mode == ThresholdMode::Nominal ? 100.0f / nominalV : parsed.nominalV / 100.0f;
+    for (const LevelKey& level : kLevelKeys) {
+      parsed.*level.field *= scale;
+    }
+  }
+  if (!parsed.valid()) {
+    return false;
+  }
+  *this = parsed;
+  return true;
+}
+
+void ThresholdProfile::format(char* buf, size_t size) const {
+  snprintf(buf,
+           size,
+           "mode=%s nominal=%.1f sag_start=%.2f sag_end=%.2f swell_start=%.2f swell_end=%.2f critical_low=%.2f "
+           "critical_high=%.2f sag_start_windows=%u sag_end_windows=%u swell_start_windows=%u swell_end_windows=%u "
+           "critical_end_windows=%u fast_half_cycles=%u",
+           ThresholdModeToString(mode),
+           nominalV,
+           sagStart,
+           sagEnd,
+           swellStart,
+           swellEnd,
+           criticalLow,
+           criticalHigh,
+           static_cast<unsigned int>(sagStartWindows),
+           static_cast<unsigned int>(sagEndWindows),
+           static_cast<unsigned int>(swellStartWindows),
+           static_cast<unsigned int>(swellEndWindows),
+           static_cast<unsigned int>(criticalEndWindows),
+           static_cast<unsigned int>(fastTriggerHalfCycles));
+}
+
+DetectionThresholds ThresholdProfile::thresholds(float baselineV) const {
+  const float scale = mode == ThresholdMode::Nominal ? baselineV / 100.0f : 1.0f;
+  DetectionThresholds out;
+  out.sagStart = sagStart * scale;
+  out.sagEnd = sagEnd * scale;
+  out.swellStart = swellStart * scale;
+  out.swellEnd = swellEnd * scale;
+  out.criticalLow = criticalLow * scale;
+  out.criticalHigh = criticalHigh * scale;
+  out.sagStartWindows = sagStartWindows;
+  out.sagEndWindows = sagEndWindows;
+  out.swellStartWindows = swellStartWindows;
+  out.swellEndWindows = swellEndWindows;
+  out.criticalEndWindows = criticalEndWindows;
+  out.fastTriggerHalfCycles = fastTriggerHalfCycles;
+  return out;
+}
+
+// Each end level sits inside its start level, so an event cannot end and restart at once.
+bool ThresholdProfile::valid() const {
+  return criticalLow > 0.0f && criticalLow < sagStart && sagStart <= sagEnd && sagEnd < swellEnd &&
+         swellEnd <= swellStart && swellStart < criticalHigh;
+}
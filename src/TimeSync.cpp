@@ -21,23 +21,35 @@ void TimeSync::update() {
   }
 
   struct tm timeinfo;
-  if (getLocalTime(&timeinfo, 2000)) {
+  bool ok = getLocalTime(&timeinfo, 2000);
+  uint64_t bootEpochMs = 0;
+  if (ok) {
     time_t epoch = mktime(&timeinfo);
-    bootEpochMs_ = static_cast<uint64_t>(epoch) * 1000ULL - now;
-    synced_ = true;
-  } else {
-    synced_ = false;
+    bootEpochMs = static_cast<uint64_t>(epoch) * 1000ULL - now;
   }
+  portENTER_CRITICAL(&lock_);
+  if (ok) {
+    bootEpochMs_ = bootEpochMs;
+  }
+  synced_ = ok;
+  portEXIT_CRITICAL(&lock_);
   lastSyncMs_ = now;
 }
 
 bool TimeSync::isSynced() const {
-  return synced_;
+  portENTER_CRITICAL(&lock_);
+  bool synced = synced_;
+  portEXIT_CRITICAL(&lock_);
+  return synced;
 }
 
 uint64_t TimeSync::nowMs() const {
-  if (!synced_) {
+  portENTER_CRITICAL(&lock_);
+  bool synced = synced_;
+  uint64_t bootEpochMs = bootEpochMs_;
+  portEXIT_CRITICAL(&lock_);
+  if (!synced) {
     return static_cast<uint64_t>(millis());
   }
-  return bootEpochMs_ + static_cast<uint64_t>(millis());
+  return bootEpochMs + static_cast<uint64_t>(millis());
 }
@@ -1,78 +1,330 @@
 #include "VoltageSampler.h"
 
+#include "Metrics.h"
+#include "WaveformRecorder.h"
+#include "WindowKernel.h"
+
+#include <algorithm>
 #include <math.h>
 
-VoltageSampler::VoltageSampler(gpio_num_t pin) : adcPin_(pin) {}
+namespace {
+uint32_t isqrt64(uint64_t value) {
+  uint64_t result = 0;
+  uint64_t bit = 1ULL << 62;
+  while (bit > value) {
+    bit >>= 2;
+  }
+  while (bit != 0) {
+    if (value >= result + bit) {
+      value -= result + bit;
+      result = (result >> 1) + bit;
+    } else {
+      result >>= 1;
+    }
+    bit >>= 2;
+  }
+  return static_cast<uint32_t>(result);
+}
 
-void VoltageSampler::begin() {
-  analogReadResolution(12);
-  analogSetPinAttenuation(adcPin_, ADC_11db);
-  intervalUs_ = 1000000UL / Config::kSampleRateHz;
-  windowStartMs_ = millis();
-  lastSampleUs_ = micros();
+int32_t toFixed(float value, int fracBits) {
+  double scaled = static_cast<double>(value) * (1 << fracBits);
+  scaled = std::min<double>(std::max<double>(scaled, INT32_MIN), INT32_MAX);
+  return static_cast<int32_t>(lround(scaled));
+}
+
+// RMS of n samples around their own mean, with fracBits fractional bits. n^2 * variance =
+// n * sum(d^2) - sum(d)^2 is exact in 64 bits for any common offset of d; its root is n * rms.
+int64_t fixedRms(uint32_t n, int64_t sum, uint64_t sumSq, int fracBits) {
+  const int64_t count = n;
+  const uint64_t scaledVariance = static_cast<uint64_t>(count * static_cast<int64_t>(sumSq) - sum * sum);
+  return ((static_cast<int64_t>(isqrt64(scaledVariance)) << fracBits) + count / 2) / count;
+}
+
+// Same over a span of spanQ8 / 256 samples measured between interpolated zero crossings. The
+// whole-sample window is up to one sample longer or shorter than the cycles it covers; the
+// boundary samples sit near zero and add little energy, so dividing by the true span removes
+// most of that jitter. 256 * span^2 * variance = spanQ8 * sum(d^2) - 256 * sum(d)^2.
+int64_t fixedRmsOverSpan(uint32_t spanQ8, int64_t sum, uint64_t sumSq, int fracBits) {
+  const int64_t scaled = static_cast<int64_t>(spanQ8) * static_cast<int64_t>(sumSq) - 256 * sum * sum;
+  const int64_t span = spanQ8;
+  return ((static_cast<int64_t>(isqrt64(scaled > 0 ? scaled : 0)) << (fracBits + 4)) + span / 2) / span;
+}
+} // namespace
+
+VoltageSampler::VoltageSampler(AdcBufferProvider& provider) : provider_(provider) {}
+
+bool VoltageSampler::begin() {
+  samplesPerWindow_ = (provider_.sampleRateHz() * Config::kWindowMs) / 1000;
+  if (samplesPerWindow_ == 0) {
+    samplesPerWindow_ = 1;
+  }
+  // Lets a synchronized window stretch down to 0.8x the nominal line frequency.
+  maxSyncSamples_ = std::min<uint32_t>(samplesPerWindow_ * 5 / 4, UINT16_MAX);
+  resetWindow();
+  return provider_.begin();
 }
 
 void VoltageSampler::setCalibration(float gain, float offset, bool hasCalibration) {
-  gain_ = gain;
-  offset_ = offset;
-  hasCalibration_ = hasCalibration;
-}
-
-bool VoltageSampler::update(VoltageSample& outSample) {
-  unsigned long nowUs = micros();
-  if (nowUs - lastSampleUs_ >= intervalUs_) {
-    lastSampleUs_ = nowUs;
-    uint16_t raw = analogRead(adcPin_);
-    count_++;
-    sum_ += raw;
-    sumSq_ += static_cast<uint64_t>(raw) * raw;
-    if (raw == 0 || raw >= 4095) {
-      saturatedCount_++;
+  if (!pendingCalibration_.push({toFixed(gain, kGainFracBits), toFixed(offset, kVoltFracBits), hasCalibration})) {
+    Serial.println("[SAMPLE] Calibration dropped, too many pending changes");
+  }
+}
+
+void VoltageSampler::setCycleSync(bool enabled) {
+  cycleSyncRequested_.store(enabled, std::memory_order_relaxed);
+}
+
+bool VoltageSampler::cycleSync() const {
+  return cycleSyncRequested_.load(std::memory_order_relaxed);
+}
+
+void VoltageSampler::setHarmonics(bool enabled) {
+  harmonicsRequested_.store(enabled, std::memory_order_relaxed);
+}
+
+bool VoltageSampler::harmonics() const {
+  return harmonicsRequested_.load(std::memory_order_relaxed);
+}
+
+void VoltageSampler::setSignalThresholds(float minRms, uint16_t minRawPkPk) {
+  noSignalRms_ = minRms;
+  noSignalRawPkPk_ = minRawPkPk;
+}
+
+void VoltageSampler::followWindows(const VoltageSampler* reference) {
+  reference_ = reference;
+}
+
+void VoltageSampler::setHalfCycleListener(HalfCycleListener* listener) {
+  halfCycleListener_ = listener;
+}
+
+void VoltageSampler::setSampleListener(SampleListener* listener) {
+  sampleListener_ = listener;
+}
+
+void VoltageSampler::setWaveformRecorder(WaveformRecorder* recorder) {
+  waveformRecorder_ = recorder;
+  if (recorder != nullptr) {
+    recorder->setSampleRate(provider_.sampleRateHz());
+  }
+}
+
+bool VoltageSampler::update(VoltageSample& outSample, uint32_t waitMs) {
+  while (!windowComplete()) {
+    if (bufferPos_ == bufferLen_) {
+      bufferPos_ = 0;
+      bufferLen_ = provider_.read(buffer_, Config::kAdcDmaBufferLen, waitMs);
+      if (bufferLen_ == 0) {
+        return false;
+      }
+      if (waveformRecorder_ != nullptr) {
+        waveformRecorder_->append(buffer_, bufferLen_);
+      }
     }
-    if (raw < minRaw_) {
-      minRaw_ = raw;
+    size_t take = std::min<size_t>({bufferLen_ - bufferPos_, windowLimit() - count_, WindowKernel::kMaxBlock});
+    const uint32_t start = Metrics::cycleCount();
+    if (cycleSync_) {
+      take = accumulateSynced(buffer_ + bufferPos_, take);
+    } else {
+      accumulate(buffer_ + bufferPos_, take);
     }
-    if (raw > maxRaw_) {
-      maxRaw_ = raw;
+    windowCycles_ += Metrics::cycleCount() - start;
+    bufferPos_ += take;
+  }
+
+  const uint32_t start = Metrics::cycleCount();
+  finishWindow(outSample);
+  lastWindowCycles_ = windowCycles_ + (Metrics::cycleCount() - start);
+  resetWindow();
+  return true;
+}
+
+void VoltageSampler::accumulate(const uint16_t* raw, size_t count) {
+  WindowKernel::Stats block;
+  block.min = minRaw_;
+  block.max = maxRaw_;
+  WindowKernel::accumulate(raw, count, dc_, block);
+  minRaw_ = block.min;
+  maxRaw_ = block.max;
+  addToWindow(block, count);
+  if (harmonics_) {
+    analyzer_.accumulate(raw, count, dc_);
+  }
+  if (sampleListener_ != nullptr) {
+    sampleListener_->onSamples(raw, count, dc_);
+  }
+}
+
+// Zero-crossing detection with hysteresis; the samples between crossings go through
+// accumulate(). Returns the number of samples consumed: it stops before the rising crossing
+// that completes the window, so that sample opens the next one.
+size_t VoltageSampler::accumulateSynced(const uint16_t* raw, size_t count) {
+  const int32_t dc = dc_;
+  size_t from = 0;
+  for (size_t i = 0; i < count; ++i) {
+    int32_t d = static_cast<int32_t>(raw[i]) - dc;
+    const bool rising = armed_ < 0 && d >= 0;
+    if (rising || (armed_ > 0 && d < 0)) {
+      accumulate(raw + from, i - from);
+      from = i;
+      armed_ = 0;
+      closeHalfCycle(static_cast<uint32_t>(bufferLen_ - bufferPos_ - i));
+      if (rising) {
+        // Interpolated between the previous sample and this one. The previous sample is below
+        // the bias unless a DC rebase in finishWindow() moved it onto or above it; it then
+        // counts as one count low, so the crossing lands on this sample.
+        const int32_t prev = std::min<int32_t>(prevD_, -1);
+        const uint32_t frac = static_cast<uint32_t>(-prev) * 256u / static_cast<uint32_t>(d - prev);
+        lastCrossingQ8_ = ((sampleIndex_ - 1) << 8) + frac;
+        if (risingCrossings_ == 0) {
+          firstCrossingQ8_ = lastCrossingQ8_;
+        }
+        risingCrossings_++;
+        if (reference_ == nullptr && risingCrossings_ - (startSynced_ ? 1 : 0) == Config::kCyclesPerWindow) {
+          endSynced_ = true;
+          return i;
+        }
+      }
+    }
+    if (d < -Config::kZeroCrossHysteresis) {
+      armed_ = -1;
+    } else if (d > Config::kZeroCrossHysteresis) {
+      armed_ = 1;
+    }
+    prevD_ = d;
+  }
+  accumulate(raw + from, count - from);
+  return count;
+}
+
+void VoltageSampler::addToWindow(const WindowKernel::Stats& block, size_t count) {
+  sum_ += block.sum;
+  sumSq_ += block.sumSq;
+  count_ += count;
+  saturatedCount_ += block.saturated;
+  sampleIndex_ += count;
+  if (halfValid_) {
+    half_.count += count;
+    half_.sum += block.sum;
+    half_.sumSq += block.sumSq;
+    half_.saturated = half_.saturated || block.saturated > 0;
+    if (half_.count > maxSyncSamples_) {
+      // No crossings for a whole window: the signal is gone or too small to track.
+      halfValid_ = false;
+      prevHalfValid_ = false;
+    }
+  }
+}
+
+void VoltageSampler::closeHalfCycle(uint32_t samplesAgo) {
+  if (halfValid_) {
+    if (prevHalfValid_) {
+      const int64_t rmsQ8 = fixedRms(prevHalf_.count + half_.count,
+                                     static_cast<int64_t>(prevHalf_.sum) + half_.sum,
+                                     prevHalf_.sumSq + half_.sumSq,
+                                     kRawFracBits);
+      lastHalfCycleVrms_ = static_cast<float>(rawToVolts(rmsQ8)) / (1 << kVoltFracBits);
+      if (halfCycleListener_ != nullptr && !prevHalf_.saturated && !half_.saturated) {
+        halfCycleListener_->onHalfCycleRms(lastHalfCycleVrms_, samplesAgo * 1000 / provider_.sampleRateHz());
+      }
     }
+    prevHalf_ = half_;
+    prevHalfValid_ = true;
   }
+  half_ = HalfCycle();
+  halfValid_ = true;
+}
+
+bool VoltageSampler::windowComplete() const {
+  return endSynced_ || count_ >= windowLimit();
+}
 
-  unsigned long nowMs = millis();
-  if (nowMs - windowStartMs_ < Config::kWindowMs) {
-    return false;
+// Without a crossing yet, a synchronized window closes at the nominal length like a fixed one.
+// A follower's window is open-ended until the reference has closed the matching one.
+size_t VoltageSampler::windowLimit() const {
+  if (reference_ != nullptr) {
+    return reference_->windowsClosed_ > windowsClosed_ ? reference_->boundaries_[windowsClosed_ % kBoundaryLog].samples
+                                                       : SIZE_MAX;
   }
+  return cycleSync_ && risingCrossings_ > 0 ? maxSyncSamples_ : samplesPerWindow_;
+}
 
-  if (count_ == 0) {
-    windowStartMs_ = nowMs;
-    return false;
+void VoltageSampler::applyPendingCalibration() {
+  Calibration calibration;
+  while (pendingCalibration_.pop(calibration)) {
+    gainQ20_ = calibration.gainQ20;
+    offsetQ16_ = calibration.offsetQ16;
+    hasCalibration_ = calibration.present;
   }
+}
+
+int64_t VoltageSampler::rawToVolts(int64_t rawQ8) const {
+  return ((rawQ8 * gainQ20_) >> (kGainFracBits + kRawFracBits - kVoltFracBits)) + offsetQ16_;
+}
+
+void VoltageSampler::finishWindow(VoltageSample& outSample) {
+  const int64_t n = count_;
+  const WindowBoundary* followed = reference_ != nullptr ? &reference_->boundaries_[windowsClosed_ % kBoundaryLog] : nullptr;
+  const bool cycleAligned = followed == nullptr && cycleSync_ && startSynced_ && endSynced_;
+  const int64_t rawRmsQ8 = cycleAligned ? fixedRmsOverSpan(lastCrossingQ8_ - firstCrossingQ8_, sum_, sumSq_, kRawFracBits)
+                                        : fixedRms(count_, sum_, sumSq_, kRawFracBits);
+  const float voltScale = 1.0f / (1 << kVoltFracBits);
+  lastRawRms_ = static_cast<float>(rawRmsQ8) / (1 << kRawFracBits);
+  lastVrms_ = static_cast<float>(rawToVolts(rawRmsQ8)) * voltScale;
 
-  float mean = static_cast<float>(sum_) / static_cast<float>(count_);
-  float meanSq = static_cast<float>(sumSq_) / static_cast<float>(count_);
-  float variance = meanSq - mean * mean;
-  if (variance < 0.0f) {
-    variance = 0.0f;
+  // Track the DC bias for the next window and move the open half-cycle sums onto it.
+  const int32_t mean = static_cast<int32_t>(dc_) + (sum_ >= 0 ? sum_ + n / 2 : sum_ - n / 2) / n;
+  const uint16_t dc = static_cast<uint16_t>(std::min<int32_t>(std::max<int32_t>(mean, 0), 4095));
+  const int32_t delta = static_cast<int32_t>(dc) - dc_;
+  for (HalfCycle* half : {&half_, &prevHalf_}) {
+    const int64_t halfCount = half->count;
+    half->sumSq = static_cast<uint64_t>(static_cast<int64_t>(half->sumSq) - 2 * delta * static_cast<int64_t>(half->sum) +
+                                        halfCount * delta * delta);
+    half->sum -= static_cast<int32_t>(halfCount * delta);
   }
-  lastRawRms_ = sqrtf(variance);
-  lastVrms_ = (lastRawRms_ * gain_) + offset_;
+  prevD_ -= delta;
+  dc_ = dc;
+
   uint16_t rawPkPk = static_cast<uint16_t>(maxRaw_ - minRaw_);
-  bool noSignal = lastVrms_ < Config::kNoSignalVrms;
-  if (Config::kNoSignalRawPkPk > 0 && rawPkPk < Config::kNoSignalRawPkPk) {
+  bool noSignal = lastVrms_ < noSignalRms_;
+  if (noSignalRawPkPk_ > 0 && rawPkPk < noSignalRawPkPk_) {
     noSignal = true;
   }
 
   outSample.raw_rms = lastRawRms_;
   outSample.vrms = noSignal ? 0.0f : lastVrms_;
-  outSample.vmin = noSignal ? 0.0f : (static_cast<float>(minRaw_) * gain_) + offset_;
-  outSample.vmax = noSignal ? 0.0f : (static_cast<float>(maxRaw_) * gain_) + offset_;
+  outSample.vmin = noSignal ? 0.0f : static_cast<float>(rawToVolts(static_cast<int64_t>(minRaw_) << kRawFracBits)) * voltScale;
+  outSample.vmax = noSignal ? 0.0f : static_cast<float>(rawToVolts(static_cast<int64_t>(maxRaw_) << kRawFracBits)) * voltScale;
   outSample.sample_count = static_cast<uint16_t>(count_);
+  outSample.freq_hz = 0.0f;
   outSample.flags = FLAG_NONE;
+  if (followed != nullptr) {
+    outSample.freq_hz = followed->freqHz;
+    outSample.flags |= followed->flags;
+    if (followed->freqHz > 0.0f) {
+      lineHz_ = followed->freqHz;
+    }
+  } else if (cycleSync_) {
+    if (risingCrossings_ >= 2 && lastCrossingQ8_ != firstCrossingQ8_) {
+      outSample.freq_hz = static_cast<float>(risingCrossings_ - 1) * provider_.sampleRateHz() * 256.0f /
+                          static_cast<float>(lastCrossingQ8_ - firstCrossingQ8_);
+      lineHz_ = outSample.freq_hz;
+    }
+    if (!cycleAligned) {
+      outSample.flags |= FLAG_NOT_CYCLE_SYNC;
+    }
+  }
   if (!hasCalibration_) {
     outSample.flags |= FLAG_CALIB_MISSING;
   }
   if (static_cast<float>(saturatedCount_) / static_cast<float>(count_) > Config::kAdcSaturationThreshold) {
     outSample.flags |= FLAG_ADC_SATURATED;
   }
+  outSample.thd_cpct = VoltageSample::kNoHarmonics;
+  if (harmonics_ && !noSignal) {
+    finishHarmonics(outSample);
+  }
   if (noSignal) {
     outSample.flags |= FLAG_NO_SIGNAL;
     if (!lastNoSignal_) {
@@ -84,14 +336,56 @@ bool VoltageSampler::update(VoltageSample& outSample) {
   }
   lastNoSignal_ = noSignal;
 
+  WindowBoundary& boundary = boundaries_[windowsClosed_ % kBoundaryLog];
+  boundary.samples = count_;
+  boundary.flags = outSample.flags & FLAG_NOT_CYCLE_SYNC;
+  boundary.freqHz = outSample.freq_hz;
+  windowsClosed_++;
+}
+
+void VoltageSampler::finishHarmonics(VoltageSample& outSample) {
+  HarmonicAnalyzer::Result result;
+  if (!analyzer_.finish(result)) {
+    return;
+  }
+  // Harmonics scale with the gain only; the offset is a correction of the total RMS.
+  const float centivoltsPerCount = 100.0f * static_cast<float>(gainQ20_) / (1 << kGainFracBits);
+  outSample.thd_cpct = static_cast<uint16_t>(std::min(lroundf(result.thdPct * 100.0f), 65534L));
+  const size_t orders[] = {3, 5, 7};
+  for (size_t i = 0; i < 3; ++i) {
+    outSample.harmonic_cv[i] =
+        static_cast<uint16_t>(std::min(lroundf(result.rms[orders[i] - 1] * centivoltsPerCount), 65535L));
+  }
+}
+
+void VoltageSampler::resetWindow() {
   count_ = 0;
   sum_ = 0;
   sumSq_ = 0;
   saturatedCount_ = 0;
   minRaw_ = 4095;
   maxRaw_ = 0;
-  windowStartMs_ = nowMs;
-  return true;
+  windowCycles_ = 0;
+
+  // A window that ended on a crossing hands it to the next one as its start.
+  startSynced_ = endSynced_;
+  risingCrossings_ = endSynced_ ? 1 : 0;
+  firstCrossingQ8_ = lastCrossingQ8_;
+  endSynced_ = false;
+  const bool cycleSync = cycleSyncRequested_.load(std::memory_order_relaxed);
+  if (cycleSync != cycleSync_) {
+    cycleSync_ = cycleSync;
+    startSynced_ = false;
+    risingCrossings_ = 0;
+    armed_ = 0;
+    halfValid_ = false;
+    prevHalfValid_ = false;
+  }
+  applyPendingCalibration();
+  harmonics_ = harmonicsRequested_.load(std::memory_order_relaxed);
+  if (harmonics_) {
+    analyzer_.begin(lineHz_, provider_.sampleRateHz());
+  }
 }
 
 float VoltageSampler::lastRawRms() const {
@@ -101,3 +395,11 @@ float VoltageSampler::lastRawRms() const {
 float VoltageSampler::lastVrms() const {
   return lastVrms_;
 }
+
+float VoltageSampler::lastHalfCycleVrms() const {
+  return lastHalfCycleVrms_;
+}
+
+uint32_t VoltageSampler::lastWindowCycles() const {
+  return lastWindowCycles_;
+}
@@ -0,0 +1,37 @@
+#include "WaveformCodec.h"
+
+namespace WaveformCodec {
+bool encode(ByteSink& out,
+            const char* deviceId,
+            const char* fwVersion,
+            const WaveformRecorder::Capture& capture,
+            float voltsPerCount) {
+  uint32_t gainBits = 0;
+  static_assert(sizeof(gainBits) == sizeof(voltsPerCount), "f32 expected");
+  memcpy(&gainBits, &voltsPerCount, sizeof(gainBits));
+
+  BufferedWriter writer(out);
+  writer.put('C');
+  writer.put('C');
+  writer.put('R');
+  writer.put('W');
+  writer.put(kVersion);
+  writer.put(static_cast<uint8_t>(capture.type));
+  writer.putLe(capture.sample_rate_hz, 2);
+  writer.putLe(capture.count, 4);
+  writer.putLe(capture.trigger_index, 4);
+  writer.putLe(capture.event_start_ts, 8);
+  writer.putLe(capture.first_sample_ts, 8);
+  writer.putLe(gainBits, 4);
+  writer.putString(deviceId);
+  writer.putString(fwVersion);
+
+  if (capture.count > 0) {
+    writer.putLe(capture.samples[0], 2);
+  }
+  for (uint32_t i = 1; i < capture.count; ++i) {
+    writer.putSvarint(static_cast<int32_t>(capture.samples[i]) - static_cast<int32_t>(capture.samples[i - 1]));
+  }
+  return writer.flush();
+}
+} // namespace WaveformCodec
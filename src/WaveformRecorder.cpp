@@ -0,0 +1,91 @@
+#include "WaveformRecorder.h"
+
+#include <algorithm>
+#include <string.h>
+
+static_assert(Config::kWaveformPreSamples > 0, "waveform pre-trigger ring must not be empty");
+static_assert(Config::kWaveformSlots >= 1 && Config::kWaveformSlots <= 4, "ready queue holds up to 4 slots");
+
+void WaveformRecorder::setSampleRate(uint32_t sampleRateHz) {
+  sampleRateHz_ = sampleRateHz > 0 ? sampleRateHz : 1;
+}
+
+void WaveformRecorder::append(const uint16_t* raw, size_t count) {
+  if (filling_ != kNotFilling) {
+    Capture& capture = slots_[filling_];
+    const size_t take = std::min<size_t>(count, kCaptureSamples - capture.count);
+    memcpy(capture.samples + capture.count, raw, take * sizeof(uint16_t));
+    capture.count += take;
+    if (capture.count == kCaptureSamples) {
+      ready_.push(static_cast<uint8_t>(filling_));
+      filling_ = kNotFilling;
+    }
+  }
+
+  // Only the newest kWaveformPreSamples can end up in a capture.
+  constexpr uint32_t kRingSize = Config::kWaveformPreSamples;
+  if (count > kRingSize) {
+    raw += count - kRingSize;
+    count = kRingSize;
+  }
+  ringCount_ = std::min<uint32_t>(ringCount_ + count, kRingSize);
+  while (count > 0) {
+    const size_t chunk = std::min<size_t>(count, kRingSize - ringHead_);
+    memcpy(ring_ + ringHead_, raw, chunk * sizeof(uint16_t));
+    ringHead_ = (ringHead_ + chunk) % kRingSize;
+    raw += chunk;
+    count -= chunk;
+  }
+}
+
+void WaveformRecorder::trigger(EventType type, uint64_t eventStartTs, uint64_t newestSampleTs) {
+  if (filling_ != kNotFilling) {
+    return; // the capture still recording already covers this start
+  }
+  size_t slot = 0;
+  while (slot < Config::kWaveformSlots && busy_[slot].load(std::memory_order_acquire)) {
+    ++slot;
+  }
+  if (slot == Config::kWaveformSlots) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  busy_[slot].store(true, std::memory_order_relaxed);
+
+  // Freeze the ring, oldest sample first.
+  constexpr uint32_t kRingSize = Config::kWaveformPreSamples;
+  Capture& capture = slots_[slot];
+  const uint32_t oldest = (ringHead_ + kRingSize - ringCount_) % kRingSize;
+  const uint32_t firstPart = std::min(ringCount_, kRingSize - oldest);
+  memcpy(capture.samples, ring_ + oldest, firstPart * sizeof(uint16_t));
+  memcpy(capture.samples + firstPart, ring_, (ringCount_ - firstPart) * sizeof(uint16_t));
+
+  capture.type = type;
+  capture.event_start_ts = eventStartTs;
+  capture.sample_rate_hz = sampleRateHz_;
+  capture.count = ringCount_;
+  capture.trigger_index = ringCount_ > 0 ? ringCount_ - 1 : 0;
+  const uint64_t preMs = (static_cast<uint64_t>(capture.trigger_index) * 1000 + sampleRateHz_ / 2) / sampleRateHz_;
+  capture.first_sample_ts = newestSampleTs - std::min(preMs, newestSampleTs);
+  filling_ = static_cast<int>(slot);
+}
+
+bool WaveformRecorder::popCapture(const Capture*& out) {
+  uint8_t slot = 0;
+  if (!ready_.pop(slot)) {
+    return false;
+  }
+  out = &slots_[slot];
+  return true;
+}
+
+void WaveformRecorder::release(const Capture* capture) {
+  const size_t slot = static_cast<size_t>(capture - slots_);
+  if (slot < Config::kWaveformSlots) {
+    busy_[slot].store(false, std::memory_order_release);
+  }
+}
+
+uint32_t WaveformRecorder::droppedCaptures() const {
+  return dropped_.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,88 @@
+#include "WindowKernel.h"
+
+#include <algorithm>
+
+namespace {
+// raw == 0 wraps to 0xFFFF, so one unsigned compare covers both rails.
+inline uint32_t isSaturated(uint16_t raw) {
+  return static_cast<uint16_t>(raw - 1) >= 4094 ? 1u : 0u;
+}
+} // namespace
+
+namespace WindowKernel {
+// The inner loop only sums raw values and their squares, four samples per step into two
+// independent lanes, with branchless min/max (MINU/MAXU and MULL on the Xtensa core; host
+// compilers turn it into cmov chains). The DC offset is applied once per block:
+//   sum(d) = sum(r) - n*dc,  sum(d^2) = sum(r^2) - 2*dc*sum(r) + n*dc^2
+// evaluated modulo 2^32, which is exact because the true results fit. Saturation is rare,
+// so samples are only counted when the block's min or max touches a rail.
+void accumulate(const uint16_t* raw, size_t count, int32_t dc, Stats& stats) {
+  uint32_t sum0 = 0;
+  uint32_t sum1 = 0;
+  uint32_t sumSq0 = 0;
+  uint32_t sumSq1 = 0;
+  uint32_t min0 = UINT16_MAX;
+  uint32_t min1 = UINT16_MAX;
+  uint32_t max0 = 0;
+  uint32_t max1 = 0;
+
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const uint32_t r0 = raw[i];
+    const uint32_t r1 = raw[i + 1];
+    const uint32_t r2 = raw[i + 2];
+    const uint32_t r3 = raw[i + 3];
+    sum0 += r0 + r2;
+    sum1 += r1 + r3;
+    sumSq0 += r0 * r0 + r2 * r2;
+    sumSq1 += r1 * r1 + r3 * r3;
+    min0 = std::min(min0, std::min(r0, r2));
+    min1 = std::min(min1, std::min(r1, r3));
+    max0 = std::max(max0, std::max(r0, r2));
+    max1 = std::max(max1, std::max(r1, r3));
+  }
+  for (; i < count; ++i) {
+    const uint32_t r = raw[i];
+    sum0 += r;
+    sumSq0 += r * r;
+    min0 = std::min(min0, r);
+    max0 = std::max(max0, r);
+  }
+
+  const uint32_t n = static_cast<uint32_t>(count);
+  const uint32_t offset = static_cast<uint32_t>(dc);
+  const uint32_t sum = sum0 + sum1;
+  stats.sum += static_cast<int32_t>(sum - n * offset);
+  stats.sumSq += (sumSq0 + sumSq1) - 2 * offset * sum + n * offset * offset;
+
+  const uint32_t blockMin = std::min(min0, min1);
+  const uint32_t blockMax = std::max(max0, max1);
+  if (blockMin == 0 || blockMax >= 4095) {
+    uint32_t saturated = 0;
+    for (size_t j = 0; j < count; ++j) {
+      saturated += isSaturated(raw[j]);
+    }
+    stats.saturated = static_cast<uint16_t>(stats.saturated + saturated);
+  }
+  stats.min = static_cast<uint16_t>(std::min<uint32_t>(stats.min, blockMin));
+  stats.max = static_cast<uint16_t>(std::max<uint32_t>(stats.max, blockMax));
+}
+
+void accumulateScalar(const uint16_t* raw, size_t count, int32_t dc, Stats& stats) {
+  for (size_t i = 0; i < count; ++i) {
+    uint16_t value = raw[i];
+    int32_t d = static_cast<int32_t>(value) - dc;
+    stats.sum += d;
+    stats.sumSq += static_cast<uint32_t>(d * d);
+    if (value == 0 || value >= 4095) {
+      stats.saturated++;
+    }
+    if (value < stats.min) {
+      stats.min = value;
+    }
+    if (value > stats.max) {
+      stats.max = value;
+    }
+  }
+}
+} // namespace WindowKernel
@@ -4,30 +4,61 @@
 #include <WiFi.h>
 #include <time.h>
 
+#include "AcquisitionTask.h"
+#include "AdcChannelDemux.h"
 #include "BatchUploader.h"
 #include "BuildInfo.h"
+#include "ChannelLayout.h"
 #include "Config.h"
+#include "DeviceConfig.h"
+#include "EnergyStore.h"
+#include "EspOtaPartition.h"
 #include "EventDetector.h"
+#include "I2sAdcProvider.h"
+#include "Metrics.h"
+#include "OtaUpdater.h"
+#include "PowerMeter.h"
+#include "ThresholdProfile.h"
 #include "TimeSync.h"
 #include "VoltageSampler.h"
+#include "WaveformRecorder.h"
 #include "WifiManager.h"
 
 #include "secrets.h"
 
 namespace {
 constexpr uint32_t kSampleLogIntervalMs = 5000;
+
+// phase: current channels only, degrees the sensors make the current lead.
+using ChannelCalibration = DeviceConfig::Calibration;
 }
 
 Preferences prefs;
+Preferences uploadPrefs;
 WifiManager wifiManager;
 TimeSync timeSync;
-VoltageSampler sampler(Config::kDefaultAdcPin);
+I2sAdcProvider adcProvider(Config::kDefaultAdcPin, Config::kSampleRateHz);
+AdcChannelDemux adcChannels(adcProvider);
+VoltageSampler sampler(adcChannels.channel(0));
 EventDetector eventDetector;
+WaveformRecorder waveforms;
+Metrics metrics;
+AcquisitionTask acquisition(adcChannels, sampler, eventDetector, waveforms, timeSync, metrics);
 BatchUploader uploader;
-
-float calibGain = 1.0f;
-float calibOffset = 0.0f;
-bool calibPresent = false;
+EspOtaPartition otaPartition;
+OtaUpdater ota(otaPartition);
+
+// Channel 0 is the primary above; the others are created in setup() from the saved layout.
+ChannelLayout channelLayout;
+VoltageSampler* channelSamplers[Config::kMaxAdcChannels] = {&sampler};
+EventDetector* channelDetectors[Config::kMaxAdcChannels] = {&eventDetector};
+ChannelCalibration calib[Config::kMaxAdcChannels];
+// Current channels: their PowerMeter and the voltage channel it measures against.
+PowerMeter* channelMeters[Config::kMaxAdcChannels] = {};
+size_t meterVoltage[Config::kMaxAdcChannels] = {};
+EnergyStore energyStore;
+ThresholdProfile thresholdProfile;
+uint32_t configVersion = 0;
 
 bool assistedMode = false;
 
@@ -35,16 +66,244 @@ String inputLine;
 unsigned long lastLogMs = 0;
 bool lastWifiConnected = false;
 bool lastNtpSynced = false;
+uint32_t lastDroppedSamples = 0;
+uint32_t lastDroppedEvents = 0;
+uint32_t lastDetectorCounters = 0;
+uint32_t lastWaveformDrops = 0;
+uint32_t lastScanDrops = 0;
+unsigned long lastTelemetryMs = 0;
+
+// Arduino core hook: with a rollback-capable bootloader the core would otherwise confirm an
+// updated image as soon as it starts; OtaUpdater confirms it after its first upload instead.
+bool verifyRollbackLater() {
+  return true;
+}
+
+// Channel 0 keeps the original keys ("gain"); channel n uses "gain<n>".
+static String calibKey(const char* name, size_t channel) {
+  return channel == 0 ? String(name) : String(name) + String(static_cast<unsigned int>(channel));
+}
+
+static void loadCalibration(size_t channel) {
+  calib[channel].gain = prefs.getFloat(calibKey("gain", channel).c_str(), 1.0f);
+  calib[channel].offset = prefs.getFloat(calibKey("offset", channel).c_str(), 0.0f);
+  calib[channel].phase = prefs.getFloat(calibKey("phase", channel).c_str(), 0.0f);
+  calib[channel].present = prefs.getBool(calibKey("has", channel).c_str(), false);
+}
+
+static void applyCalibration(size_t channel) {
+  channelSamplers[channel]->setCalibration(calib[channel].gain, calib[channel].offset, calib[channel].present);
+  // Meters scale by both gains, so a voltage channel's gain reaches its current channels too.
+  for (size_t i = 0; i < channelLayout.count; ++i) {
+    if (channelMeters[i] != nullptr && (i == channel || meterVoltage[i] == channel)) {
+      channelMeters[i]->setCalibration(calib[meterVoltage[i]].gain, calib[i].gain, calib[i].phase);
+    }
+  }
+}
+
+static void saveCalibration(size_t channel) {
+  prefs.putFloat(calibKey("gain", channel).c_str(), calib[channel].gain);
+  prefs.putFloat(calibKey("offset", channel).c_str(), calib[channel].offset);
+  prefs.putFloat(calibKey("phase", channel).c_str(), calib[channel].phase);
+  prefs.putBool(calibKey("has", channel).c_str(), calib[channel].present);
+  applyCalibration(channel);
+}
+
+// Builds the samplers and detectors of the secondary channels; they follow the primary's
+// windows. Current channels have no NO_SIGNAL floor and no event detection; the k-th current
+// channel is metered against the k-th voltage channel, or the primary when there are fewer.
+static void setupChannels() {
+  adcProvider.setPins(channelLayout.pins, channelLayout.count);
+  size_t voltages[Config::kMaxAdcChannels] = {0};
+  size_t voltageCount = 1;
+  for (size_t i = 1; i < channelLayout.count; ++i) {
+    VoltageSampler* channelSampler = new VoltageSampler(adcChannels.channel(i));
+    channelSampler->followWindows(&sampler);
+    if (channelLayout.kinds[i] == ChannelKind::Voltage) {
+      channelDetectors[i] = new EventDetector(Config::kChannelEventHistoryPoints);
+      voltages[voltageCount++] = i;
+    } else {
+      channelSampler->setSignalThresholds(0.0f, 0);
+    }
+    channelSamplers[i] = channelSampler;
+  }
+
+  VoltageTrace* traces[Config::kMaxAdcChannels] = {};
+  size_t currentCount = 0;
+  for (size_t i = 1; i < channelLayout.count; ++i) {
+    if (channelLayout.kinds[i] == ChannelKind::Current) {
+      const size_t voltage = currentCount < voltageCount ? voltages[currentCount] : 0;
+      currentCount++;
+      if (traces[voltage] == nullptr) {
+        traces[voltage] = new VoltageTrace();
+        channelSamplers[voltage]->setSampleListener(traces[voltage]);
+      }
+      // The scan converts the layout's inputs one after the other within each sample period.
+      channelMeters[i] = new PowerMeter(*traces[voltage], Config::kSampleRateHz);
+      channelMeters[i]->setScanDelay((static_cast<float>(i) - static_cast<float>(voltage)) / channelLayout.count);
+      channelSamplers[i]->setSampleListener(channelMeters[i]);
+      meterVoltage[i] = voltage;
+    }
+    acquisition.addChannel(channelLayout.kinds[i], *channelSamplers[i], channelDetectors[i], channelMeters[i]);
+  }
+}
 
-static void applyCalibration() {
-  sampler.setCalibration(calibGain, calibOffset, calibPresent);
+// Hands the profile to every detector (applied at their next window) and to the uploader's
+// reduction, which keeps windows outside the start levels at nominal unreduced.
+static void applyThresholds() {
+  for (size_t i = 0; i < channelLayout.count; ++i) {
+    if (channelDetectors[i] != nullptr && !channelDetectors[i]->setProfile(thresholdProfile)) {
+      Serial.printf("[DETECT] ch%u busy, profile not applied\n", static_cast<unsigned int>(i));
+    }
+  }
+  const DetectionThresholds nominal = thresholdProfile.thresholds(thresholdProfile.nominalV);
+  uploader.setDisturbanceBand(nominal.sagStart, nominal.swellStart);
+}
+
+// Saves and applies profile if it differs from the running one. source tags the log.
+static void setThresholdProfile(const ThresholdProfile& profile, const char* source) {
+  char current[ThresholdProfile::kTextLength];
+  char updated[ThresholdProfile::kTextLength];
+  thresholdProfile.format(current, sizeof(current));
+  profile.format(updated, sizeof(updated));
+  if (strcmp(current, updated) == 0) {
+    return;
+  }
+  thresholdProfile = profile;
+  prefs.putString("thresholds", updated);
+  applyThresholds();
+  Serial.printf("[DETECT] %s profile applied: %s\n", source, updated);
 }
 
-static void saveCalibration() {
-  prefs.putFloat("gain", calibGain);
-  prefs.putFloat("offset", calibOffset);
-  prefs.putBool("has", calibPresent);
-  applyCalibration();
+// Applies key=value pairs over the current profile.
+static bool updateThresholds(const char* text, const char* source) {
+  ThresholdProfile profile = thresholdProfile;
+  if (!profile.parse(text)) {
+    Serial.printf("[DETECT] Invalid %s profile '%s'\n", source, text);
+    return false;
+  }
+  setThresholdProfile(profile, source);
+  return true;
+}
+
+// The running settings, as a config document would describe them.
+static DeviceConfig currentConfig() {
+  DeviceConfig config;
+  config.version = configVersion;
+  config.channelCount = channelLayout.count;
+  std::copy(calib, calib + channelLayout.count, config.calib);
+  config.thresholds = thresholdProfile;
+  config.batchMaxPoints = uploader.batchMaxPoints();
+  config.batchMaxWaitMs = uploader.batchMaxWaitMs();
+  config.cycleSync = sampler.cycleSync();
+  config.harmonics = sampler.harmonics();
+  config.uploadFormat = uploader.uploadFormat();
+  config.compression = uploader.compression();
+  config.reduction = uploader.reduction();
+  config.swingToleranceV = uploader.swingTolerance();
+  config.firmware = ota.manifest();
+  return config;
+}
+
+// Applies and saves what differs from the running settings, all from loop() between two of
+// its iterations; the acquisition task picks calibration and window changes up at its next
+// window, so no window mixes old and new settings.
+static void applyConfig(const DeviceConfig& config) {
+  for (size_t i = 0; i < channelLayout.count; ++i) {
+    const ChannelCalibration& next = config.calib[i];
+    if (next.gain != calib[i].gain || next.offset != calib[i].offset || next.phase != calib[i].phase ||
+        next.present != calib[i].present) {
+      calib[i] = next;
+      saveCalibration(i);
+    }
+  }
+  setThresholdProfile(config.thresholds, "server");
+  if (config.batchMaxPoints != uploader.batchMaxPoints() || config.batchMaxWaitMs != uploader.batchMaxWaitMs()) {
+    uploader.setBatchLimits(config.batchMaxPoints, config.batchMaxWaitMs);
+    uploadPrefs.putUInt("batchpts", config.batchMaxPoints);
+    uploadPrefs.putUInt("batchwait", config.batchMaxWaitMs);
+  }
+  if (config.cycleSync != sampler.cycleSync()) {
+    for (size_t i = 0; i < channelLayout.count; ++i) {
+      channelSamplers[i]->setCycleSync(config.cycleSync);
+    }
+    prefs.putBool("cyclesync", config.cycleSync);
+  }
+  if (config.harmonics != sampler.harmonics()) {
+    sampler.setHarmonics(config.harmonics);
+    prefs.putBool("harmonics", config.harmonics);
+  }
+  if (config.uploadFormat != uploader.uploadFormat()) {
+    uploader.setUploadFormat(config.uploadFormat);
+    uploadPrefs.putUChar("format", static_cast<uint8_t>(config.uploadFormat));
+  }
+  if (config.compression != uploader.compression()) {
+    uploader.setCompression(config.compression);
+    uploadPrefs.putBool("gzip", config.compression);
+  }
+  if (config.reduction != uploader.reduction() || config.swingToleranceV != uploader.swingTolerance()) {
+    uploader.setReduction(config.reduction, config.swingToleranceV);
+    uploadPrefs.putUChar("reduce", static_cast<uint8_t>(config.reduction));
+    uploadPrefs.putFloat("swingtol", config.swingToleranceV);
+  }
+  if (ota.offer(config.firmware, Config::kFirmwareVersion)) {
+    // A restart before the image is activated fetches the whole document again and resumes.
+    uploadPrefs.remove("cfgetag");
+  }
+  configVersion = config.version;
+  uploader.setConfigVersion(configVersion);
+  uploadPrefs.putUInt("cfgver", configVersion);
+}
+
+class ServerConfig : public BatchUploader::ConfigListener {
+ public:
+  void onConfig(const char* document) override {
+    uploadPrefs.putString("cfgetag", uploader.configEtag());
+    if (strlen(document) > DeviceConfig::kMaxDocumentLength) {
+      Serial.println("[CONFIG] Document too long, ignored");
+      return;
+    }
+    DeviceConfig config = currentConfig();
+    uint32_t unknownKeys = 0;
+    uint32_t errorLine = 0;
+    if (!config.parse(document, &unknownKeys, &errorLine)) {
+      Serial.printf("[CONFIG] Document rejected at line %u, nothing applied\n", static_cast<unsigned int>(errorLine));
+      return;
+    }
+    applyConfig(config);
+    Serial.printf("[CONFIG] Version %lu applied (%u unknown keys)\n",
+                  static_cast<unsigned long>(configVersion),
+                  static_cast<unsigned int>(unknownKeys));
+  }
+};
+ServerConfig serverConfig;
+
+static bool hasMeters() {
+  return std::any_of(channelMeters, channelMeters + Config::kMaxAdcChannels, [](const PowerMeter* meter) {
+    return meter != nullptr;
+  });
+}
+
+// Queues the open batch and saves the energy counters, then boots the image OtaUpdater activated.
+static void restartForUpdate() {
+  Serial.printf("[OTA] Restarting into %s\n", ota.manifest().version);
+  uploader.flush();
+  if (hasMeters()) {
+    ChannelEnergy energy;
+    acquisition.energy(energy);
+    energyStore.save(energy);
+  }
+  Serial.flush();
+  ESP.restart();
+}
+
+static void collectGauges() {
+  Metrics::Gauges gauges;
+  gauges.adcOverruns = adcProvider.overrunCount();
+  gauges.acqSampleDrops = acquisition.droppedSamples();
+  gauges.acqSampleHighWatermark = acquisition.sampleQueueHighWatermark();
+  uploader.collectGauges(gauges);
+  metrics.setGauges(gauges);
 }
 
 static void handleCommand(const String& line) {
@@ -52,27 +311,165 @@ static void handleCommand(const String& line) {
   cmd.trim();
   if (cmd.length() == 0) return;
 
+  // "calib <n> gain <v>" addresses channel n of the layout; without a number, channel 0.
+  size_t channel = 0;
+  if (cmd.startsWith("calib ") && cmd.length() > 6 && isDigit(cmd[6])) {
+    channel = static_cast<size_t>(cmd[6] - '0');
+    cmd = String("calib") + cmd.substring(7);
+    if (channel >= channelLayout.count) {
+      Serial.printf("[CALIB] no channel %u in layout\n", static_cast<unsigned int>(channel));
+      return;
+    }
+  }
+
   if (cmd.equalsIgnoreCase("calib show")) {
-    Serial.printf("[CALIB] gain=%.4f offset=%.4f present=%s\n",
-                  calibGain, calibOffset, calibPresent ? "yes" : "no");
+    for (size_t i = 0; i < channelLayout.count; ++i) {
+      Serial.printf("[CALIB] ch%u %s GPIO%d gain=%.4f offset=%.4f phase=%.2f present=%s\n",
+                    static_cast<unsigned int>(i),
+                    ChannelKindToString(channelLayout.kinds[i]),
+                    static_cast<int>(channelLayout.pins[i]),
+                    calib[i].gain,
+                    calib[i].offset,
+                    calib[i].phase,
+                    calib[i].present ? "yes" : "no");
+    }
     return;
   }
 
   if (cmd.startsWith("calib gain")) {
     float value = cmd.substring(String("calib gain").length()).toFloat();
-    calibGain = value;
-    calibPresent = true;
-    saveCalibration();
-    Serial.printf("[CALIB] gain set to %.4f\n", calibGain);
+    calib[channel].gain = value;
+    calib[channel].present = true;
+    saveCalibration(channel);
+    Serial.printf("[CALIB] ch%u gain set to %.4f\n", static_cast<unsigned int>(channel), calib[channel].gain);
     return;
   }
 
   if (cmd.startsWith("calib offset")) {
     float value = cmd.substring(String("calib offset").length()).toFloat();
-    calibOffset = value;
-    calibPresent = true;
-    saveCalibration();
-    Serial.printf("[CALIB] offset set to %.4f\n", calibOffset);
+    calib[channel].offset = value;
+    calib[channel].present = true;
+    saveCalibration(channel);
+    Serial.printf("[CALIB] ch%u offset set to %.4f\n", static_cast<unsigned int>(channel), calib[channel].offset);
+    return;
+  }
+
+  if (cmd.startsWith("calib phase")) {
+    if (channelMeters[channel] == nullptr) {
+      Serial.printf("[CALIB] ch%u is not a current channel\n", static_cast<unsigned int>(channel));
+      return;
+    }
+    calib[channel].phase = cmd.substring(String("calib phase").length()).toFloat();
+    saveCalibration(channel);
+    Serial.printf("[CALIB] ch%u phase set to %.2f deg\n", static_cast<unsigned int>(channel), calib[channel].phase);
+    return;
+  }
+
+  if (cmd.equalsIgnoreCase("energy show")) {
+    ChannelEnergy energy;
+    acquisition.energy(energy);
+    for (size_t i = 1; i < channelLayout.count; ++i) {
+      if (channelMeters[i] != nullptr) {
+        Serial.printf("[ENERGY] ch%u import=%.3f kWh export=%.3f kWh (vs ch%u)\n",
+                      static_cast<unsigned int>(i),
+                      energy.importWh[i - 1] / 1000.0,
+                      energy.exportWh[i - 1] / 1000.0,
+                      static_cast<unsigned int>(meterVoltage[i]));
+      }
+    }
+    return;
+  }
+
+  if (cmd.equalsIgnoreCase("energy reset")) {
+    acquisition.setEnergy(ChannelEnergy());
+    energyStore.clear();
+    Serial.println("[ENERGY] counters reset");
+    return;
+  }
+
+  if (cmd.equalsIgnoreCase("channels show")) {
+    char layout[Config::kMaxAdcChannels * 4 + 1];
+    channelLayout.format(layout, sizeof(layout));
+    Serial.printf("[ADC] channels=%s saved=%s\n", layout, prefs.getString("layout", layout).c_str());
+    return;
+  }
+
+  if (cmd.startsWith("channels set ")) {
+    String text = cmd.substring(String("channels set ").length());
+    ChannelLayout layout;
+    if (!layout.parse(text.c_str())) {
+      Serial.println("[ADC] usage: channels set V34 [V35 V32 I33 ...] (first entry a voltage, ADC1 pins 32-39)");
+      return;
+    }
+    char formatted[Config::kMaxAdcChannels * 4 + 1];
+    layout.format(formatted, sizeof(formatted));
+    prefs.putString("layout", formatted);
+    Serial.printf("[ADC] channels saved as %s, restart to apply\n", formatted);
+    return;
+  }
+
+  if (cmd.equalsIgnoreCase("detect show")) {
+    char text[ThresholdProfile::kTextLength];
+    thresholdProfile.format(text, sizeof(text));
+    Serial.printf("[DETECT] %s (levels in %s)\n", text, thresholdProfile.mode == ThresholdMode::Nominal ? "%" : "V");
+    for (size_t i = 0; i < channelLayout.count; ++i) {
+      if (channelDetectors[i] == nullptr) {
+        continue;
+      }
+      const float baseline = channelDetectors[i]->baseline();
+      const DetectionThresholds levels = thresholdProfile.thresholds(baseline);
+      Serial.printf("[DETECT] ch%u baseline=%.1fV sag=%.1f/%.1fV swell=%.1f/%.1fV critical=%.1f/%.1fV\n",
+                    static_cast<unsigned int>(i),
+                    thresholdProfile.mode == ThresholdMode::Nominal ? baseline : thresholdProfile.nominalV,
+                    levels.sagStart,
+                    levels.sagEnd,
+                    levels.swellStart,
+                    levels.swellEnd,
+                    levels.criticalLow,
+                    levels.criticalHigh);
+    }
+    return;
+  }
+
+  if (cmd.startsWith("detect set ")) {
+    String text = cmd.substring(String("detect set ").length());
+    if (!updateThresholds(text.c_str(), "CLI")) {
+      Serial.println("[DETECT] usage: detect set key=value ... (mode=fixed|nominal nominal=<v> sag_start=<lvl> "
+                     "sag_end swell_start swell_end critical_low critical_high *_windows=<n> fast_half_cycles=<n>)");
+    }
+    return;
+  }
+
+  if (cmd.equalsIgnoreCase("detect reset")) {
+    thresholdProfile = ThresholdProfile();
+    prefs.remove("thresholds");
+    applyThresholds();
+    Serial.println("[DETECT] profile reset to defaults");
+    return;
+  }
+
+  if (cmd.equalsIgnoreCase("config show")) {
+    char document[DeviceConfig::kMaxDocumentLength];
+    currentConfig().format(document, sizeof(document));
+    Serial.printf("[CONFIG] etag=%s\n%s", uploader.configEtag()[0] != '\0' ? uploader.configEtag() : "-", document);
+    return;
+  }
+
+  if (cmd.equalsIgnoreCase("config fetch")) {
+    uploader.requestConfigFetch();
+    Serial.println("[CONFIG] fetch requested");
+    return;
+  }
+
+  if (cmd.equalsIgnoreCase("ota show")) {
+    const FirmwareManifest& offered = ota.manifest();
+    Serial.printf("[OTA] running=%s confirmed=%s state=%s offered=%s %lu/%lu bytes\n",
+                  Config::kFirmwareVersion,
+                  ota.validating() ? "no" : "yes",
+                  OtaStateToString(ota.state()),
+                  offered.version[0] != '\0' ? offered.version : "-",
+                  static_cast<unsigned long>(ota.bytesWritten()),
+                  static_cast<unsigned long>(offered.size));
     return;
   }
 
@@ -88,8 +485,89 @@ static void handleCommand(const String& line) {
     return;
   }
 
+  if (cmd.equalsIgnoreCase("window show")) {
+    Serial.printf("[SAMPLE] window=%s\n", sampler.cycleSync() ? "cycles" : "fixed");
+    return;
+  }
+
+  if (cmd.equalsIgnoreCase("window cycles") || cmd.equalsIgnoreCase("window fixed")) {
+    bool enabled = cmd.endsWith("cycles");
+    for (size_t i = 0; i < channelLayout.count; ++i) {
+      channelSamplers[i]->setCycleSync(enabled);
+    }
+    prefs.putBool("cyclesync", enabled);
+    Serial.printf("[SAMPLE] window set to %s\n", enabled ? "cycles" : "fixed");
+    return;
+  }
+
+  if (cmd.equalsIgnoreCase("harmonics show")) {
+    Serial.printf("[SAMPLE] harmonics=%s\n", sampler.harmonics() ? "on" : "off");
+    return;
+  }
+
+  if (cmd.equalsIgnoreCase("harmonics on") || cmd.equalsIgnoreCase("harmonics off")) {
+    bool enabled = cmd.endsWith("on");
+    sampler.setHarmonics(enabled);
+    prefs.putBool("harmonics", enabled);
+    Serial.printf("[SAMPLE] harmonics %s\n", enabled ? "ON" : "OFF");
+    return;
+  }
+
+  if (cmd.equalsIgnoreCase("upload show")) {
+    Serial.printf("[UPLOAD] format=%s gzip=%s reduce=%s swing_tol=%.2fV\n",
+                  UploadFormatToString(uploader.uploadFormat()),
+                  uploader.compression() ? "on" : "off",
+                  SampleReductionToString(uploader.reduction()),
+                  uploader.swingTolerance());
+    return;
+  }
+
+  if (cmd.startsWith("upload reduce ")) {
+    String args = cmd.substring(String("upload reduce ").length());
+    args.trim();
+    int space = args.indexOf(' ');
+    String name = space < 0 ? args : args.substring(0, space);
+    float tolerance = space < 0 ? uploader.swingTolerance() : args.substring(space + 1).toFloat();
+    SampleReduction mode;
+    if (!SampleReductionFromString(name.c_str(), mode) || tolerance <= 0.0f) {
+      Serial.println("[UPLOAD] usage: upload reduce raw|1s|10s|60s|swing [tolerance_v]");
+      return;
+    }
+    uploader.setReduction(mode, tolerance);
+    uploadPrefs.putUChar("reduce", static_cast<uint8_t>(mode));
+    uploadPrefs.putFloat("swingtol", tolerance);
+    Serial.printf("[UPLOAD] reduce set to %s (swing_tol=%.2fV)\n", SampleReductionToString(mode), tolerance);
+    return;
+  }
+
+  if (cmd.equalsIgnoreCase("upload format json") || cmd.equalsIgnoreCase("upload format bin")) {
+    UploadFormat format = cmd.endsWith("bin") ? UploadFormat::Binary : UploadFormat::Json;
+    uploader.setUploadFormat(format);
+    uploadPrefs.putUChar("format", static_cast<uint8_t>(format));
+    Serial.printf("[UPLOAD] format set to %s\n", UploadFormatToString(format));
+    return;
+  }
+
+  if (cmd.equalsIgnoreCase("upload gzip on") || cmd.equalsIgnoreCase("upload gzip off")) {
+    bool enabled = cmd.endsWith("on");
+    uploader.setCompression(enabled);
+    uploadPrefs.putBool("gzip", enabled);
+    Serial.printf("[UPLOAD] gzip %s\n", enabled ? "ON" : "OFF");
+    return;
+  }
+
+  if (cmd.equalsIgnoreCase("stats")) {
+    collectGauges();
+    metrics.printTo(Serial);
+    return;
+  }
+
   if (cmd.equalsIgnoreCase("help")) {
-    Serial.println("Commands: calib show | calib gain <v> | calib offset <v> | calib assist on/off");
+    Serial.println("Commands: calib show | calib [ch] gain <v> | calib [ch] offset <v> | calib <ch> phase <deg> | "
+                   "calib assist on/off | channels show | channels set <layout> | energy show | energy reset | "
+                   "detect show | detect set <key=value ...> | detect reset | config show | config fetch | ota show | "
+                   "window show | window cycles/fixed | harmonics show | harmonics on/off | upload show | upload format json/bin | upload gzip on/off | "
+                   "upload reduce raw/1s/10s/60s/swing [tol] | stats");
     return;
   }
 
@@ -101,34 +579,85 @@ void setup() {
   delay(500);
 
   Serial.printf("CCR ESP32 firmware %s\n", CCR_FW_VERSION_STR);
+  // First, so an image that keeps crashing during setup still counts its boots.
+  otaPartition.begin(Config::kFirmwareVersion);
+  ota.begin();
 
   prefs.begin("calib", false);
-  calibGain = prefs.getFloat("gain", 1.0f);
-  calibOffset = prefs.getFloat("offset", 0.0f);
-  calibPresent = prefs.getBool("has", false);
-
-  if (!calibPresent) {
-    Serial.println("[CALIB] No calibration found. Using defaults.");
+  const String layout = prefs.getString("layout", "");
+  if (layout.length() > 0 && !channelLayout.parse(layout.c_str())) {
+    Serial.printf("[ADC] Invalid saved channels '%s'. Using GPIO%d only.\n", layout.c_str(), static_cast<int>(Config::kDefaultAdcPin));
+  }
+  setupChannels();
+  ChannelEnergy savedEnergy;
+  if (hasMeters() && energyStore.begin(savedEnergy)) {
+    acquisition.setEnergy(savedEnergy);
+  }
+  const bool cycleSync = prefs.getBool("cyclesync", Config::kCycleSyncDefault);
+  for (size_t i = 0; i < channelLayout.count; ++i) {
+    loadCalibration(i);
+    if (!calib[i].present) {
+      Serial.printf("[CALIB] No calibration found for ch%u. Using defaults.\n", static_cast<unsigned int>(i));
+    }
+    applyCalibration(i);
+    channelSamplers[i]->setCycleSync(cycleSync);
+  }
+  sampler.setHarmonics(prefs.getBool("harmonics", Config::kHarmonicsDefault));
+  const String thresholds = prefs.getString("thresholds", "");
+  if (thresholds.length() > 0 && !thresholdProfile.parse(thresholds.c_str())) {
+    Serial.printf("[DETECT] Invalid saved profile '%s'. Using defaults.\n", thresholds.c_str());
   }
-  applyCalibration();
 
   wifiManager.begin(WIFI_SSID, WIFI_PASSWORD);
   timeSync.begin();
 
-  sampler.begin();
+  bool adcOk = true;
+  for (size_t i = 0; i < channelLayout.count; ++i) {
+    adcOk = channelSamplers[i]->begin() && adcOk;
+  }
+  if (!adcOk) {
+    Serial.println("[ADC] Continuous capture init failed.");
+  }
+  if (!acquisition.begin()) {
+    Serial.println("[ACQ] Failed to start acquisition task.");
+  }
 
   if (!LittleFS.begin(true)) {
     Serial.println("[FS] LittleFS mount failed. Persistence disabled.");
   }
 
   uploader.begin(CCR_BASE_URL, DEVICE_ID, CCR_API_KEY);
+  uploadPrefs.begin("upload", false);
+  uploader.setUploadFormat(uploadPrefs.getUChar("format", 0) == static_cast<uint8_t>(UploadFormat::Binary)
+                               ? UploadFormat::Binary
+                               : UploadFormat::Json);
+  uploader.setCompression(uploadPrefs.getBool("gzip", false));
+  const uint8_t reduce = uploadPrefs.getUChar("reduce", 0);
+  uploader.setReduction(reduce <= static_cast<uint8_t>(SampleReduction::SwingingDoor) ? static_cast<SampleReduction>(reduce)
+                                                                                      : SampleReduction::Raw,
+                        uploadPrefs.getFloat("swingtol", Config::kSwingDoorToleranceV));
+  uploader.setBatchLimits(uploadPrefs.getUInt("batchpts", Config::kBatchMaxPoints),
+                         uploadPrefs.getUInt("batchwait", Config::kBatchMaxWaitMs));
+  configVersion = uploadPrefs.getUInt("cfgver", 0);
+  uploader.setConfigVersion(configVersion);
+  uploader.setConfigEtag(uploadPrefs.getString("cfgetag", "").c_str());
+  uploader.setConfigListener(&serverConfig);
+  applyThresholds();
 
   Serial.println("[SYSTEM] Setup complete. Type 'help' for commands.");
 }
 
 void loop() {
-  wifiManager.update();
-  timeSync.update();
+  metrics.markLoop();
+  metrics.sampleHeap();
+  {
+    Metrics::Scope scope(metrics, Metrics::Stage::Wifi);
+    wifiManager.update();
+  }
+  {
+    Metrics::Scope scope(metrics, Metrics::Stage::Time);
+    timeSync.update();
+  }
 
   const bool wifiConnected = wifiManager.isConnected();
   if (wifiConnected != lastWifiConnected) {
@@ -165,21 +694,15 @@ void loop() {
     }
   }
 
-  VoltageSample sample;
-  if (sampler.update(sample)) {
-    sample.ts_ms = timeSync.nowMs();
-
-    if (!timeSync.isSynced()) {
-      sample.flags |= FLAG_NTP_NOT_SYNC;
-    }
-    if (!wifiConnected) {
-      sample.flags |= FLAG_WIFI_DOWN;
-    }
+  acquisition.setWifiConnected(wifiConnected);
 
+  VoltageSample sample;
+  ChannelValues channelValues;
+  while (acquisition.popSample(sample, &channelValues)) {
     const bool saturated = (sample.flags & FLAG_ADC_SATURATED) != 0;
     if (!saturated) {
-      eventDetector.addSample(sample);
-      uploader.addSample(sample);
+      Metrics::Scope scope(metrics, Metrics::Stage::Enqueue);
+      uploader.addSample(sample, channelValues.count > 0 ? &channelValues : nullptr);
     }
 
     if (assistedMode) {
@@ -187,25 +710,126 @@ void loop() {
     }
 
     if (millis() - lastLogMs > kSampleLogIntervalMs) {
-      Serial.printf("[SAMPLE] vrms=%.2f flags=0x%04x%s\n",
+      Serial.printf("[SAMPLE] vrms=%.2f f=%.3f flags=0x%04x%s\n",
                     sample.vrms,
+                    sample.freq_hz,
                     static_cast<unsigned int>(sample.flags),
                     (sample.flags & FLAG_NO_SIGNAL) ? " NO_SIGNAL" : "");
+      for (size_t i = 0; i < channelValues.count; ++i) {
+        Serial.printf("[SAMPLE] ch%u %s=%.3f flags=0x%04x\n",
+                      static_cast<unsigned int>(i + 1),
+                      channelValues.kind[i] == ChannelKind::Current ? "irms" : "vrms",
+                      channelValues.rms[i],
+                      static_cast<unsigned int>(channelValues.flags[i]));
+        if (channelValues.kind[i] == ChannelKind::Current) {
+          Serial.printf("[POWER] ch%u P=%.1fW Q=%.1fvar S=%.1fVA PF=%.3f\n",
+                        static_cast<unsigned int>(i + 1),
+                        channelValues.activeW[i],
+                        channelValues.reactiveVar[i],
+                        channelValues.apparentVa[i],
+                        channelValues.apparentVa[i] > 0.0f ? channelValues.activeW[i] / channelValues.apparentVa[i] : 0.0f);
+        }
+      }
+      if (sample.hasHarmonics()) {
+        Serial.printf("[SAMPLE] thd=%.2f%% h3=%.2f h5=%.2f h7=%.2f V\n",
+                      sample.thd_cpct / 100.0f,
+                      sample.harmonic_cv[0] / 100.0f,
+                      sample.harmonic_cv[1] / 100.0f,
+                      sample.harmonic_cv[2] / 100.0f);
+      }
       lastLogMs = millis();
     }
   }
 
+  if (hasMeters()) {
+    ChannelEnergy energy;
+    acquisition.energy(energy);
+    uploader.setEnergy(energy);
+    energyStore.update(energy);
+  }
+
+  const uint32_t droppedSamples = acquisition.droppedSamples();
+  const uint32_t droppedEvents = acquisition.droppedEvents();
+  if (droppedSamples != lastDroppedSamples || droppedEvents != lastDroppedEvents) {
+    Serial.printf("[ACQ] queue overflow: dropped samples=%u events=%u\n",
+                  static_cast<unsigned int>(droppedSamples),
+                  static_cast<unsigned int>(droppedEvents));
+    lastDroppedSamples = droppedSamples;
+    lastDroppedEvents = droppedEvents;
+  }
+
+  uint32_t shortened = 0;
+  uint32_t detectorDropped = 0;
+  uint32_t truncated = 0;
+  for (size_t i = 0; i < channelLayout.count; ++i) {
+    if (channelDetectors[i] != nullptr) {
+      shortened += channelDetectors[i]->shortenedEvents();
+      detectorDropped += channelDetectors[i]->droppedEvents();
+      truncated += channelDetectors[i]->truncatedEvents();
+    }
+  }
+  if (shortened + detectorDropped + truncated != lastDetectorCounters) {
+    Serial.printf("[EVENT] shortened=%u dropped=%u truncated=%u\n",
+                  static_cast<unsigned int>(shortened),
+                  static_cast<unsigned int>(detectorDropped),
+                  static_cast<unsigned int>(truncated));
+    lastDetectorCounters = shortened + detectorDropped + truncated;
+  }
+
   VoltageEvent event;
-  if (eventDetector.pollCompletedEvent(event)) {
-    Serial.printf("[EVENT] %s start=%llu end=%llu min=%.2f max=%.2f samples=%u\n",
+  while (acquisition.popEvent(event)) {
+    Serial.printf("[EVENT] ch%u %s start=%llu end=%llu min=%.2f max=%.2f samples=%u\n",
+                  static_cast<unsigned int>(event.channel),
                   EventTypeToString(event.type),
                   static_cast<unsigned long long>(event.start_ts),
                   static_cast<unsigned long long>(event.end_ts),
                   event.min_vrms,
                   event.max_vrms,
-                  static_cast<unsigned int>(event.samples.size()));
-    uploader.addEvent(event);
+                  static_cast<unsigned int>(event.sample_count));
+    Metrics::Scope scope(metrics, Metrics::Stage::Enqueue);
+    uploader.addEvent(event, channelDetectors[event.channel]->history());
+  }
+
+  const WaveformRecorder::Capture* capture = nullptr;
+  while (waveforms.popCapture(capture)) {
+    Serial.printf("[WAVE] %s start=%llu samples=%u\n",
+                  EventTypeToString(capture->type),
+                  static_cast<unsigned long long>(capture->event_start_ts),
+                  static_cast<unsigned int>(capture->count));
+    {
+      Metrics::Scope scope(metrics, Metrics::Stage::Enqueue);
+      uploader.addWaveform(*capture, calib[0].gain);
+    }
+    waveforms.release(capture);
+  }
+
+  const uint32_t waveformDrops = waveforms.droppedCaptures();
+  if (waveformDrops != lastWaveformDrops) {
+    Serial.printf("[WAVE] no free capture slot: dropped=%u\n", static_cast<unsigned int>(waveformDrops));
+    lastWaveformDrops = waveformDrops;
+  }
+
+  const uint32_t scanDrops = adcChannels.droppedSamples();
+  if (scanDrops != lastScanDrops) {
+    Serial.printf("[ADC] scanned samples dropped=%u\n", static_cast<unsigned int>(scanDrops));
+    lastScanDrops = scanDrops;
+  }
+
+  if (millis() - lastTelemetryMs >= Config::kTelemetryIntervalMs) {
+    lastTelemetryMs = millis();
+    collectGauges();
+    Metrics::Scope scope(metrics, Metrics::Stage::Enqueue);
+    uploader.addTelemetry(metrics);
+  }
+
+  const HttpSession::Stats& httpStats = uploader.session().stats();
+  ota.checkHealth(uploader.uploadsSent(), wifiConnected, httpStats.requests - httpStats.errors);
+  if (ota.state() == OtaUpdater::State::Ready) {
+    restartForUpdate();
   }
 
+  // One image chunk per pass, after the uploads, on the same connection.
+  Metrics::Scope scope(metrics, Metrics::Stage::Upload);
   uploader.update(wifiConnected, Config::kWindowMs);
+  ota.update(uploader.session(), wifiConnected);
 }
@@ -0,0 +1,557 @@
+// BatchUploader against the HTTPClient stub on a virtual clock: batching, retries, event
+// payloads and the remote config document.
+
+#include "BatchUploader.h"
+#include "Config.h"
+#include "DeviceConfig.h"
+#include "EventDetector.h"
+#include "Metrics.h"
+#include "NativeHost.h"
+#include "StorageQueue.h"
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+class BatchUploaderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    reset();
+  }
+
+  // A fresh uploader on an empty filesystem, the stub and the sample clock back at the start.
+  void reset() {
+    NativeHost::useVirtualClock(1000);
+    ASSERT_TRUE(NativeHost::resetFilesystem());
+    NativeHost::http() = {};
+    NativeHost::http().keepBodies = true;
+    uploader.reset(new BatchUploader());
+    uploader->begin("http://test", "test", "");
+    ts_ = 1700000000000ULL;
+  }
+
+  void TearDown() override {
+    NativeHost::http() = {};
+  }
+
+  void addSamples(size_t count, const ChannelValues* channels = nullptr) {
+    VoltageSample sample;
+    sample.sample_count = Config::kWindowSamples;
+    for (size_t i = 0; i < count; ++i) {
+      sample.ts_ms = ts_;
+      sample.vrms = 230.0f + static_cast<float>(i % 10) * 0.125f;
+      ts_ += Config::kWindowMs;
+      uploader->addSample(sample, channels);
+    }
+  }
+
+  std::unique_ptr<BatchUploader> uploader;
+
+ private:
+  uint64_t ts_ = 1700000000000ULL;
+};
+
+// Records what BatchUploader hands over from GET /config.
+class ConfigRecorder : public BatchUploader::ConfigListener {
+ public:
+  void onConfig(const char* document) override {
+    calls++;
+    if (config.parse(document)) {
+      applied++;
+    }
+  }
+
+  DeviceConfig config;
+  uint32_t calls = 0;
+  uint32_t applied = 0;
+};
+
+// A full batch is queued while offline and POSTed once, as the JSON the server expects, as
+// soon as the connection is up.
+TEST_F(BatchUploaderTest, QueuedBatchIsPostedOnceWhenConnected) {
+  uploader->setBatchLimits(50, Config::kBatchMaxWaitMs);
+  addSamples(50);
+  uploader->update(false, Config::kWindowMs);
+  EXPECT_EQ(NativeHost::http().requests, 0u);
+
+  uploader->update(true, Config::kWindowMs);
+  uploader->update(true, Config::kWindowMs);
+  EXPECT_EQ(NativeHost::http().requests, 1u);
+  EXPECT_EQ(uploader->uploadsSent(), 1u);
+  EXPECT_EQ(NativeHost::http().lastUrl, "http://test/ingest/voltage/samples");
+  const std::string& body = NativeHost::http().lastBody;
+  EXPECT_EQ(body.rfind("{\"device_id\":\"test\",\"fw_version\":\"", 0), 0u);
+  EXPECT_NE(body.find("\"sample_period_ms\":200,\"samples\":[[1700000000000,230.000,0],[1700000000200,230.125,0]"),
+            std::string::npos);
+  EXPECT_EQ(body.back(), '}');
+}
+
+// The front record of the samples queue, read through a second handle on its directory.
+std::string queuedSamplesRecord() {
+  StorageQueue queue("/queue_samples", nullptr, Config::kSamplesQueueMaxBytes);
+  std::vector<uint8_t> record;
+  if (!queue.begin() || !queue.front(record)) {
+    return std::string();
+  }
+  return std::string(record.begin(), record.end());
+}
+
+// Decodes a gzip member with zlib, the way the server does; empty on error.
+std::string gunzip(const std::string& data) {
+  z_stream stream = {};
+  if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+    return std::string();
+  }
+  std::string out;
+  char chunk[4096];
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.size());
+  int result = Z_OK;
+  while (result == Z_OK) {
+    stream.next_out = reinterpret_cast<Bytef*>(chunk);
+    stream.avail_out = sizeof(chunk);
+    result = inflate(&stream, Z_NO_FLUSH);
+    out.append(chunk, sizeof(chunk) - stream.avail_out);
+  }
+  inflateEnd(&stream);
+  return result == Z_STREAM_END && stream.avail_in == 0 ? out : std::string();
+}
+
+// A batch large enough to take many scratch buffers is streamed from the queue to the socket:
+// the server must receive exactly the bytes that were queued, in every format, and a gzip
+// record must decode to the plain record.
+TEST_F(BatchUploaderTest, UploadSendsQueuedBytesUnchanged) {
+  for (UploadFormat format : {UploadFormat::Json, UploadFormat::Binary}) {
+    std::string plainBody;
+    for (bool gzip : {false, true}) {
+      reset();
+      uploader->setUploadFormat(format);
+      uploader->setCompression(gzip);
+      uploader->setBatchLimits(1500, Config::kBatchMaxWaitMs);
+      addSamples(1500);
+      uploader->update(false, Config::kWindowMs);
+      const std::string queued = queuedSamplesRecord();
+      ASSERT_GT(queued.size(), gzip ? 0 : 8 * Config::kQueueScratchBytes) << UploadFormatToString(format) << " gzip " << gzip;
+
+      uploader->update(true, Config::kWindowMs);
+      ASSERT_EQ(NativeHost::http().requests, 1u) << UploadFormatToString(format) << " gzip " << gzip;
+      const std::string& body = NativeHost::http().lastBody;
+      EXPECT_TRUE(body == queued) << UploadFormatToString(format) << " gzip " << gzip << ": sent " << body.size()
+                                  << " bytes, queued " << queued.size();
+      EXPECT_EQ(NativeHost::http().lastContentEncoding, gzip ? "gzip" : "") << UploadFormatToString(format);
+
+      if (!gzip) {
+        plainBody = body;
+        continue;
+      }
+      EXPECT_TRUE(gunzip(body) == plainBody) << UploadFormatToString(format);
+    }
+  }
+}
+
+// The open batch lives in a block of kBatchRamBytes: at the largest point limit it is queued
+// in pieces that fit, smaller ones when every row carries secondary channels, and no window is
+// lost in between.
+TEST_F(BatchUploaderTest, OpenBatchIsBoundedByBytes) {
+  ChannelValues channels;
+  channels.count = 3;
+  channels.kind[2] = ChannelKind::Current;
+  const struct {
+    const ChannelValues* channels;
+    size_t rowBytes;
+  } layouts[] = {{nullptr, sizeof(VoltageSample)}, {&channels, sizeof(VoltageSample) + sizeof(ChannelValues)}};
+  for (const auto& layout : layouts) {
+    reset();
+    uploader->setBatchLimits(Config::kBatchMaxPoints, Config::kBatchMaxWaitMs);
+    const size_t windows = 3 * Config::kBatchRamBytes / layout.rowBytes + 100;
+    addSamples(windows, layout.channels);
+    uploader->flush();
+
+    StorageQueue queue("/queue_samples", nullptr, Config::kSamplesQueueMaxBytes);
+    ASSERT_TRUE(queue.begin());
+    size_t records = 0;
+    size_t rows = 0;
+    std::vector<uint8_t> record;
+    while (queue.front(record)) {
+      const std::string body(record.begin(), record.end());
+      size_t recordRows = 0;
+      for (size_t at = body.find("[1700"); at != std::string::npos; at = body.find("[1700", at + 1)) {
+        recordRows++;
+      }
+      EXPECT_LE(recordRows * layout.rowBytes, Config::kBatchRamBytes) << "record " << records;
+      rows += recordRows;
+      records++;
+      queue.pop();
+    }
+    EXPECT_EQ(records, 4u) << layout.rowBytes << " bytes per row";
+    EXPECT_EQ(rows, windows) << layout.rowBytes << " bytes per row";
+  }
+}
+
+// A 503 keeps the record and backs off; the retry after the wait sends the same bytes.
+TEST_F(BatchUploaderTest, ServerErrorKeepsRecordAndBacksOff) {
+  uploader->setBatchLimits(20, Config::kBatchMaxWaitMs);
+  addSamples(20);
+  NativeHost::http().statusCode = 503;
+  uploader->update(true, Config::kWindowMs);
+  EXPECT_EQ(NativeHost::http().requests, 1u);
+  const std::string firstBody = NativeHost::http().lastBody;
+
+  NativeHost::http().statusCode = 200;
+  NativeHost::advanceClockMs(1000);
+  uploader->update(true, Config::kWindowMs); // backing off: no request
+  EXPECT_EQ(NativeHost::http().requests, 1u);
+
+  NativeHost::advanceClockMs(60000);
+  uploader->update(true, Config::kWindowMs);
+  EXPECT_EQ(NativeHost::http().requests, 2u);
+  EXPECT_EQ(NativeHost::http().lastBody, firstBody);
+  EXPECT_EQ(uploader->uploadsSent(), 1u);
+}
+
+// A 503 streak is an outage, not a bad payload: however long it lasts, the record stays queued
+// and nothing goes to the dead-letter queue.
+TEST_F(BatchUploaderTest, ServerErrorStreakKeepsRecord) {
+  uploader->setBatchLimits(20, Config::kBatchMaxWaitMs);
+  addSamples(20);
+  NativeHost::http().statusCode = 503;
+  uploader->update(true, Config::kWindowMs);
+  const std::string firstBody = NativeHost::http().lastBody;
+  for (int i = 0; i < 30; ++i) {
+    NativeHost::advanceClockMs(10UL * 60UL * 1000UL);
+    uploader->update(true, Config::kWindowMs);
+  }
+  EXPECT_EQ(NativeHost::http().requests, 31u);
+
+  Metrics::Gauges gauges;
+  uploader->collectGauges(gauges);
+  EXPECT_EQ(gauges.samplesQueue.records, 1u);
+  EXPECT_EQ(gauges.deadLetterQueue.records, 0u);
+
+  NativeHost::http().statusCode = 200;
+  NativeHost::advanceClockMs(10UL * 60UL * 1000UL);
+  uploader->update(true, Config::kWindowMs);
+  EXPECT_EQ(NativeHost::http().lastBody, firstBody);
+  EXPECT_EQ(uploader->uploadsSent(), 1u);
+}
+
+// A 4xx rejects the payload itself: the head goes to the dead-letter queue and the next record
+// is sent in the same pass, without backing off.
+TEST_F(BatchUploaderTest, ClientErrorDeadLettersHeadAndSendsNext) {
+  uploader->setBatchLimits(20, Config::kBatchMaxWaitMs);
+  addSamples(20);
+  uploader->update(false, Config::kWindowMs);
+  addSamples(20);
+  uploader->update(false, Config::kWindowMs);
+
+  NativeHost::http().statusCode = 400;
+  NativeHost::http().onRequest = [](const NativeHost::HttpStub& stub) {
+    if (stub.requests > 1) {
+      NativeHost::http().statusCode = 200;
+    }
+  };
+  uploader->update(true, Config::kWindowMs);
+  EXPECT_EQ(NativeHost::http().requests, 2u);
+  EXPECT_EQ(uploader->uploadsSent(), 1u);
+
+  Metrics::Gauges gauges;
+  uploader->collectGauges(gauges);
+  EXPECT_EQ(gauges.samplesQueue.records, 0u);
+  EXPECT_EQ(gauges.deadLetterQueue.records, 1u);
+}
+
+// GET /config costs one request per round: on connect, on request, with the ETag turning an
+// unchanged document into a 304 the listener never sees, and not again while backing off.
+TEST_F(BatchUploaderTest, ConfigDocumentFetchedWithEtag) {
+  ConfigRecorder recorder;
+  recorder.config.channelCount = 4;
+  NativeHost::http().responseBody = "version=7\nbatch_points=3000\n";
+  NativeHost::http().responseEtag = "\"v7\"";
+  uploader->setConfigListener(&recorder);
+  uploader->update(true, Config::kWindowMs);
+  uploader->update(true, Config::kWindowMs); // within the interval: no request
+  EXPECT_EQ(NativeHost::http().requests, 1u);
+  EXPECT_EQ(recorder.calls, 1u);
+
+  uploader->requestConfigFetch();
+  uploader->update(true, Config::kWindowMs);
+  EXPECT_EQ(NativeHost::http().lastIfNoneMatch, "\"v7\"");
+  EXPECT_EQ(recorder.calls, 1u);
+
+  NativeHost::http().responseBody = "version=8\nbatch_points=1500\n";
+  NativeHost::http().responseEtag = "\"v8\"";
+  uploader->requestConfigFetch();
+  uploader->update(true, Config::kWindowMs);
+  NativeHost::http().statusCode = 503;
+  uploader->requestConfigFetch();
+  uploader->update(true, Config::kWindowMs);
+  uploader->update(true, Config::kWindowMs); // backing off: no request
+
+  EXPECT_EQ(NativeHost::http().requests, 4u);
+  EXPECT_EQ(recorder.calls, 2u);
+  EXPECT_EQ(recorder.applied, 2u);
+  EXPECT_EQ(recorder.config.version, 8u);
+  EXPECT_EQ(recorder.config.batchMaxPoints, 1500u);
+  EXPECT_STREQ(uploader->configEtag(), "\"v8\"");
+}
+
+// The config GET and the sample POSTs share one keep-alive connection; once it has been idle
+// longer than kHttpIdleTimeoutMs the session closes it and the next request opens another.
+TEST_F(BatchUploaderTest, RequestsShareConnectionUntilIdle) {
+  ConfigRecorder recorder;
+  NativeHost::http().responseBody = "version=1\n";
+  uploader->setConfigListener(&recorder);
+  uploader->setBatchLimits(20, Config::kBatchMaxWaitMs);
+  addSamples(20);
+  uploader->update(true, Config::kWindowMs);
+  const HttpSession::Stats& stats = uploader->session().stats();
+  EXPECT_EQ(NativeHost::http().requests, 2u);
+  EXPECT_EQ(stats.connectionsOpened, 1u);
+  EXPECT_EQ(stats.requestsOnConnection, 2u);
+
+  NativeHost::advanceClockMs(Config::kHttpIdleTimeoutMs / 2);
+  addSamples(20);
+  uploader->update(true, Config::kWindowMs);
+  EXPECT_TRUE(uploader->session().lastRequestReused());
+  uploader->requestConfigFetch();
+  uploader->update(true, Config::kWindowMs);
+  EXPECT_TRUE(uploader->session().lastRequestReused());
+  EXPECT_EQ(NativeHost::http().requests, 4u);
+  EXPECT_EQ(stats.connectionsOpened, 1u);
+  EXPECT_EQ(stats.maxRequestsPerConnection, 4u);
+
+  NativeHost::advanceClockMs(Config::kHttpIdleTimeoutMs + 1);
+  uploader->update(true, Config::kWindowMs); // nothing to send: only the idle check
+  EXPECT_EQ(NativeHost::http().requests, 4u);
+  addSamples(20);
+  uploader->update(true, Config::kWindowMs);
+  EXPECT_FALSE(uploader->session().lastRequestReused());
+  EXPECT_EQ(NativeHost::http().requests, 5u);
+  EXPECT_EQ(stats.connectionsOpened, 2u);
+  EXPECT_EQ(stats.requestsOnConnection, 1u);
+  EXPECT_EQ(stats.errors, 0u);
+}
+
+// The detector as it was before events became ranges over a shared history: every event
+// copies the pre-trigger ring (which already ends with the trigger window), appends the
+// trigger window again and then every window up to the end of post-recording.
+class CopyingEventDetector {
+ public:
+  struct Event {
+    EventType type = EventType::Sag;
+    uint64_t start_ts = 0;
+    uint64_t end_ts = 0;
+    float min_vrms = 0.0f;
+    float max_vrms = 0.0f;
+    std::vector<VoltageSample> samples;
+  };
+
+  CopyingEventDetector() : ring_(Config::kEventPrePoints) {}
+
+  void addSample(const VoltageSample& sample) {
+    ring_[ringIndex_] = sample;
+    ringIndex_ = (ringIndex_ + 1) % ring_.size();
+    ringFull_ = ringFull_ || ringIndex_ == 0;
+    if (sample.flags & FLAG_NO_SIGNAL) {
+      eventActive_ = false;
+      postRecording_ = false;
+      sagCounter_ = 0;
+      swellCounter_ = 0;
+      endCounter_ = 0;
+      postCounter_ = 0;
+      return;
+    }
+    const float detectVrms = detectionValue();
+    if (eventActive_) {
+      append(sample);
+      bool inside = false;
+      uint16_t endWindows = Config::kCriticalEndWindows;
+      if (active_.type == EventType::Sag) {
+        inside = detectVrms > Config::kSagEnd;
+        endWindows = Config::kSagEndWindows;
+      } else if (active_.type == EventType::Swell) {
+        inside = detectVrms < Config::kSwellEnd;
+        endWindows = Config::kSwellEndWindows;
+      } else {
+        inside = detectVrms > Config::kCriticalLow && detectVrms < Config::kCriticalHigh;
+      }
+      endCounter_ = inside ? endCounter_ + 1 : 0;
+      if (endCounter_ >= endWindows && !postRecording_) {
+        active_.end_ts = sample.ts_ms;
+        postRecording_ = true;
+        postCounter_ = 0;
+      }
+      if (postRecording_ && ++postCounter_ >= Config::kEventPostPoints) {
+        completed.push_back(active_);
+        eventActive_ = false;
+        postRecording_ = false;
+      }
+      return;
+    }
+    if (detectVrms < Config::kCriticalLow || detectVrms > Config::kCriticalHigh) {
+      start(EventType::Critical, sample);
+      return;
+    }
+    sagCounter_ = detectVrms < Config::kSagStart ? sagCounter_ + 1 : 0;
+    swellCounter_ = detectVrms > Config::kSwellStart ? swellCounter_ + 1 : 0;
+    if (sagCounter_ >= Config::kSagStartWindows) {
+      start(EventType::Sag, sample);
+      sagCounter_ = 0;
+    } else if (swellCounter_ >= Config::kSwellStartWindows) {
+      start(EventType::Swell, sample);
+      swellCounter_ = 0;
+    }
+  }
+
+  std::vector<Event> completed;
+
+ private:
+  float detectionValue() const {
+    float sum = 0.0f;
+    int count = 0;
+    const size_t available = ringFull_ ? ring_.size() : ringIndex_;
+    for (size_t i = 0; i < std::min<size_t>(3, available); ++i) {
+      const VoltageSample& sample = ring_[(ringIndex_ + ring_.size() - 1 - i) % ring_.size()];
+      if (!(sample.flags & FLAG_NO_SIGNAL)) {
+        sum += sample.vrms;
+        count++;
+      }
+    }
+    return count == 0 ? 0.0f : sum / static_cast<float>(count);
+  }
+
+  void start(EventType type, const VoltageSample& sample) {
+    eventActive_ = true;
+    postRecording_ = false;
+    endCounter_ = 0;
+    postCounter_ = 0;
+    active_ = {};
+    active_.type = type;
+    active_.start_ts = sample.ts_ms;
+    active_.min_vrms = sample.vrms;
+    active_.max_vrms = sample.vrms;
+    const size_t available = ringFull_ ? ring_.size() : ringIndex_;
+    const size_t first = (ringIndex_ + ring_.size() - available) % ring_.size();
+    for (size_t i = 0; i < available; ++i) {
+      active_.samples.push_back(ring_[(first + i) % ring_.size()]);
+    }
+    append(sample);
+  }
+
+  void append(const VoltageSample& sample) {
+    active_.samples.push_back(sample);
+    active_.min_vrms = std::min(active_.min_vrms, sample.vrms);
+    active_.max_vrms = std::max(active_.max_vrms, sample.vrms);
+  }
+
+  std::vector<VoltageSample> ring_;
+  size_t ringIndex_ = 0;
+  bool ringFull_ = false;
+  uint16_t sagCounter_ = 0;
+  uint16_t swellCounter_ = 0;
+  bool eventActive_ = false;
+  bool postRecording_ = false;
+  uint16_t endCounter_ = 0;
+  uint16_t postCounter_ = 0;
+  Event active_;
+};
+
+// The event JSON of the copying implementation, plus the channel key added with scanned inputs.
+std::string copyingEventJson(const CopyingEventDetector::Event& event) {
+  char buf[160];
+  std::string json = std::string("{\"device_id\":\"test\",\"fw_version\":\"") + Config::kFirmwareVersion +
+                     "\",\"type\":\"" + EventTypeToString(event.type) + "\",\"channel\":0";
+  snprintf(buf,
+           sizeof(buf),
+           ",\"start_ts\":%llu,\"end_ts\":%llu,\"min_vrms\":%.3f,\"max_vrms\":%.3f,\"samples\":[",
+           static_cast<unsigned long long>(event.start_ts),
+           static_cast<unsigned long long>(event.end_ts),
+           event.min_vrms,
+           event.max_vrms);
+  json += buf;
+  for (size_t i = 0; i < event.samples.size(); ++i) {
+    const VoltageSample& sample = event.samples[i];
+    snprintf(buf,
+             sizeof(buf),
+             "%s[%llu,%.3f,%u]",
+             i == 0 ? "" : ",",
+             static_cast<unsigned long long>(sample.ts_ms),
+             (sample.flags & FLAG_NO_SIGNAL) ? 0.0f : sample.vrms,
+             static_cast<unsigned int>(sample.flags));
+    json += buf;
+  }
+  return json + "]}";
+}
+
+// Sags, swells and critical dips between noisy nominal windows, with signal dropouts in the
+// pre-trigger history and the first event before the history has filled: every queued event
+// payload must be byte for byte what the copying detector produced.
+TEST_F(BatchUploaderTest, EventPayloadsMatchCopyingDetector) {
+  std::unique_ptr<EventDetector> detector(new EventDetector());
+  CopyingEventDetector reference;
+  uint64_t ts = 1700000000000ULL;
+  uint32_t queued = 0;
+  uint32_t noise = 1;
+  auto feed = [&](float vrms, size_t count, uint16_t flags) {
+    VoltageSample sample;
+    sample.sample_count = Config::kWindowSamples;
+    for (size_t i = 0; i < count; ++i) {
+      noise = noise * 1103515245u + 12345u;
+      sample.ts_ms = ts;
+      sample.vrms = vrms + static_cast<float>((noise >> 16) % 2000) / 1000.0f - 1.0f;
+      sample.flags = flags;
+      ts += Config::kWindowMs;
+      detector->addSample(sample);
+      reference.addSample(sample);
+      VoltageEvent event;
+      while (detector->pollCompletedEvent(event)) {
+        uploader->addEvent(event, detector->history());
+        queued++;
+      }
+    }
+  };
+  const size_t settle = Config::kSagEndWindows + Config::kEventPostPoints + 20;
+  feed(230.0f, 100, FLAG_NONE);
+  feed(200.0f, 12, FLAG_NONE);
+  feed(230.0f, settle, FLAG_NONE);
+  feed(0.0f, 3, FLAG_NO_SIGNAL);
+  feed(230.0f, 200, FLAG_NONE);
+  feed(258.0f, 30, FLAG_NONE);
+  feed(231.0f, settle, FLAG_NONE);
+  feed(230.0f, 500, FLAG_NONE);
+  feed(170.0f, 4, FLAG_NONE);
+  feed(229.0f, settle, FLAG_NONE);
+  feed(205.0f, 400, FLAG_NONE);
+  feed(230.0f, settle, FLAG_NONE);
+
+  ASSERT_EQ(reference.completed.size(), 4u);
+  ASSERT_EQ(queued, reference.completed.size());
+  EXPECT_EQ(detector->truncatedEvents(), 0u);
+  StorageQueue queue("/queue_events", nullptr, Config::kEventsQueueMaxBytes);
+  ASSERT_TRUE(queue.begin());
+  for (const CopyingEventDetector::Event& expected : reference.completed) {
+    std::vector<uint8_t> record;
+    ASSERT_TRUE(queue.front(record));
+    queue.pop();
+    const std::string payload(record.begin(), record.end());
+    const std::string baseline = copyingEventJson(expected);
+    EXPECT_TRUE(payload == baseline) << EventTypeToString(expected.type) << " at " << expected.start_ts << ": "
+                                     << payload.size() << " bytes, baseline " << baseline.size();
+  }
+  EXPECT_FALSE(queue.hasItems());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  NativeHost::setSerialQuiet(true);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,89 @@
+// DeviceConfig: the key=value document served on GET /config.
+
+#include "DeviceConfig.h"
+
+#include <gtest/gtest.h>
+#include <string.h>
+
+namespace {
+
+const char* kDocument =
+    "# site 12\n"
+    "version=7\n"
+    "gain0=0.3125\r\n"
+    "offset0=-0.4\n"
+    "phase3=2.5\n"
+    "thresholds=mode=nominal nominal=120\n"
+    "batch_points=3000\n"
+    "batch_wait_s=600\n"
+    "window=fixed\n"
+    "harmonics=on\n"
+    "format=bin\n"
+    "gzip=on\n"
+    "reduce=swing\n"
+    "swing_tol=0.25\n"
+    "fw_version=0.4.0.abcdef0\n"
+    "fw_path=/firmware/0.4.0.bin\n"
+    "fw_size=912384\n"
+    "fw_sha256=BA7816BF8F01CFEA414140DE5DAE2223B00361A396177A9CB410FF61F20015AD\n"
+    "future_key=1\n";
+
+TEST(DeviceConfig, ParsesEveryKey) {
+  DeviceConfig config;
+  config.channelCount = 4;
+  uint32_t unknown = 0;
+  ASSERT_TRUE(config.parse(kDocument, &unknown));
+  EXPECT_EQ(unknown, 1u);
+  EXPECT_EQ(config.version, 7u);
+  EXPECT_TRUE(config.calib[0].present);
+  EXPECT_FLOAT_EQ(config.calib[3].phase, 2.5f);
+  EXPECT_FALSE(config.calib[1].present);
+  EXPECT_EQ(config.thresholds.mode, ThresholdMode::Nominal);
+  EXPECT_EQ(config.batchMaxWaitMs, 600000u);
+  EXPECT_FALSE(config.cycleSync);
+  EXPECT_TRUE(config.harmonics);
+  EXPECT_EQ(config.uploadFormat, UploadFormat::Binary);
+  EXPECT_EQ(config.reduction, SampleReduction::SwingingDoor);
+  EXPECT_TRUE(config.firmware.complete());
+  EXPECT_EQ(config.firmware.size, 912384u);
+  EXPECT_EQ(config.firmware.sha256[0], 0xba);
+}
+
+// format() must read back to the same document.
+TEST(DeviceConfig, FormatRoundTrips) {
+  DeviceConfig config;
+  config.channelCount = 4;
+  ASSERT_TRUE(config.parse(kDocument));
+  char formatted[DeviceConfig::kMaxDocumentLength];
+  config.format(formatted, sizeof(formatted));
+
+  DeviceConfig reread;
+  reread.channelCount = config.channelCount;
+  ASSERT_TRUE(reread.parse(formatted));
+  char reformatted[DeviceConfig::kMaxDocumentLength];
+  reread.format(reformatted, sizeof(reformatted));
+  EXPECT_STREQ(formatted, reformatted);
+}
+
+// One bad value rejects the whole document and leaves every setting unchanged.
+TEST(DeviceConfig, BadValueLeavesConfigUntouched) {
+  DeviceConfig config;
+  config.channelCount = 4;
+  ASSERT_TRUE(config.parse(kDocument));
+
+  uint32_t errorLine = 0;
+  EXPECT_FALSE(config.parse("version=8\ngain1=2\nbatch_points=0\n", nullptr, &errorLine));
+  EXPECT_EQ(errorLine, 3u);
+  EXPECT_EQ(config.version, 7u);
+  EXPECT_FALSE(config.calib[1].present);
+  EXPECT_FALSE(config.parse("gain5=1\n"));
+  EXPECT_FALSE(config.parse("thresholds=sag_start=300\n"));
+  EXPECT_EQ(config.version, 7u);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
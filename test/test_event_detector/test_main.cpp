@@ -0,0 +1,272 @@
+// EventDetector on synthetic window streams: event ranges over the shared history and the
+// runtime threshold profiles.
+
+#include "Config.h"
+#include "EventDetector.h"
+#include "NativeHost.h"
+#include "ThresholdProfile.h"
+
+#include <gtest/gtest.h>
+#include <math.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace {
+
+// Feeds windows at vrms and collects the events they complete.
+class WindowFeeder {
+ public:
+  explicit WindowFeeder(EventDetector& detector) : detector_(detector) {}
+
+  void feed(float vrms, size_t count, uint16_t flags = FLAG_NONE) {
+    VoltageSample sample;
+    sample.sample_count = Config::kWindowSamples;
+    sample.flags = flags;
+    for (size_t i = 0; i < count; ++i) {
+      sample.ts_ms = ts;
+      sample.vrms = vrms;
+      ts += Config::kWindowMs;
+      detector_.addSample(sample);
+      VoltageEvent event;
+      while (detector_.pollCompletedEvent(event)) {
+        events.push_back(event);
+        completedAt.push_back(sample.ts_ms);
+      }
+    }
+  }
+
+  uint32_t count(EventType type) const {
+    uint32_t n = 0;
+    for (const VoltageEvent& event : events) {
+      n += event.type == type ? 1 : 0;
+    }
+    return n;
+  }
+
+  uint64_t ts = 1700000000000ULL;
+  std::vector<VoltageEvent> events;
+  std::vector<uint64_t> completedAt; // ts of the window that completed each event
+
+ private:
+  EventDetector& detector_;
+};
+
+// A 4 s sag to 200 V: one event holding kEventPrePoints of history up to its trigger and
+// every window after it, through the recovery and kEventPostPoints of post-recording.
+TEST(EventDetector, SagCoversPreTriggerHistoryAndPostWindow) {
+  std::unique_ptr<EventDetector> detector(new EventDetector());
+  WindowFeeder feeder(*detector);
+  feeder.feed(230.0f, 400);
+  const uint64_t sagTs = feeder.ts;
+  feeder.feed(200.0f, 20);
+  const uint64_t recoveryTs = feeder.ts;
+  feeder.feed(230.0f, Config::kSagEndWindows + Config::kEventPostPoints + 10);
+
+  ASSERT_EQ(feeder.events.size(), 1u);
+  const VoltageEvent& event = feeder.events[0];
+  EXPECT_EQ(event.type, EventType::Sag);
+  EXPECT_GT(event.start_ts, sagTs);
+  EXPECT_LT(event.start_ts, recoveryTs);
+  EXPECT_GT(event.end_ts, recoveryTs);
+  EXPECT_FLOAT_EQ(event.min_vrms, 200.0f);
+  EXPECT_FLOAT_EQ(event.max_vrms, 230.0f);
+
+  const SampleHistory& history = detector->history();
+  ASSERT_TRUE(history.intact(event.first_seq));
+  EXPECT_EQ(history.at(event.first_seq).ts_ms, event.start_ts - (Config::kEventPrePoints - 1) * Config::kWindowMs);
+  EXPECT_EQ(history.at(event.first_seq + event.sample_count - 1).ts_ms, feeder.completedAt[0]);
+  EXPECT_EQ(event.sample_count, (feeder.completedAt[0] - event.start_ts) / Config::kWindowMs + Config::kEventPrePoints);
+  EXPECT_EQ(detector->truncatedEvents(), 0u);
+  EXPECT_EQ(detector->droppedEvents(), 0u);
+}
+
+// Loss of signal completes every slot with the windows it has instead of discarding them: a
+// sag in its post-recording keeps its end, a sag still open ends at the loss.
+TEST(EventDetector, LossOfSignalCompletesRecordingEvents) {
+  std::unique_ptr<EventDetector> detector(new EventDetector());
+  WindowFeeder feeder(*detector);
+  feeder.feed(230.0f, 400);
+  feeder.feed(200.0f, 20);
+  feeder.feed(230.0f, Config::kSagEndWindows + 5);
+  feeder.feed(195.0f, 20);
+  ASSERT_TRUE(feeder.events.empty());
+  const uint64_t lossTs = feeder.ts;
+  feeder.feed(0.0f, 10, FLAG_NO_SIGNAL);
+
+  ASSERT_EQ(feeder.events.size(), 2u);
+  for (const VoltageEvent& event : feeder.events) {
+    EXPECT_EQ(event.type, EventType::Sag);
+    EXPECT_LT(event.start_ts, lossTs);
+    EXPECT_LE(event.end_ts, lossTs);
+    EXPECT_GT(event.end_ts, event.start_ts);
+    const SampleHistory& history = detector->history();
+    ASSERT_TRUE(history.intact(event.first_seq));
+    const VoltageSample& last = history.at(event.first_seq + event.sample_count - 1);
+    EXPECT_EQ(last.flags & FLAG_NO_SIGNAL, 0) << "no-signal window inside the event";
+    EXPECT_EQ(last.ts_ms, lossTs - Config::kWindowMs);
+  }
+  EXPECT_LT(feeder.events[0].end_ts, feeder.events[1].start_ts);
+  EXPECT_FLOAT_EQ(feeder.events[1].min_vrms, 195.0f);
+  EXPECT_EQ(feeder.events[1].end_ts, lossTs);
+  EXPECT_EQ(detector->droppedEvents(), 0u);
+
+  // Detection resumes once the signal is back.
+  feeder.feed(230.0f, 100);
+  feeder.feed(200.0f, 20);
+  feeder.feed(230.0f, Config::kSagEndWindows + Config::kEventPostPoints + 10);
+  EXPECT_EQ(feeder.count(EventType::Sag), 3u);
+}
+
+// Dips shorter than kSagStartWindows of the three-window average are not events.
+TEST(EventDetector, ShortDipIsNotAnEvent) {
+  std::unique_ptr<EventDetector> detector(new EventDetector());
+  WindowFeeder feeder(*detector);
+  feeder.feed(230.0f, 100);
+  feeder.feed(200.0f, 4);
+  feeder.feed(230.0f, Config::kEventPostPoints + 100);
+  EXPECT_TRUE(feeder.events.empty());
+}
+
+// A sag, a swell inside its post-trigger window and a sag inside both fill every slot; a
+// further swell then completes the first sag early. Each disturbance is its own event with its
+// own type, and the early one still covers its recovery.
+TEST(EventDetector, NestedEventsKeepTheirTypesWhenSlotsRunOut) {
+  static_assert(Config::kMaxActiveEvents == 3, "the trace nests one event per slot");
+  std::unique_ptr<EventDetector> detector(new EventDetector());
+  WindowFeeder feeder(*detector);
+  feeder.feed(230.0f, 400);
+  const uint64_t firstSagTs = feeder.ts;
+  feeder.feed(200.0f, 10);
+  feeder.feed(230.0f, Config::kSagEndWindows + 5);
+  feeder.feed(258.0f, 10);
+  feeder.feed(230.0f, Config::kSwellEndWindows + 5);
+  feeder.feed(200.0f, 10);
+  feeder.feed(230.0f, Config::kSagEndWindows + 5);
+  EXPECT_TRUE(feeder.events.empty());
+  const uint64_t lastSwellTs = feeder.ts;
+  feeder.feed(258.0f, 10);
+  ASSERT_EQ(feeder.events.size(), 1u);
+  EXPECT_EQ(detector->shortenedEvents(), 1u);
+  feeder.feed(230.0f, Config::kSwellEndWindows + Config::kEventPostPoints + 10);
+
+  ASSERT_EQ(feeder.events.size(), 4u);
+  const EventType expected[] = {EventType::Sag, EventType::Swell, EventType::Sag, EventType::Swell};
+  for (size_t i = 0; i < 4; ++i) {
+    EXPECT_EQ(feeder.events[i].type, expected[i]) << "event " << i;
+  }
+  const VoltageEvent& first = feeder.events[0];
+  EXPECT_GT(first.start_ts, firstSagTs);
+  EXPECT_GT(first.end_ts, first.start_ts);
+  EXPECT_FLOAT_EQ(first.min_vrms, 200.0f);
+  EXPECT_FLOAT_EQ(first.max_vrms, 258.0f);
+  EXPECT_GT(feeder.completedAt[0], lastSwellTs);
+  EXPECT_LT(feeder.completedAt[0], first.end_ts + Config::kEventPostPoints * Config::kWindowMs);
+  EXPECT_GT(feeder.events[3].start_ts, lastSwellTs);
+  EXPECT_FLOAT_EQ(feeder.events[3].max_vrms, 258.0f);
+  EXPECT_EQ(detector->shortenedEvents(), 1u);
+  EXPECT_EQ(detector->droppedEvents(), 0u);
+}
+
+TEST(EventDetector, NominalProfileScalesLevels) {
+  ThresholdProfile profile;
+  ASSERT_TRUE(profile.parse("mode=nominal nominal=120"));
+  const DetectionThresholds levels = profile.thresholds(120.0f);
+  EXPECT_NEAR(levels.sagStart, 108.0f, 0.01f);
+  EXPECT_NEAR(levels.swellStart, 132.0f, 0.01f);
+
+  ThresholdProfile rejected = profile;
+  EXPECT_FALSE(rejected.parse("sag_start=95 sag_end=92"));
+  EXPECT_FALSE(rejected.parse("bogus=1"));
+}
+
+// A 120 V site configured at runtime: "mode=nominal nominal=120" catches a sag to 100 V and
+// follows a supply that settles at 124 V, so that a dip to 110 V (92% of nominal, 89% of the
+// baseline) is a sag as well. Ten minutes of swell at 140 V must not drag the baseline along.
+TEST(EventDetector, NominalBaselineFollowsSupplyButNotSwells) {
+  ThresholdProfile profile;
+  ASSERT_TRUE(profile.parse("mode=nominal nominal=120"));
+  std::unique_ptr<EventDetector> detector(new EventDetector());
+  ASSERT_TRUE(detector->setProfile(profile));
+  WindowFeeder feeder(*detector);
+
+  feeder.feed(120.0f, 100);
+  EXPECT_TRUE(feeder.events.empty());
+  feeder.feed(100.0f, 10);
+  // Recovery: kSagEndWindows back above sag_end, then the post-trigger recording.
+  feeder.feed(120.0f, Config::kSagEndWindows + Config::kEventPostPoints + 10);
+  EXPECT_EQ(feeder.count(EventType::Sag), 1u);
+
+  feeder.feed(124.0f, 5 * 60 * 1000 / Config::kWindowMs);
+  const float tracked = detector->baseline();
+  EXPECT_NEAR(tracked, 124.0f, 0.5f);
+  feeder.feed(110.0f, 10);
+  feeder.feed(124.0f, Config::kSagEndWindows + Config::kEventPostPoints + 10);
+  EXPECT_EQ(feeder.count(EventType::Sag), 2u);
+
+  feeder.feed(140.0f, 10 * 60 * 1000 / Config::kWindowMs);
+  EXPECT_NEAR(detector->baseline(), tracked, 0.5f);
+}
+
+// RMS over (endMs - spanMs, endMs] of a 50 Hz supply at 230 V with a dip to dipV over
+// [dipStartMs, dipEndMs), in 1 ms steps.
+float supplyRms(uint64_t endMs, uint64_t spanMs, uint64_t dipStartMs, uint64_t dipEndMs, float dipV) {
+  double sumSq = 0.0;
+  for (uint64_t t = endMs - spanMs; t < endMs; ++t) {
+    const double v = (t >= dipStartMs && t < dipEndMs) ? dipV : 230.0;
+    sumSq += v * v;
+  }
+  return static_cast<float>(sqrt(sumSq / spanMs));
+}
+
+// Feeds a 3-cycle dip to 195 V as AcquisitionTask does: a one-cycle value at every crossing,
+// a window every kWindowMs. Returns the completed events.
+std::vector<VoltageEvent> feedThreeCycleDip(bool halfCycles, uint64_t dipStartMs, uint64_t dipEndMs) {
+  constexpr uint64_t kHalfMs = 500 / Config::kMainsNominalHz;
+  constexpr uint64_t kStartMs = 1700000000000ULL;
+  std::unique_ptr<EventDetector> detector(new EventDetector());
+  std::vector<VoltageEvent> events;
+  const uint64_t endMs = dipEndMs + (Config::kSagEndWindows + Config::kEventPostPoints + 20) * Config::kWindowMs;
+  for (uint64_t ts = kStartMs + Config::kWindowMs; ts <= endMs; ts += kHalfMs) {
+    if (halfCycles) {
+      detector->addHalfCycle(supplyRms(ts, 2 * kHalfMs, dipStartMs, dipEndMs, 195.0f), ts);
+    }
+    if ((ts - kStartMs) % Config::kWindowMs == 0) {
+      VoltageSample sample;
+      sample.sample_count = Config::kWindowSamples;
+      sample.ts_ms = ts;
+      sample.vrms = supplyRms(ts, Config::kWindowMs, dipStartMs, dipEndMs, 195.0f);
+      detector->addSample(sample);
+    }
+    VoltageEvent event;
+    while (detector->pollCompletedEvent(event)) {
+      events.push_back(event);
+    }
+  }
+  return events;
+}
+
+// Three cycles below sagStart average out inside a 200 ms window; only the half-cycle path sees
+// them, and stamps the event to within a half cycle of the true edges.
+TEST(EventDetector, FastPathTimesThreeCycleDip) {
+  const uint64_t dipStartMs = 1700000000000ULL + 100 * Config::kWindowMs + 70;
+  const uint64_t dipEndMs = dipStartMs + 3 * 1000 / Config::kMainsNominalHz;
+
+  EXPECT_TRUE(feedThreeCycleDip(false, dipStartMs, dipEndMs).empty());
+
+  const std::vector<VoltageEvent> events = feedThreeCycleDip(true, dipStartMs, dipEndMs);
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].type, EventType::Sag);
+  EXPECT_FLOAT_EQ(events[0].min_vrms, 195.0f);
+  EXPECT_LE(std::max(events[0].start_ts, dipStartMs) - std::min(events[0].start_ts, dipStartMs), 10u);
+  EXPECT_LE(std::max(events[0].end_ts, dipEndMs) - std::min(events[0].end_ts, dipEndMs), 10u);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  NativeHost::setSerialQuiet(true);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
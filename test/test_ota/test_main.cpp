@@ -0,0 +1,203 @@
+// OtaUpdater against the Range-serving HTTP stub and a file-backed partition, on a virtual
+// clock.
+
+#include "Config.h"
+#include "FileOtaPartition.h"
+#include "HttpSession.h"
+#include "NativeHost.h"
+#include "OtaUpdater.h"
+#include "Sha256.h"
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+namespace {
+
+const std::string kSlot = std::string(Config::kFsBasePath) + "/ota_slot.bin";
+
+// Runs an updater until it leaves Downloading, stepping the virtual clock past retry waits.
+void runOta(OtaUpdater& ota, HttpSession& session) {
+  for (int i = 0; i < 1000 && ota.state() == OtaUpdater::State::Downloading; ++i) {
+    ota.update(session, true);
+    NativeHost::advanceClockMs(1000);
+  }
+}
+
+std::string readFile(const std::string& path) {
+  std::string data;
+  if (FILE* file = fopen(path.c_str(), "rb")) {
+    char buf[1024];
+    size_t n = 0;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+      data.append(buf, n);
+    }
+    fclose(file);
+  }
+  return data;
+}
+
+class OtaTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    NativeHost::useVirtualClock(1000);
+    ASSERT_TRUE(NativeHost::resetFilesystem());
+    image.assign(3 * Config::kOtaChunkBytes + 1000, '\0');
+    uint32_t seed = 12345;
+    for (char& byte : image) {
+      seed = seed * 1664525u + 1013904223u;
+      byte = static_cast<char>(seed >> 24);
+    }
+    snprintf(manifest.version, sizeof(manifest.version), "9.9.9");
+    snprintf(manifest.path, sizeof(manifest.path), "/firmware/9.9.9.bin");
+    manifest.size = static_cast<uint32_t>(image.size());
+    Sha256 hash;
+    hash.update(reinterpret_cast<const uint8_t*>(image.data()), image.size());
+    hash.finish(manifest.sha256);
+
+    NativeHost::http() = {};
+    NativeHost::http().responseBody = image;
+    session.begin("http://test", "test", "");
+  }
+
+  void TearDown() override {
+    NativeHost::http() = {};
+  }
+
+  size_t chunks() const {
+    return (image.size() + Config::kOtaChunkBytes - 1) / Config::kOtaChunkBytes;
+  }
+
+  std::string image;
+  FirmwareManifest manifest;
+  HttpSession session;
+};
+
+TEST(Sha256, MatchesKnownVector) {
+  uint8_t digest[Sha256::kDigestSize];
+  uint8_t expected[Sha256::kDigestSize];
+  Sha256 abc;
+  abc.update(reinterpret_cast<const uint8_t*>("abc"), 3);
+  abc.finish(digest);
+  ASSERT_TRUE(Sha256::fromHex("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", expected));
+  EXPECT_EQ(memcmp(digest, expected, sizeof(digest)), 0);
+}
+
+// The image lands chunk by chunk, bit-exact, resuming at the same offset after a failed
+// request, and never writes more than a chunk at a time.
+TEST_F(OtaTest, DownloadResumesAfterFailedChunk) {
+  FileOtaPartition partition(kSlot.c_str(), 64 * 1024, "1.0.0");
+  OtaUpdater ota(partition);
+  ota.begin();
+  EXPECT_FALSE(ota.offer(manifest, "9.9.9"));
+  ASSERT_TRUE(ota.offer(manifest, "1.0.0"));
+  ota.update(session, true);
+  NativeHost::http().statusCode = 503;
+  ota.update(session, true);
+  NativeHost::http().statusCode = 200;
+  ota.update(session, true); // backing off: no request
+  EXPECT_EQ(NativeHost::http().requests, 2u);
+  EXPECT_EQ(ota.bytesWritten(), Config::kOtaChunkBytes);
+
+  runOta(ota, session);
+  EXPECT_EQ(ota.state(), OtaUpdater::State::Ready);
+  EXPECT_EQ(NativeHost::http().requests, chunks() + 1);
+  EXPECT_LE(partition.largestWrite(), Config::kOtaChunkBytes);
+  EXPECT_TRUE(readFile(kSlot) == image);
+}
+
+// A wrong SHA-256 is never activated; the version is abandoned after kOtaMaxImageAttempts.
+TEST_F(OtaTest, BadHashIsNeverActivated) {
+  FileOtaPartition partition(kSlot.c_str(), 64 * 1024, "1.0.0");
+  OtaUpdater ota(partition);
+  FirmwareManifest bad = manifest;
+  bad.sha256[0] ^= 0x01;
+  ASSERT_TRUE(ota.offer(bad, "1.0.0"));
+  runOta(ota, session);
+  EXPECT_EQ(ota.state(), OtaUpdater::State::Failed);
+  EXPECT_EQ(NativeHost::http().requests, chunks() * Config::kOtaMaxImageAttempts);
+  partition.boot();
+  EXPECT_EQ(partition.runningVersion(), "1.0.0");
+  EXPECT_FALSE(ota.offer(bad, "1.0.0"));
+}
+
+// An updated image that never completes an upload rolls back and is not offered again.
+TEST_F(OtaTest, UnconfirmedImageRollsBack) {
+  FileOtaPartition partition(kSlot.c_str(), 64 * 1024, "1.0.0");
+  OtaUpdater ota(partition);
+  ASSERT_TRUE(ota.offer(manifest, "1.0.0"));
+  runOta(ota, session);
+  ASSERT_EQ(ota.state(), OtaUpdater::State::Ready);
+
+  partition.boot();
+  OtaUpdater rebooted(partition);
+  rebooted.begin();
+  EXPECT_EQ(partition.runningVersion(), "9.9.9");
+  EXPECT_TRUE(rebooted.validating());
+  rebooted.checkHealth(0, true, 1);
+  EXPECT_EQ(partition.runningVersion(), "9.9.9");
+  NativeHost::advanceClockMs(Config::kOtaValidationMs + 1);
+  rebooted.checkHealth(0, true, 1);
+  EXPECT_EQ(partition.runningVersion(), "1.0.0");
+  EXPECT_TRUE(partition.rejected("9.9.9"));
+  EXPECT_FALSE(rebooted.offer(manifest, "1.0.0"));
+}
+
+// Time without WiFi, or with a server that never answers, does not count against the image: an
+// outage right after the update keeps it pending, and the window starts once uploads can go out.
+TEST_F(OtaTest, OfflineForWholeWindowKeepsImage) {
+  FileOtaPartition partition(kSlot.c_str(), 64 * 1024, "1.0.0");
+  ASSERT_TRUE(partition.beginImage(image.size(), "9.9.9"));
+  ASSERT_TRUE(partition.write(reinterpret_cast<const uint8_t*>(image.data()), image.size()));
+  ASSERT_TRUE(partition.activate());
+  partition.boot();
+  OtaUpdater ota(partition);
+  ota.begin();
+
+  for (int minute = 0; minute < 60; ++minute) {
+    NativeHost::advanceClockMs(60000);
+    ota.checkHealth(0, false, 0);
+  }
+  for (int minute = 0; minute < 60; ++minute) {
+    NativeHost::advanceClockMs(60000);
+    ota.checkHealth(0, true, 0); // WiFi up, every request a transport error
+  }
+  EXPECT_TRUE(ota.validating());
+  EXPECT_EQ(partition.runningVersion(), "9.9.9");
+  EXPECT_FALSE(partition.rejected("9.9.9"));
+
+  NativeHost::advanceClockMs(Config::kOtaValidationMs / 2);
+  ota.checkHealth(0, true, 1);
+  EXPECT_TRUE(ota.validating());
+  ota.checkHealth(1, true, 2);
+  EXPECT_FALSE(ota.validating());
+  EXPECT_FALSE(partition.pendingValidation());
+  EXPECT_EQ(partition.runningVersion(), "9.9.9");
+}
+
+// One successful upload confirms the image for good.
+TEST_F(OtaTest, UploadConfirmsImage) {
+  FileOtaPartition partition(kSlot.c_str(), 64 * 1024, "1.0.0");
+  ASSERT_TRUE(partition.beginImage(image.size(), "9.9.9"));
+  ASSERT_TRUE(partition.write(reinterpret_cast<const uint8_t*>(image.data()), image.size()));
+  ASSERT_TRUE(partition.activate());
+  partition.boot();
+  OtaUpdater ota(partition);
+  ota.begin();
+  ota.checkHealth(1, true, 1);
+  NativeHost::advanceClockMs(Config::kOtaValidationMs + 1);
+  ota.checkHealth(0, true, 1);
+  EXPECT_FALSE(ota.validating());
+  EXPECT_FALSE(partition.pendingValidation());
+  EXPECT_EQ(partition.runningVersion(), "9.9.9");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  NativeHost::setSerialQuiet(true);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,201 @@
+// SampleReducer on synthetic window streams: the swinging door's interpolation bound, the
+// pass-through of disturbed windows and the tier summaries.
+
+#include "Config.h"
+#include "NativeHost.h"
+#include "SampleReducer.h"
+
+#include <gtest/gtest.h>
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+constexpr uint64_t kStartTs = 1700000040000ULL; // on a 60 s tier boundary
+
+// A slowly wandering supply inside the disturbance band, with noise: enough structure for
+// the door to archive points regularly. A secondary voltage and a current channel wander too.
+struct Trace {
+  std::vector<VoltageSample> samples;
+  std::vector<ChannelValues> channels;
+};
+
+Trace makeTrace(size_t count) {
+  Trace trace;
+  uint32_t noise = 2463534242u;
+  for (size_t i = 0; i < count; ++i) {
+    const double t = static_cast<double>(i) * Config::kWindowMs / 1000.0;
+    noise = noise * 1664525u + 1013904223u;
+    const double jitter = ((noise >> 8) / 16777216.0 - 0.5) * 0.6;
+    VoltageSample sample;
+    sample.ts_ms = kStartTs + i * Config::kWindowMs;
+    sample.sample_count = Config::kWindowSamples;
+    sample.vrms = static_cast<float>(230.0 + 4.0 * sin(2.0 * M_PI * t / 600.0) + 1.5 * sin(2.0 * M_PI * t / 37.0) + jitter);
+    trace.samples.push_back(sample);
+
+    ChannelValues row;
+    row.count = 2;
+    row.kind[0] = ChannelKind::Voltage;
+    row.kind[1] = ChannelKind::Current;
+    row.rms[0] = static_cast<float>(229.0 + 3.0 * sin(2.0 * M_PI * t / 450.0) - jitter);
+    row.rms[1] = static_cast<float>(8.0 + 2.0 * sin(2.0 * M_PI * t / 90.0) + 0.5 * jitter);
+    trace.channels.push_back(row);
+  }
+  return trace;
+}
+
+float rowValue(const VoltageSample& sample, const ChannelValues* row, size_t channel) {
+  return channel == 0 ? sample.vrms : row->rms[channel - 1];
+}
+
+// Every window lies within tolerance of the line between the emitted points around it, on the
+// primary and on each secondary channel.
+void expectInterpolationWithinTolerance(const Trace& trace, bool withChannels, float tolerance) {
+  SampleReducer reducer;
+  reducer.setMode(SampleReduction::SwingingDoor, tolerance);
+  SamplePoints points;
+  for (size_t i = 0; i < trace.samples.size(); ++i) {
+    reducer.add(trace.samples[i], withChannels ? &trace.channels[i] : nullptr, points);
+  }
+  reducer.flush(points);
+  ASSERT_EQ(points.channels.size(), withChannels ? points.size() : 0u);
+  ASSERT_GE(points.size(), 2u);
+  EXPECT_LT(points.size(), trace.samples.size());
+  EXPECT_EQ(points.samples.front().ts_ms, trace.samples.front().ts_ms);
+  EXPECT_EQ(points.samples.back().ts_ms, trace.samples.back().ts_ms);
+
+  const size_t channelCount = withChannels ? 3 : 1;
+  size_t segment = 0;
+  for (size_t i = 0; i < trace.samples.size(); ++i) {
+    const VoltageSample& sample = trace.samples[i];
+    while (segment + 2 < points.size() && points.samples[segment + 1].ts_ms <= sample.ts_ms) {
+      segment++;
+    }
+    const VoltageSample& a = points.samples[segment];
+    const VoltageSample& b = points.samples[segment + 1];
+    ASSERT_LT(a.ts_ms, b.ts_ms);
+    ASSERT_LE(a.ts_ms, sample.ts_ms);
+    ASSERT_LE(sample.ts_ms, b.ts_ms);
+    const float f = static_cast<float>(sample.ts_ms - a.ts_ms) / static_cast<float>(b.ts_ms - a.ts_ms);
+    for (size_t c = 0; c < channelCount; ++c) {
+      const ChannelValues* rowA = withChannels ? &points.channels[segment] : nullptr;
+      const ChannelValues* rowB = withChannels ? &points.channels[segment + 1] : nullptr;
+      const float va = rowValue(a, rowA, c);
+      const float vb = rowValue(b, rowB, c);
+      const float actual = rowValue(sample, withChannels ? &trace.channels[i] : nullptr, c);
+      ASSERT_LE(fabsf(va + f * (vb - va) - actual), tolerance + 1e-3f) << "window " << i << " channel " << c;
+    }
+  }
+}
+
+TEST(SampleReducer, SwingingDoorInterpolationStaysWithinTolerance) {
+  const Trace trace = makeTrace(20000);
+  for (float tolerance : {Config::kSwingDoorToleranceV, 0.2f, 1.5f}) {
+    SCOPED_TRACE(tolerance);
+    expectInterpolationWithinTolerance(trace, false, tolerance);
+    expectInterpolationWithinTolerance(trace, true, tolerance);
+  }
+}
+
+// A sag on the primary and a swell on the secondary voltage channel: in every reducing mode
+// each of their windows comes through as it went in, with a summary of its own value in tier
+// modes.
+TEST(SampleReducer, DisturbedWindowsPassThroughUnreduced) {
+  Trace trace = makeTrace(3000);
+  std::vector<size_t> disturbed;
+  for (size_t i = 1000; i < 1017; ++i) {
+    trace.samples[i].vrms = 195.0f + static_cast<float>(i % 3);
+    disturbed.push_back(i);
+  }
+  for (size_t i = 2000; i < 2008; ++i) {
+    trace.channels[i].rms[0] = 258.0f;
+    disturbed.push_back(i);
+  }
+
+  for (SampleReduction mode : {SampleReduction::Tier1s,
+                               SampleReduction::Tier10s,
+                               SampleReduction::Tier60s,
+                               SampleReduction::SwingingDoor}) {
+    SCOPED_TRACE(SampleReductionToString(mode));
+    SampleReducer reducer;
+    reducer.setMode(mode, Config::kSwingDoorToleranceV);
+    SamplePoints points;
+    for (size_t i = 0; i < trace.samples.size(); ++i) {
+      reducer.add(trace.samples[i], &trace.channels[i], points);
+    }
+    reducer.flush(points);
+    ASSERT_EQ(points.channels.size(), points.size());
+    const bool tier = mode != SampleReduction::SwingingDoor;
+    ASSERT_EQ(points.summaries.size(), tier ? points.size() : 0u);
+    for (size_t p = 1; p < points.size(); ++p) {
+      ASSERT_LT(points.samples[p - 1].ts_ms, points.samples[p].ts_ms) << "point " << p;
+    }
+
+    for (size_t i : disturbed) {
+      const VoltageSample& window = trace.samples[i];
+      auto it = std::find_if(points.samples.begin(), points.samples.end(), [&](const VoltageSample& point) {
+        return point.ts_ms == window.ts_ms;
+      });
+      ASSERT_NE(it, points.samples.end()) << "window " << i << " reduced away";
+      const size_t p = static_cast<size_t>(it - points.samples.begin());
+      EXPECT_EQ(it->vrms, window.vrms) << "window " << i;
+      EXPECT_EQ(it->sample_count, window.sample_count) << "window " << i;
+      EXPECT_EQ(points.channels[p].rms[0], trace.channels[i].rms[0]) << "window " << i;
+      EXPECT_EQ(points.channels[p].rms[1], trace.channels[i].rms[1]) << "window " << i;
+      if (tier) {
+        EXPECT_EQ(points.summaries[p].min, window.vrms) << "window " << i;
+        EXPECT_EQ(points.summaries[p].max, window.vrms) << "window " << i;
+        EXPECT_EQ(points.summaries[p].p99, window.vrms) << "window " << i;
+      }
+    }
+  }
+}
+
+// One 60 s tier of 300 windows holding 210.0, 210.1, ... 239.9 in scrambled order: the point
+// carries the first window's timestamp and the mean, and the summary the extremes and the
+// nearest-rank 99th percentile (the 297th smallest value).
+TEST(SampleReducer, TierSummaryOfKnownSequence) {
+  constexpr size_t kWindows = Config::kReduceMaxTierMs / Config::kWindowMs;
+  static_assert(kWindows == 300, "the sequence fills one 60 s tier");
+  SampleReducer reducer;
+  reducer.setMode(SampleReduction::Tier60s, Config::kSwingDoorToleranceV);
+  reducer.setDisturbanceBand(200.0f, 250.0f);
+  SamplePoints points;
+  double sum = 0.0;
+  for (size_t i = 0; i < kWindows + 1; ++i) {
+    VoltageSample sample;
+    sample.ts_ms = kStartTs + i * Config::kWindowMs;
+    sample.sample_count = Config::kWindowSamples;
+    sample.vrms = 210.0f + static_cast<float>((i * 7) % kWindows) * 0.1f;
+    if (i < kWindows) {
+      sum += sample.vrms;
+    }
+    reducer.add(sample, nullptr, points);
+  }
+
+  // The 301st window opens the next tier and closes this one.
+  ASSERT_EQ(points.size(), 1u);
+  ASSERT_EQ(points.summaries.size(), 1u);
+  EXPECT_EQ(points.samples[0].ts_ms, kStartTs);
+  EXPECT_EQ(points.samples[0].sample_count, kWindows);
+  EXPECT_NEAR(points.samples[0].vrms, sum / kWindows, 1e-3);
+  EXPECT_FLOAT_EQ(points.summaries[0].min, 210.0f);
+  EXPECT_FLOAT_EQ(points.summaries[0].max, 210.0f + 299 * 0.1f);
+  EXPECT_FLOAT_EQ(points.summaries[0].p99, 210.0f + 296 * 0.1f);
+
+  reducer.flush(points);
+  ASSERT_EQ(points.size(), 2u);
+  EXPECT_EQ(points.samples[1].ts_ms, kStartTs + kWindows * Config::kWindowMs);
+  EXPECT_EQ(points.samples[1].sample_count, 1u);
+  EXPECT_FLOAT_EQ(points.summaries[1].p99, points.samples[1].vrms);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  NativeHost::setSerialQuiet(true);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
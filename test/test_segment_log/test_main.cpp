@@ -0,0 +1,202 @@
+// SegmentLog recovery from what a power cut leaves on flash: a torn record, a corrupted one,
+// and a read cursor older than the pops that followed it.
+
+#include "Config.h"
+#include "NativeHost.h"
+#include "SegmentLog.h"
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+const std::string kDir = std::string(Config::kFsBasePath) + "/test_log";
+constexpr uint32_t kSegmentBytes = 1024;
+constexpr size_t kRecordBytes = 100; // 112 bytes framed: 9 records per segment
+
+std::vector<uint8_t> recordPayload(uint32_t i) {
+  std::vector<uint8_t> payload(kRecordBytes);
+  for (size_t j = 0; j < payload.size(); ++j) {
+    payload[j] = static_cast<uint8_t>(i * 31 + j);
+  }
+  return payload;
+}
+
+std::string segmentPath(uint32_t segment) {
+  char name[16];
+  snprintf(name, sizeof(name), "/%08u.seg", static_cast<unsigned int>(segment));
+  return kDir + name;
+}
+
+std::string readFile(const std::string& path) {
+  std::string data;
+  if (FILE* file = fopen(path.c_str(), "rb")) {
+    char buf[512];
+    size_t n = 0;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+      data.append(buf, n);
+    }
+    fclose(file);
+  }
+  return data;
+}
+
+void writeFile(const std::string& path, const std::string& data) {
+  FILE* file = fopen(path.c_str(), "wb");
+  ASSERT_NE(file, nullptr);
+  ASSERT_EQ(fwrite(data.data(), 1, data.size(), file), data.size());
+  fclose(file);
+}
+
+class SegmentLogTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(NativeHost::resetFilesystem());
+  }
+
+  std::unique_ptr<SegmentLog> open() {
+    std::unique_ptr<SegmentLog> log(new SegmentLog(kDir, kSegmentBytes, 64 * 1024));
+    EXPECT_TRUE(log->begin());
+    return log;
+  }
+
+  void append(SegmentLog& log, uint32_t first, uint32_t count) {
+    for (uint32_t i = first; i < first + count; ++i) {
+      const std::vector<uint8_t> payload = recordPayload(i);
+      ASSERT_TRUE(log.append(payload.data(), payload.size(), 1)) << "record " << i;
+    }
+  }
+
+  // Reads and pops the front record, which must be record i.
+  void expectPop(SegmentLog& log, uint32_t i) {
+    std::vector<uint8_t> out;
+    uint8_t kind = 0;
+    ASSERT_TRUE(log.peek(out, &kind)) << "record " << i;
+    EXPECT_EQ(out, recordPayload(i)) << "record " << i;
+    ASSERT_TRUE(log.pop()) << "record " << i;
+  }
+};
+
+// Power lost while a record was being written: the log reopens with every record before it,
+// drops the torn one, and appends after it on a fresh segment.
+TEST_F(SegmentLogTest, RecordTruncatedMidPayload) {
+  {
+    std::unique_ptr<SegmentLog> log = open();
+    append(*log, 0, 5);
+  }
+  std::string segment = readFile(segmentPath(1));
+  ASSERT_EQ(segment.size(), 5 * (12 + kRecordBytes));
+  writeFile(segmentPath(1), segment.substr(0, segment.size() - kRecordBytes / 2));
+
+  std::unique_ptr<SegmentLog> log = open();
+  EXPECT_EQ(log->stats().pendingRecords, 4u);
+  append(*log, 5, 2);
+  EXPECT_EQ(log->stats().pendingRecords, 6u);
+  for (uint32_t i : {0, 1, 2, 3, 5, 6}) {
+    expectPop(*log, i);
+  }
+  EXPECT_TRUE(log->empty());
+  std::vector<uint8_t> out;
+  EXPECT_FALSE(log->peek(out, nullptr));
+}
+
+// The same with the cut inside a record header.
+TEST_F(SegmentLogTest, RecordTruncatedMidHeader) {
+  {
+    std::unique_ptr<SegmentLog> log = open();
+    append(*log, 0, 3);
+  }
+  std::string segment = readFile(segmentPath(1));
+  writeFile(segmentPath(1), segment.substr(0, 2 * (12 + kRecordBytes) + 5));
+
+  std::unique_ptr<SegmentLog> log = open();
+  EXPECT_EQ(log->stats().pendingRecords, 2u);
+  append(*log, 3, 1);
+  for (uint32_t i : {0, 1, 3}) {
+    expectPop(*log, i);
+  }
+  EXPECT_TRUE(log->empty());
+}
+
+// A flipped payload bit: the record is skipped and counted, its neighbours are delivered, and
+// appends do not land behind the bad record.
+TEST_F(SegmentLogTest, RecordWithBadCrcIsSkipped) {
+  {
+    std::unique_ptr<SegmentLog> log = open();
+    append(*log, 0, 5);
+  }
+  std::string segment = readFile(segmentPath(1));
+  segment[2 * (12 + kRecordBytes) + 12 + 40] ^= 0x10;
+  writeFile(segmentPath(1), segment);
+
+  std::unique_ptr<SegmentLog> log = open();
+  append(*log, 5, 1);
+  for (uint32_t i : {0, 1, 3, 4, 5}) {
+    expectPop(*log, i);
+  }
+  EXPECT_EQ(log->stats().corruptRecords, 1u);
+  EXPECT_TRUE(log->empty());
+}
+
+// Power lost after a record was delivered but before pop() renamed the new cursor into place:
+// the next boot sees the old cursor (and a leftover cursor.tmp) and delivers that record once
+// more, then continues with nothing lost.
+TEST_F(SegmentLogTest, StaleCursorRedeliversWithinSegment) {
+  std::string staleCursor;
+  {
+    std::unique_ptr<SegmentLog> log = open();
+    append(*log, 0, 6);
+    expectPop(*log, 0);
+    expectPop(*log, 1);
+    staleCursor = readFile(kDir + "/cursor");
+    expectPop(*log, 2);
+    writeFile(kDir + "/cursor.tmp", readFile(kDir + "/cursor"));
+  }
+  writeFile(kDir + "/cursor", staleCursor);
+
+  std::unique_ptr<SegmentLog> log = open();
+  EXPECT_EQ(log->stats().pendingRecords, 4u);
+  for (uint32_t i = 2; i < 6; ++i) {
+    expectPop(*log, i);
+  }
+  EXPECT_TRUE(log->empty());
+  EXPECT_NE(access((kDir + "/cursor.tmp").c_str(), F_OK), 0);
+}
+
+// The same when that pop finished a segment: the segment was deleted but the cursor still
+// points into it, so reading resumes at the oldest segment left.
+TEST_F(SegmentLogTest, StaleCursorIntoDeletedSegment) {
+  const uint32_t perSegment = kSegmentBytes / (12 + kRecordBytes);
+  std::string staleCursor;
+  {
+    std::unique_ptr<SegmentLog> log = open();
+    append(*log, 0, 2 * perSegment + 3);
+    for (uint32_t i = 0; i + 1 < perSegment; ++i) {
+      expectPop(*log, i);
+    }
+    staleCursor = readFile(kDir + "/cursor");
+    expectPop(*log, perSegment - 1);
+    ASSERT_NE(access(segmentPath(1).c_str(), F_OK), 0);
+  }
+  writeFile(kDir + "/cursor", staleCursor);
+
+  std::unique_ptr<SegmentLog> log = open();
+  EXPECT_EQ(log->stats().pendingRecords, perSegment + 3);
+  for (uint32_t i = perSegment; i < 2 * perSegment + 3; ++i) {
+    expectPop(*log, i);
+  }
+  EXPECT_TRUE(log->empty());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  NativeHost::setSerialQuiet(true);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
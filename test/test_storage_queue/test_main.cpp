@@ -0,0 +1,132 @@
+// StorageQueue and its SegmentLog on the host filesystem below Config::kFsBasePath.
+
+#include "Config.h"
+#include "NativeHost.h"
+#include "StorageQueue.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace {
+
+// Record i: 100..799 bytes derived from i, kind i % 3.
+std::vector<uint8_t> recordPayload(uint32_t i) {
+  std::vector<uint8_t> payload(100 + (i * 37) % 700);
+  for (size_t j = 0; j < payload.size(); ++j) {
+    payload[j] = static_cast<uint8_t>(i * 7 + j);
+  }
+  return payload;
+}
+
+class StorageQueueTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(NativeHost::resetFilesystem());
+  }
+
+  std::unique_ptr<StorageQueue> open(uint32_t maxBytes = 512 * 1024) {
+    std::unique_ptr<StorageQueue> queue(new StorageQueue("/test_queue", nullptr, maxBytes));
+    EXPECT_TRUE(queue->begin());
+    return queue;
+  }
+
+  void expectFront(StorageQueue& queue, uint32_t i) {
+    std::vector<uint8_t> out;
+    uint8_t kind = 0xFF;
+    ASSERT_TRUE(queue.front(out, &kind)) << "record " << i;
+    EXPECT_EQ(out, recordPayload(i)) << "record " << i;
+    EXPECT_EQ(kind, i % 3) << "record " << i;
+  }
+};
+
+// Records come back in order with their kinds across several segments, and a reopened queue
+// resumes at the persisted cursor.
+TEST_F(StorageQueueTest, FifoAcrossSegmentsAndReopen) {
+  const uint32_t records = 200; // ~90 KiB, three segments
+  {
+    std::unique_ptr<StorageQueue> queue = open();
+    for (uint32_t i = 0; i < records; ++i) {
+      const std::vector<uint8_t> payload = recordPayload(i);
+      ASSERT_TRUE(queue->enqueue(payload.data(), payload.size(), static_cast<uint8_t>(i % 3)));
+    }
+    EXPECT_GE(queue->stats().segments, 3u);
+    for (uint32_t i = 0; i < records / 2; ++i) {
+      expectFront(*queue, i);
+      queue->pop();
+    }
+  }
+  std::unique_ptr<StorageQueue> queue = open();
+  EXPECT_EQ(queue->stats().pendingRecords, records / 2);
+  for (uint32_t i = records / 2; i < records; ++i) {
+    expectFront(*queue, i);
+    queue->pop();
+  }
+  EXPECT_FALSE(queue->hasItems());
+  EXPECT_EQ(queue->stats().corruptRecords, 0u);
+}
+
+// A record written through RecordWriter in odd-sized pieces reads back whole through
+// FrontStream, which is what HTTPClient sends from; an aborted writer leaves nothing behind.
+TEST_F(StorageQueueTest, StreamedRecordReadsBackThroughFrontStream) {
+  std::unique_ptr<StorageQueue> queue = open();
+  std::vector<uint8_t> payload(5000);
+  for (size_t i = 0; i < payload.size(); ++i) {
+    payload[i] = static_cast<uint8_t>(i * 13 + 5);
+  }
+  {
+    StorageQueue::RecordWriter aborted(*queue, 1, 0);
+    aborted.write(payload.data(), 100);
+  }
+  {
+    StorageQueue::RecordWriter writer(*queue, 2, 0);
+    for (size_t pos = 0; pos < payload.size(); pos += 777) {
+      ASSERT_TRUE(writer.write(payload.data() + pos, std::min<size_t>(777, payload.size() - pos)));
+    }
+    ASSERT_TRUE(writer.commit());
+  }
+  EXPECT_EQ(queue->stats().pendingRecords, 1u);
+
+  StorageQueue::FrontStream stream;
+  ASSERT_TRUE(queue->openFront(stream));
+  EXPECT_EQ(stream.length(), payload.size());
+  EXPECT_EQ(stream.kind(), 2);
+  std::vector<uint8_t> out(payload.size() + 10);
+  EXPECT_EQ(stream.readBytes(reinterpret_cast<char*>(out.data()), out.size()), payload.size());
+  out.resize(payload.size());
+  EXPECT_EQ(out, payload);
+  // A retried POST sends the same bytes again.
+  ASSERT_TRUE(stream.rewind());
+  EXPECT_EQ(stream.read(), payload[0]);
+  stream.close();
+}
+
+// Over maxBytes the oldest whole segment goes; the newest records survive and are counted.
+TEST_F(StorageQueueTest, DropsOldestSegmentWhenFull) {
+  std::unique_ptr<StorageQueue> queue = open(3 * Config::kQueueSegmentBytes);
+  const uint32_t records = 400; // ~180 KiB
+  for (uint32_t i = 0; i < records; ++i) {
+    const std::vector<uint8_t> payload = recordPayload(i);
+    ASSERT_TRUE(queue->enqueue(payload.data(), payload.size(), static_cast<uint8_t>(i % 3)));
+  }
+  const SegmentLog::Stats& stats = queue->stats();
+  EXPECT_LE(stats.storedBytes, 3 * Config::kQueueSegmentBytes);
+  EXPECT_GT(stats.droppedRecords, 0u);
+  EXPECT_EQ(stats.droppedRecords + stats.pendingRecords, records);
+
+  for (uint32_t i = stats.droppedRecords; i < records; ++i) {
+    expectFront(*queue, i);
+    queue->pop();
+  }
+  EXPECT_FALSE(queue->hasItems());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  NativeHost::setSerialQuiet(true);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}